@@ -0,0 +1,41 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef BOXCARAVERAGE_H
+#define BOXCARAVERAGE_H
+
+#include <QVector>
+
+// Calculates a boxcar average
+class BoxcarAverage final {
+ public:
+  BoxcarAverage(int buckets = 8) : m_data(buckets, 0) {}
+
+  // Increment the data in the current bucket.
+  void addSample(qint64 sample) {
+    m_data[m_head] += sample;
+    m_sum += sample;
+  }
+
+  // Advance the boxcar average to the next bucket, recycling the oldest.
+  void advance() {
+    m_head = (m_head + 1) % m_data.length();
+    m_sum -= m_data[m_head];
+    m_data[m_head] = 0;
+    if (m_count < m_data.length()) {
+      m_count++;
+    }
+  }
+
+  // Calculate the average value over the buckets.
+  qint64 average() const { return m_sum / m_count; }
+
+ private:
+  QVector<qint64> m_data;
+  qsizetype m_head = 0;
+  qsizetype m_count = 1;
+  qint64 m_sum = 0;
+};
+
+#endif  // BOXCARAVERAGE_H
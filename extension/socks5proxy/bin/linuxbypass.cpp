@@ -35,9 +35,11 @@ LinuxBypass::LinuxBypass(Socks5* proxy) : QObject(proxy) {
     return;
   }
 
-  // If we get this far - we can perform split tunneling.
+  // If we get this far - we can perform split tunneling. Outgoing connections
+  // may be set up from worker threads, and the mark must be applied before the
+  // socket connects, so handle them synchronously in the caller's thread.
   connect(proxy, &Socks5::outgoingConnection, this,
-          &LinuxBypass::outgoingConnection);
+          &LinuxBypass::outgoingConnection, Qt::DirectConnection);
   connect(DNSResolver::instance(), &DNSResolver::setupDnsSocket, this,
           &LinuxBypass::outgoingConnection);
 }
@@ -12,6 +12,8 @@
 #include <QTcpServer>
 #include <QTimer>
 
+#include "connectionpool.h"
+#include "flowcontrol.h"
 #include "socks5.h"
 #include "sockslogger.h"
 
@@ -31,6 +33,9 @@ struct CliOptions {
   QString password = {};
   bool verbose = false;
   bool logfile = false;
+  int threads = 0;
+  qint64 maxBuffer = 0;
+  int poolSize = 0;
 #if defined(PROXY_OS_WIN)
   bool service = false;
 #endif
@@ -70,6 +75,23 @@ static CliOptions parseArgs(const QCoreApplication& app) {
   QCommandLineOption verboseOption({"v", "verbose"}, "Verbose");
   parser.addOption(verboseOption);
 
+  QCommandLineOption threadsOption(
+      {"t", "threads"},
+      "Number of worker threads to handle connections (0 = main thread only)",
+      "count");
+  parser.addOption(threadsOption);
+
+  QCommandLineOption bufferOption(
+      {"b", "max-buffer"},
+      "Maximum buffer size per connection and direction in KiB", "size");
+  parser.addOption(bufferOption);
+
+  QCommandLineOption poolOption(
+      {"c", "pool"},
+      "Number of idle upstream connections to keep per recent destination",
+      "count");
+  parser.addOption(poolOption);
+
 #if defined(PROXY_OS_WIN)
   QCommandLineOption serviceOption({"s", "service"}, "Windows service mode");
   parser.addOption(serviceOption);
@@ -104,6 +126,30 @@ static CliOptions parseArgs(const QCoreApplication& app) {
   if (parser.isSet(verboseOption)) {
     out.verbose = true;
   }
+  if (parser.isSet(threadsOption)) {
+    bool okay = false;
+    const auto t = parser.value(threadsOption).toInt(&okay);
+    if (!okay || t < 0 || t > 256) {
+      qFatal("Thread count is Not Valid");
+    }
+    out.threads = t;
+  }
+  if (parser.isSet(bufferOption)) {
+    bool okay = false;
+    const auto b = parser.value(bufferOption).toLongLong(&okay);
+    if (!okay || b <= 0) {
+      qFatal("Buffer size is Not Valid");
+    }
+    out.maxBuffer = b * 1024;
+  }
+  if (parser.isSet(poolOption)) {
+    bool okay = false;
+    const auto c = parser.value(poolOption).toInt(&okay);
+    if (!okay || c < 0 || c > 16) {
+      qFatal("Pool size is Not Valid");
+    }
+    out.poolSize = c;
+  }
 #if defined(PROXY_OS_WIN)
   if (parser.isSet(serviceOption)) {
     out.service = true;
@@ -126,6 +172,13 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  if (config.maxBuffer > 0) {
+    FlowControl::setMaximumSize(config.maxBuffer);
+  }
+  if (config.poolSize > 0) {
+    ConnectionPool::setPoolSize(config.poolSize);
+  }
+
   // QHostAddress isn't registered as a built-in metatype, and sometimes the
   // moc tool doesn't figure out that we need it.
   qRegisterMetaType<QHostAddress>();
@@ -185,6 +238,10 @@ int main(int argc, char** argv) {
   }
   QObject::connect(socks5, &Socks5::incomingConnection, logger,
                    &SocksLogger::incomingConnection);
+  if (config.threads > 0) {
+    qDebug() << "Using" << config.threads << "worker threads";
+    socks5->setWorkerThreads(config.threads);
+  }
 
 #if defined(PROXY_OS_LINUX)
   new LinuxBypass(socks5);
@@ -15,12 +15,20 @@
 #include <QDir>
 #include <QFile>
 #include <QLoggingCategory>
+#include <algorithm>
 
 #include "socks5.h"
 
 // 4MB of log data ought to be enough for anyone.
 constexpr const qsizetype LOGFILE_MAX_SIZE = 4 * 1024 * 1024;
 
+// How often to log the DNS cache statistics, in ticks.
+constexpr const int DNS_STATS_INTERVAL = 60;
+
+// How often to log the busiest destinations, in ticks, and how many of them.
+constexpr const int TOP_DESTINATIONS_INTERVAL = 60;
+constexpr const qsizetype TOP_DESTINATIONS_COUNT = 5;
+
 SocksLogger* SocksLogger::s_instance = nullptr;
 
 // static
@@ -58,11 +66,33 @@ SocksLogger::~SocksLogger() {
 }
 
 void SocksLogger::incomingConnection(Socks5Connection* conn) {
-  connect(conn, &Socks5Connection::dataSentReceived, this,
-          &SocksLogger::dataSentReceived);
-  connect(conn, &Socks5Connection::stateChanged, this,
-          &SocksLogger::connectionStateChanged);
-  connect(conn, &QObject::destroyed, this, [this]() { m_numConnections--; });
+  quint64 id = m_nextTrackedId++;
+  m_tracked.insert(id, Tracked{conn->counters()});
+
+  // The connection may be handed to a worker thread, and be gone by the time
+  // we get to it. Copy what we need on its thread, and handle it on ours.
+  connect(
+      conn, &Socks5Connection::stateChanged, this,
+      [this, conn, id]() {
+        StateChange change{conn->state(),
+                           conn->clientName(),
+                           conn->hostLookupStack(),
+                           conn->isDatagramRelay(),
+                           conn->errorString(),
+                           conn->sendHighWaterMark(),
+                           conn->recvHighWaterMark(),
+                           conn->sendStallTime(),
+                           conn->recvStallTime()};
+        QMetaObject::invokeMethod(
+            this, [this, id, change]() { connectionStateChanged(id, change); },
+            Qt::QueuedConnection);
+      },
+      Qt::DirectConnection);
+  connect(conn, &QObject::destroyed, this, [this, id]() {
+    m_numConnections--;
+    // Keep the counters around until their final values have been collected.
+    m_tracked[id].closed = true;
+  });
 
   m_events.append(
       Event{conn->clientName(), QDateTime::currentMSecsSinceEpoch()});
@@ -72,6 +102,7 @@ void SocksLogger::incomingConnection(Socks5Connection* conn) {
 
 void SocksLogger::tick() {
   // Update the boxcar average.
+  collectTraffic();
   m_tx_bytes.advance();
   m_rx_bytes.advance();
 
@@ -86,6 +117,12 @@ void SocksLogger::tick() {
 
   // Update the status.
   printStatus();
+  if ((++m_tickCount % DNS_STATS_INTERVAL) == 0) {
+    printDnsStats();
+  }
+  if ((m_tickCount % TOP_DESTINATIONS_INTERVAL) == 0) {
+    printTopDestinations();
+  }
 
   // Handle logfile rotation.
   QMutexLocker lock(&m_logFileMutex);
@@ -123,24 +160,87 @@ void SocksLogger::printStatus() {
     out << " [" << addresses.join(", ") << "]";
     out << " Up: " << bytesToString(m_tx_bytes.average()) << "/s";
     out << " Down: " << bytesToString(m_rx_bytes.average()) << "/s";
+
+    auto dns = DNSResolver::instance()->cacheStats();
+    quint64 lookups = dns.hits + dns.misses + dns.coalesced;
+    if (lookups > 0) {
+      out << " DNS: " << ((dns.hits + dns.coalesced) * 100 / lookups) << "%";
+    }
   }
 
   output.truncate(80);
   while (output.length() < 80) output.append(' ');
+  QMutexLocker lock(&m_statusMutex);
   QTextStream out(stdout);
   out << output << '\r';
 
   m_lastStatus = output;
 }
 
-void SocksLogger::dataSentReceived(qint64 sent, qint64 received) {
+void SocksLogger::printDnsStats() {
+  auto dns = DNSResolver::instance()->cacheStats();
+  qDebug() << "DNS cache hits:" << dns.hits << "misses:" << dns.misses
+           << "coalesced:" << dns.coalesced;
+}
+
+void SocksLogger::collectTraffic() {
+  quint64 sent = 0;
+  quint64 received = 0;
+
+  auto i = m_tracked.begin();
+  while (i != m_tracked.end()) {
+    Tracked& t = i.value();
+    quint64 txtotal = t.counters->sent.load(std::memory_order_relaxed);
+    quint64 rxtotal = t.counters->received.load(std::memory_order_relaxed);
+    quint64 tx = txtotal - t.sent;
+    quint64 rx = rxtotal - t.received;
+    t.sent = txtotal;
+    t.received = rxtotal;
+
+    sent += tx;
+    received += rx;
+    if (!t.destination.isEmpty() && ((tx + rx) > 0)) {
+      m_destinationBytes[t.destination] += tx + rx;
+    }
+
+    if (t.closed) {
+      i = m_tracked.erase(i);
+    } else {
+      ++i;
+    }
+  }
+
   m_tx_bytes.addSample(sent);
   m_rx_bytes.addSample(received);
 }
 
-QDebug& SocksLogger::printEventStack(QDebug& msg, Socks5Connection* conn) {
+void SocksLogger::printTopDestinations() {
+  if (m_destinationBytes.isEmpty()) {
+    return;
+  }
+
+  QList<std::pair<quint64, QString>> sorted;
+  sorted.reserve(m_destinationBytes.count());
+  for (auto i = m_destinationBytes.cbegin(); i != m_destinationBytes.cend();
+       ++i) {
+    sorted.append({i.value(), i.key()});
+  }
+  qsizetype count = qMin(sorted.count(), TOP_DESTINATIONS_COUNT);
+  std::partial_sort(sorted.begin(), sorted.begin() + count, sorted.end(),
+                    std::greater<>());
+
+  // Start counting afresh for the next report.
+  m_destinationBytes.clear();
+
+  auto msg = qInfo() << "Top destinations:";
+  for (qsizetype i = 0; i < count; i++) {
+    msg << sorted[i].second << bytesToString(sorted[i].first);
+  }
+}
+
+QDebug& SocksLogger::printEventStack(QDebug& msg, const QStringList& stack) {
   bool first = true;
-  for (const QString& hostname : conn->hostLookupStack()) {
+  for (const QString& hostname : stack) {
     if (!first) {
       msg << "->";
     }
@@ -150,22 +250,39 @@ QDebug& SocksLogger::printEventStack(QDebug& msg, Socks5Connection* conn) {
   return msg;
 }
 
-void SocksLogger::connectionStateChanged() {
-  Socks5Connection* conn = qobject_cast<Socks5Connection*>(QObject::sender());
-  if (conn->state() == Socks5Connection::Proxy) {
-    auto msg = qDebug() << "Connecting" << conn->clientName() << "to";
-    printEventStack(msg, conn);
+void SocksLogger::connectionStateChanged(quint64 id,
+                                         const StateChange& change) {
+  if (change.state == Socks5Connection::Proxy) {
+    // Attribute traffic to the name the client asked for.
+    QString destination = QStringLiteral("UDP");
+    if (!change.datagramRelay) {
+      destination = change.hostLookupStack.value(0);
+    }
+    auto i = m_tracked.find(id);
+    if (i != m_tracked.end()) {
+      i->destination = destination;
+    }
+  }
+
+  if (change.state == Socks5Connection::Proxy && change.datagramRelay) {
+    qDebug() << "Relaying UDP for" << change.clientName;
+  } else if (change.state == Socks5Connection::Proxy) {
+    auto msg = qDebug() << "Connecting" << change.clientName << "to";
+    printEventStack(msg, change.hostLookupStack);
   }
-  if (conn->state() == Socks5Connection::Closed) {
-    if (!conn->errorString().isEmpty()) {
+  if (change.state == Socks5Connection::Closed) {
+    if (!change.errorString.isEmpty()) {
       // Failed connection
       auto msg = qDebug() << "Failed";
-      printEventStack(msg, conn) << "->" << conn->errorString();
+      printEventStack(msg, change.hostLookupStack)
+          << "->" << change.errorString;
     } else {
       // Successful connection
       auto msg = qDebug() << "Closed";
-      printEventStack(msg, conn) << "txbuf" << conn->sendHighWaterMark()
-                                 << "rxbuf" << conn->recvHighWaterMark();
+      printEventStack(msg, change.hostLookupStack)
+          << "txbuf" << change.sendHighWaterMark << "rxbuf"
+          << change.recvHighWaterMark << "txstall" << change.sendStallTime
+          << "rxstall" << change.recvStallTime;
     }
   }
 }
@@ -247,11 +364,13 @@ void SocksLogger::logHandler(QtMsgType type, const QMessageLogContext& ctx,
   }
 
   if (s_instance->m_verbose || (type != QtMsgType::QtDebugMsg)) {
+    QMutexLocker lock(&s_instance->m_statusMutex);
     // A message logger that plays nicely with the status output.
     // Clears the current line - prints the log message - reprints the status.
     out << QString(80, ' ') << '\r';
     out << msg << "\r\n";
     out << s_instance->m_lastStatus << '\r';
+    out.flush();
   }
 
   // Handle logging to file.
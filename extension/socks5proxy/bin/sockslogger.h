@@ -5,46 +5,20 @@
 #ifndef SOCKSLOGGER_H
 #define SOCKSLOGGER_H
 
+#include <QHash>
 #include <QMutex>
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QTimer>
-#include <QVector>
+#include <memory>
+
+#include "boxcaraverage.h"
+#include "socks5connection.h"
 
 class QDir;
 class QFile;
 class Socks5;
-class Socks5Connection;
-
-// Calculates a boxcar average
-class BoxcarAverage final {
- public:
-  BoxcarAverage(int buckets = 8) : m_buckets(buckets) { advance(); }
-
-  // Increment the data in the current bucket.
-  void addSample(qint64 sample) { m_data[0] += sample; }
-
-  // Advance the boxcar average to the next bucket.
-  void advance() {
-    if (m_data.length() >= m_buckets) {
-      m_data.resize(m_buckets - 1);
-    }
-    m_data.push_front(0);
-  }
-
-  // Calculate the average value over the buckets.
-  qint64 average() const {
-    qint64 sum = 0;
-    for (auto x : m_data) {
-      sum += x;
-    }
-    return m_data.isEmpty() ? 0 : sum / m_data.length();
-  }
-
- private:
-  const int m_buckets;
-  QVector<qint64> m_data;
-};
 
 class SocksLogger final : public QObject {
   Q_OBJECT
@@ -54,7 +28,7 @@ class SocksLogger final : public QObject {
   ~SocksLogger();
 
   static QString bytesToString(qint64 value);
-  static QDebug& printEventStack(QDebug& msg, Socks5Connection* conn);
+  static QDebug& printEventStack(QDebug& msg, const QStringList& stack);
   void printStatus();
 
   const QString& logfile() const { return m_logFileName; }
@@ -70,9 +44,24 @@ class SocksLogger final : public QObject {
                       const QString& msg);
   static void logHandler(QtMsgType type, const QMessageLogContext& ctx,
                          const QString& msg);
-  void dataSentReceived(qint64 sent, qint64 received);
-  void connectionStateChanged();
+  // What we need to know about a connection when its state changes, copied on
+  // the thread it runs on.
+  struct StateChange {
+    Socks5Connection::Socks5State state;
+    QString clientName;
+    QStringList hostLookupStack;
+    bool datagramRelay;
+    QString errorString;
+    quint64 sendHighWaterMark;
+    quint64 recvHighWaterMark;
+    qint64 sendStallTime;
+    qint64 recvStallTime;
+  };
+  void connectionStateChanged(quint64 id, const StateChange& change);
+  void collectTraffic();
   void tick();
+  void printDnsStats();
+  void printTopDestinations();
 
  private:
   static SocksLogger* s_instance;
@@ -90,10 +79,27 @@ class SocksLogger final : public QObject {
   qsizetype m_numConnections = 0;
 
   QTimer m_timer;
+  int m_tickCount = 0;
+  QMutex m_statusMutex;
   QString m_lastStatus;
 
   BoxcarAverage m_rx_bytes;
   BoxcarAverage m_tx_bytes;
+
+  // Traffic counters of the connections, which are sampled once per tick
+  // rather than reported as the data moves. Only used on our own thread.
+  struct Tracked {
+    std::shared_ptr<const TrafficCounters> counters;
+    quint64 sent = 0;
+    quint64 received = 0;
+    QString destination;
+    bool closed = false;
+  };
+  QHash<quint64, Tracked> m_tracked;
+  quint64 m_nextTrackedId = 0;
+
+  // Bytes relayed per destination since the last report.
+  QHash<QString, quint64> m_destinationBytes;
 };
 
 #endif  // SOCKSLOGGER_H
@@ -14,9 +14,11 @@
 #include <QAbstractSocket>
 #include <QFileInfo>
 #include <QHostAddress>
+#include <QReadLocker>
 #include <QScopeGuard>
 #include <QSettings>
 #include <QUuid>
+#include <QWriteLocker>
 
 #include "socks5.h"
 #include "winutils.h"
@@ -63,8 +65,10 @@ static void routeChangeCallback(PVOID context, PMIB_IPFORWARD_ROW2 row,
 }
 
 WindowsBypass::WindowsBypass(Socks5* proxy) : QObject(proxy) {
+  // Outgoing connections may be set up from worker threads, so this must be
+  // handled synchronously in the caller's thread.
   connect(proxy, &Socks5::outgoingConnection, this,
-          &WindowsBypass::outgoingConnection);
+          &WindowsBypass::outgoingConnection, Qt::DirectConnection);
   connect(DNSResolver::instance(), &DNSResolver::setupDnsSocket, this,
           &WindowsBypass::outgoingConnection);
 
@@ -87,6 +91,7 @@ void WindowsBypass::outgoingConnection(qintptr sd, const QHostAddress& dest) {
     // This destination should not require exclusion.
     return;
   }
+  QReadLocker lock(&m_lock);
   const MIB_IPFORWARD_ROW2* route = lookupRoute(dest);
   if (route == nullptr) {
     // No routing exclusions to apply.
@@ -207,13 +212,17 @@ void WindowsBypass::refreshAddresses() {
   }
 
   // Swap the updated table into use.
-  m_interfaceData.swap(data);
+  {
+    QWriteLocker lock(&m_lock);
+    m_interfaceData.swap(data);
+  }
   updateNameserver();
 }
 
 void WindowsBypass::interfaceChanged(quint64 luid) {
   qDebug() << "Interface changed for:" << QString::number(luid, 16);
 
+  QWriteLocker lock(&m_lock);
   auto i = m_interfaceData.find(luid);
   if (i == m_interfaceData.end()) {
     // Nothing to update.
@@ -238,6 +247,7 @@ void WindowsBypass::interfaceChanged(quint64 luid) {
     i->ipv6metric = ULONG_MAX;
   }
 
+  lock.unlock();
   updateNameserver();
 }
 
@@ -375,7 +385,10 @@ void WindowsBypass::updateTable(QVector<MIB_IPFORWARD_ROW2>& table,
                                 int family) {
   // Update the output table on exit.
   QVector<MIB_IPFORWARD_ROW2> update;
-  auto swapGuard = qScopeGuard([&] { table.swap(update); });
+  auto swapGuard = qScopeGuard([&] {
+    QWriteLocker lock(&m_lock);
+    table.swap(update);
+  });
 
   // Fetch the routing table.
   MIB_IPFORWARD_TABLE2* mib;
@@ -8,6 +8,7 @@
 #include <QHash>
 #include <QHostAddress>
 #include <QObject>
+#include <QReadWriteLock>
 #include <QVector>
 
 class Socks5;
@@ -47,6 +48,8 @@ class WindowsBypass final : public QObject {
     QHostAddress ipv6addr;
   };
 
+  // Guards the tables below, which are read from proxy worker threads.
+  mutable QReadWriteLock m_lock;
   QHash<quint64, InterfaceData> m_interfaceData;
   QVector<struct _MIB_IPFORWARD_ROW2> m_routeTableIpv4;
   QVector<struct _MIB_IPFORWARD_ROW2> m_routeTableIpv6;
@@ -0,0 +1,195 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "connectionpool.h"
+
+#ifdef Q_OS_WIN
+#  include <winsock2.h>
+#  include <ws2ipdef.h>
+
+#  include "winutils.h"
+#else
+#  include <errno.h>
+#  include <string.h>
+#  include <sys/socket.h>
+#endif
+
+#include <QDebug>
+#include <QTcpSocket>
+#include <QTimer>
+#include <atomic>
+#include <iterator>
+
+// How long an idle connection is kept open waiting to be claimed. This needs
+// to be shorter than servers are willing to keep a silent connection around.
+constexpr const int POOL_IDLE_TIMEOUT_MSEC = 10000;
+
+// The most idle connections a pool will hold across all destinations.
+constexpr const qsizetype MAX_POOLED_CONNECTIONS = 64;
+
+// The most destinations a pool keeps track of the demand for.
+constexpr const qsizetype MAX_TRACKED_DESTINATIONS = 256;
+
+namespace {
+std::atomic<int> s_poolSize = 0;
+}
+
+ConnectionPool::ConnectionPool(QObject* parent) : QObject(parent) {
+  m_sweepTimer = new QTimer(this);
+  m_sweepTimer->setInterval(1000);
+  connect(m_sweepTimer, &QTimer::timeout, this, &ConnectionPool::sweep);
+}
+
+// static
+int ConnectionPool::poolSize() { return s_poolSize; }
+
+// static
+void ConnectionPool::setPoolSize(int count) { s_poolSize = qMax(count, 0); }
+
+QTcpSocket* ConnectionPool::take(const QHostAddress& addr, quint16 port,
+                                 QObject* parent) {
+  const int size = poolSize();
+  if (size <= 0) {
+    return nullptr;
+  }
+
+  // Look for a connection that has finished its handshake.
+  const Destination dest(addr, port);
+  QTcpSocket* socket = nullptr;
+  auto it = m_idle.find(dest);
+  if (it != m_idle.end()) {
+    QList<Entry>& entries = it.value();
+    for (qsizetype i = 0; i < entries.count(); i++) {
+      if (entries[i].socket->state() == QAbstractSocket::ConnectedState) {
+        socket = entries.takeAt(i).socket;
+        m_count--;
+        break;
+      }
+    }
+  }
+
+  // Top the pool back up for next time, but only for destinations that are in
+  // demand. Opening connections on every CONNECT would mostly pay for
+  // handshakes whose connections sit idle until they time out.
+  bool inDemand = recordConnect(dest);
+  if ((socket != nullptr) || inDemand) {
+    qsizetype pending = m_idle.value(dest).count();
+    while ((pending < size) && (m_count < MAX_POOLED_CONNECTIONS)) {
+      open(dest);
+      pending++;
+    }
+  }
+
+  if (socket != nullptr) {
+    socket->disconnect(this);
+    socket->setParent(parent);
+  }
+  return socket;
+}
+
+bool ConnectionPool::recordConnect(const Destination& dest) {
+  auto it = m_demand.find(dest);
+  if ((it == m_demand.end()) || it->window.hasExpired()) {
+    if ((it == m_demand.end()) &&
+        (m_demand.count() >= MAX_TRACKED_DESTINATIONS)) {
+      for (auto i = m_demand.begin(); i != m_demand.end();) {
+        i = i->window.hasExpired() ? m_demand.erase(i) : std::next(i);
+      }
+      if (m_demand.count() >= MAX_TRACKED_DESTINATIONS) {
+        m_demand.clear();
+      }
+    }
+    it = m_demand.insert(dest, Demand{0, QDeadlineTimer(DEMAND_WINDOW_MSEC)});
+  }
+
+  it->connects++;
+  return it->connects >= WARM_CONNECT_COUNT;
+}
+
+void ConnectionPool::open(const Destination& dest) {
+  const QHostAddress& addr = dest.first;
+  int family = AF_INET;
+  if (addr.protocol() == QAbstractSocket::IPv6Protocol) {
+    family = AF_INET6;
+  }
+
+  // As with Socks5Connection, create the socket ourselves so that the
+  // platform layer can fiddle with it before we connect.
+  qintptr newsock = socket(family, SOCK_STREAM, IPPROTO_TCP);
+#ifdef Q_OS_WIN
+  if (newsock == INVALID_SOCKET) {
+    qDebug() << "Failed to create pooled socket:"
+             << WinUtils::win32strerror(WSAGetLastError());
+    return;
+  }
+#else
+  if (newsock < 0) {
+    qDebug() << "Failed to create pooled socket:" << strerror(errno);
+    return;
+  }
+#endif
+  emit setupOutSocket(newsock, addr);
+
+  QTcpSocket* pooled = new QTcpSocket(this);
+  pooled->setSocketDescriptor(newsock, QAbstractSocket::UnconnectedState);
+  pooled->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+  pooled->connectToHost(addr, dest.second);
+
+  connect(pooled, &QTcpSocket::disconnected, this,
+          [this, pooled]() { remove(pooled); });
+  connect(pooled, &QTcpSocket::errorOccurred, this,
+          [this, pooled]() { remove(pooled); });
+
+  m_idle[dest].append(Entry{pooled, QDeadlineTimer(POOL_IDLE_TIMEOUT_MSEC)});
+  m_count++;
+  if (!m_sweepTimer->isActive()) {
+    m_sweepTimer->start();
+  }
+}
+
+void ConnectionPool::remove(QTcpSocket* socket) {
+  for (auto it = m_idle.begin(); it != m_idle.end(); ++it) {
+    QList<Entry>& entries = it.value();
+    for (qsizetype i = 0; i < entries.count(); i++) {
+      if (entries[i].socket != socket) {
+        continue;
+      }
+      entries.removeAt(i);
+      if (entries.isEmpty()) {
+        m_idle.erase(it);
+      }
+      m_count--;
+      socket->disconnect(this);
+      socket->deleteLater();
+      return;
+    }
+  }
+}
+
+void ConnectionPool::sweep() {
+  auto it = m_idle.begin();
+  while (it != m_idle.end()) {
+    QList<Entry>& entries = it.value();
+    for (qsizetype i = entries.count() - 1; i >= 0; i--) {
+      if (!entries[i].expires.hasExpired()) {
+        continue;
+      }
+      QTcpSocket* socket = entries.takeAt(i).socket;
+      socket->disconnect(this);
+      socket->abort();
+      socket->deleteLater();
+      m_count--;
+    }
+
+    if (entries.isEmpty()) {
+      it = m_idle.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (m_count == 0) {
+    m_sweepTimer->stop();
+  }
+}
@@ -0,0 +1,80 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QObject>
+#include <utility>
+
+class QTcpSocket;
+class QTimer;
+
+// Keeps a few upstream connections open to destinations that are connected
+// to often, so that the next CONNECT to the same destination can skip the TCP
+// handshake. Idle connections are closed when they haven't been claimed for a
+// while. A pool only serves connections living on its own thread.
+class ConnectionPool final : public QObject {
+  Q_OBJECT
+
+ public:
+  explicit ConnectionPool(QObject* parent = nullptr);
+  ~ConnectionPool() = default;
+
+  // The number of idle connections to keep per destination. Pooling is
+  // disabled when this is zero, which is the default.
+  static int poolSize();
+  static void setPoolSize(int count);
+
+  // How many connects to a destination, within DEMAND_WINDOW_MSEC, it takes
+  // before connections to it are opened ahead of time.
+  static constexpr int WARM_CONNECT_COUNT = 3;
+  static constexpr int DEMAND_WINDOW_MSEC = 30000;
+
+  /**
+   * @brief Take an established connection to a destination.
+   *
+   * If one was available, or if the destination has been connected to often
+   * enough recently, new connections are opened to the destination so that
+   * the next request for it can be served from the pool.
+   *
+   * @param addr - the destination address
+   * @param port - the destination port
+   * @param parent - the new QObject parent for the socket
+   * @return QTcpSocket* - a connected socket, or nullptr if there is none.
+   */
+  QTcpSocket* take(const QHostAddress& addr, quint16 port, QObject* parent);
+
+ signals:
+  // Emitted before an outgoing socket connects. The socket must be configured
+  // before the signal returns.
+  void setupOutSocket(qintptr sd, const QHostAddress& dest);
+
+ private:
+  using Destination = std::pair<QHostAddress, quint16>;
+  struct Entry {
+    QTcpSocket* socket;
+    QDeadlineTimer expires;
+  };
+  struct Demand {
+    int connects;
+    QDeadlineTimer window;
+  };
+
+  bool recordConnect(const Destination& dest);
+  void open(const Destination& dest);
+  void remove(QTcpSocket* socket);
+  void sweep();
+
+  QHash<Destination, QList<Entry>> m_idle;
+  QHash<Destination, Demand> m_demand;
+  qsizetype m_count = 0;
+  QTimer* m_sweepTimer = nullptr;
+};
+
+#endif  // CONNECTIONPOOL_H
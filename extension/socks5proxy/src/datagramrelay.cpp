@@ -0,0 +1,647 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "datagramrelay.h"
+
+#include "dnsresolver.h"
+
+#ifdef Q_OS_LINUX
+#  include <errno.h>
+#  include <netinet/in.h>
+#  include <string.h>
+#  include <sys/socket.h>
+#  include <unistd.h>
+#else
+#  include <QNetworkDatagram>
+#  include <QUdpSocket>
+#  ifdef Q_OS_WIN
+#    include <winsock2.h>
+#  else
+#    include <errno.h>
+#    include <string.h>
+#    include <sys/socket.h>
+#  endif
+#endif
+
+#include <QDebug>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QtEndian>
+
+// The largest datagram we relay, anything bigger is dropped. This leaves
+// plenty of room for QUIC and DNS, which is what we expect to carry.
+constexpr const qint64 MAX_DATAGRAM_SIZE = 8192;
+
+// How many resolved domain names to remember for a client.
+constexpr const qsizetype MAX_NAME_ENTRIES = 256;
+
+// How many domain names to look up at once for a client, and how long to wait
+// for an answer before the name may be looked up again. A name that could not
+// be resolved is not looked up again until then either.
+constexpr const qsizetype MAX_PENDING_LOOKUPS = 16;
+constexpr const int LOOKUP_TIMEOUT_MSEC = 5000;
+
+#ifdef Q_OS_LINUX
+// How many datagrams to move per system call, and how many batches to handle
+// before returning to the event loop.
+constexpr const int DATAGRAM_BATCH_SIZE = 16;
+constexpr const int MAX_BATCHES_PER_WAKEUP = 4;
+
+struct DatagramRelay::Batch {
+  char buffer[DATAGRAM_BATCH_SIZE][MAX_DATAGRAM_SIZE];
+  char header[DATAGRAM_BATCH_SIZE][MAX_HEADER_LENGTH];
+  sockaddr_storage rxaddr[DATAGRAM_BATCH_SIZE];
+  sockaddr_storage txaddr[DATAGRAM_BATCH_SIZE];
+  iovec rxiov[DATAGRAM_BATCH_SIZE];
+  iovec txiov[DATAGRAM_BATCH_SIZE][2];
+  mmsghdr rx[DATAGRAM_BATCH_SIZE];
+  mmsghdr tx[DATAGRAM_BATCH_SIZE];
+};
+
+namespace {
+
+socklen_t toSockaddr(const QHostAddress& addr, quint16 port,
+                     sockaddr_storage* ss) {
+  memset(ss, 0, sizeof(sockaddr_storage));
+  if (addr.protocol() == QAbstractSocket::IPv6Protocol) {
+    auto* sin6 = reinterpret_cast<sockaddr_in6*>(ss);
+    Q_IPV6ADDR ip6 = addr.toIPv6Address();
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = qToBigEndian(port);
+    memcpy(&sin6->sin6_addr, &ip6, sizeof(ip6));
+    return sizeof(sockaddr_in6);
+  }
+
+  auto* sin = reinterpret_cast<sockaddr_in*>(ss);
+  sin->sin_family = AF_INET;
+  sin->sin_port = qToBigEndian(port);
+  sin->sin_addr.s_addr = qToBigEndian(addr.toIPv4Address());
+  return sizeof(sockaddr_in);
+}
+
+quint16 sockaddrPort(const sockaddr_storage* ss) {
+  if (ss->ss_family == AF_INET6) {
+    auto* sin6 = reinterpret_cast<const sockaddr_in6*>(ss);
+    return qFromBigEndian(sin6->sin6_port);
+  }
+  auto* sin = reinterpret_cast<const sockaddr_in*>(ss);
+  return qFromBigEndian(sin->sin_port);
+}
+
+}  // namespace
+#endif
+
+DatagramRelay::DatagramRelay(QObject* parent) : QObject(parent) {}
+
+DatagramRelay::~DatagramRelay() {
+#ifdef Q_OS_LINUX
+  // Notifiers must go away before their descriptors are closed.
+  delete m_clientNotifier;
+  if (m_clientSocket >= 0) {
+    close(m_clientSocket);
+  }
+  for (int i = 0; i < 2; i++) {
+    delete m_outNotifier[i];
+    if (m_outSocket[i] >= 0) {
+      close(m_outSocket[i]);
+    }
+  }
+  delete m_batch;
+#endif
+}
+
+// static
+DatagramRelay* DatagramRelay::create(const QHostAddress& bindAddress,
+                                     const QHostAddress& clientAddress,
+                                     quint16 clientPort,
+                                     std::shared_ptr<TrafficCounters> counters,
+                                     QObject* parent) {
+  DatagramRelay* relay = new DatagramRelay(parent);
+  if (!relay->bindClient(bindAddress)) {
+    delete relay;
+    return nullptr;
+  }
+
+  relay->m_clientAddress = clientAddress;
+  relay->m_clientPort = clientPort;
+  relay->m_counters = std::move(counters);
+  return relay;
+}
+
+// static
+qint64 DatagramRelay::parseHeader(const char* data, qint64 length,
+                                  QHostAddress& addr, QString& hostname,
+                                  quint16& port) {
+  // +-----+------+------+----------+----------+----------+
+  // | RSV | FRAG | ATYP | DST.ADDR | DST.PORT |   DATA   |
+  // +-----+------+------+----------+----------+----------+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  addr.clear();
+  hostname.clear();
+  if (length < 4) {
+    return -1;
+  }
+  if ((p[0] != 0x00) || (p[1] != 0x00)) {
+    return -1;
+  }
+  if (p[2] != 0x00) {
+    // Fragment reassembly is optional, and nobody uses it.
+    return -1;
+  }
+
+  qint64 offset = 4;
+  switch (p[3]) {
+    case 0x01: /* Ipv4 */
+      if (length < offset + 4 + 2) {
+        return -1;
+      }
+      addr.setAddress(qFromBigEndian<quint32>(p + offset));
+      offset += 4;
+      break;
+
+    case 0x03: /* Domain name */
+      if ((length < offset + 1) || (length < offset + 1 + p[offset] + 2)) {
+        return -1;
+      }
+      hostname = QString::fromUtf8(data + offset + 1, p[offset]);
+      offset += 1 + p[offset];
+      break;
+
+    case 0x04: /* Ipv6 */
+      if (length < offset + 16 + 2) {
+        return -1;
+      }
+      addr.setAddress(p + offset);
+      offset += 16;
+      break;
+
+    default:
+      return -1;
+  }
+
+  port = qFromBigEndian<quint16>(p + offset);
+  return offset + 2;
+}
+
+// static
+qint64 DatagramRelay::writeHeader(char* buffer, const QHostAddress& addr,
+                                  quint16 port) {
+  uint8_t* p = reinterpret_cast<uint8_t*>(buffer);
+  p[0] = 0x00;
+  p[1] = 0x00;
+  p[2] = 0x00;
+
+  qint64 offset = 4;
+  bool isIpv4 = false;
+  quint32 ip4 = addr.toIPv4Address(&isIpv4);
+  if (isIpv4) {
+    p[3] = 0x01;
+    qToBigEndian(ip4, p + offset);
+    offset += 4;
+  } else {
+    Q_IPV6ADDR ip6 = addr.toIPv6Address();
+    p[3] = 0x04;
+    memcpy(p + offset, &ip6, sizeof(ip6));
+    offset += 16;
+  }
+
+  qToBigEndian(port, p + offset);
+  return offset + 2;
+}
+
+bool DatagramRelay::acceptClient(const QHostAddress& addr, quint16 port) {
+  // Only relay datagrams for the client that made the association. If we
+  // don't know its address, it came from a local socket and must be local.
+  if (m_clientAddress.isNull()) {
+    if (!addr.isLoopback()) {
+      return false;
+    }
+  } else if (!addr.isEqual(m_clientAddress,
+                           QHostAddress::TolerantConversion)) {
+    return false;
+  }
+  if ((m_clientPort != 0) && (port != m_clientPort)) {
+    return false;
+  }
+
+  // Replies go back to wherever the first datagram came from.
+  m_clientAddress = addr;
+  m_clientPort = port;
+  m_clientSeen = true;
+  return true;
+}
+
+bool DatagramRelay::route(const char* data, qint64 length, QHostAddress& dest,
+                          quint16& port, qint64& header) {
+  QString hostname;
+  header = parseHeader(data, length, dest, hostname, port);
+  if (header < 0) {
+    return false;
+  }
+  if (hostname.isEmpty()) {
+    return !dest.isNull();
+  }
+
+  auto it = m_names.constFind(hostname);
+  if (it != m_names.constEnd()) {
+    dest = it.value();
+    return !dest.isNull();
+  }
+
+  // We don't know this name yet. Drop the datagram and look it up, the client
+  // will retry soon enough.
+  if (!m_lookups.contains(hostname) &&
+      (m_lookups.count() < MAX_PENDING_LOOKUPS)) {
+    startLookup(hostname);
+  }
+  return false;
+}
+
+void DatagramRelay::startLookup(const QString& hostname) {
+  DatagramLookup* lookup = new DatagramLookup(this);
+  m_lookups.insert(hostname, lookup);
+  connect(lookup, &DatagramLookup::finished, this,
+          [this, hostname](const QHostAddress& addr) {
+            lookupFinished(hostname, addr);
+          });
+
+  // Don't let a lookup that never completes, or that failed, hold on to its
+  // slot.
+  QTimer::singleShot(LOOKUP_TIMEOUT_MSEC, lookup, [this, hostname, lookup]() {
+    if (m_lookups.value(hostname) == lookup) {
+      m_lookups.remove(hostname);
+    }
+    lookup->deleteLater();
+  });
+
+  DNSResolver::instance()->resolveAsync(hostname, lookup);
+}
+
+void DatagramRelay::lookupFinished(const QString& hostname,
+                                   const QHostAddress& addr) {
+  // The resolver reports every address it found, we only need the first.
+  DatagramLookup* lookup = m_lookups.value(hostname);
+  if (lookup == nullptr) {
+    return;
+  }
+  lookup->disconnect(this);
+
+  // Failures are not remembered: the lookup keeps its slot until it times
+  // out, so that the datagrams meanwhile don't each trigger a new lookup, and
+  // the name is looked up again after that.
+  if (addr.isNull()) {
+    qDebug() << "Lookup failed for" << hostname;
+    return;
+  }
+  m_lookups.remove(hostname);
+  lookup->deleteLater();
+
+  if (m_names.count() >= MAX_NAME_ENTRIES) {
+    m_names.clear();
+  }
+  m_names.insert(hostname, addr);
+}
+
+#ifdef Q_OS_LINUX
+bool DatagramRelay::bindClient(const QHostAddress& bindAddress) {
+  int family = AF_INET;
+  if (bindAddress.protocol() == QAbstractSocket::IPv6Protocol) {
+    family = AF_INET6;
+  }
+
+  m_clientSocket =
+      socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (m_clientSocket < 0) {
+    qDebug() << "Failed to create relay socket:" << strerror(errno);
+    return false;
+  }
+
+  sockaddr_storage ss;
+  socklen_t len = toSockaddr(bindAddress, 0, &ss);
+  if (bind(m_clientSocket, reinterpret_cast<sockaddr*>(&ss), len) != 0) {
+    qDebug() << "Failed to bind relay socket:" << strerror(errno);
+    return false;
+  }
+  len = sizeof(ss);
+  if (getsockname(m_clientSocket, reinterpret_cast<sockaddr*>(&ss), &len) !=
+      0) {
+    qDebug() << "Failed to get relay address:" << strerror(errno);
+    return false;
+  }
+  m_localAddress.setAddress(reinterpret_cast<sockaddr*>(&ss));
+  m_localPort = sockaddrPort(&ss);
+
+  m_clientNotifier =
+      new QSocketNotifier(m_clientSocket, QSocketNotifier::Read, this);
+  connect(m_clientNotifier, &QSocketNotifier::activated, this,
+          &DatagramRelay::readClient);
+  return true;
+}
+
+int DatagramRelay::outboundSocket(const QHostAddress& dest) {
+  const int index =
+      (dest.protocol() == QAbstractSocket::IPv6Protocol) ? 1 : 0;
+  if (m_outSocket[index] >= 0) {
+    return index;
+  }
+
+  const int family = index ? AF_INET6 : AF_INET;
+  int sd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  IPPROTO_UDP);
+  if (sd < 0) {
+    qDebug() << "Failed to create outgoing socket:" << strerror(errno);
+    return -1;
+  }
+
+  // Let the platform layer mark the socket before anything is sent on it.
+  emit setupOutSocket(sd, dest);
+
+  m_outSocket[index] = sd;
+  m_outNotifier[index] = new QSocketNotifier(sd, QSocketNotifier::Read, this);
+  connect(m_outNotifier[index], &QSocketNotifier::activated, this,
+          [this, index]() { readRemote(index); });
+  return index;
+}
+
+int DatagramRelay::receiveBatch(int sd) {
+  if (m_batch == nullptr) {
+    m_batch = new Batch();
+  }
+
+  Batch& b = *m_batch;
+  for (int i = 0; i < DATAGRAM_BATCH_SIZE; i++) {
+    b.rxiov[i].iov_base = b.buffer[i];
+    b.rxiov[i].iov_len = MAX_DATAGRAM_SIZE;
+    b.rx[i].msg_hdr = {};
+    b.rx[i].msg_hdr.msg_name = &b.rxaddr[i];
+    b.rx[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+    b.rx[i].msg_hdr.msg_iov = &b.rxiov[i];
+    b.rx[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int count = recvmmsg(sd, b.rx, DATAGRAM_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+  if (count < 0) {
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+      qDebug() << "recvmmsg failed:" << strerror(errno);
+    }
+    return 0;
+  }
+  return count;
+}
+
+void DatagramRelay::sendBatch(int sd, int count, qint64& bytes) {
+  Batch& b = *m_batch;
+  int offset = 0;
+  while (offset < count) {
+    int sent = sendmmsg(sd, b.tx + offset, count - offset, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Whatever we couldn't send is lost, as it could have been in the
+      // network. If the socket is full, so is the rest of the batch.
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        break;
+      }
+      qDebug() << "sendmmsg failed:" << strerror(errno);
+      offset++;
+      continue;
+    }
+
+    // The payload is always the last element of the message.
+    for (int i = offset; i < offset + sent; i++) {
+      const msghdr& hdr = b.tx[i].msg_hdr;
+      bytes += hdr.msg_iov[hdr.msg_iovlen - 1].iov_len;
+    }
+    offset += sent;
+  }
+}
+
+void DatagramRelay::readClient() {
+  qint64 sent = 0;
+  for (int round = 0; round < MAX_BATCHES_PER_WAKEUP; round++) {
+    int count = receiveBatch(m_clientSocket);
+    if (count <= 0) {
+      break;
+    }
+
+    // Strip the headers in place, and send runs of datagrams going out of the
+    // same socket together.
+    Batch& b = *m_batch;
+    int pending = 0;
+    int pendingIndex = -1;
+    for (int i = 0; i < count; i++) {
+      if (b.rx[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        continue;
+      }
+      QHostAddress from(reinterpret_cast<sockaddr*>(&b.rxaddr[i]));
+      if (!acceptClient(from, sockaddrPort(&b.rxaddr[i]))) {
+        continue;
+      }
+
+      QHostAddress dest;
+      quint16 port;
+      qint64 header;
+      if (!route(b.buffer[i], b.rx[i].msg_len, dest, port, header)) {
+        continue;
+      }
+      int index = outboundSocket(dest);
+      if (index < 0) {
+        continue;
+      }
+      if ((index != pendingIndex) && (pending > 0)) {
+        sendBatch(m_outSocket[pendingIndex], pending, sent);
+        pending = 0;
+      }
+      pendingIndex = index;
+
+      msghdr& hdr = b.tx[pending].msg_hdr;
+      b.txiov[pending][0].iov_base = b.buffer[i] + header;
+      b.txiov[pending][0].iov_len = b.rx[i].msg_len - header;
+      hdr = {};
+      hdr.msg_name = &b.txaddr[pending];
+      hdr.msg_namelen = toSockaddr(dest, port, &b.txaddr[pending]);
+      hdr.msg_iov = b.txiov[pending];
+      hdr.msg_iovlen = 1;
+      pending++;
+    }
+    if (pending > 0) {
+      sendBatch(m_outSocket[pendingIndex], pending, sent);
+    }
+
+    if (count < DATAGRAM_BATCH_SIZE) {
+      break;
+    }
+  }
+
+  if (sent > 0) {
+    m_counters->add(sent, 0);
+  }
+}
+
+void DatagramRelay::readRemote(int index) {
+  sockaddr_storage client;
+  socklen_t clientlen = toSockaddr(m_clientAddress, m_clientPort, &client);
+
+  qint64 received = 0;
+  for (int round = 0; round < MAX_BATCHES_PER_WAKEUP; round++) {
+    int count = receiveBatch(m_outSocket[index]);
+    if (count <= 0) {
+      break;
+    }
+    if (!m_clientSeen) {
+      continue;
+    }
+
+    // Prepend the reply header by gathering it with the payload.
+    Batch& b = *m_batch;
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+      if (b.rx[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        continue;
+      }
+      QHostAddress from(reinterpret_cast<sockaddr*>(&b.rxaddr[i]));
+      qint64 header = writeHeader(b.header[pending], from,
+                                  sockaddrPort(&b.rxaddr[i]));
+
+      msghdr& hdr = b.tx[pending].msg_hdr;
+      b.txiov[pending][0].iov_base = b.header[pending];
+      b.txiov[pending][0].iov_len = header;
+      b.txiov[pending][1].iov_base = b.buffer[i];
+      b.txiov[pending][1].iov_len = b.rx[i].msg_len;
+      hdr = {};
+      hdr.msg_name = &client;
+      hdr.msg_namelen = clientlen;
+      hdr.msg_iov = b.txiov[pending];
+      hdr.msg_iovlen = 2;
+      pending++;
+    }
+    if (pending > 0) {
+      sendBatch(m_clientSocket, pending, received);
+    }
+
+    if (count < DATAGRAM_BATCH_SIZE) {
+      break;
+    }
+  }
+
+  if (received > 0) {
+    m_counters->add(0, received);
+  }
+}
+
+#else
+bool DatagramRelay::bindClient(const QHostAddress& bindAddress) {
+  m_clientSocket = new QUdpSocket(this);
+  if (!m_clientSocket->bind(bindAddress, 0)) {
+    qDebug() << "Failed to bind relay socket:" << m_clientSocket->errorString();
+    return false;
+  }
+  m_localAddress = m_clientSocket->localAddress();
+  m_localPort = m_clientSocket->localPort();
+
+  connect(m_clientSocket, &QUdpSocket::readyRead, this,
+          &DatagramRelay::readClient);
+  return true;
+}
+
+int DatagramRelay::outboundSocket(const QHostAddress& dest) {
+  const int index =
+      (dest.protocol() == QAbstractSocket::IPv6Protocol) ? 1 : 0;
+  if (m_outSocket[index] != nullptr) {
+    return index;
+  }
+
+  // As with TCP, create the socket ourselves so that the platform layer can
+  // configure it before anything is sent on it.
+  const int family = index ? AF_INET6 : AF_INET;
+  qintptr sd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+#  ifdef Q_OS_WIN
+  if (sd == INVALID_SOCKET) {
+    qDebug() << "Failed to create outgoing socket:" << WSAGetLastError();
+    return -1;
+  }
+#  else
+  if (sd < 0) {
+    qDebug() << "Failed to create outgoing socket:" << strerror(errno);
+    return -1;
+  }
+#  endif
+  emit setupOutSocket(sd, dest);
+
+  // The socket is bound implicitly by the first datagram sent, if the
+  // platform layer didn't already bind it.
+  QUdpSocket* socket = new QUdpSocket(this);
+  if (!socket->setSocketDescriptor(sd, QAbstractSocket::BoundState)) {
+    qDebug() << "Failed to set up outgoing socket:" << socket->errorString();
+    delete socket;
+    return -1;
+  }
+  connect(socket, &QUdpSocket::readyRead, this,
+          [this, index]() { readRemote(index); });
+
+  m_outSocket[index] = socket;
+  return index;
+}
+
+void DatagramRelay::readClient() {
+  qint64 sent = 0;
+  while (m_clientSocket->hasPendingDatagrams()) {
+    QNetworkDatagram datagram = m_clientSocket->receiveDatagram();
+    if (!acceptClient(datagram.senderAddress(), datagram.senderPort())) {
+      continue;
+    }
+
+    const QByteArray data = datagram.data();
+    if (data.length() > MAX_DATAGRAM_SIZE) {
+      continue;
+    }
+    QHostAddress dest;
+    quint16 port;
+    qint64 header;
+    if (!route(data.constData(), data.length(), dest, port, header)) {
+      continue;
+    }
+    int index = outboundSocket(dest);
+    if (index < 0) {
+      continue;
+    }
+
+    qint64 len = m_outSocket[index]->writeDatagram(
+        data.constData() + header, data.length() - header, dest, port);
+    if (len > 0) {
+      sent += len;
+    }
+  }
+
+  if (sent > 0) {
+    m_counters->add(sent, 0);
+  }
+}
+
+void DatagramRelay::readRemote(int index) {
+  qint64 received = 0;
+  QUdpSocket* socket = m_outSocket[index];
+  while (socket->hasPendingDatagrams()) {
+    QNetworkDatagram datagram = socket->receiveDatagram();
+    if (!m_clientSeen || (datagram.data().length() > MAX_DATAGRAM_SIZE)) {
+      continue;
+    }
+
+    char header[MAX_HEADER_LENGTH];
+    qint64 len =
+        writeHeader(header, datagram.senderAddress(), datagram.senderPort());
+    QByteArray reply(header, len);
+    reply.append(datagram.data());
+    if (m_clientSocket->writeDatagram(reply, m_clientAddress, m_clientPort) >
+        0) {
+      received += datagram.data().length();
+    }
+  }
+
+  if (received > 0) {
+    m_counters->add(0, received);
+  }
+}
+#endif
@@ -0,0 +1,144 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef DATAGRAMRELAY_H
+#define DATAGRAMRELAY_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QHostAddress>
+#include <QObject>
+#include <memory>
+
+#include "trafficcounters.h"
+
+class QSocketNotifier;
+class QUdpSocket;
+
+// A lookup of one destination name for a DatagramRelay. The resolver tracks
+// one request per object, so every name being looked up gets one of these.
+class DatagramLookup final : public QObject {
+  Q_OBJECT
+
+ public:
+  explicit DatagramLookup(QObject* parent) : QObject(parent) {}
+
+ signals:
+  // The address of the name, or a null address if it doesn't exist.
+  void finished(const QHostAddress& addr);
+
+ private slots:
+  void onHostnameResolved(QHostAddress addr) { emit finished(addr); }
+  void onHostnameNotFound() { emit finished(QHostAddress()); }
+};
+
+// Relays UDP datagrams for a SOCKS5 client that sent a UDP ASSOCIATE request.
+// Datagrams from the client start with a SOCKS5 UDP request header naming
+// their destination, which is stripped before they are forwarded. Replies are
+// sent back to the client with a header naming their source. On Linux the
+// datagrams are moved in batches using recvmmsg(2) and sendmmsg(2).
+class DatagramRelay final : public QObject {
+  Q_OBJECT
+
+ public:
+  /**
+   * @brief Create a relay listening for datagrams from a client.
+   *
+   * @param bindAddress - the local address to receive client datagrams on
+   * @param clientAddress - the address the client sends from, or a null
+   * address to accept datagrams from any loopback address
+   * @param clientPort - the port the client sends from, or zero if unknown
+   * @param counters - the traffic counters to add the relayed bytes to
+   * @param parent - the QObject parent of the relay
+   * @return DatagramRelay* - the new relay, or nullptr on failure.
+   */
+  static DatagramRelay* create(const QHostAddress& bindAddress,
+                               const QHostAddress& clientAddress,
+                               quint16 clientPort,
+                               std::shared_ptr<TrafficCounters> counters,
+                               QObject* parent);
+  ~DatagramRelay();
+
+  const QHostAddress& localAddress() const { return m_localAddress; }
+  quint16 localPort() const { return m_localPort; }
+
+  /**
+   * @brief Parse the SOCKS5 UDP request header at the start of a datagram.
+   *
+   * @param data - the datagram
+   * @param length - the length of the datagram
+   * @param addr - set to the destination address, if given as an address
+   * @param hostname - set to the destination name, if given as a domain name
+   * @param port - set to the destination port
+   * @return qint64 - the length of the header, or -1 if it is malformed or
+   * the datagram is a fragment.
+   */
+  static qint64 parseHeader(const char* data, qint64 length,
+                            QHostAddress& addr, QString& hostname,
+                            quint16& port);
+
+  /**
+   * @brief Write the SOCKS5 UDP reply header for a datagram.
+   *
+   * @param buffer - output buffer of at least MAX_HEADER_LENGTH bytes
+   * @param addr - the source address of the datagram
+   * @param port - the source port of the datagram
+   * @return qint64 - the length of the header.
+   */
+  static qint64 writeHeader(char* buffer, const QHostAddress& addr,
+                            quint16 port);
+
+  static constexpr const qint64 MAX_HEADER_LENGTH = 4 + 16 + 2;
+
+ signals:
+  // Emitted before an outgoing socket is first used. The socket must be
+  // configured before the signal returns.
+  void setupOutSocket(qintptr sd, const QHostAddress& dest);
+
+ private:
+  explicit DatagramRelay(QObject* parent);
+  bool bindClient(const QHostAddress& bindAddress);
+  bool acceptClient(const QHostAddress& addr, quint16 port);
+  bool route(const char* data, qint64 length, QHostAddress& dest,
+             quint16& port, qint64& header);
+  int outboundSocket(const QHostAddress& dest);
+  void startLookup(const QString& hostname);
+  void lookupFinished(const QString& hostname, const QHostAddress& addr);
+  void readClient();
+  void readRemote(int index);
+
+  QHostAddress m_localAddress;
+  quint16 m_localPort = 0;
+  std::shared_ptr<TrafficCounters> m_counters;
+
+  QHostAddress m_clientAddress;
+  quint16 m_clientPort = 0;
+  bool m_clientSeen = false;
+
+  // Destinations given as domain names, and the lookups still in flight.
+  // Datagrams for names that are not yet known are dropped.
+  QHash<QString, QHostAddress> m_names;
+  QHash<QString, DatagramLookup*> m_lookups;
+
+#ifdef Q_OS_LINUX
+  int receiveBatch(int sd);
+  void sendBatch(int sd, int count, qint64& bytes);
+
+  int m_clientSocket = -1;
+  QSocketNotifier* m_clientNotifier = nullptr;
+
+  // Outgoing sockets for IPv4 and IPv6 destinations.
+  int m_outSocket[2] = {-1, -1};
+  QSocketNotifier* m_outNotifier[2] = {nullptr, nullptr};
+
+  // Scratch space for the batched system calls, allocated on first use.
+  struct Batch;
+  Batch* m_batch = nullptr;
+#else
+  QUdpSocket* m_clientSocket = nullptr;
+  QUdpSocket* m_outSocket[2] = {nullptr, nullptr};
+#endif
+};
+
+#endif  // DATAGRAMRELAY_H
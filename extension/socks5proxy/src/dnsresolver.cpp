@@ -15,9 +15,25 @@
 #include <QCoreApplication>
 #include <QMutexLocker>
 #include <QObject>
+#include <QScopeGuard>
+#include <QThread>
 
 #include "socks5connection.h"
 
+// Maximum number of hostnames to keep in the cache.
+constexpr const int DNS_CACHE_SIZE = 1024;
+// Upper bound on how long to cache an answer, regardless of its TTL.
+constexpr const qint64 DNS_CACHE_MAX_TTL_MSEC = 5 * 60 * 1000;
+// How long to remember that a hostname does not exist.
+constexpr const qint64 DNS_CACHE_NEGATIVE_TTL_MSEC = 10 * 1000;
+
+namespace {
+struct QueryContext {
+  DNSResolver* resolver;
+  QString hostname;
+};
+}  // namespace
+
 Q_GLOBAL_STATIC(DNSResolver, dnsResolver);
 DNSResolver* DNSResolver::instance() { return dnsResolver; }
 
@@ -90,31 +106,44 @@ DNSResolver::DNSResolver() {
 
   m_timer.setSingleShot(true);
   connect(&m_timer, &QTimer::timeout, this, &DNSResolver::aresTimeout);
+
+  m_cache.setMaxCost(DNS_CACHE_SIZE);
 }
 
 DNSResolver::~DNSResolver() { ares_destroy(m_channel); }
 
 /* Callback that is called when DNS query is finished */
-void DNSResolver::addressInfoCallback(QObject* ctx, int status, int timeouts,
+void DNSResolver::addressInfoCallback(const QString& hostname, int status,
+                                      int timeouts,
                                       struct ares_addrinfo* result) {
-  QMutexLocker locker(&m_requestLock);
-  if (!m_requests.contains(ctx)) {
-    qDebug() << "Connection destroyed before resolution completed";
-    return;
-  }
+  auto guard = qScopeGuard([&]() {
+    if (result) {
+      ares_freeaddrinfo(result);
+    }
+  });
+  const QList<QObject*> waiters = m_pending.take(hostname);
+
+  // Every request merged onto this query gets an answer, even if the lookup
+  // failed, otherwise its connection would wait forever.
+  QList<QHostAddress> addrs;
+  auto notify = qScopeGuard([&]() {
+    for (QObject* ctx : waiters) {
+      notifyResolved(ctx, addrs);
+    }
+  });
 
-  // This should be our Socks5Connection
   switch (status) {
+    case ARES_SUCCESS:
+      break;
+    case ARES_ENOTFOUND: {
+      qDebug() << "The name was not found.";
+      QDeadlineTimer expires(DNS_CACHE_NEGATIVE_TTL_MSEC);
+      m_cache.insert(hostname, new CacheEntry{{}, expires});
+      return;
+    }
     case ARES_ENOTIMP:
       qDebug() << "The ares library does not know how to find addresses of "
                   "type family. ";
-      QMetaObject::invokeMethod(ctx, "onHostnameNotFound",
-                                Qt::QueuedConnection);
-      return;
-    case ARES_ENOTFOUND:
-      qDebug() << "The name was not found.";
-      QMetaObject::invokeMethod(ctx, "onHostnameNotFound",
-                                Qt::QueuedConnection);
       return;
     case ARES_ENOMEM:
       qDebug() << "Memory was exhausted.";
@@ -127,45 +156,109 @@ void DNSResolver::addressInfoCallback(QObject* ctx, int status, int timeouts,
       qDebug() << "The name service channel channel is being destroyed; the "
                   "query will not be completed. ";
       return;
+    default:
+      qDebug() << "DNS lookup failed:" << ares_strerror(status);
+      return;
   }
 
-  Q_ASSERT(status == ARES_SUCCESS);
-
-  auto guard = qScopeGuard([&]() { ares_freeaddrinfo(result); });
   if (!result) {
     return;
   }
+  qint64 ttl = DNS_CACHE_MAX_TTL_MSEC;
   for (auto node = result->nodes; node != NULL; node = node->ai_next) {
     if (node->ai_family != AF_INET && node->ai_family != AF_INET6) {
       continue;
     }
-    QHostAddress target{node->ai_addr};
+    addrs.append(QHostAddress(node->ai_addr));
+    ttl = qMin(ttl, qMax(node->ai_ttl, 0) * qint64(1000));
+  }
+
+  // Answers without a TTL (eg: from the hosts file) are not cached.
+  if (!addrs.isEmpty() && ttl > 0) {
+    m_cache.insert(hostname, new CacheEntry{addrs, QDeadlineTimer(ttl)});
+  }
+}
+
+void DNSResolver::notifyResolved(QObject* ctx,
+                                 const QList<QHostAddress>& addrs) {
+  QMutexLocker locker(&m_requestLock);
+  if (!m_requests.contains(ctx)) {
+    qDebug() << "Connection destroyed before resolution completed";
+    return;
+  }
+
+  // This should be our Socks5Connection
+  if (addrs.isEmpty()) {
+    QMetaObject::invokeMethod(ctx, "onHostnameNotFound", Qt::QueuedConnection);
+    return;
+  }
+  for (const QHostAddress& target : addrs) {
     QMetaObject::invokeMethod(ctx, "onHostnameResolved", Qt::QueuedConnection,
                               Q_ARG(QHostAddress, target));
   }
 }
 
-void DNSResolver::requestDestroyed() {
+void DNSResolver::requestDestroyed(QObject* obj) {
   QMutexLocker locker(&m_requestLock);
-  m_requests.remove(QObject::sender());
+  m_requests.remove(obj);
 }
 
 void DNSResolver::resolveAsync(const QString& hostname, QObject* parent) {
   // Store the requesting connections in a hash map.
   // This allows us to detect when connections are destroyed, and prevents
   // use-after-free bugs if the resolution completes after the connection
-  // is freed.
+  // is freed. The connection may live in another thread, so the request must
+  // be dropped synchronously as it is destroyed.
   QObject::connect(parent, &QObject::destroyed, this,
-                   &DNSResolver::requestDestroyed);
+                   &DNSResolver::requestDestroyed, Qt::DirectConnection);
   m_requestLock.lock();
   m_requests.insert(parent, hostname);
   m_requestLock.unlock();
 
+  // The c-ares channel and its socket notifiers belong to our thread.
+  if (QThread::currentThread() != thread()) {
+    QMetaObject::invokeMethod(
+        this, [this, hostname, parent]() { startQuery(hostname, parent); });
+    return;
+  }
+  startQuery(hostname, parent);
+}
+
+void DNSResolver::startQuery(const QString& hostname, QObject* parent) {
+  m_requestLock.lock();
+  bool pending = m_requests.contains(parent);
+  m_requestLock.unlock();
+  if (!pending) {
+    return;
+  }
+
+  // Answer from the cache if we can.
+  CacheEntry* entry = m_cache.object(hostname);
+  if (entry != nullptr) {
+    if (!entry->expires.hasExpired()) {
+      m_cacheHits++;
+      notifyResolved(parent, entry->addrs);
+      return;
+    }
+    m_cache.remove(hostname);
+  }
+
+  // Join a query for the same hostname if one is already in flight.
+  auto i = m_pending.find(hostname);
+  if (i != m_pending.end()) {
+    m_cacheCoalesced++;
+    i->append(parent);
+    return;
+  }
+  m_cacheMisses++;
+  m_pending.insert(hostname, {parent});
+
   auto callback = [](void* arg, int status, int timeouts,
                      struct ares_addrinfo* results) {
-    QObject* ctx = static_cast<QObject*>(arg);
-    auto instance = DNSResolver::instance();
-    instance->addressInfoCallback(ctx, status, timeouts, results);
+    QueryContext* ctx = static_cast<QueryContext*>(arg);
+    ctx->resolver->addressInfoCallback(ctx->hostname, status, timeouts,
+                                       results);
+    delete ctx;
   };
 
   auto name = hostname.toStdString();
@@ -173,7 +266,8 @@ void DNSResolver::resolveAsync(const QString& hostname, QObject* parent) {
   memset(&hints, 0, sizeof(hints));
   hints.ai_family = AF_UNSPEC;
   hints.ai_flags = ARES_AI_CANONNAME;
-  ares_getaddrinfo(m_channel, name.c_str(), NULL, &hints, callback, parent);
+  ares_getaddrinfo(m_channel, name.c_str(), NULL, &hints, callback,
+                   new QueryContext{this, hostname});
   updateTimeout();
 }
 
@@ -191,6 +285,9 @@ void DNSResolver::setNameserver(const QList<QHostAddress>& dnsList) {
   qDebug() << "Setting nameservers:" << serverString;
   int result = ares_set_servers_csv(m_channel, serverString.constData());
   Q_ASSERT(result == ARES_SUCCESS);
+
+  // The answers of the previous nameservers may not hold for the new ones.
+  m_cache.clear();
 }
 
 void DNSResolver::socketAcivated(QSocketDescriptor sd,
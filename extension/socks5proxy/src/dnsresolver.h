@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <QCache>
+#include <QDeadlineTimer>
 #include <QGlobalStatic>
 #include <QHash>
 #include <QHostAddress>
@@ -11,6 +13,7 @@
 #include <QObject>
 #include <QSocketNotifier>
 #include <QTimer>
+#include <atomic>
 
 struct ares_channeldata;
 class ares_addrinfo;
@@ -25,6 +28,8 @@ class Socks5Connection;
 class DNSResolver : public QObject {
   Q_OBJECT
 
+  friend class TestDNSResolver;
+
  public:
   DNSResolver();
   ~DNSResolver();
@@ -34,6 +39,9 @@ class DNSResolver : public QObject {
   /**
    * @brief Queues up a DNS Query to get Resolved.
    *
+   * This may be called from any thread, the notification will be delivered
+   * to the thread of the parent object.
+   *
    * @param hostname - The requested Hostname
    * @param parent - The QObject to notify. Will call the
    * onHostnameResolved(QHostAddress) method when done.
@@ -42,17 +50,28 @@ class DNSResolver : public QObject {
 
   void setNameserver(const QList<QHostAddress>& addr);
 
+  struct CacheStats {
+    quint64 hits;
+    quint64 misses;
+    quint64 coalesced;
+  };
+  CacheStats cacheStats() const {
+    return CacheStats{m_cacheHits, m_cacheMisses, m_cacheCoalesced};
+  }
+
  signals:
   void setupDnsSocket(qintptr sd, const QHostAddress& dest);
 
  private slots:
-  void requestDestroyed();
+  void requestDestroyed(QObject* obj);
   void socketAcivated(QSocketDescriptor sd, QSocketNotifier::Type type);
   void aresTimeout();
 
  private:
-  void addressInfoCallback(QObject* ctx, int status, int timeouts,
+  void addressInfoCallback(const QString& hostname, int status, int timeouts,
                            struct ares_addrinfo* result);
+  void startQuery(const QString& hostname, QObject* parent);
+  void notifyResolved(QObject* ctx, const QList<QHostAddress>& addrs);
   void shutdownAres();
   void updateTimeout();
 
@@ -75,6 +94,21 @@ class DNSResolver : public QObject {
   QHash<QObject*, QString> m_requests;
   QMutex m_requestLock;
 
+  // Resolved hostnames, an empty address list is a negative entry. Entries
+  // are evicted in least-recently-used order. Only used from our thread.
+  struct CacheEntry {
+    QList<QHostAddress> addrs;
+    QDeadlineTimer expires;
+  };
+  QCache<QString, CacheEntry> m_cache;
+
+  // Requests waiting for a query in flight, by hostname.
+  QHash<QString, QList<QObject*>> m_pending;
+
+  std::atomic<quint64> m_cacheHits = 0;
+  std::atomic<quint64> m_cacheMisses = 0;
+  std::atomic<quint64> m_cacheCoalesced = 0;
+
   QHash<int, QSocketNotifier*> m_notifiers;
   QTimer m_timer;
 
@@ -0,0 +1,74 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "flowcontrol.h"
+
+#include <atomic>
+
+// Shrink the buffer back to the minimum after this long without traffic.
+constexpr const qint64 FLOW_IDLE_MSEC = 1000;
+
+namespace {
+std::atomic<qint64> s_maximumSize = 1024 * 1024;
+}
+
+FlowControl::FlowControl() : m_size(minimumSize()) { m_clock.start(); }
+
+// static
+qint64 FlowControl::maximumSize() { return s_maximumSize; }
+
+// static
+void FlowControl::setMaximumSize(qint64 size) {
+  s_maximumSize = qMax(size, minimumSize());
+}
+
+qint64 FlowControl::stallTime() const {
+  if (m_stalled) {
+    return m_stallTime + m_clock.elapsed() - m_stallStart;
+  }
+  return m_stallTime;
+}
+
+bool FlowControl::prepare(qint64 queued, qint64 pending) {
+  const qint64 now = m_clock.elapsed();
+  const qint64 previous = m_size;
+
+  if ((queued == 0) && ((now - m_lastActivity) > FLOW_IDLE_MSEC)) {
+    // The connection went idle, release the memory.
+    m_size = minimumSize();
+    m_filled = false;
+  } else if (m_filled && (queued == 0) && (pending > 0)) {
+    // The buffer was full, and has been drained while data was waiting. The
+    // destination can take more than we are giving it.
+    m_size = qMin(m_size * 2, maximumSize());
+    m_filled = false;
+  }
+
+  if ((queued > 0) || (pending > 0)) {
+    m_lastActivity = now;
+  }
+  return m_size != previous;
+}
+
+void FlowControl::finish(qint64 queued, qint64 pending) {
+  const qint64 now = m_clock.elapsed();
+  if (queued > 0) {
+    m_lastActivity = now;
+  }
+  if ((queued > 0) && ((quint64)queued > m_watermark)) {
+    m_watermark = queued;
+  }
+
+  const bool full = (queued >= m_size) && (pending > 0);
+  if (full) {
+    m_filled = true;
+  }
+  if (full && !m_stalled) {
+    m_stalled = true;
+    m_stallStart = now;
+  } else if (!full && m_stalled) {
+    m_stalled = false;
+    m_stallTime += now - m_stallStart;
+  }
+}
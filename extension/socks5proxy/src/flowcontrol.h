@@ -0,0 +1,63 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef FLOWCONTROL_H
+#define FLOWCONTROL_H
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+// Tracks the buffering limit for one direction of a proxied connection.
+//
+// The limit starts at minimumSize() and doubles whenever the buffer is seen to
+// be filled and then completely drained while more data was waiting, meaning
+// that the buffer rather than the destination was the bottleneck. It falls back
+// to the minimum after the connection has been idle for a while.
+class FlowControl final {
+ public:
+  FlowControl();
+
+  static constexpr qint64 minimumSize() { return 16 * 1024; }
+  static qint64 maximumSize();
+  static void setMaximumSize(qint64 size);
+
+  // The number of bytes that may currently be queued for the destination.
+  qint64 size() const { return m_size; }
+
+  // The largest number of bytes ever queued for the destination.
+  quint64 watermark() const { return m_watermark; }
+
+  // Total time in milliseconds spent with the buffer full.
+  qint64 stallTime() const;
+
+  /**
+   * @brief Update the limit before moving data.
+   *
+   * @param queued - bytes waiting to be written to the destination
+   * @param pending - bytes waiting to be read from the source
+   * @return bool - true if the limit was changed.
+   */
+  bool prepare(qint64 queued, qint64 pending);
+
+  /**
+   * @brief Update the statistics after moving data.
+   *
+   * @param queued - bytes waiting to be written to the destination
+   * @param pending - bytes waiting to be read from the source
+   */
+  void finish(qint64 queued, qint64 pending);
+
+ private:
+  qint64 m_size;
+  quint64 m_watermark = 0;
+
+  QElapsedTimer m_clock;
+  qint64 m_lastActivity = 0;
+  qint64 m_stallStart = 0;
+  qint64 m_stallTime = 0;
+  bool m_stalled = false;
+  bool m_filled = false;
+};
+
+#endif  // FLOWCONTROL_H
@@ -8,22 +8,64 @@
 #include <QLocalSocket>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QThread>
 
+#include "connectionpool.h"
 #include "socks5connection.h"
 
 #define MAX_CLIENTS 1024
 
 Socks5::Socks5(QLocalServer* server) : QObject(server) {
+  m_pool = createPool(this);
   connect(server, &QLocalServer::newConnection, this,
           [this, server]() { newConnection(server); });
 }
 
 Socks5::Socks5(QTcpServer* server) : QObject(server) {
+  m_pool = createPool(this);
   connect(server, &QTcpServer::newConnection, this,
           [this, server]() { newConnection(server); });
 }
 
-Socks5::~Socks5() { m_shuttingDown = true; }
+Socks5::~Socks5() {
+  m_shuttingDown = true;
+
+  for (const Worker& worker : m_workers) {
+    worker.thread->quit();
+    worker.thread->wait();
+    delete worker.thread;
+  }
+}
+
+void Socks5::setWorkerThreads(int count) {
+  Q_ASSERT(m_workers.isEmpty());
+
+  for (int i = 0; i < count; i++) {
+    QThread* thread = new QThread();
+    thread->setObjectName(QString("Socks5Worker-%1").arg(i));
+
+    // Sockets handed to the worker are parented to this object, so that they
+    // get cleaned up in the worker thread when it exits.
+    QObject* root = new QObject();
+    ConnectionPool* pool = createPool(root);
+    root->moveToThread(thread);
+    connect(thread, &QThread::finished, root, &QObject::deleteLater);
+
+    thread->start();
+    m_workers.append(Worker{thread, root, pool, 0});
+  }
+}
+
+ConnectionPool* Socks5::createPool(QObject* parent) {
+  ConnectionPool* pool = new ConnectionPool(parent);
+  connect(
+      pool, &ConnectionPool::setupOutSocket, this,
+      [this](qintptr sd, const QHostAddress& dest) {
+        emit outgoingConnection(sd, dest);
+      },
+      Qt::DirectConnection);
+  return pool;
+}
 
 template <typename T>
 void Socks5::newConnection(T* server) {
@@ -43,15 +85,53 @@ void Socks5::newConnection(T* server) {
       newConnection(server);
     });
 
-    connect(con, &Socks5Connection::setupOutSocket, this,
-            [this](qintptr sd, const QHostAddress& dest) {
-              emit outgoingConnection(sd, dest);
-            });
+    connect(
+        con, &Socks5Connection::setupOutSocket, this,
+        [this](qintptr sd, const QHostAddress& dest) {
+          emit outgoingConnection(sd, dest);
+        },
+        Qt::DirectConnection);
+    con->setConnectionPool(m_pool);
 
     ++m_clientCount;
     emit incomingConnection(con);
     emit connectionsChanged();
+
+    if (!m_workers.isEmpty()) {
+      dispatch(socket, con);
+    }
+  }
+}
+
+void Socks5::dispatch(QObject* socket, Socks5Connection* con) {
+  // Pick the least loaded worker, starting from the next one in turn so that
+  // ties are broken in a round-robin fashion.
+  const qsizetype count = m_workers.count();
+  qsizetype index = m_nextWorker % count;
+  for (qsizetype i = 1; i < count; i++) {
+    qsizetype candidate = (m_nextWorker + i) % count;
+    if (m_workers[candidate].load < m_workers[index].load) {
+      index = candidate;
+    }
   }
+  m_nextWorker = index + 1;
+
+  Worker& worker = m_workers[index];
+  worker.load++;
+  con->setConnectionPool(worker.pool);
+  connect(con, &QObject::destroyed, this, [this, index]() {
+    if (!m_shuttingDown) {
+      m_workers[index].load--;
+    }
+  });
+
+  // Move the socket, and the connection along with it, into the worker. Only
+  // parentless objects can change threads, so re-parent it once it arrives.
+  QObject* root = worker.root;
+  socket->setParent(nullptr);
+  socket->moveToThread(worker.thread);
+  QMetaObject::invokeMethod(root,
+                            [socket, root]() { socket->setParent(root); });
 }
 
 void Socks5::clientDismissed() {
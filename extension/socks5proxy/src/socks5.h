@@ -5,14 +5,17 @@
 #ifndef SOCKS5_H
 #define SOCKS5_H
 
+#include <QList>
 #include <QObject>
 
 #include "dnsresolver.h"
 #include "socks5connection.h"
 
+class ConnectionPool;
 class QHostAddress;
 class QLocalServer;
 class QTcpServer;
+class QThread;
 
 class Socks5 final : public QObject {
   Q_OBJECT
@@ -25,18 +28,48 @@ class Socks5 final : public QObject {
 
   uint16_t connections() const { return m_clientCount; }
 
+  /**
+   * @brief Distribute connections over a pool of worker threads.
+   *
+   * Connections are accepted on the thread of the server, then handed right
+   * away to the least loaded worker thread, which negotiates and relays them
+   * for the rest of their lifetime. This must be called before any
+   * connections are accepted.
+   *
+   * @param count - the number of worker threads, or zero to handle all
+   * connections on the thread of the server.
+   */
+  void setWorkerThreads(int count);
+
  signals:
   void connectionsChanged();
   void incomingConnection(Socks5Connection* connection);
+
+  // This signal may be emitted from a worker thread, and the socket must be
+  // configured before it returns. Receivers must use Qt::DirectConnection.
   void outgoingConnection(qintptr sd, const QHostAddress& dest);
 
  private:
   void clientDismissed();
   template <typename T>
   void newConnection(T* server);
+  void dispatch(QObject* socket, Socks5Connection* con);
+  ConnectionPool* createPool(QObject* parent);
 
   uint16_t m_clientCount = 0;
   bool m_shuttingDown = false;
+
+  // Upstream connections kept warm for connections on our own thread.
+  ConnectionPool* m_pool = nullptr;
+
+  struct Worker {
+    QThread* thread;
+    QObject* root;
+    ConnectionPool* pool;
+    int load;
+  };
+  QList<Worker> m_workers;
+  qsizetype m_nextWorker = 0;
 };
 
 #endif  // SOCKS5_H
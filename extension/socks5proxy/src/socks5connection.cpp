@@ -4,6 +4,8 @@
 
 #include "socks5connection.h"
 
+#include "connectionpool.h"
+#include "datagramrelay.h"
 #include "dnsresolver.h"
 #include "socks5.h"
 
@@ -16,10 +18,27 @@
 #  include <arpa/inet.h>
 #endif
 
+#ifdef Q_OS_LINUX
+#  include "splicerelay.h"
+#endif
+
 #include <QDnsLookup>
 #include <QHostAddress>
+#include <QTimer>
+#include <QtEndian>
+
+// The longest negotiation we may need to parse in one go: a greeting offering
+// every method, followed by a request for the longest domain name.
+constexpr const qint64 MAX_NEGOTIATION_LENGTH = (2 + 255) + (4 + 1 + 255 + 2);
+
+// How long to wait for a connection attempt before racing it against the next
+// address, as recommended by RFC 8305 section 5.
+constexpr const int CONNECTION_ATTEMPT_DELAY_MSEC = 250;
 
-constexpr const int MAX_CONNECTION_BUFFER = 16 * 1024;
+// The addresses of a hostname are delivered one at a time, so when every
+// attempt has failed, wait this long for more of them before giving up. See
+// the Resolution Delay in RFC 8305 section 3.
+constexpr const int RESOLUTION_DELAY_MSEC = 50;
 
 namespace {
 
@@ -30,38 +49,6 @@ namespace {
 #  define PACK(__Declaration__) __Declaration__ __attribute__((__packed__))
 #endif
 
-PACK(struct ClientGreetingPacket {
-  uint8_t version;
-  uint8_t nauth;
-});
-
-PACK(struct ServerChoicePacket {
-  uint8_t version;
-  uint8_t cauth;
-});
-
-PACK(struct ClientConnectionRequestPacket {
-  uint8_t version;
-  uint8_t cmd;
-  uint8_t rsv;
-  uint8_t atype;
-});
-
-PACK(struct ClientConnectionAddressIpv4Packet {
-  uint8_t ip_dst[4];
-  uint16_t port;
-});
-
-PACK(struct ClientConnectionAddressDomainNamePacket {
-  uint8_t cmd;
-  uint16_t port;
-});
-
-PACK(struct ClientConnectionAddressIpv6Packet {
-  uint8_t ip_dst[16];
-  uint16_t port;
-});
-
 PACK(struct ServerResponsePacket {
   uint8_t m_version = 0x05;
   uint8_t m_rep = 0x01;
@@ -72,20 +59,51 @@ PACK(struct ServerResponsePacket {
 });
 
 ServerResponsePacket createServerResponsePacket(uint8_t rep,
-                                                uint16_t port = 0x00u) {
-  return ServerResponsePacket{0x05, rep, 0x00, 0x01, 0x00, port};
+                                                uint16_t port = 0x00u,
+                                                uint32_t addr = 0x00u) {
+  return ServerResponsePacket{0x05, rep, 0x00, 0x01, qToBigEndian(addr),
+                              qToBigEndian(port)};
+}
+
+// Sockets may report IPv4 addresses in their IPv6-mapped form, which we would
+// rather not have to deal with.
+QHostAddress unmapAddress(const QHostAddress& addr) {
+  bool isIpv4 = false;
+  quint32 ip4 = addr.toIPv4Address(&isIpv4);
+  if (isIpv4) {
+    return QHostAddress(ip4);
+  }
+  return addr;
+}
+
+void setReadBufferSize(QIODevice* device, qint64 size) {
+  if (auto* s = qobject_cast<QAbstractSocket*>(device)) {
+    s->setReadBufferSize(size);
+  } else if (auto* s = qobject_cast<QLocalSocket*>(device)) {
+    s->setReadBufferSize(size);
+  }
 }
 
 }  // namespace
 
 Socks5Connection::Socks5Connection(QIODevice* socket)
     : QObject(socket), m_inSocket(socket) {
+  m_attemptTimer = new QTimer(this);
+  m_attemptTimer->setSingleShot(true);
+  connect(m_attemptTimer, &QTimer::timeout, this,
+          &Socks5Connection::nextAttempt);
+
   connect(m_inSocket, &QIODevice::readyRead, this,
           &Socks5Connection::readyRead);
 
   connect(m_inSocket, &QIODevice::bytesWritten, this,
           &Socks5Connection::bytesWritten);
-  readyRead();
+
+  // A client may have pipelined its request already. Parse it from the event
+  // loop, once the owner has attached the connection pool and the socket
+  // hooks, and has moved the connection to the thread it will run on.
+  QMetaObject::invokeMethod(this, &Socks5Connection::readyRead,
+                            Qt::QueuedConnection);
 }
 
 Socks5Connection::Socks5Connection(QTcpSocket* socket)
@@ -102,9 +120,11 @@ Socks5Connection::Socks5Connection(QTcpSocket* socket)
             }
           });
 
-  socket->setReadBufferSize(MAX_CONNECTION_BUFFER);
+  socket->setReadBufferSize(m_sendFlow.size());
 
   m_socksPort = socket->localPort();
+  m_socksAddress = unmapAddress(socket->localAddress());
+  m_clientAddress = unmapAddress(socket->peerAddress());
   m_clientName = socket->peerAddress().toString();
 }
 
@@ -122,7 +142,8 @@ Socks5Connection::Socks5Connection(QLocalSocket* socket)
             }
           });
 
-  socket->setReadBufferSize(MAX_CONNECTION_BUFFER);
+  socket->setReadBufferSize(m_sendFlow.size());
+  m_socksAddress = QHostAddress(QHostAddress::LocalHost);
 
   // TODO: Some magic may be required here to resolve the entity of which client
   // tried to connect. Some breadcrumbs:
@@ -144,11 +165,9 @@ void Socks5Connection::setError(Socks5Replies reason,
       [[fallthrough]];
     case ClientConnectionRequest:
       [[fallthrough]];
-    case ClientConnectionAddress: {
-      ServerResponsePacket packet(createServerResponsePacket(reason));
-      m_inSocket->write((char*)&packet, sizeof(ServerResponsePacket));
+    case ClientConnectionAddress:
+      writeReply(reason);
       break;
-    }
 
     default:
       break;
@@ -160,6 +179,14 @@ void Socks5Connection::setError(Socks5Replies reason,
 
 void Socks5Connection::setState(Socks5State newstate) {
   m_state = newstate;
+#ifdef Q_OS_LINUX
+  // The relay keeps the flow control state while it owns the sockets, pick
+  // it up for the statistics.
+  if (m_splice != nullptr) {
+    m_sendFlow = m_splice->sendFlow();
+    m_recvFlow = m_splice->recvFlow();
+  }
+#endif
   emit stateChanged();
 
   // If the new state is Proxy, keep track of how many bytes are yet to be
@@ -171,6 +198,7 @@ void Socks5Connection::setState(Socks5State newstate) {
 
   // If the state is closing. Shutdown the sockets.
   if (m_state == Closed) {
+    m_attemptTimer->stop();
     m_inSocket->close();
     if (m_outSocket != nullptr) {
       m_outSocket->close();
@@ -183,146 +211,194 @@ void Socks5Connection::setState(Socks5State newstate) {
 
 void Socks5Connection::readyRead() {
   switch (m_state) {
-    case ClientGreeting: {
-      const auto packet = readPacket<ClientGreetingPacket>(m_inSocket);
-      if (!packet) {
-        return;
-      }
-      uint8_t version = packet.value().version;
-      if (version != 0x5) {
-        // We only currently want to support socks5.
-        // as otherwise we could not support udp or auth.
-        auto msg = QString("SOCKS version %1 not supported").arg(version);
-        setError(ErrorGeneral, msg);
-        return;
-      }
-      m_authNumber = packet.value().nauth;
-      setState(AuthenticationMethods);
+    case ClientGreeting:
       [[fallthrough]];
-    }
+    case ClientConnectionRequest:
+      parseNegotiation();
+      break;
 
-    case AuthenticationMethods: {
-      if (m_inSocket->bytesAvailable() < (qint64)m_authNumber) {
-        return;
-      }
+    case ClientConnectionAddress:
+      // Any early data stays buffered until the connection is established.
+      break;
 
-      char buffer[INT8_MAX];
-      if (m_inSocket->read(buffer, m_authNumber) != m_authNumber) {
-        setError(ErrorGeneral, m_inSocket->errorString());
-        return;
+    case Proxy:
+      if (m_relay != nullptr) {
+        // Nothing is expected on the control connection of a UDP association.
+        m_inSocket->skip(m_inSocket->bytesAvailable());
+        break;
       }
+      proxy(m_inSocket, m_outSocket, m_sendFlow);
+#ifdef Q_OS_LINUX
+      maybeStartSplice();
+#endif
+      break;
 
-      ServerChoicePacket packet;
-      packet.version = 0x5;
-      packet.cauth = 0x00;  // TODO: authentication check!
+    case Closed:
+      break;
 
-      if (m_inSocket->write((const char*)&packet, sizeof(ServerChoicePacket)) !=
-          sizeof(ServerChoicePacket)) {
-        setError(ErrorGeneral, m_inSocket->errorString());
-        return;
-      }
+    default:
+      Q_ASSERT(false);
+      break;
+  }
+}
 
-      setState(ClientConnectionRequest);
-      [[fallthrough]];
+void Socks5Connection::parseNegotiation() {
+  // Clients using optimistic SOCKS send the greeting and the connection
+  // request without waiting for our replies, so parse as much as we can out
+  // of the buffered data in a single pass.
+  char buffer[MAX_NEGOTIATION_LENGTH];
+  const qint64 length = m_inSocket->peek(buffer, sizeof(buffer));
+  if (length <= 0) {
+    return;
+  }
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(buffer);
+  qint64 offset = 0;
+
+  if (m_state == ClientGreeting) {
+    // +-----+----------+----------+
+    // | VER | NMETHODS | METHODS  |
+    // +-----+----------+----------+
+    if (length < 2) {
+      return;
     }
-
-    case ClientConnectionRequest: {
-      auto const packet = readPacket<ClientConnectionRequestPacket>(m_inSocket);
-      if (!packet) {
-        return;
-      }
-      if (packet.value().version != 0x5 || packet.value().rsv != 0x00) {
-        setError(ErrorGeneral, "Malformed connection request");
-        return;
-      }
-      if (packet.value().cmd != 0x01u /* connection */) {
-        setError(ErrorCommandNotSupported, "Command not supported");
-        return;
-      }
-      m_addressType = packet.value().atype;
-      setState(ClientConnectionAddress);
-      [[fallthrough]];
+    uint8_t version = data[0];
+    if (version != 0x5) {
+      // We only currently want to support socks5.
+      // as otherwise we could not support udp or auth.
+      auto msg = QString("SOCKS version %1 not supported").arg(version);
+      setError(ErrorGeneral, msg);
+      return;
     }
+    m_authNumber = data[1];
+    if (length < 2 + m_authNumber) {
+      return;
+    }
+    offset += 2 + m_authNumber;
 
-    case ClientConnectionAddress: {
-      if (m_addressType == 0x01 /* Ipv4 */) {
-        auto const packet =
-            readPacket<ClientConnectionAddressIpv4Packet>(m_inSocket);
-        if (!packet) {
-          return;
-        }
-        struct sockaddr_in sa;
-        sa.sin_family = AF_INET;
-        sa.sin_port = ntohs(packet.value().port);
-        memcpy(&(sa.sin_addr), (void*)&packet.value().ip_dst, 4);
-        m_destAddress.setAddress((struct sockaddr*)&sa);
-
-        configureOutSocket(sa.sin_port);
-      }
-
-      else if (m_addressType == 0x03 /* Domain name */) {
-        if (m_inSocket->bytesAvailable() == 0) return;
-
-        uint8_t length;
-        if (m_inSocket->read((char*)&length, 1) != 1) {
-          setError(ErrorGeneral, m_inSocket->errorString());
-          return;
-        }
-
-        char buffer[UINT8_MAX];
-        if (m_inSocket->read(buffer, length) != length) {
-          setError(ErrorGeneral, m_inSocket->errorString());
-          return;
-        }
-
-        uint16_t port;
-        if (m_inSocket->read((char*)&port, sizeof(port)) != sizeof(port)) {
-          setError(ErrorGeneral, m_inSocket->errorString());
-          return;
-        }
-
-        QString hostname = QString::fromUtf8(buffer, length);
-        m_hostLookupStack.append(hostname);
-        m_destPort = htons(port);
-        DNSResolver::instance()->resolveAsync(hostname, this);
-      }
+    // Choose a method, but hold back the reply in case the connection request
+    // has been pipelined along with the greeting.
+    m_pendingReply.append(char(0x05));
+    m_pendingReply.append(char(0x00));  // TODO: authentication check!
+    setState(ClientConnectionRequest);
+  }
 
-      else if (m_addressType == 0x04 /* Ipv6 */) {
-        auto const packet =
-            readPacket<ClientConnectionAddressIpv6Packet>(m_inSocket);
-        if (!packet) {
-          return;
+  // +-----+-----+-------+------+----------+----------+
+  // | VER | CMD |  RSV  | ATYP | DST.ADDR | DST.PORT |
+  // +-----+-----+-------+------+----------+----------+
+  const uint8_t* request = data + offset;
+  const qint64 available = length - offset;
+  qint64 addrLength = -1;
+  if (available >= 4) {
+    if (request[0] != 0x5 || request[2] != 0x00) {
+      setError(ErrorGeneral, "Malformed connection request");
+      return;
+    }
+    if ((request[1] != 0x01u /* connection */) &&
+        (request[1] != 0x03u /* UDP associate */)) {
+      setError(ErrorCommandNotSupported, "Command not supported");
+      return;
+    }
+    switch (request[3]) {
+      case 0x01: /* Ipv4 */
+        addrLength = 4;
+        break;
+      case 0x03: /* Domain name */
+        if (available >= 5) {
+          addrLength = 1 + request[4];
         }
-        struct sockaddr_in6 sa;
-        sa.sin6_family = AF_INET6;
-        sa.sin6_port = ntohs(packet.value().port);
-        memcpy(&(sa.sin6_addr), (void*)&packet.value().ip_dst, 16);
-        m_destAddress.setAddress((struct sockaddr*)&sa);
-
-        configureOutSocket(sa.sin6_port);
-      }
-
-      else {
+        break;
+      case 0x04: /* Ipv6 */
+        addrLength = 16;
+        break;
+      default:
         setError(ErrorAddressNotSupported, "Address type not supported");
         return;
+    }
+  }
+
+  // If the request is incomplete, consume what we have parsed so far and send
+  // the method selection that the client is waiting for.
+  if ((addrLength < 0) || (available < 4 + addrLength + 2)) {
+    if (offset > 0) {
+      m_inSocket->skip(offset);
+    }
+    if (!m_pendingReply.isEmpty()) {
+      if (m_inSocket->write(m_pendingReply) != m_pendingReply.length()) {
+        setError(ErrorGeneral, m_inSocket->errorString());
+        return;
       }
+      m_pendingReply.clear();
     }
+    return;
+  }
 
-    break;
+  m_addressType = request[3];
+  const uint8_t* addr = request + 4;
+  quint16 port = qFromBigEndian<quint16>(addr + addrLength);
+  m_inSocket->skip(offset + 4 + addrLength + 2);
+  setState(ClientConnectionAddress);
+
+  if (request[1] == 0x03u /* UDP associate */) {
+    // The address is where the client will send datagrams from, which is
+    // often unknown to the client. Only the port is of use to us.
+    startDatagramRelay(port);
+  } else if (m_addressType == 0x01 /* Ipv4 */) {
+    m_destAddress.setAddress(qFromBigEndian<quint32>(addr));
+    configureOutSocket(port);
+  } else if (m_addressType == 0x03 /* Domain name */) {
+    QString hostname =
+        QString::fromUtf8(reinterpret_cast<const char*>(addr + 1), addr[0]);
+    m_hostLookupStack.append(hostname);
+    m_destPort = port;
+    DNSResolver::instance()->resolveAsync(hostname, this);
+  } else if (m_addressType == 0x04 /* Ipv6 */) {
+    m_destAddress.setAddress(addr);
+    configureOutSocket(port);
+  }
+}
 
-    case Proxy:
-      proxy(m_inSocket, m_outSocket, m_sendHighWaterMark);
-      break;
+bool Socks5Connection::writeReply(Socks5Replies reply, quint16 port,
+                                  quint32 addr) {
+  // Send the reply along with the method selection, if it was held back.
+  ServerResponsePacket packet(createServerResponsePacket(reply, port, addr));
+  m_pendingReply.append((const char*)&packet, sizeof(ServerResponsePacket));
+  qint64 len = m_inSocket->write(m_pendingReply);
+  bool okay = (len == m_pendingReply.length());
+  m_pendingReply.clear();
+  return okay;
+}
 
-    default:
-      Q_ASSERT(false);
-      break;
+void Socks5Connection::startDatagramRelay(quint16 clientPort) {
+  m_relay = DatagramRelay::create(m_socksAddress, m_clientAddress, clientPort,
+                                  m_counters, this);
+  if (m_relay == nullptr) {
+    setError(ErrorGeneral, "Failed to create datagram relay");
+    return;
   }
+
+  // Outgoing datagram sockets need the same treatment as TCP sockets.
+  connect(m_relay, &DatagramRelay::setupOutSocket, this,
+          &Socks5Connection::setupOutSocket, Qt::DirectConnection);
+
+  // An all-zero address tells the client to use the address of the proxy,
+  // which is what we bound to anyway.
+  const QHostAddress& local = m_relay->localAddress();
+  quint32 addr = 0;
+  if (local.protocol() == QAbstractSocket::IPv4Protocol) {
+    addr = local.toIPv4Address();
+  }
+  if (!writeReply(Success, m_relay->localPort(), addr)) {
+    setError(ErrorGeneral, m_inSocket->errorString());
+    return;
+  }
+
+  // The association lasts for as long as the control connection.
+  setState(Proxy);
 }
 
 void Socks5Connection::bytesWritten(qint64 bytes) {
   // Ignore this signal outside of the proxy state.
-  if (m_state != Proxy) {
+  if ((m_state != Proxy) || (m_relay != nullptr)) {
     return;
   }
 
@@ -336,31 +412,54 @@ void Socks5Connection::bytesWritten(qint64 bytes) {
   }
 
   // Drive statistics and proxy data.
-  emit dataSentReceived(0, bytes);
-  proxy(m_outSocket, m_inSocket, m_recvHighWaterMark);
+  m_counters->add(0, bytes);
+  proxy(m_outSocket, m_inSocket, m_recvFlow);
+#ifdef Q_OS_LINUX
+  maybeStartSplice();
+#endif
 }
 
 void Socks5Connection::onHostnameResolved(QHostAddress resolved) {
-  if (m_outSocket != nullptr) {
-    // We might get multiple ip results.
+  Q_ASSERT(!resolved.isNull());
+  if ((m_outSocket != nullptr) || (m_state != ClientConnectionAddress)) {
     return;
   }
-  m_destAddress = resolved;
-  Q_ASSERT(!resolved.isNull());
-  configureOutSocket(m_destPort);
+
+  // We might get multiple ip results, race connections to all of them.
+  m_candidates.append(resolved);
+  if (m_attempts.isEmpty()) {
+    m_attemptTimer->stop();
+    startAttempt();
+  } else if (!m_attemptTimer->isActive()) {
+    m_attemptTimer->start(CONNECTION_ATTEMPT_DELAY_MSEC);
+  }
 }
 
 void Socks5Connection::proxy(QIODevice* from, QIODevice* to,
                              quint64& watermark) {
+  FlowControl flow;
+  proxy(from, to, flow);
+  if (flow.watermark() > watermark) {
+    watermark = flow.watermark();
+  }
+}
+
+void Socks5Connection::proxy(QIODevice* from, QIODevice* to,
+                             FlowControl& flow) {
   Q_ASSERT(from && to);
 
+  // Resize the source buffer to follow the flow control limit.
+  if (flow.prepare(to->bytesToWrite(), from->bytesAvailable())) {
+    setReadBufferSize(from, flow.size());
+  }
+
   for (;;) {
     qint64 available = from->bytesAvailable();
     if (available <= 0) {
       break;
     }
 
-    qint64 capacity = MAX_CONNECTION_BUFFER - to->bytesToWrite();
+    qint64 capacity = flow.size() - to->bytesToWrite();
     if (capacity <= 0) {
       break;
     }
@@ -376,16 +475,42 @@ void Socks5Connection::proxy(QIODevice* from, QIODevice* to,
     }
   }
 
-  // Update buffer high watermark.
-  qint64 queued = to->bytesToWrite();
-  if (queued > watermark) {
-    watermark = queued;
-  }
+  // Update buffer high watermark and stall time.
+  flow.finish(to->bytesToWrite(), from->bytesAvailable());
 }
 
 void Socks5Connection::configureOutSocket(quint16 port) {
   Q_ASSERT(!m_destAddress.isNull());
-  m_hostLookupStack.append(m_destAddress.toString());
+  m_destPort = port;
+  m_candidates.append(m_destAddress);
+  startAttempt();
+}
+
+void Socks5Connection::startAttempt() {
+  if (m_candidates.isEmpty()) {
+    return;
+  }
+
+  // Alternate between address families, starting with IPv6. See RFC 8305
+  // section 4 for the address ordering.
+  qsizetype index = 0;
+  for (qsizetype i = 0; i < m_candidates.count(); i++) {
+    if (m_candidates[i].protocol() != m_lastAttemptProtocol) {
+      index = i;
+      break;
+    }
+  }
+  m_destAddress = m_candidates.takeAt(index);
+  m_lastAttemptProtocol = m_destAddress.protocol();
+
+  // Skip the handshake if there is a warm connection to the destination.
+  if (m_pool != nullptr) {
+    QTcpSocket* pooled = m_pool->take(m_destAddress, m_destPort, this);
+    if (pooled != nullptr) {
+      attemptConnected(pooled);
+      return;
+    }
+  }
 
   int family;
   if (m_destAddress.protocol() == QAbstractSocket::IPv6Protocol) {
@@ -401,41 +526,118 @@ void Socks5Connection::configureOutSocket(quint16 port) {
   qintptr newsock = socket(family, SOCK_STREAM, IPPROTO_TCP);
 #ifdef Q_OS_WIN
   if (newsock == INVALID_SOCKET) {
-    setError(ErrorGeneral, WinUtils::win32strerror(WSAGetLastError()));
+    attemptFailed(nullptr, ErrorGeneral,
+                  WinUtils::win32strerror(WSAGetLastError()));
     return;
   }
 #else
   if (newsock < 0) {
-    setError(ErrorGeneral, strerror(errno));
+    attemptFailed(nullptr, ErrorGeneral, strerror(errno));
     return;
   }
 #endif
   emit setupOutSocket(newsock, m_destAddress);
 
-  m_outSocket = new QTcpSocket(this);
-  m_outSocket->setSocketDescriptor(newsock, QAbstractSocket::UnconnectedState);
-  m_outSocket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
-  m_outSocket->connectToHost(m_destAddress, port);
+  QTcpSocket* attempt = new QTcpSocket(this);
+  attempt->setSocketDescriptor(newsock, QAbstractSocket::UnconnectedState);
+  attempt->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+  attempt->connectToHost(m_destAddress, m_destPort);
+  m_attempts.append(attempt);
 
-  connect(m_outSocket, &QTcpSocket::connected, this, [this]() {
-    ServerResponsePacket packet(createServerResponsePacket(0x00, m_socksPort));
-    if (m_inSocket->write((char*)&packet, sizeof(ServerResponsePacket)) !=
-        sizeof(ServerResponsePacket)) {
-      setError(ErrorGeneral, m_inSocket->errorString());
-      return;
+  connect(attempt, &QTcpSocket::connected, this,
+          [this, attempt]() { attemptConnected(attempt); });
+
+  connect(attempt, &QTcpSocket::errorOccurred, this,
+          [this, attempt](QAbstractSocket::SocketError error) {
+            attemptFailed(attempt, socketErrorToSocks5Rep(error),
+                          attempt->errorString());
+          });
+
+  // Give this attempt a head start before racing the next address.
+  if (!m_candidates.isEmpty()) {
+    m_attemptTimer->start(CONNECTION_ATTEMPT_DELAY_MSEC);
+  }
+}
+
+void Socks5Connection::nextAttempt() {
+  if (!m_candidates.isEmpty()) {
+    startAttempt();
+    return;
+  }
+
+  // Every address has been tried, and no more of them turned up.
+  if (m_attempts.isEmpty() && (m_state == ClientConnectionAddress)) {
+    m_hostLookupStack.append(m_destAddress.toString());
+    setError(m_attemptReply, m_attemptError);
+  }
+}
+
+void Socks5Connection::attemptFailed(QTcpSocket* attempt, Socks5Replies reply,
+                                     const QString& errorString) {
+  if (attempt != nullptr) {
+    m_attempts.removeOne(attempt);
+    attempt->disconnect(this);
+    attempt->deleteLater();
+  }
+  if (m_state != ClientConnectionAddress) {
+    return;
+  }
+
+  // Move straight on to the next address, if there is one.
+  if (!m_candidates.isEmpty()) {
+    m_attemptTimer->stop();
+    startAttempt();
+    return;
+  }
+
+  // Otherwise, fail once the last attempt in flight is gone, and the hostname
+  // has had a chance to deliver the rest of its addresses.
+  if (m_attempts.isEmpty()) {
+    m_attemptReply = reply;
+    m_attemptError = errorString;
+    if (m_addressType == 0x03 /* Domain name */) {
+      m_attemptTimer->start(RESOLUTION_DELAY_MSEC);
+    } else {
+      nextAttempt();
     }
+  }
+}
 
-    setState(Proxy);
-    readyRead();
-  });
+void Socks5Connection::attemptConnected(QTcpSocket* attempt) {
+  if (m_state != ClientConnectionAddress) {
+    return;
+  }
+
+  // We have a winner, cancel everything else.
+  m_attemptTimer->stop();
+  m_candidates.clear();
+  m_attempts.removeOne(attempt);
+  for (QTcpSocket* loser : m_attempts) {
+    loser->disconnect(this);
+    loser->abort();
+    loser->deleteLater();
+  }
+  m_attempts.clear();
+  attempt->disconnect(this);
+
+  m_outSocket = attempt;
+  m_destAddress = m_outSocket->peerAddress();
+  m_hostLookupStack.append(m_destAddress.toString());
 
   connect(m_outSocket, &QIODevice::bytesWritten, this, [this](qint64 bytes) {
-    emit dataSentReceived(bytes, 0);
-    proxy(m_inSocket, m_outSocket, m_sendHighWaterMark);
+    m_counters->add(bytes, 0);
+    proxy(m_inSocket, m_outSocket, m_sendFlow);
+#ifdef Q_OS_LINUX
+    maybeStartSplice();
+#endif
   });
 
-  connect(m_outSocket, &QTcpSocket::readyRead, this,
-          [this]() { proxy(m_outSocket, m_inSocket, m_recvHighWaterMark); });
+  connect(m_outSocket, &QTcpSocket::readyRead, this, [this]() {
+    proxy(m_outSocket, m_inSocket, m_recvFlow);
+#ifdef Q_OS_LINUX
+    maybeStartSplice();
+#endif
+  });
 
   connect(m_outSocket, &QTcpSocket::disconnected, this,
           [this]() { setState(Closed); });
@@ -448,7 +650,69 @@ void Socks5Connection::configureOutSocket(quint16 port) {
               setError(ErrorGeneral, m_outSocket->errorString());
             }
           });
+
+  if (!writeReply(Success, m_socksPort)) {
+    setError(ErrorGeneral, m_inSocket->errorString());
+    return;
+  }
+
+  setState(Proxy);
+  readyRead();
+
+  // A pooled connection may have received data before it was claimed.
+  if (m_outSocket->bytesAvailable() > 0) {
+    proxy(m_outSocket, m_inSocket, m_recvFlow);
+  }
+}
+
+#ifdef Q_OS_LINUX
+void Socks5Connection::maybeStartSplice() {
+  if ((m_splice != nullptr) || (m_state != Proxy)) {
+    return;
+  }
+
+  // We can only hand the sockets over to the kernel once the negotiation has
+  // completed and Qt has nothing left buffered in either direction.
+  if ((m_recvIgnoreBytes > 0) || (m_inSocket->bytesAvailable() > 0) ||
+      (m_inSocket->bytesToWrite() > 0) || (m_outSocket->bytesAvailable() > 0) ||
+      (m_outSocket->bytesToWrite() > 0)) {
+    return;
+  }
+
+  qintptr insd = -1;
+  if (auto* s = qobject_cast<QAbstractSocket*>(m_inSocket)) {
+    insd = s->socketDescriptor();
+  } else if (auto* s = qobject_cast<QLocalSocket*>(m_inSocket)) {
+    insd = s->socketDescriptor();
+  }
+  qintptr outsd = m_outSocket->socketDescriptor();
+  if ((insd < 0) || (outsd < 0)) {
+    return;
+  }
+
+  m_splice = SpliceRelay::create(insd, outsd, m_sendFlow, m_recvFlow,
+                                 m_counters, this);
+  if (m_splice == nullptr) {
+    return;
+  }
+
+  // The relay now owns the connections. Detach the Qt sockets so that they
+  // stop reading from the descriptors and release their copies.
+  m_inSocket->disconnect(this);
+  m_outSocket->disconnect(this);
+  if (auto* s = qobject_cast<QAbstractSocket*>(m_inSocket)) {
+    s->abort();
+  } else if (auto* s = qobject_cast<QLocalSocket*>(m_inSocket)) {
+    s->abort();
+  }
+  m_outSocket->abort();
+
+  connect(m_splice, &SpliceRelay::closed, this,
+          [this]() { setState(Closed); });
+  connect(m_splice, &SpliceRelay::errorOccurred, this,
+          [this](const QString& error) { setError(ErrorGeneral, error); });
 }
+#endif
 
 void Socks5Connection::onHostnameNotFound() {
   setError(ErrorHostUnreachable, "Failed to Resolve DNS Query");
@@ -469,22 +733,3 @@ Socks5Connection::Socks5Replies Socks5Connection::socketErrorToSocks5Rep(
       return ErrorGeneral;
   }
 }
-
-template <typename T>
-std::optional<T> Socks5Connection::readPacket(QIODevice* connection) {
-  // There are not enough bytes to read don't touch the connection.
-  if (connection->bytesAvailable() < (qint64)sizeof(T)) {
-    return {};
-  }
-  connection->startTransaction();
-  T packet;
-  if (connection->read((char*)&packet, sizeof(T)) != sizeof(T)) {
-    // If we did not read the correct amount of data
-    // Abort the transaction and reset the buffer, so the
-    // caller can try to read again.
-    connection->rollbackTransaction();
-    return {};
-  }
-  connection->commitTransaction();
-  return packet;
-}
@@ -10,6 +10,15 @@
 #include <QLocalSocket>
 #include <QObject>
 #include <QTcpSocket>
+#include <memory>
+
+#include "flowcontrol.h"
+#include "trafficcounters.h"
+
+class ConnectionPool;
+class DatagramRelay;
+class QTimer;
+class SpliceRelay;
 
 class Socks5Connection final : public QObject {
   Q_OBJECT
@@ -27,6 +36,16 @@ class Socks5Connection final : public QObject {
    *
    * @param from- the source device
    * @param to- the output device
+   * @param flow- the flow control state for this direction
+   */
+  static void proxy(QIODevice* rx, QIODevice* tx, FlowControl& flow);
+
+  /**
+   * @brief Copies incoming bytes to another QIODevice, using a fixed buffer
+   * limit of FlowControl::minimumSize().
+   *
+   * @param from- the source device
+   * @param to- the output device
    * @param watermark- reference to the buffer high watermark
    */
   static void proxy(QIODevice* rx, QIODevice* tx, quint64& watermark);
@@ -55,23 +74,10 @@ class Socks5Connection final : public QObject {
   static Socks5Replies socketErrorToSocks5Rep(
       QAbstractSocket::SocketError error);
 
-  /**
-   * @brief Reads <T> from a QIODevice
-   * Returns T if enough data
-   * was read, std::nothing if nothing was found
-   *
-   * This function has no side effects on the connection
-   * if nothing was returned.
-   *
-   * There is no formal typecheck that the underlying
-   * data of <T> is correct.
-   *
-   * @tparam T - Type to read
-   * @param connection - A QIODevice to read from
-   * @return std::optional<T> - The read T if enough bytes were written.
-   */
-  template <typename T>
-  static std::optional<T> readPacket(QIODevice* connection);
+  // Set the pool to take upstream connections from. The pool must live on
+  // the same thread as the connection, and be set before control returns to
+  // the event loop.
+  void setConnectionPool(ConnectionPool* pool) { m_pool = pool; }
 
   const QString& clientName() const { return m_clientName; }
 
@@ -81,13 +87,24 @@ class Socks5Connection final : public QObject {
 
   const Socks5State& state() const { return m_state; }
 
-  quint64 sendHighWaterMark() const { return m_sendHighWaterMark; }
-  quint64 recvHighWaterMark() const { return m_recvHighWaterMark; }
+  bool isDatagramRelay() const { return m_relay != nullptr; }
+
+  quint64 sendHighWaterMark() const { return m_sendFlow.watermark(); }
+  quint64 recvHighWaterMark() const { return m_recvFlow.watermark(); }
+  qint64 sendStallTime() const { return m_sendFlow.stallTime(); }
+  qint64 recvStallTime() const { return m_recvFlow.stallTime(); }
+  qint64 sendBufferSize() const { return m_sendFlow.size(); }
+  qint64 recvBufferSize() const { return m_recvFlow.size(); }
   const QString& errorString() const { return m_errorString; }
 
+  // Bytes relayed over the lifetime of the connection, which may be read
+  // from any thread.
+  std::shared_ptr<const TrafficCounters> counters() const {
+    return m_counters;
+  }
+
  signals:
   void setupOutSocket(qintptr sd, const QHostAddress& dest);
-  void dataSentReceived(qint64 sent, qint64 received);
   void stateChanged();
 
  private slots:
@@ -98,20 +115,36 @@ class Socks5Connection final : public QObject {
   void setState(Socks5State state);
   void setError(Socks5Replies reply, const QString& errorString);
   void configureOutSocket(quint16 port);
+  void startAttempt();
+  void nextAttempt();
+  void attemptFailed(QTcpSocket* attempt, Socks5Replies reply,
+                     const QString& errorString);
+  void attemptConnected(QTcpSocket* attempt);
   void readyRead();
+  void parseNegotiation();
+  bool writeReply(Socks5Replies reply, quint16 port = 0, quint32 addr = 0);
+  void startDatagramRelay(quint16 clientPort);
   void bytesWritten(qint64 bytes);
+#ifdef Q_OS_LINUX
+  void maybeStartSplice();
+#endif
 
   // Implemented by platform-specific code in socks5local_<platform>.cpp
   static QString localClientName(QLocalSocket* s);
 
+  friend class TestSocks5Connection;
+
   Socks5State m_state = ClientGreeting;
   QString m_errorString;
 
   uint8_t m_authNumber = 0;
+  QByteArray m_pendingReply;
   QIODevice* m_inSocket = nullptr;
   QTcpSocket* m_outSocket = nullptr;
 
   QString m_clientName;
+  QHostAddress m_clientAddress;
+  QHostAddress m_socksAddress;
   uint16_t m_socksPort = 0;
   uint16_t m_destPort = 0;
 
@@ -119,9 +152,28 @@ class Socks5Connection final : public QObject {
   QHostAddress m_destAddress;
   QStringList m_hostLookupStack;
 
-  quint64 m_sendHighWaterMark = 0;
-  quint64 m_recvHighWaterMark = 0;
+  // Happy Eyeballs state: addresses yet to be tried, connection attempts that
+  // are still in flight, and the error to report if they all fail.
+  QList<QHostAddress> m_candidates;
+  QList<QTcpSocket*> m_attempts;
+  QTimer* m_attemptTimer = nullptr;
+  Socks5Replies m_attemptReply = ErrorGeneral;
+  QString m_attemptError;
+  ConnectionPool* m_pool = nullptr;
+  QAbstractSocket::NetworkLayerProtocol m_lastAttemptProtocol =
+      QAbstractSocket::IPv4Protocol;
+
+  FlowControl m_sendFlow;
+  FlowControl m_recvFlow;
   quint64 m_recvIgnoreBytes = 0;
+  std::shared_ptr<TrafficCounters> m_counters =
+      std::make_shared<TrafficCounters>();
+
+  DatagramRelay* m_relay = nullptr;
+
+#ifdef Q_OS_LINUX
+  SpliceRelay* m_splice = nullptr;
+#endif
 };
 
 #endif  // Socks5Connection_H
@@ -0,0 +1,214 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "splicerelay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QFile>
+#include <QSocketNotifier>
+
+namespace {
+
+// The largest pipe an unprivileged process may ask for.
+int pipeMaxSize() {
+  static const int size = []() {
+    QFile file("/proc/sys/fs/pipe-max-size");
+    bool ok = false;
+    int value = 0;
+    if (file.open(QIODevice::ReadOnly)) {
+      value = file.readAll().trimmed().toInt(&ok);
+    }
+    return ok ? value : 0;
+  }();
+  return size;
+}
+
+}  // namespace
+
+SpliceRelay::SpliceRelay(QObject* parent) : QObject(parent) {}
+
+SpliceRelay::~SpliceRelay() {
+  closeChannel(m_upstream);
+  closeChannel(m_downstream);
+  if (m_clientSocket >= 0) {
+    close(m_clientSocket);
+  }
+  if (m_remoteSocket >= 0) {
+    close(m_remoteSocket);
+  }
+}
+
+// static
+SpliceRelay* SpliceRelay::create(qintptr client, qintptr remote,
+                                 const FlowControl& sendFlow,
+                                 const FlowControl& recvFlow,
+                                 std::shared_ptr<TrafficCounters> counters,
+                                 QObject* parent) {
+  SpliceRelay* relay = new SpliceRelay(parent);
+  relay->m_counters = std::move(counters);
+
+  // Take our own references to the sockets, so that the Qt socket objects can
+  // be closed without tearing down the connections.
+  relay->m_clientSocket = fcntl(client, F_DUPFD_CLOEXEC, 0);
+  relay->m_remoteSocket = fcntl(remote, F_DUPFD_CLOEXEC, 0);
+  if ((relay->m_clientSocket < 0) || (relay->m_remoteSocket < 0)) {
+    qDebug() << "Failed to duplicate sockets:" << strerror(errno);
+    delete relay;
+    return nullptr;
+  }
+
+  const int flags = O_NONBLOCK | O_CLOEXEC;
+  if ((pipe2(relay->m_upstream.pipe, flags) != 0) ||
+      (pipe2(relay->m_downstream.pipe, flags) != 0)) {
+    qDebug() << "Failed to create splice pipes:" << strerror(errno);
+    delete relay;
+    return nullptr;
+  }
+
+  // Make room in the pipes for the largest buffer we might grow to, within
+  // the limits of the system. If the kernel still says no, such as when the
+  // user is out of pipe buffers, we carry on with the default size.
+  int pipeSize = static_cast<int>(FlowControl::maximumSize());
+  if (pipeMaxSize() > 0) {
+    pipeSize = qMin(pipeSize, pipeMaxSize());
+  }
+  for (Channel* channel : {&relay->m_upstream, &relay->m_downstream}) {
+    if ((fcntl(channel->pipe[1], F_SETPIPE_SZ, pipeSize) < 0) &&
+        (errno != EPERM) && (errno != EBUSY)) {
+      qDebug() << "Failed to resize splice pipe:" << strerror(errno);
+    }
+  }
+
+  relay->m_upstream.flow = sendFlow;
+  relay->m_downstream.flow = recvFlow;
+  relay->m_upstream.src = relay->m_clientSocket;
+  relay->m_upstream.dst = relay->m_remoteSocket;
+  relay->m_downstream.src = relay->m_remoteSocket;
+  relay->m_downstream.dst = relay->m_clientSocket;
+  relay->setupChannel(relay->m_upstream);
+  relay->setupChannel(relay->m_downstream);
+  return relay;
+}
+
+void SpliceRelay::setupChannel(Channel& channel) {
+  channel.readNotifier =
+      new QSocketNotifier(channel.src, QSocketNotifier::Read, this);
+  connect(channel.readNotifier, &QSocketNotifier::activated, this,
+          [this, &channel]() { pump(channel); });
+
+  channel.writeNotifier =
+      new QSocketNotifier(channel.dst, QSocketNotifier::Write, this);
+  channel.writeNotifier->setEnabled(false);
+  connect(channel.writeNotifier, &QSocketNotifier::activated, this,
+          [this, &channel]() { pump(channel); });
+}
+
+void SpliceRelay::closeChannel(Channel& channel) {
+  // Notifiers must go away before their descriptors are closed.
+  delete channel.readNotifier;
+  channel.readNotifier = nullptr;
+  delete channel.writeNotifier;
+  channel.writeNotifier = nullptr;
+
+  for (int& fd : channel.pipe) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+}
+
+void SpliceRelay::pump(Channel& channel) {
+  if (m_finished || channel.finished) {
+    return;
+  }
+
+  // We can't tell how much data is waiting in the source socket, so assume
+  // there is more for as long as it keeps filling the pipe.
+  channel.flow.prepare(channel.queued, channel.eof ? 0 : 1);
+
+  constexpr const unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+  bool progress = true;
+  bool filled = false;
+  while (progress) {
+    progress = false;
+
+    // Fill the pipe from the source socket.
+    const qint64 capacity = channel.flow.size() - channel.queued;
+    if (!channel.eof && (capacity > 0)) {
+      ssize_t len = splice(channel.src, nullptr, channel.pipe[1], nullptr,
+                           capacity, flags);
+      if (len > 0) {
+        channel.queued += len;
+        filled = (len == capacity);
+        progress = true;
+      } else if (len == 0) {
+        channel.eof = true;
+      } else if ((errno != EAGAIN) && (errno != EINTR)) {
+        fail(errno);
+        return;
+      }
+    }
+
+    // Drain the pipe into the destination socket.
+    if (channel.queued > 0) {
+      ssize_t len = splice(channel.pipe[0], nullptr, channel.dst, nullptr,
+                           channel.queued, flags);
+      if (len > 0) {
+        channel.queued -= len;
+        progress = true;
+        if (&channel == &m_upstream) {
+          m_counters->add(len, 0);
+        } else {
+          m_counters->add(0, len);
+        }
+      } else if ((len < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+        fail(errno);
+        return;
+      }
+    }
+  }
+
+  // If data remains in the pipe then the destination is blocked. Stop reading
+  // from the source until it becomes writable again.
+  const bool blocked = channel.queued > 0;
+  channel.flow.finish(channel.queued, filled ? 1 : 0);
+  channel.readNotifier->setEnabled(!channel.eof && !blocked);
+  channel.writeNotifier->setEnabled(blocked);
+  if (!channel.eof || blocked) {
+    return;
+  }
+
+  // Pass the end of the stream on. The destination may still have more to
+  // say, so the connection is only done once both directions have finished.
+  channel.finished = true;
+  if ((shutdown(channel.dst, SHUT_WR) != 0) && (errno != ENOTCONN)) {
+    fail(errno);
+    return;
+  }
+  if (m_upstream.finished && m_downstream.finished) {
+    m_finished = true;
+    emit closed();
+  }
+}
+
+void SpliceRelay::fail(int error) {
+  m_finished = true;
+  for (Channel* channel : {&m_upstream, &m_downstream}) {
+    channel->readNotifier->setEnabled(false);
+    channel->writeNotifier->setEnabled(false);
+  }
+
+  if ((error == ECONNRESET) || (error == EPIPE)) {
+    emit closed();
+  } else {
+    emit errorOccurred(strerror(error));
+  }
+}
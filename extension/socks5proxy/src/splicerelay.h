@@ -0,0 +1,87 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef SPLICERELAY_H
+#define SPLICERELAY_H
+
+#include <QObject>
+#include <memory>
+
+#include "flowcontrol.h"
+#include "trafficcounters.h"
+
+class QSocketNotifier;
+
+// Relays data between two connected stream sockets using splice(2) through a
+// pair of pipes, so that proxied payload never has to be copied into userspace.
+// Each direction keeps at most FlowControl::size() bytes in flight, which
+// provides the same flow control as Socks5Connection::proxy(). When one side
+// stops sending, its peer is shut down for writing, and the other direction
+// carries on until it reaches the end of its stream too.
+class SpliceRelay final : public QObject {
+  Q_OBJECT
+
+ public:
+  /**
+   * @brief Create a relay between two socket descriptors.
+   *
+   * The descriptors are duplicated, the caller retains ownership of the ones
+   * passed in and is free to close them once the relay has been created.
+   *
+   * @param client - the socket connected to the SOCKS client
+   * @param remote - the socket connected to the destination
+   * @param sendFlow - flow control state from the client to the remote
+   * @param recvFlow - flow control state from the remote to the client
+   * @param counters - the traffic counters to add the relayed bytes to
+   * @param parent - the QObject parent of the relay
+   * @return SpliceRelay* - the new relay, or nullptr on failure.
+   */
+  static SpliceRelay* create(qintptr client, qintptr remote,
+                             const FlowControl& sendFlow,
+                             const FlowControl& recvFlow,
+                             std::shared_ptr<TrafficCounters> counters,
+                             QObject* parent);
+  ~SpliceRelay();
+
+  const FlowControl& sendFlow() const { return m_upstream.flow; }
+  const FlowControl& recvFlow() const { return m_downstream.flow; }
+
+ signals:
+  void closed();
+  void errorOccurred(const QString& errorString);
+
+ private:
+  struct Channel {
+    int src = -1;
+    int dst = -1;
+    int pipe[2] = {-1, -1};
+    qint64 queued = 0;
+    FlowControl flow;
+    bool eof = false;
+    // The end of the stream has been passed on to the destination.
+    bool finished = false;
+    QSocketNotifier* readNotifier = nullptr;
+    QSocketNotifier* writeNotifier = nullptr;
+  };
+
+  explicit SpliceRelay(QObject* parent);
+  void setupChannel(Channel& channel);
+  void pump(Channel& channel);
+  void closeChannel(Channel& channel);
+  void fail(int error);
+
+  bool m_finished = false;
+
+  int m_clientSocket = -1;
+  int m_remoteSocket = -1;
+
+  std::shared_ptr<TrafficCounters> m_counters;
+
+  // Client to remote.
+  Channel m_upstream;
+  // Remote to client.
+  Channel m_downstream;
+};
+
+#endif  // SPLICERELAY_H
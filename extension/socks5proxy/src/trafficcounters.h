@@ -0,0 +1,24 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef TRAFFICCOUNTERS_H
+#define TRAFFICCOUNTERS_H
+
+#include <QtGlobal>
+#include <atomic>
+
+// Bytes relayed over the lifetime of a connection. The relays add to them as
+// data goes through, and the logger samples them on its own thread at every
+// tick, so no signal is needed per write.
+struct TrafficCounters {
+  std::atomic<quint64> sent = 0;
+  std::atomic<quint64> received = 0;
+
+  void add(qint64 sentBytes, qint64 receivedBytes) {
+    sent.fetch_add(sentBytes, std::memory_order_relaxed);
+    received.fetch_add(receivedBytes, std::memory_order_relaxed);
+  }
+};
+
+#endif  // TRAFFICCOUNTERS_H
@@ -0,0 +1,565 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// A load generator for measuring the performance of the SOCKS5 proxy.
+//
+// The proxy runs in its own thread, and forwards connections to loopback
+// target servers running in another thread. The clients run on the main
+// thread, and speak SOCKS5 directly so that both the TCP and the local socket
+// front-ends can be exercised. Results are printed and can be saved as JSON to
+// be compared across releases.
+
+#include <time.h>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSysInfo>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+#include <QtEndian>
+#include <algorithm>
+#include <ctime>
+#include <functional>
+#include <memory>
+
+#ifdef Q_OS_WIN
+#  include <windows.h>
+#endif
+
+#include "socks5.h"
+
+namespace {
+
+constexpr const qint64 CHUNK_SIZE = 64 * 1024;
+
+struct BenchOptions {
+  int clients = 16;
+  int connections = 2000;
+  qint64 bulkBytes = 64 * 1024 * 1024;
+  int threads = 0;
+  bool local = false;
+  QStringList scenarios = {"connect", "upload", "download"};
+  QString output;
+};
+
+// CPU time consumed by the calling thread, in microseconds.
+qint64 threadCpuTime() {
+#ifdef Q_OS_WIN
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return 0;
+  }
+  quint64 k = (quint64(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+  quint64 u = (quint64(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+  return (k + u) / 10;
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+// CPU time consumed by the whole process, in microseconds.
+qint64 processCpuTime() {
+  return qint64(std::clock()) * 1000000 / CLOCKS_PER_SEC;
+}
+
+// Runs a functor in the thread of the context object, and waits for it.
+template <typename F>
+void runIn(QObject* context, F&& func) {
+  QMetaObject::invokeMethod(context, std::forward<F>(func),
+                            Qt::BlockingQueuedConnection);
+}
+
+// A thread hosting some objects, which are destroyed along with it.
+class BenchThread final {
+ public:
+  explicit BenchThread(const QString& name) {
+    m_thread.setObjectName(name);
+    m_context = new QObject();
+    m_context->moveToThread(&m_thread);
+    m_thread.start();
+  }
+  ~BenchThread() {
+    // Deferred deletions are still processed as the thread finishes.
+    m_context->deleteLater();
+    m_thread.quit();
+    m_thread.wait();
+  }
+
+  QObject* context() const { return m_context; }
+
+  qint64 cpuTime() {
+    qint64 result = 0;
+    runIn(m_context, [&result]() { result = threadCpuTime(); });
+    return result;
+  }
+
+ private:
+  QThread m_thread;
+  QObject* m_context = nullptr;
+};
+
+// Loopback servers for the proxy to connect to.
+class TargetServers final {
+ public:
+  explicit TargetServers(QObject* context, qint64 sourceBytes) {
+    runIn(context, [&]() {
+      // Echo everything back to the client.
+      m_echoPort = listen(context, [](QTcpSocket* s) {
+        QObject::connect(s, &QTcpSocket::readyRead, s,
+                         [s]() { s->write(s->readAll()); });
+      });
+
+      // Discard everything sent by the client.
+      m_sinkPort = listen(context, [](QTcpSocket* s) {
+        QObject::connect(s, &QTcpSocket::readyRead, s,
+                         [s]() { s->skip(s->bytesAvailable()); });
+      });
+
+      // Send sourceBytes to the client, then close.
+      m_sourcePort = listen(context, [sourceBytes](QTcpSocket* s) {
+        auto remaining = std::make_shared<qint64>(sourceBytes);
+        auto fill = [s, remaining]() {
+          static const QByteArray chunk(CHUNK_SIZE, 'S');
+          while ((*remaining > 0) && (s->bytesToWrite() < CHUNK_SIZE)) {
+            qint64 len = qMin(*remaining, CHUNK_SIZE);
+            s->write(chunk.constData(), len);
+            *remaining -= len;
+          }
+          if ((*remaining == 0) && (s->bytesToWrite() == 0)) {
+            s->disconnectFromHost();
+          }
+        };
+        QObject::connect(s, &QTcpSocket::bytesWritten, s, fill);
+        fill();
+      });
+    });
+  }
+
+  quint16 echoPort() const { return m_echoPort; }
+  quint16 sinkPort() const { return m_sinkPort; }
+  quint16 sourcePort() const { return m_sourcePort; }
+
+ private:
+  static quint16 listen(QObject* parent,
+                        std::function<void(QTcpSocket*)> handler) {
+    QTcpServer* server = new QTcpServer(parent);
+    server->listen(QHostAddress::LocalHost);
+    QObject::connect(server, &QTcpServer::newConnection, server,
+                     [server, handler]() {
+                       while (server->hasPendingConnections()) {
+                         QTcpSocket* s = server->nextPendingConnection();
+                         QObject::connect(s, &QTcpSocket::disconnected, s,
+                                          &QObject::deleteLater);
+                         handler(s);
+                       }
+                     });
+    return server->serverPort();
+  }
+
+  quint16 m_echoPort = 0;
+  quint16 m_sinkPort = 0;
+  quint16 m_sourcePort = 0;
+};
+
+// The proxy under test.
+class ProxyServer final {
+ public:
+  ProxyServer(QObject* context, const BenchOptions& options) {
+    runIn(context, [&]() {
+      Socks5* socks5;
+      if (options.local) {
+        QLocalServer* server = new QLocalServer(context);
+        m_localName =
+            QString("socksbench-%1").arg(QCoreApplication::applicationPid());
+        QLocalServer::removeServer(m_localName);
+        socks5 = new Socks5(server);
+        if (!server->listen(m_localName)) {
+          qFatal("Unable to listen on the local socket");
+        }
+      } else {
+        QTcpServer* server = new QTcpServer(context);
+        socks5 = new Socks5(server);
+        if (!server->listen(QHostAddress::LocalHost)) {
+          qFatal("Unable to listen on the proxy port");
+        }
+        m_port = server->serverPort();
+      }
+      socks5->setWorkerThreads(options.threads);
+    });
+  }
+
+  quint16 port() const { return m_port; }
+  const QString& localName() const { return m_localName; }
+
+ private:
+  quint16 m_port = 0;
+  QString m_localName;
+};
+
+// A single SOCKS5 client connection.
+class BenchClient final : public QObject {
+ public:
+  enum Mode { Connect, Upload, Download };
+
+  struct Result {
+    bool ok;
+    qint64 handshakeUsec;
+    qint64 bytes;
+  };
+  using Callback = std::function<void(const Result&)>;
+
+  static void start(const ProxyServer& proxy, Mode mode, quint16 target,
+                    qint64 bytes, Callback done) {
+    if (!proxy.localName().isEmpty()) {
+      QLocalSocket* s = new QLocalSocket();
+      BenchClient* client = new BenchClient(s, mode, target, bytes, done);
+      connect(s, &QLocalSocket::connected, client, &BenchClient::connected);
+      connect(s, &QLocalSocket::errorOccurred, client,
+              [client](QLocalSocket::LocalSocketError error) {
+                // The source closes the connection once it's done.
+                bool done = client->m_transferred >= client->m_bytes;
+                client->finish(done && error == QLocalSocket::PeerClosedError);
+              });
+      s->connectToServer(proxy.localName());
+    } else {
+      QTcpSocket* s = new QTcpSocket();
+      BenchClient* client = new BenchClient(s, mode, target, bytes, done);
+      connect(s, &QTcpSocket::connected, client, &BenchClient::connected);
+      connect(s, &QTcpSocket::errorOccurred, client,
+              [client](QAbstractSocket::SocketError error) {
+                // The source closes the connection once it's done.
+                bool done = client->m_transferred >= client->m_bytes;
+                client->finish(done &&
+                               error == QAbstractSocket::RemoteHostClosedError);
+              });
+      s->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+      s->connectToHost(QHostAddress::LocalHost, proxy.port());
+    }
+  }
+
+ private:
+  BenchClient(QIODevice* socket, Mode mode, quint16 target, qint64 bytes,
+              Callback done)
+      : QObject(socket),
+        m_socket(socket),
+        m_mode(mode),
+        m_target(target),
+        m_bytes(bytes),
+        m_done(done) {
+    m_timer.start();
+    connect(m_socket, &QIODevice::readyRead, this, &BenchClient::readyRead);
+    connect(m_socket, &QIODevice::bytesWritten, this,
+            &BenchClient::bytesWritten);
+  }
+
+  void connected() {
+    // Pipeline the greeting and the connection request.
+    QByteArray request;
+    request.append("\x05\x01\x00", 3);
+    request.append("\x05\x01\x00\x01\x7f\x00\x00\x01", 8);
+    quint16 port = qToBigEndian<quint16>(m_target);
+    request.append(reinterpret_cast<const char*>(&port), sizeof(port));
+    m_socket->write(request);
+  }
+
+  void readyRead() {
+    if (m_handshakeUsec < 0) {
+      // Wait for the method selection and the connection reply.
+      constexpr const qint64 replyLength = 2 + 10;
+      if (m_socket->bytesAvailable() < replyLength) {
+        return;
+      }
+      QByteArray reply = m_socket->read(replyLength);
+      if (reply.at(1) != 0x00 || reply.at(3) != 0x00) {
+        finish(false);
+        return;
+      }
+      m_handshakeUsec = m_timer.nsecsElapsed() / 1000;
+
+      if (m_mode == Connect) {
+        m_socket->write("x", 1);
+      } else if (m_mode == Upload) {
+        bytesWritten(0);
+      }
+    }
+
+    if (m_mode == Connect) {
+      if (m_socket->bytesAvailable() > 0) {
+        m_transferred = m_socket->skip(m_socket->bytesAvailable());
+        finish(true);
+      }
+    } else if (m_mode == Download) {
+      m_transferred += m_socket->skip(m_socket->bytesAvailable());
+      if (m_transferred >= m_bytes) {
+        finish(true);
+      }
+    }
+  }
+
+  void bytesWritten(qint64 bytes) {
+    if ((m_mode != Upload) || (m_handshakeUsec < 0)) {
+      return;
+    }
+    static const QByteArray chunk(CHUNK_SIZE, 'U');
+    while ((m_transferred < m_bytes) &&
+           (m_socket->bytesToWrite() < CHUNK_SIZE)) {
+      qint64 len = qMin(m_bytes - m_transferred, CHUNK_SIZE);
+      m_socket->write(chunk.constData(), len);
+      m_transferred += len;
+    }
+    if ((m_transferred >= m_bytes) && (m_socket->bytesToWrite() == 0)) {
+      finish(true);
+    }
+  }
+
+  void finish(bool ok) {
+    if (m_finished) {
+      return;
+    }
+    m_finished = true;
+    m_socket->disconnect(this);
+    m_socket->close();
+    m_socket->deleteLater();
+    m_done(Result{ok, m_handshakeUsec, m_transferred});
+  }
+
+  QIODevice* m_socket;
+  const Mode m_mode;
+  const quint16 m_target;
+  const qint64 m_bytes;
+  const Callback m_done;
+
+  QElapsedTimer m_timer;
+  qint64 m_handshakeUsec = -1;
+  qint64 m_transferred = 0;
+  bool m_finished = false;
+};
+
+qint64 percentile(const QList<qint64>& sorted, int pct) {
+  if (sorted.isEmpty()) {
+    return 0;
+  }
+  qsizetype index = (sorted.count() - 1) * pct / 100;
+  return sorted.at(index);
+}
+
+QJsonObject runScenario(const BenchOptions& options, const ProxyServer& proxy,
+                        BenchThread& proxyThread, BenchClient::Mode mode,
+                        quint16 target) {
+  const int total =
+      (mode == BenchClient::Connect) ? options.connections : options.clients;
+  const qint64 bytes = (mode == BenchClient::Connect) ? 0 : options.bulkBytes;
+
+  QList<qint64> latencies;
+  latencies.reserve(total);
+  qint64 transferred = 0;
+  int started = 0;
+  int finished = 0;
+  int failures = 0;
+  QEventLoop loop;
+
+  std::function<void()> launch = [&]() {
+    if (started >= total) {
+      return;
+    }
+    started++;
+    BenchClient::start(proxy, mode, target, bytes,
+                       [&](const BenchClient::Result& result) {
+                         finished++;
+                         if (result.ok) {
+                           latencies.append(result.handshakeUsec);
+                           transferred += result.bytes;
+                         } else {
+                           failures++;
+                         }
+                         if (finished >= total) {
+                           loop.quit();
+                         } else {
+                           launch();
+                         }
+                       });
+  };
+
+  const qint64 proxyCpuStart = proxyThread.cpuTime();
+  const qint64 processCpuStart = processCpuTime();
+  QElapsedTimer wallclock;
+  wallclock.start();
+
+  for (int i = 0; i < qMin(options.clients, total); i++) {
+    launch();
+  }
+  if (total > 0) {
+    loop.exec();
+  }
+
+  const double seconds = wallclock.nsecsElapsed() / 1e9;
+  const qint64 proxyCpu = proxyThread.cpuTime() - proxyCpuStart;
+  const qint64 processCpu = processCpuTime() - processCpuStart;
+  std::sort(latencies.begin(), latencies.end());
+
+  QJsonObject handshake;
+  handshake["p50"] = percentile(latencies, 50);
+  handshake["p90"] = percentile(latencies, 90);
+  handshake["p99"] = percentile(latencies, 99);
+  handshake["max"] = latencies.isEmpty() ? 0 : latencies.last();
+
+  QJsonObject result;
+  result["connections"] = total;
+  result["failures"] = failures;
+  result["duration_sec"] = seconds;
+  result["connections_per_sec"] = total / seconds;
+  result["handshake_usec"] = handshake;
+  result["bytes"] = transferred;
+  result["mbytes_per_sec"] = transferred / seconds / (1024 * 1024);
+  result["process_cpu_usec"] = processCpu;
+  // With worker threads, the connections are not handled on the proxy thread.
+  if (options.threads == 0) {
+    result["proxy_cpu_usec"] = proxyCpu;
+    result["proxy_cpu_usec_per_connection"] = double(proxyCpu) / total;
+  }
+  result["process_cpu_usec_per_connection"] = double(processCpu) / total;
+  return result;
+}
+
+BenchOptions parseArgs(const QCoreApplication& app) {
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmark the SOCKS5 proxy");
+  parser.addHelpOption();
+
+  QCommandLineOption clientsOption({"c", "clients"},
+                                   "Number of concurrent clients", "count");
+  parser.addOption(clientsOption);
+
+  QCommandLineOption connectionsOption(
+      {"n", "connections"}, "Number of connections to make in the connect test",
+      "count");
+  parser.addOption(connectionsOption);
+
+  QCommandLineOption bytesOption(
+      {"b", "bytes"}, "Megabytes transferred per client in bulk tests", "MiB");
+  parser.addOption(bytesOption);
+
+  QCommandLineOption threadsOption({"t", "threads"},
+                                   "Number of proxy worker threads", "count");
+  parser.addOption(threadsOption);
+
+  QCommandLineOption localOption({"l", "local"},
+                                 "Use the local socket front-end");
+  parser.addOption(localOption);
+
+  QCommandLineOption scenarioOption(
+      {"s", "scenario"},
+      "Scenario to run: connect, upload or download (default: all)", "name");
+  parser.addOption(scenarioOption);
+
+  QCommandLineOption outputOption(
+      {"o", "output"}, "Write the results as JSON to a file", "file");
+  parser.addOption(outputOption);
+  parser.process(app);
+
+  BenchOptions out;
+  if (parser.isSet(clientsOption)) {
+    out.clients = qMax(1, parser.value(clientsOption).toInt());
+  }
+  if (parser.isSet(connectionsOption)) {
+    out.connections = qMax(1, parser.value(connectionsOption).toInt());
+  }
+  if (parser.isSet(bytesOption)) {
+    out.bulkBytes = qMax(1LL, parser.value(bytesOption).toLongLong()) * 1024 *
+                    1024;
+  }
+  if (parser.isSet(threadsOption)) {
+    out.threads = qMax(0, parser.value(threadsOption).toInt());
+  }
+  if (parser.isSet(localOption)) {
+    out.local = true;
+  }
+  if (parser.isSet(scenarioOption)) {
+    out.scenarios = parser.values(scenarioOption);
+  }
+  if (parser.isSet(outputOption)) {
+    out.output = parser.value(outputOption);
+  }
+  return out;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("socksbench");
+  auto const options = parseArgs(app);
+  qRegisterMetaType<QHostAddress>();
+
+  BenchThread targetThread("targets");
+  BenchThread proxyThread("proxy");
+  TargetServers targets(targetThread.context(), options.bulkBytes);
+  ProxyServer proxy(proxyThread.context(), options);
+
+  QJsonObject scenarios;
+  QTextStream out(stdout);
+  for (const QString& name : options.scenarios) {
+    QJsonObject result;
+    if (name == "connect") {
+      result = runScenario(options, proxy, proxyThread, BenchClient::Connect,
+                           targets.echoPort());
+    } else if (name == "upload") {
+      result = runScenario(options, proxy, proxyThread, BenchClient::Upload,
+                           targets.sinkPort());
+    } else if (name == "download") {
+      result = runScenario(options, proxy, proxyThread, BenchClient::Download,
+                           targets.sourcePort());
+    } else {
+      qWarning() << "Unknown scenario:" << name;
+      continue;
+    }
+    scenarios[name] = result;
+
+    auto handshake = result["handshake_usec"].toObject();
+    out << name << ": " << result["connections"].toInt() << " connections ("
+        << result["failures"].toInt() << " failed) "
+        << QString::number(result["connections_per_sec"].toDouble(), 'f', 1)
+        << " conn/s, handshake p50/p90/p99 " << handshake["p50"].toInteger()
+        << "/" << handshake["p90"].toInteger() << "/"
+        << handshake["p99"].toInteger() << " us, "
+        << QString::number(result["mbytes_per_sec"].toDouble(), 'f', 1)
+        << " MiB/s, "
+        << QString::number(
+               result["process_cpu_usec_per_connection"].toDouble(), 'f', 0)
+        << " us cpu/conn" << Qt::endl;
+  }
+
+  QJsonObject report;
+  report["frontend"] = options.local ? "local" : "tcp";
+  report["clients"] = options.clients;
+  report["threads"] = options.threads;
+  report["bulk_bytes"] = options.bulkBytes;
+  report["host"] = QSysInfo::machineHostName();
+  report["cpu"] = QSysInfo::currentCpuArchitecture();
+  report["os"] = QSysInfo::prettyProductName();
+  report["scenarios"] = scenarios;
+
+  if (!options.output.isEmpty()) {
+    QFile file(options.output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qWarning() << "Unable to write" << options.output;
+      return 1;
+    }
+    file.write(QJsonDocument(report).toJson());
+  }
+  return 0;
+}
@@ -0,0 +1,58 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "testboxcaraverage.h"
+
+#include "boxcaraverage.h"
+
+void TestBoxcarAverage::empty() {
+  BoxcarAverage average;
+  QCOMPARE(average.average(), qint64(0));
+  average.advance();
+  QCOMPARE(average.average(), qint64(0));
+}
+
+void TestBoxcarAverage::warmUp() {
+  BoxcarAverage average(4);
+
+  // Samples in the same bucket add up.
+  average.addSample(60);
+  average.addSample(40);
+  QCOMPARE(average.average(), qint64(100));
+
+  // Until the window is full, only the buckets seen so far count.
+  average.advance();
+  QCOMPARE(average.average(), qint64(50));
+  average.addSample(200);
+  QCOMPARE(average.average(), qint64(150));
+  average.advance();
+  QCOMPARE(average.average(), qint64(100));
+}
+
+void TestBoxcarAverage::window() {
+  BoxcarAverage average(4);
+  for (qint64 sample : {40, 80, 120}) {
+    average.addSample(sample);
+    average.advance();
+  }
+  QCOMPARE(average.average(), qint64((40 + 80 + 120) / 4));
+  average.addSample(160);
+  QCOMPARE(average.average(), qint64((40 + 80 + 120 + 160) / 4));
+
+  // Once the window is full, every step drops the oldest bucket.
+  average.advance();
+  QCOMPARE(average.average(), qint64((80 + 120 + 160) / 4));
+  average.advance();
+  QCOMPARE(average.average(), qint64((120 + 160) / 4));
+  average.advance();
+  QCOMPARE(average.average(), qint64(160 / 4));
+  average.advance();
+  QCOMPARE(average.average(), qint64(0));
+
+  // And the recycled buckets start from zero.
+  average.addSample(400);
+  QCOMPARE(average.average(), qint64(400 / 4));
+}
+
+QTEST_MAIN(TestBoxcarAverage)
@@ -0,0 +1,90 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "testconnectionpool.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTest>
+
+#include "connectionpool.h"
+
+namespace {
+
+// Counts the connections made to a local server.
+class Upstream final : public QTcpServer {
+ public:
+  Upstream() {
+    connect(this, &QTcpServer::newConnection, this, [this]() {
+      while (QTcpSocket* s = nextPendingConnection()) {
+        m_accepted.append(s);
+      }
+    });
+    listen(QHostAddress::LocalHost);
+  }
+
+  QList<QTcpSocket*> m_accepted;
+};
+
+}  // namespace
+
+void TestConnectionPool::cleanup() { ConnectionPool::setPoolSize(0); }
+
+void TestConnectionPool::disabled() {
+  Upstream upstream;
+  QVERIFY(upstream.isListening());
+  ConnectionPool pool;
+  QObject parent;
+
+  for (int i = 0; i < ConnectionPool::WARM_CONNECT_COUNT * 2; i++) {
+    QVERIFY(!pool.take(QHostAddress::LocalHost, upstream.serverPort(),
+                       &parent));
+  }
+  QTest::qWait(200);
+  QCOMPARE(upstream.m_accepted.count(), 0);
+}
+
+void TestConnectionPool::noWarmupOnFirstConnect() {
+  ConnectionPool::setPoolSize(2);
+  Upstream upstream;
+  QVERIFY(upstream.isListening());
+  ConnectionPool pool;
+  QObject parent;
+
+  // A destination seen once is not worth any spare connections.
+  QVERIFY(
+      !pool.take(QHostAddress::LocalHost, upstream.serverPort(), &parent));
+  QTest::qWait(200);
+  QCOMPARE(upstream.m_accepted.count(), 0);
+}
+
+void TestConnectionPool::warmupAfterRepeatedConnects() {
+  ConnectionPool::setPoolSize(2);
+  Upstream upstream;
+  QVERIFY(upstream.isListening());
+  ConnectionPool pool;
+  QObject parent;
+
+  for (int i = 0; i < ConnectionPool::WARM_CONNECT_COUNT; i++) {
+    QVERIFY(
+        !pool.take(QHostAddress::LocalHost, upstream.serverPort(), &parent));
+  }
+  QTRY_COMPARE(upstream.m_accepted.count(), 2);
+
+  // Once the connections are established, they are handed out.
+  QTcpSocket* socket = nullptr;
+  QTRY_VERIFY((socket = pool.take(QHostAddress::LocalHost,
+                                  upstream.serverPort(), &parent)) != nullptr);
+  QCOMPARE(socket->parent(), &parent);
+  QCOMPARE(socket->state(), QAbstractSocket::ConnectedState);
+
+  // A hit tops the pool back up.
+  QTRY_COMPARE(upstream.m_accepted.count(), 3);
+
+  // The claimed socket is no longer the pool's to close.
+  QTest::qWait(100);
+  QCOMPARE(socket->state(), QAbstractSocket::ConnectedState);
+}
+
+QTEST_MAIN(TestConnectionPool)
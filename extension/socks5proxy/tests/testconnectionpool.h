@@ -0,0 +1,19 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <QObject>
+#include <QTest>
+
+class TestConnectionPool final : public QObject {
+  Q_OBJECT
+
+ private slots:
+  void cleanup();
+
+  void disabled();
+  void noWarmupOnFirstConnect();
+  void warmupAfterRepeatedConnects();
+};
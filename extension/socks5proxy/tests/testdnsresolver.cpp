@@ -0,0 +1,98 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "testdnsresolver.h"
+
+#include <ares.h>
+
+#include <QDeadlineTimer>
+#include <QTest>
+
+#include "dnsresolver.h"
+
+// Register a request as if it had joined a query in flight.
+void TestDNSResolver::addWaiter(DNSResolver* resolver, const QString& hostname,
+                                DNSWaiter* waiter) {
+  resolver->m_requests.insert(waiter, hostname);
+  resolver->m_pending[hostname].append(waiter);
+}
+
+void TestDNSResolver::cacheHit() {
+  DNSWaiter waiter;
+  DNSResolver resolver;
+
+  const QHostAddress addr("192.0.2.1");
+  resolver.m_cache.insert("cached.test", new DNSResolver::CacheEntry{
+                                             {addr}, QDeadlineTimer(60000)});
+
+  resolver.resolveAsync("cached.test", &waiter);
+  QTRY_COMPARE(waiter.m_resolved.count(), 1);
+  QCOMPARE(waiter.m_resolved.first(), addr);
+  QCOMPARE(resolver.cacheStats().hits, quint64(1));
+  QCOMPARE(resolver.cacheStats().misses, quint64(0));
+  QVERIFY(resolver.m_pending.isEmpty());
+}
+
+void TestDNSResolver::negativeExpiry() {
+  DNSWaiter first;
+  DNSWaiter second;
+  DNSWaiter third;
+  DNSResolver resolver;
+  const QString hostname("negative.invalid");
+
+  // A name that doesn't exist is remembered as a negative entry.
+  addWaiter(&resolver, hostname, &first);
+  resolver.addressInfoCallback(hostname, ARES_ENOTFOUND, 0, nullptr);
+  QTRY_COMPARE(first.m_notFound, 1);
+
+  DNSResolver::CacheEntry* entry = resolver.m_cache.object(hostname);
+  QVERIFY(entry);
+  QVERIFY(entry->addrs.isEmpty());
+
+  // While it is fresh, it answers without a query.
+  resolver.resolveAsync(hostname, &second);
+  QTRY_COMPARE(second.m_notFound, 1);
+  QCOMPARE(resolver.cacheStats().hits, quint64(1));
+  QVERIFY(!resolver.m_pending.contains(hostname));
+
+  // Once it expires, the name is looked up again.
+  entry->expires = QDeadlineTimer(0);
+  resolver.resolveAsync(hostname, &third);
+  QCOMPARE(resolver.cacheStats().hits, quint64(1));
+  QCOMPARE(resolver.cacheStats().misses, quint64(1));
+}
+
+void TestDNSResolver::failureWithWaiters() {
+  DNSWaiter waiters[3];
+  DNSResolver resolver;
+  const QString hostname("timeout.test");
+
+  for (DNSWaiter& waiter : waiters) {
+    addWaiter(&resolver, hostname, &waiter);
+  }
+
+  // Any failure, not only the ones with a dedicated message, must release
+  // every request merged onto the query.
+  resolver.addressInfoCallback(hostname, ARES_ETIMEOUT, 1, nullptr);
+  for (DNSWaiter& waiter : waiters) {
+    QTRY_COMPARE(waiter.m_notFound, 1);
+    QVERIFY(waiter.m_resolved.isEmpty());
+  }
+  QVERIFY(!resolver.m_pending.contains(hostname));
+
+  // A failure is not a negative answer, and is not cached.
+  QVERIFY(!resolver.m_cache.contains(hostname));
+}
+
+void TestDNSResolver::nameserverClearsCache() {
+  DNSResolver resolver;
+  resolver.m_cache.insert(
+      "cached.test", new DNSResolver::CacheEntry{{QHostAddress("192.0.2.1")},
+                                                 QDeadlineTimer(60000)});
+
+  resolver.setNameserver({QHostAddress("127.0.0.1")});
+  QVERIFY(!resolver.m_cache.contains("cached.test"));
+}
+
+QTEST_MAIN(TestDNSResolver)
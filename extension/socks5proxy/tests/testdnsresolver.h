@@ -0,0 +1,40 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <QHostAddress>
+#include <QList>
+#include <QObject>
+#include <QTest>
+
+class DNSResolver;
+
+// Stands in for a Socks5Connection waiting for a hostname.
+class DNSWaiter final : public QObject {
+  Q_OBJECT
+
+ public:
+  Q_INVOKABLE void onHostnameResolved(QHostAddress addr) {
+    m_resolved.append(addr);
+  }
+  Q_INVOKABLE void onHostnameNotFound() { m_notFound++; }
+
+  QList<QHostAddress> m_resolved;
+  int m_notFound = 0;
+};
+
+class TestDNSResolver final : public QObject {
+  Q_OBJECT
+
+ private:
+  static void addWaiter(DNSResolver* resolver, const QString& hostname,
+                        DNSWaiter* waiter);
+
+ private slots:
+  void cacheHit();
+  void negativeExpiry();
+  void failureWithWaiters();
+  void nameserverClearsCache();
+};
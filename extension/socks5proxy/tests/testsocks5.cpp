@@ -8,13 +8,18 @@
 #include <QEventLoop>
 #include <QFileInfo>
 #include <QFuture>
+#include <QMutex>
+#include <QNetworkDatagram>
 #include <QNetworkProxy>
 #include <QObject>
 #include <QPromise>
 #include <QRandomGenerator>
+#include <QSet>
 #include <QTcpServer>
 #include <QTest>
+#include <QThread>
 #include <QTimer>
+#include <QUdpSocket>
 
 #include "socks5.h"
 #include "socks5connection.h"
@@ -101,15 +106,14 @@ void TestSocks5::proxyTCP() {
   Socks5 proxy(&proxyServer);
   proxyServer.listen(QHostAddress::LocalHost, proxyPort);
 
-  QFuture<std::tuple<qint64, qint64>> proxyHadData;
+  std::shared_ptr<const TrafficCounters> proxyCounters;
   auto const connectionToServer = connectTo(serverPort, proxyPort);
 
   QString proxyClientName;
   QObject::connect(
       &proxy, &Socks5::incomingConnection, [&](Socks5Connection* conn) {
         proxyClientName = conn->clientName();
-        proxyHadData =
-            QtFuture::connect(conn, &Socks5Connection::dataSentReceived);
+        proxyCounters = conn->counters();
       });
 
   while (!connectionToServer.isFinished()) {
@@ -117,14 +121,141 @@ void TestSocks5::proxyTCP() {
   };
   // The TCP Server should have gotten a connection
   QCOMPARE(serverHadConnection.result(), true);
-  // Data Recieved should be 0
-  QCOMPARE(std::get<0>(proxyHadData.result()), qsizetype(0));
-  // Data Sent should be 10.
-  QCOMPARE(std::get<1>(proxyHadData.result()), qsizetype(10));
+  // Nothing was sent to the server, and it sent us 10 bytes.
+  QVERIFY(proxyCounters != nullptr);
+  QCOMPARE(proxyCounters->sent.load(), quint64(0));
+  QTRY_COMPARE(proxyCounters->received.load(), quint64(10));
   // The Proxy server should have gotten a connection
   QCOMPARE(proxyClientName, "127.0.0.1");
   // We should have gotten the correct string
   QCOMPARE(connectionToServer.result(), QByteArray{testData});
 }
 
+/**
+ * Create a UDP Server - echoing every datagram back.
+ *
+ * Send the greeting and a UDP ASSOCIATE request to the proxy in one go,
+ * then send a datagram to the server through the relay and check that the
+ * echo comes back with the address of the server.
+ *
+ */
+void TestSocks5::proxyUDP() {
+  QUdpSocket server;
+  QVERIFY(server.bind(QHostAddress::LocalHost, 0));
+  QObject::connect(&server, &QUdpSocket::readyRead, [&server]() {
+    while (server.hasPendingDatagrams()) {
+      QNetworkDatagram datagram = server.receiveDatagram();
+      server.writeDatagram(datagram.makeReply(datagram.data()));
+    }
+  });
+
+  QTcpServer proxyServer;
+  Socks5 proxy(&proxyServer);
+  QVERIFY(proxyServer.listen(QHostAddress::LocalHost, 0));
+
+  QUdpSocket client;
+  QVERIFY(client.bind(QHostAddress::LocalHost, 0));
+  const quint16 clientPort = client.localPort();
+
+  QTcpSocket control;
+  control.connectToHost(QHostAddress::LocalHost, proxyServer.serverPort());
+  QVERIFY(control.waitForConnected());
+  QByteArray request("\x05\x01\x00\x05\x03\x00\x01\x7f\x00\x00\x01", 11);
+  request.append(char(clientPort >> 8));
+  request.append(char(clientPort & 0xff));
+  control.write(request);
+
+  // The method selection and the reply should arrive together.
+  QTRY_COMPARE(control.bytesAvailable(), qint64(12));
+  const QByteArray reply = control.readAll();
+  QCOMPARE(reply.left(6), QByteArray("\x05\x00\x05\x00\x00\x01", 6));
+  QCOMPARE(reply.mid(6, 4), QByteArray("\x7f\x00\x00\x01", 4));
+  const quint16 relayPort = (quint8(reply[10]) << 8) | quint8(reply[11]);
+  QVERIFY(relayPort != 0);
+
+  QByteArray header("\x00\x00\x00\x01\x7f\x00\x00\x01", 8);
+  header.append(char(server.localPort() >> 8));
+  header.append(char(server.localPort() & 0xff));
+  client.writeDatagram(header + testData, QHostAddress::LocalHost, relayPort);
+
+  QTRY_VERIFY(client.hasPendingDatagrams());
+  QNetworkDatagram echo = client.receiveDatagram();
+  QCOMPARE(echo.senderPort(), relayPort);
+  QCOMPARE(echo.data(), header + testData);
+}
+
+/**
+ * Create a TCP Server - echoing everything back.
+ *
+ * Spread several connections over a pool of worker threads, and check that
+ * they all run to completion away from the main thread.
+ *
+ */
+void TestSocks5::proxyWorkerThreads() {
+  constexpr int CONNECTION_COUNT = 6;
+
+  QTcpServer server;
+  QVERIFY(server.listen(QHostAddress::LocalHost, 0));
+  QObject::connect(&server, &QTcpServer::newConnection, [&server]() {
+    while (QTcpSocket* s = server.nextPendingConnection()) {
+      QObject::connect(s, &QTcpSocket::readyRead,
+                       [s]() { s->write(s->readAll()); });
+      QObject::connect(s, &QTcpSocket::disconnected, s,
+                       &QObject::deleteLater);
+    }
+  });
+
+  QTcpServer proxyServer;
+  Socks5 proxy(&proxyServer);
+  proxy.setWorkerThreads(3);
+  QVERIFY(proxyServer.listen(QHostAddress::LocalHost, 0));
+
+  // Record the threads the connections reached the Proxy state on.
+  QMutex mutex;
+  QSet<QThread*> threads;
+  QObject::connect(&proxy, &Socks5::incomingConnection,
+                   [&](Socks5Connection* conn) {
+                     QObject::connect(
+                         conn, &Socks5Connection::stateChanged, conn,
+                         [&, conn]() {
+                           if (conn->state() == Socks5Connection::Proxy) {
+                             QMutexLocker lock(&mutex);
+                             threads.insert(QThread::currentThread());
+                           }
+                         },
+                         Qt::DirectConnection);
+                   });
+
+  QList<QTcpSocket*> clients;
+  for (int i = 0; i < CONNECTION_COUNT; i++) {
+    QTcpSocket* client = new QTcpSocket(&proxyServer);
+    client->setProxy(QNetworkProxy{QNetworkProxy::ProxyType::Socks5Proxy,
+                                   "localhost", proxyServer.serverPort()});
+    client->connectToHost(QHostAddress::LocalHost, server.serverPort());
+    clients.append(client);
+  }
+  for (int i = 0; i < CONNECTION_COUNT; i++) {
+    QVERIFY(clients[i]->waitForConnected());
+    clients[i]->write(QByteArray::number(i) + testData);
+  }
+  for (int i = 0; i < CONNECTION_COUNT; i++) {
+    QByteArray expected = QByteArray::number(i) + testData;
+    QTRY_COMPARE(clients[i]->bytesAvailable(), qint64(expected.length()));
+    QCOMPARE(clients[i]->readAll(), expected);
+  }
+  QCOMPARE(proxy.connections(), uint16_t(CONNECTION_COUNT));
+
+  {
+    QMutexLocker lock(&mutex);
+    QVERIFY(!threads.isEmpty());
+    QVERIFY(!threads.contains(QThread::currentThread()));
+  }
+
+  // The connections are cleaned up on their workers as the clients leave.
+  for (QTcpSocket* client : clients) {
+    client->disconnectFromHost();
+  }
+  QTRY_COMPARE(proxy.connections(), uint16_t(0));
+}
+
 QTEST_MAIN(TestSocks5)
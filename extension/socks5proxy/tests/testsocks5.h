@@ -12,4 +12,6 @@ class TestSocks5 final : public QObject {
 
  private slots:
   void proxyTCP();
+  void proxyUDP();
+  void proxyWorkerThreads();
 };
@@ -7,11 +7,36 @@
 #include <QBuffer>
 #include <QEventLoop>
 #include <QObject>
+#include <QPointer>
 #include <QTcpServer>
 #include <QTest>
+#include <QTimer>
 
+#include "flowcontrol.h"
 #include "socks5connection.h"
 
+namespace {
+
+// Accepts a client connection, and hands it to a Socks5Connection that is
+// waiting for the address of the destination.
+Socks5Connection* waitingConnection(QTcpServer& server, QTcpSocket& client,
+                                    uint8_t addressType, quint16 port) {
+  client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+  if (!server.waitForNewConnection(500)) {
+    return nullptr;
+  }
+  QTcpSocket* socket = server.nextPendingConnection();
+  socket->setParent(&server);
+
+  Socks5Connection* conn = new Socks5Connection(socket);
+  conn->m_state = Socks5Connection::ClientConnectionAddress;
+  conn->m_addressType = addressType;
+  conn->m_destPort = port;
+  return conn;
+}
+
+}  // namespace
+
 /**
  * Data should be copied, in order from rx to tx
  */
@@ -137,4 +162,116 @@ void TestSocks5Connection::proxyFlowControl() {
   QCOMPARE(sendSocket.bytesToWrite(), expect);
 }
 
+/**
+ * The flow control limit should double each time the buffer is filled and then
+ * drained while more data is waiting, up to the configured maximum.
+ */
+void TestSocks5Connection::flowControlGrowth() {
+  FlowControl flow;
+  const qint64 initial = FlowControl::minimumSize();
+  QCOMPARE(flow.size(), initial);
+
+  // Draining a buffer that was never filled should have no effect.
+  QCOMPARE(flow.prepare(0, 100), false);
+  QCOMPARE(flow.size(), initial);
+
+  // Fill the buffer while data is waiting, and then drain it.
+  flow.finish(initial, 100);
+  QCOMPARE(flow.watermark(), initial);
+  QCOMPARE(flow.prepare(0, 100), true);
+  QCOMPARE(flow.size(), initial * 2);
+
+  // The buffer should stop growing at the maximum size.
+  const qint64 maximum = FlowControl::maximumSize();
+  FlowControl::setMaximumSize(initial * 4);
+  for (int i = 0; i < 8; i++) {
+    flow.finish(flow.size(), 100);
+    flow.prepare(0, 100);
+  }
+  QCOMPARE(flow.size(), initial * 4);
+  QCOMPARE(flow.watermark(), initial * 4);
+  FlowControl::setMaximumSize(maximum);
+}
+
+/**
+ * The addresses of a hostname arrive one at a time. When every attempt so far
+ * has failed, an address that turns up shortly afterwards is still tried.
+ */
+void TestSocks5Connection::resolutionDelay() {
+  QTcpServer upstream;
+  QVERIFY(upstream.listen(QHostAddress::LocalHost));
+  QTcpServer server;
+  QVERIFY(server.listen(QHostAddress::LocalHost));
+  QTcpSocket client;
+  QPointer<Socks5Connection> conn =
+      waitingConnection(server, client, 0x03, upstream.serverPort());
+  QVERIFY(conn);
+
+  conn->attemptFailed(nullptr, Socks5Connection::ErrorConnectionRefused,
+                      "Connection refused");
+  QCOMPARE(conn->state(), Socks5Connection::ClientConnectionAddress);
+  QVERIFY(conn->m_attemptTimer->isActive());
+
+  conn->onHostnameResolved(QHostAddress(QHostAddress::LocalHost));
+  QTRY_VERIFY(conn && (conn->state() == Socks5Connection::Proxy));
+  QCOMPARE(conn->destAddress(), QHostAddress(QHostAddress::LocalHost));
+  QTRY_VERIFY(upstream.hasPendingConnections());
+}
+
+/**
+ * Once no more addresses turn up, the last error is reported to the client.
+ */
+void TestSocks5Connection::resolutionExhausted() {
+  QTcpServer server;
+  QVERIFY(server.listen(QHostAddress::LocalHost));
+  QTcpSocket client;
+  QPointer<Socks5Connection> conn = waitingConnection(server, client, 0x03, 1);
+  QVERIFY(conn);
+
+  conn->attemptFailed(nullptr, Socks5Connection::ErrorConnectionRefused,
+                      "Connection refused");
+  QTRY_VERIFY(conn.isNull());
+
+  QTRY_VERIFY(client.bytesAvailable() >= 10);
+  QByteArray reply = client.readAll();
+  QCOMPARE(reply.at(0), char(0x05));
+  QCOMPARE(reply.at(1), char(Socks5Connection::ErrorConnectionRefused));
+}
+
+/**
+ * An address given by the client is all there is, its failure is final.
+ */
+void TestSocks5Connection::addressLiteralFailure() {
+  QTcpServer server;
+  QVERIFY(server.listen(QHostAddress::LocalHost));
+  QTcpSocket client;
+  QPointer<Socks5Connection> conn = waitingConnection(server, client, 0x01, 1);
+  QVERIFY(conn);
+
+  conn->attemptFailed(nullptr, Socks5Connection::ErrorConnectionRefused,
+                      "Connection refused");
+  QCOMPARE(conn->state(), Socks5Connection::Closed);
+  QVERIFY(!conn->m_attemptTimer->isActive());
+  QTRY_VERIFY(conn.isNull());
+}
+
+/**
+ * Closing the connection cancels any pending attempt.
+ */
+void TestSocks5Connection::closeStopsAttemptTimer() {
+  QTcpServer server;
+  QVERIFY(server.listen(QHostAddress::LocalHost));
+  QTcpSocket client;
+  QPointer<Socks5Connection> conn = waitingConnection(server, client, 0x03, 1);
+  QVERIFY(conn);
+
+  conn->attemptFailed(nullptr, Socks5Connection::ErrorConnectionRefused,
+                      "Connection refused");
+  QVERIFY(conn->m_attemptTimer->isActive());
+
+  conn->setState(Socks5Connection::Closed);
+  QVERIFY(!conn->m_attemptTimer->isActive());
+  QTRY_VERIFY(conn.isNull());
+}
+
 QTEST_MAIN(TestSocks5Connection)
@@ -15,4 +15,10 @@ class TestSocks5Connection final : public QObject {
   void proxy();
   void proxyClosed();
   void proxyFlowControl();
+  void flowControlGrowth();
+
+  void resolutionDelay();
+  void resolutionExhausted();
+  void addressLiteralFailure();
+  void closeStopsAttemptTimer();
 };
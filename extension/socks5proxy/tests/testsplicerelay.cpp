@@ -0,0 +1,129 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "testsplicerelay.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QSignalSpy>
+#include <QTest>
+
+#include "flowcontrol.h"
+#include "splicerelay.h"
+
+namespace {
+
+// A connected pair of TCP sockets over the loopback interface.
+struct TcpPair {
+  TcpPair() {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    if ((bind(listener, (struct sockaddr*)&addr, addrlen) == 0) &&
+        (listen(listener, 1) == 0) &&
+        (getsockname(listener, (struct sockaddr*)&addr, &addrlen) == 0)) {
+      local = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (::connect(local, (struct sockaddr*)&addr, addrlen) == 0) {
+        peer = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      }
+    }
+    close(listener);
+  }
+  ~TcpPair() {
+    for (int fd : {local, peer}) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+  bool isValid() const { return (local >= 0) && (peer >= 0); }
+
+  int local = -1;
+  int peer = -1;
+};
+
+// Reads whatever is waiting on the socket, returns false once it reaches the
+// end of the stream.
+bool readAvailable(int fd, QByteArray& data) {
+  char buf[1024];
+  while (true) {
+    ssize_t len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (len > 0) {
+      data.append(buf, len);
+      continue;
+    }
+    return len != 0;
+  }
+}
+
+}  // namespace
+
+// The sockets handed to the relay are "proxy" in these tests, and the ones
+// we play with are the client and the remote.
+void TestSpliceRelay::relay() {
+  TcpPair client;
+  TcpPair remote;
+  QVERIFY(client.isValid() && remote.isValid());
+
+  auto counters = std::make_shared<TrafficCounters>();
+  SpliceRelay* relay =
+      SpliceRelay::create(client.peer, remote.local, FlowControl(),
+                          FlowControl(), counters, this);
+  QVERIFY(relay != nullptr);
+
+  QCOMPARE(send(client.local, "ping", 4, 0), ssize_t(4));
+  QByteArray upstream;
+  QTRY_VERIFY(readAvailable(remote.peer, upstream) && (upstream == "ping"));
+
+  QCOMPARE(send(remote.peer, "pong", 4, 0), ssize_t(4));
+  QByteArray downstream;
+  QTRY_VERIFY(readAvailable(client.local, downstream) &&
+              (downstream == "pong"));
+
+  QCOMPARE(counters->sent.load(), quint64(4));
+  QCOMPARE(counters->received.load(), quint64(4));
+  delete relay;
+}
+
+void TestSpliceRelay::halfClose() {
+  TcpPair client;
+  TcpPair remote;
+  QVERIFY(client.isValid() && remote.isValid());
+
+  SpliceRelay* relay = SpliceRelay::create(
+      client.peer, remote.local, FlowControl(), FlowControl(),
+      std::make_shared<TrafficCounters>(), this);
+  QVERIFY(relay != nullptr);
+  QSignalSpy closed(relay, &SpliceRelay::closed);
+
+  // The client is done sending, the remote gets all of it and then the end
+  // of the stream.
+  QCOMPARE(send(client.local, "request", 7, 0), ssize_t(7));
+  QCOMPARE(shutdown(client.local, SHUT_WR), 0);
+  QByteArray upstream;
+  QTRY_VERIFY(!readAvailable(remote.peer, upstream));
+  QCOMPARE(upstream, "request");
+
+  // The remote can still answer.
+  QTest::qWait(50);
+  QCOMPARE(closed.count(), 0);
+  QCOMPARE(send(remote.peer, "response", 8, 0), ssize_t(8));
+  QByteArray downstream;
+  QTRY_VERIFY(readAvailable(client.local, downstream) &&
+              (downstream == "response"));
+  QCOMPARE(closed.count(), 0);
+
+  // And the relay is finished once the remote is done too.
+  QCOMPARE(shutdown(remote.peer, SHUT_WR), 0);
+  QTRY_VERIFY(!readAvailable(client.local, downstream));
+  QTRY_COMPARE(closed.count(), 1);
+  delete relay;
+}
+
+QTEST_MAIN(TestSpliceRelay)
@@ -0,0 +1,307 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "addonhashcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QPromise>
+#include <atomic>
+#include <memory>
+
+#if QT_CONFIG(thread)
+#  include <QThreadPool>
+#endif
+
+#ifdef Q_OS_UNIX
+#  include <sys/stat.h>
+#endif
+
+#include "leakdetector.h"
+#include "logger.h"
+#include "settingsholder.h"
+
+namespace {
+Logger logger("AddonHashCache");
+
+// A file changed within this window of its verification could have been
+// changed again without moving its timestamps, so its record is not trusted.
+// The file is hashed again on the next run, and the new record is.
+constexpr const qint64 RACY_WINDOW_MSEC = 2000;
+
+// The records are only kept across runs where the status change time of a
+// file can't be forged.
+#ifdef Q_OS_UNIX
+constexpr const bool PERSISTENT_RECORDS = true;
+#else
+constexpr const bool PERSISTENT_RECORDS = false;
+#endif
+}  // namespace
+
+AddonHashCache::AddonHashCache() { MZ_COUNT_CTOR(AddonHashCache); }
+
+AddonHashCache::~AddonHashCache() { MZ_COUNT_DTOR(AddonHashCache); }
+
+bool AddonHashCache::Record::isSameFile(const Record& other) const {
+  return m_size == other.m_size && m_modified == other.m_modified &&
+         m_changed == other.m_changed && m_inode == other.m_inode;
+}
+
+// static
+bool AddonHashCache::fileRecord(const QString& filePath, Record* record) {
+  Q_ASSERT(record);
+
+  QFileInfo info(filePath);
+  if (!info.isFile()) {
+    return false;
+  }
+
+  record->m_size = info.size();
+  record->m_modified = info.lastModified().toMSecsSinceEpoch();
+  record->m_changed = info.metadataChangeTime().toMSecsSinceEpoch();
+
+#ifdef Q_OS_UNIX
+  struct stat st;
+  if (::stat(QFile::encodeName(filePath).constData(), &st) == 0) {
+    record->m_inode = static_cast<quint64>(st.st_ino);
+  }
+#endif
+
+  return true;
+}
+
+// static
+QByteArray AddonHashCache::hashFile(const QString& filePath) {
+  QFile file(filePath);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return QByteArray();
+  }
+
+  QCryptographicHash hash(QCryptographicHash::Sha256);
+
+  // Map the file rather than reading it, and fall back to reading it in
+  // chunks where mapping isn't supported.
+  qint64 size = file.size();
+  uchar* data = size > 0 ? file.map(0, size) : nullptr;
+  if (data) {
+    hash.addData(QByteArrayView(reinterpret_cast<const char*>(data), size));
+    file.unmap(data);
+  } else if (!hash.addData(&file)) {
+    return QByteArray();
+  }
+
+  return hash.result();
+}
+
+bool AddonHashCache::lookup(const QString& filePath, const Record& current,
+                            QByteArray* sha256) const {
+  auto it = m_records.constFind(filePath);
+  if (it == m_records.constEnd() || !it->isSameFile(current)) {
+    return false;
+  }
+
+  if (current.m_modified > it->m_verified - RACY_WINDOW_MSEC ||
+      current.m_changed > it->m_verified - RACY_WINDOW_MSEC) {
+    return false;
+  }
+
+  *sha256 = it->m_sha256;
+  return true;
+}
+
+void AddonHashCache::store(const QString& filePath, const Record& before,
+                           const QByteArray& sha256) {
+  // Don't record a hash if the file changed while it was being hashed.
+  Record record;
+  if (!fileRecord(filePath, &record) || !record.isSameFile(before)) {
+    m_records.remove(filePath);
+    return;
+  }
+
+  record.m_verified = QDateTime::currentMSecsSinceEpoch();
+  record.m_sha256 = sha256;
+  m_records.insert(filePath, record);
+}
+
+void AddonHashCache::prefetch(const QStringList& filePaths, QObject* context,
+                              std::function<void()>&& callback) {
+  load();
+
+  // Shared with the workers, which may outlive the cache.
+  struct Batch {
+    QStringList m_filePaths;
+    QList<Record> m_records;
+    QList<QByteArray> m_hashes;
+    std::atomic<qsizetype> m_remaining = 0;
+    QPromise<void> m_promise;
+  };
+  auto batch = std::make_shared<Batch>();
+
+  for (const QString& filePath : filePaths) {
+    Record current;
+    QByteArray sha256;
+    if (fileRecord(filePath, &current) && !lookup(filePath, current, &sha256)) {
+      batch->m_filePaths.append(filePath);
+      batch->m_records.append(current);
+    }
+  }
+
+  const qsizetype count = batch->m_filePaths.count();
+  batch->m_hashes.resize(count);
+  batch->m_remaining = count;
+
+  // The results are recorded on the thread of the context.
+  batch->m_promise.future().then(
+      context, [this, batch, generation = m_generation,
+                callback = std::move(callback)]() {
+        if (generation == m_generation && !batch->m_filePaths.isEmpty()) {
+          for (qsizetype i = 0; i < batch->m_filePaths.count(); ++i) {
+            if (!batch->m_hashes.at(i).isEmpty()) {
+              store(batch->m_filePaths.at(i), batch->m_records.at(i),
+                    batch->m_hashes.at(i));
+            }
+          }
+          save();
+        }
+        callback();
+      });
+
+  batch->m_promise.start();
+  if (count == 0) {
+    batch->m_promise.finish();
+    return;
+  }
+
+  logger.debug() << "Hashing" << count << "of" << filePaths.count()
+                 << "addons";
+
+#if QT_CONFIG(thread)
+  QByteArray* results = batch->m_hashes.data();
+  for (qsizetype i = 0; i < count; ++i) {
+    QThreadPool::globalInstance()->start([batch, results, i]() {
+      results[i] = hashFile(batch->m_filePaths.at(i));
+      if (--batch->m_remaining == 0) {
+        batch->m_promise.finish();
+      }
+    });
+  }
+#else
+  for (qsizetype i = 0; i < count; ++i) {
+    batch->m_hashes[i] = hashFile(batch->m_filePaths.at(i));
+  }
+  batch->m_promise.finish();
+#endif
+}
+
+QByteArray AddonHashCache::hash(const QString& filePath) {
+  load();
+
+  Record current;
+  if (!fileRecord(filePath, &current)) {
+    return QByteArray();
+  }
+
+  QByteArray sha256;
+  if (lookup(filePath, current, &sha256)) {
+    return sha256;
+  }
+
+  sha256 = hashFile(filePath);
+  if (!sha256.isEmpty()) {
+    store(filePath, current, sha256);
+    save();
+  }
+
+  return sha256;
+}
+
+void AddonHashCache::insert(const QString& filePath, const QByteArray& sha256) {
+  load();
+
+  Record current;
+  if (fileRecord(filePath, &current)) {
+    store(filePath, current, sha256);
+    save();
+  }
+}
+
+void AddonHashCache::remove(const QString& filePath) {
+  load();
+
+  if (m_records.remove(filePath)) {
+    save();
+  }
+}
+
+void AddonHashCache::reset() {
+  m_records.clear();
+  m_loaded = true;
+  m_generation++;
+
+  SettingsHolder* settingsHolder = SettingsHolder::instance();
+  if (settingsHolder) {
+    settingsHolder->removeAddonVerifiedHashes();
+  }
+}
+
+void AddonHashCache::load() {
+  if (m_loaded) {
+    return;
+  }
+  m_loaded = true;
+
+  SettingsHolder* settingsHolder = SettingsHolder::instance();
+  if (!settingsHolder || !PERSISTENT_RECORDS) {
+    return;
+  }
+
+  QJsonObject obj =
+      QJsonDocument::fromJson(settingsHolder->addonVerifiedHashes()).object();
+  for (auto it = obj.constBegin(); it != obj.constEnd(); ++it) {
+    QJsonObject entry = it.value().toObject();
+
+    Record record;
+    record.m_size = entry["size"].toInteger(-1);
+    record.m_modified = entry["modified"].toInteger();
+    record.m_changed = entry["changed"].toInteger();
+    record.m_inode = entry["inode"].toString().toULongLong();
+    record.m_verified = entry["verified"].toInteger();
+    record.m_sha256 =
+        QByteArray::fromHex(entry["sha256"].toString().toLatin1());
+
+    if (record.m_size < 0 || record.m_sha256.isEmpty()) {
+      continue;
+    }
+
+    m_records.insert(it.key(), record);
+  }
+}
+
+void AddonHashCache::save() {
+  SettingsHolder* settingsHolder = SettingsHolder::instance();
+  if (!settingsHolder || !PERSISTENT_RECORDS) {
+    return;
+  }
+
+  QJsonObject obj;
+  for (auto it = m_records.constBegin(); it != m_records.constEnd(); ++it) {
+    QJsonObject entry;
+    entry["size"] = it->m_size;
+    entry["modified"] = it->m_modified;
+    entry["changed"] = it->m_changed;
+    entry["inode"] = QString::number(it->m_inode);
+    entry["verified"] = it->m_verified;
+    entry["sha256"] = QString::fromLatin1(it->m_sha256.toHex());
+    obj[it.key()] = entry;
+  }
+
+  settingsHolder->setAddonVerifiedHashes(
+      QJsonDocument(obj).toJson(QJsonDocument::Compact));
+}
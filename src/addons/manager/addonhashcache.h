@@ -0,0 +1,93 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef ADDONHASHCACHE_H
+#define ADDONHASHCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <functional>
+
+class QObject;
+
+// The SHA-256 of the addon files, as verified on a previous run. A record is
+// only trusted while the file keeps the same size, inode, modification and
+// status change times, so that unchanged addons are not hashed again at every
+// startup. The records are kept in the settings.
+//
+// Only Unix keeps the records across runs: elsewhere, the status change time
+// can be set by anyone who can write to the file, so an addon modified with
+// its timestamps restored would not be hashed again. There, every addon is
+// hashed once per run.
+class AddonHashCache final {
+ public:
+  AddonHashCache();
+  ~AddonHashCache();
+
+  /**
+   * @brief Hash the files without a valid record, in parallel and in the
+   * background, and record the result.
+   *
+   * The callback runs on the thread of the context once the hashes are
+   * recorded, right away if there is nothing to hash. It doesn't run if the
+   * context is destroyed first.
+   *
+   * @param filePaths - the files that are about to be validated
+   * @param context - the object the callback belongs to
+   * @param callback - called when the prefetch is done
+   */
+  void prefetch(const QStringList& filePaths, QObject* context,
+                std::function<void()>&& callback);
+
+  /**
+   * @brief Return the SHA-256 of a file, hashing it only if needed.
+   *
+   * @param filePath - the file
+   * @return QByteArray - the hash, or an empty QByteArray if the file can't be
+   * read.
+   */
+  QByteArray hash(const QString& filePath);
+
+  // Record the hash of a file that has just been written.
+  void insert(const QString& filePath, const QByteArray& sha256);
+
+  void remove(const QString& filePath);
+
+  void reset();
+
+ private:
+  struct Record {
+    qint64 m_size = -1;
+    qint64 m_modified = 0;
+    qint64 m_changed = 0;
+    quint64 m_inode = 0;
+    qint64 m_verified = 0;
+    QByteArray m_sha256;
+
+    bool isSameFile(const Record& other) const;
+  };
+
+  static bool fileRecord(const QString& filePath, Record* record);
+  static QByteArray hashFile(const QString& filePath);
+
+  bool lookup(const QString& filePath, const Record& current,
+              QByteArray* sha256) const;
+  void store(const QString& filePath, const Record& before,
+             const QByteArray& sha256);
+
+  void load();
+  void save();
+
+ private:
+  QHash<QString, Record> m_records;
+  bool m_loaded = false;
+
+  // Bumped by reset(), so that the results of a prefetch that was already
+  // running are dropped.
+  quint64 m_generation = 0;
+};
+
+#endif  // ADDONHASHCACHE_H
@@ -120,6 +120,30 @@ void AddonManager::updateAddonsList(bool status, QList<AddonData> addons) {
     removeAddon(addonId);
   }
 
+  // Hash the addons that are about to be validated in one go, so that the
+  // files that changed since the last run are hashed in parallel, off the
+  // main thread.
+  QStringList addonFilePaths;
+  QDir dir;
+  if (m_addonDirectory.getDirectory(&dir)) {
+    for (const AddonData& addonData : addons) {
+      if (!m_addons.contains(addonData.m_addonId)) {
+        addonFilePaths.append(
+            dir.filePath(QString("%1.rcc").arg(addonData.m_addonId)));
+      }
+    }
+  }
+
+  quint64 serial = ++m_updateSerial;
+  m_hashCache.prefetch(addonFilePaths, this, [this, serial, addons]() {
+    // A newer list supersedes this one.
+    if (serial == m_updateSerial) {
+      loadAddons(addons);
+    }
+  });
+}
+
+void AddonManager::loadAddons(const QList<AddonData>& addons) {
   bool taskAdded = false;
 
   // Fetch new addons
@@ -139,8 +163,10 @@ void AddonManager::updateAddonsList(bool status, QList<AddonData> addons) {
   }
 
   if (taskAdded) {
+    // In the add-on group, so that this runs once the downloads are done.
     TaskScheduler::scheduleTask(
-        new TaskFunction([this]() { loadCompleted(); }, Task::Reschedulable));
+        new TaskFunction([this]() { loadCompleted(); }, Task::Reschedulable,
+                         TaskAddon::CONFLICT_GROUP));
   } else {
     loadCompleted();
   }
@@ -231,6 +257,11 @@ void AddonManager::retranslate() {
 void AddonManager::removeAddon(const QString& addonId) {
   QString addonFileName(QString("%1.rcc").arg(addonId));
   instance()->m_addonDirectory.deleteFile(addonFileName);
+
+  QDir dir;
+  if (instance()->m_addonDirectory.getDirectory(&dir)) {
+    instance()->m_hashCache.remove(dir.filePath(addonFileName));
+  }
 }
 
 bool AddonManager::validateAndLoad(const QString& addonId,
@@ -252,16 +283,14 @@ bool AddonManager::validateAndLoad(const QString& addonId,
   }
   QString addonFilePath(dir.filePath(addonFileName));
 
-  // Hash validation
+  // Hash validation. The hash is cached while the file doesn't change.
   if (checkSha256) {
-    QByteArray addonFileContents;
-
-    if (!m_addonDirectory.readFile(addonFileName, &addonFileContents)) {
+    QByteArray addonFileHash = m_hashCache.hash(addonFilePath);
+    if (addonFileHash.isEmpty()) {
       return false;
     }
 
-    if (QCryptographicHash::hash(addonFileContents,
-                                 QCryptographicHash::Sha256) != sha256) {
+    if (addonFileHash != sha256) {
       logger.warning() << "Addon hash does not match" << addonId;
       return false;
     }
@@ -306,6 +335,13 @@ void AddonManager::storeAndLoadAddon(const QByteArray& addonData,
     return;
   }
 
+  // The data has just been verified. Record it, so that the file is not
+  // hashed at every startup.
+  QDir dir;
+  if (m_addonDirectory.getDirectory(&dir)) {
+    m_hashCache.insert(dir.filePath(addonFileName), sha256);
+  }
+
   if (!validateAndLoad(addonId, sha256, false)) {
     logger.warning() << "Unable to load the addon";
   }
@@ -448,6 +484,8 @@ void AddonManager::refreshAddons() {
 
 void AddonManager::reset() {
   m_addonDirectory.reset();
+  m_hashCache.reset();
+  m_updateSerial++;
 
   QStringList addonIds;
   for (QMap<QString, AddonData>::const_iterator i(m_addons.constBegin());
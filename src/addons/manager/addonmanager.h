@@ -9,6 +9,7 @@
 #include <QJSValue>
 #include <QMap>
 
+#include "addonhashcache.h"
 #include "addonindex.h"
 #include "addons/addon.h"  // required for the signal
 
@@ -74,6 +75,7 @@ class AddonManager final : public QAbstractListModel {
   void initialize();
 
   void updateAddonsList(bool status, QList<AddonData> addons);
+  void loadAddons(const QList<AddonData>& addons);
 
   void refreshAddons();
 
@@ -111,6 +113,8 @@ class AddonManager final : public QAbstractListModel {
 
   AddonIndex m_addonIndex;
   AddonDirectory m_addonDirectory;
+  AddonHashCache m_hashCache;
+  quint64 m_updateSerial = 0;
 };
 
 #endif  // ADDONMANAGER_H
@@ -20,6 +20,13 @@ class CaptivePortalRequestTask final : public Task {
 
   void run() override;
 
+  // The detection only reports its result, so it can run next to the other
+  // tasks.
+  Priority priority() const override { return Interactive; }
+  QString conflictGroup() const override {
+    return QStringLiteral("captiveportal");
+  }
+
  signals:
   void operationCompleted(CaptivePortalRequest::CaptivePortalResult detected);
 
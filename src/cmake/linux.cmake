@@ -78,6 +78,8 @@ if(NOT BUILD_FLATPAK)
         ${CMAKE_SOURCE_DIR}/src/platforms/linux/daemon/linuxdaemon.cpp
         ${CMAKE_SOURCE_DIR}/src/platforms/linux/daemon/linuxfirewall.cpp
         ${CMAKE_SOURCE_DIR}/src/platforms/linux/daemon/linuxfirewall.h
+        ${CMAKE_SOURCE_DIR}/src/platforms/linux/daemon/wireguardstatslinux.cpp
+        ${CMAKE_SOURCE_DIR}/src/platforms/linux/daemon/wireguardstatslinux.h
         ${CMAKE_SOURCE_DIR}/src/platforms/linux/daemon/wireguardutilslinux.cpp
         ${CMAKE_SOURCE_DIR}/src/platforms/linux/daemon/wireguardutilslinux.h
     )
@@ -56,6 +56,8 @@ target_sources(shared-sources INTERFACE
     ${CMAKE_SOURCE_DIR}/src/addons/conditionwatchers/addonconditionwatchertriggertimesecs.h
     ${CMAKE_SOURCE_DIR}/src/addons/manager/addondirectory.cpp
     ${CMAKE_SOURCE_DIR}/src/addons/manager/addondirectory.h
+    ${CMAKE_SOURCE_DIR}/src/addons/manager/addonhashcache.cpp
+    ${CMAKE_SOURCE_DIR}/src/addons/manager/addonhashcache.h
     ${CMAKE_SOURCE_DIR}/src/addons/manager/addonindex.cpp
     ${CMAKE_SOURCE_DIR}/src/addons/manager/addonindex.h
     ${CMAKE_SOURCE_DIR}/src/addons/manager/addonmanager.cpp
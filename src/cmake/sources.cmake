@@ -78,6 +78,8 @@ target_sources(mozillavpn-sources INTERFACE
     ${CMAKE_CURRENT_SOURCE_DIR}/daemon/daemonlocalserverconnection.h
     ${CMAKE_CURRENT_SOURCE_DIR}/daemon/daemonaccesscontrol.cpp
     ${CMAKE_CURRENT_SOURCE_DIR}/daemon/daemonaccesscontrol.h
+    ${CMAKE_CURRENT_SOURCE_DIR}/daemon/daemonprotocol.cpp
+    ${CMAKE_CURRENT_SOURCE_DIR}/daemon/daemonprotocol.h
     ${CMAKE_CURRENT_SOURCE_DIR}/daemon/dnsutils.h
     ${CMAKE_CURRENT_SOURCE_DIR}/daemon/iputils.h
     ${CMAKE_CURRENT_SOURCE_DIR}/daemon/wireguardutils.h
@@ -148,6 +150,8 @@ target_sources(mozillavpn-sources INTERFACE
     ${CMAKE_CURRENT_SOURCE_DIR}/releasemonitor.h
     ${CMAKE_CURRENT_SOURCE_DIR}/serverlatency.cpp
     ${CMAKE_CURRENT_SOURCE_DIR}/serverlatency.h
+    ${CMAKE_CURRENT_SOURCE_DIR}/serverlatencystore.cpp
+    ${CMAKE_CURRENT_SOURCE_DIR}/serverlatencystore.h
     ${CMAKE_CURRENT_SOURCE_DIR}/settingswatcher.cpp
     ${CMAKE_CURRENT_SOURCE_DIR}/settingswatcher.h
     ${CMAKE_CURRENT_SOURCE_DIR}/statusicon.cpp
@@ -9,6 +9,7 @@
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QRandomGenerator>
+#include <QtEndian>
 
 #include "chacha20poly1305.h"
 #include "logger.h"
@@ -30,10 +31,163 @@
 constexpr int NONCE_SIZE = 12;
 constexpr int MAC_SIZE = 16;
 constexpr int ENCRYPTED_V2_HEADER_SIZE = 4;
+constexpr char ENCRYPTED_V2_FLAG_SECTIONED = 0x01;
+constexpr int SECTION_LENGTH_SIZE = 4;
 
 namespace {
 Logger logger("CryptoSettings");
 CryptoSettings* s_instance = nullptr;
+
+// Settings that are large, or rarely change, and that are stored in their own
+// section of the encrypted file. A key ending with a slash matches a group.
+struct SectionedKey {
+  const char* m_key;
+  const char* m_section;
+};
+constexpr const SectionedKey SECTIONED_KEYS[] = {
+    {"servers", "servers"},
+    {"serverData", "servers"},
+    {"serversETag", "servers"},
+    {"serversLastModified", "servers"},
+    {"devices", "account"},
+    {"subscriptionData", "account"},
+    {"subscriptionTransactions", "account"},
+    {"iapProducts", "account"},
+    {"featuresFlippedOff", "features"},
+    {"featuresFlippedOn", "features"},
+    {"recentConnections2", "recent"},
+    {"addons/", "addons"},
+};
+
+// A section of an encrypted V2 file:
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+// | Name Length |   Name   |  Nonce  |   MAC   |  Length  |  Ciphertext  |
+// |    8-bit    | variable | 96-bit  | 128-bit |  32-bit  |   variable   |
+// +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+struct SectionRecord {
+  QByteArray m_prefix;
+  QString m_name;
+  QByteArray m_nonce;
+  QByteArray m_mac;
+  QByteArray m_ciphertext;
+
+  QByteArray toByteArray() const {
+    QByteArray record(m_prefix);
+    record.reserve(m_prefix.length() + NONCE_SIZE + MAC_SIZE +
+                   SECTION_LENGTH_SIZE + m_ciphertext.length());
+    record.append(m_nonce);
+    record.append(m_mac);
+    char length[SECTION_LENGTH_SIZE];
+    qToBigEndian<quint32>(m_ciphertext.length(), length);
+    record.append(length, SECTION_LENGTH_SIZE);
+    record.append(m_ciphertext);
+    return record;
+  }
+};
+
+QByteArray sectionPrefix(const QString& name) {
+  QByteArray utf8 = name.toUtf8();
+  Q_ASSERT(utf8.length() <= UINT8_MAX);
+  QByteArray prefix(1, static_cast<char>(utf8.length()));
+  prefix.append(utf8);
+  return prefix;
+}
+
+bool readSectionRecord(QIODevice& device, SectionRecord& record) {
+  char nameLength;
+  if (!device.getChar(&nameLength)) {
+    logger.error() << "Failed to read the section name";
+    return false;
+  }
+  QByteArray name = device.read(static_cast<quint8>(nameLength));
+  if (name.length() != static_cast<quint8>(nameLength)) {
+    logger.error() << "Failed to read the section name";
+    return false;
+  }
+  record.m_prefix = QByteArray(1, nameLength) + name;
+  record.m_name = QString::fromUtf8(name);
+
+  record.m_nonce = device.read(NONCE_SIZE);
+  record.m_mac = device.read(MAC_SIZE);
+  QByteArray length = device.read(SECTION_LENGTH_SIZE);
+  if ((record.m_nonce.length() != NONCE_SIZE) ||
+      (record.m_mac.length() != MAC_SIZE) ||
+      (length.length() != SECTION_LENGTH_SIZE)) {
+    logger.error() << "Failed to read the section header";
+    return false;
+  }
+
+  quint32 ciphertextLength = qFromBigEndian<quint32>(length.constData());
+  if (ciphertextLength > device.bytesAvailable()) {
+    logger.error() << "Failed to read the section ciphertext";
+    return false;
+  }
+  record.m_ciphertext = device.read(ciphertextLength);
+  return record.m_ciphertext.length() ==
+         static_cast<qsizetype>(ciphertextLength);
+}
+
+QByteArray nonceFromCounter(uint64_t counter) {
+  Q_ASSERT(NONCE_SIZE > sizeof(counter));
+  QByteArray nonce(NONCE_SIZE, 0x00);
+  memcpy(nonce.data(), &counter, sizeof(counter));
+  return nonce;
+}
+
+uint64_t counterFromNonce(const QByteArray& nonce) {
+  uint64_t counter;
+  Q_ASSERT(nonce.length() > static_cast<qsizetype>(sizeof(counter)));
+  memcpy(&counter, nonce.constData(), sizeof(counter));
+  return counter;
+}
+
+bool isValidKey(const QByteArray& key) {
+  if (key.isEmpty()) {
+    logger.error() << "Something went wrong reading the key";
+    return false;
+  }
+  if (key.length() != CRYPTO_SETTINGS_KEY_SIZE) {
+    logger.error() << "Invalid key length:" << key.length();
+    return false;
+  }
+  return true;
+}
+
+// Values handed back by QSettings are usually the very same copies that were
+// last written or read, so check for shared data before comparing contents.
+bool isSameValue(const QVariant& a, const QVariant& b) {
+  if ((a.typeId() == QMetaType::QByteArray) &&
+      (b.typeId() == QMetaType::QByteArray)) {
+    const QByteArray* x = static_cast<const QByteArray*>(a.constData());
+    const QByteArray* y = static_cast<const QByteArray*>(b.constData());
+    if ((x->constData() == y->constData()) && (x->length() == y->length())) {
+      return true;
+    }
+  } else if ((a.typeId() == QMetaType::QString) &&
+             (b.typeId() == QMetaType::QString)) {
+    const QString* x = static_cast<const QString*>(a.constData());
+    const QString* y = static_cast<const QString*>(b.constData());
+    if ((x->constData() == y->constData()) && (x->length() == y->length())) {
+      return true;
+    }
+  }
+  return a == b;
+}
+
+bool isSameValues(const QSettings::SettingsMap& a,
+                  const QSettings::SettingsMap& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (auto i = a.constBegin(), j = b.constBegin(); i != a.constEnd();
+       ++i, ++j) {
+    if ((i.key() != j.key()) || !isSameValue(i.value(), j.value())) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 // static
@@ -123,21 +277,7 @@ bool CryptoSettings::readFile(QIODevice& device, QSettings::SettingsMap& map) {
 // static
 bool CryptoSettings::readJsonFile(QIODevice& device,
                                   QSettings::SettingsMap& map) {
-  QByteArray content = device.readAll();
-
-  QJsonDocument json = QJsonDocument::fromJson(content);
-  if (!json.isObject()) {
-    logger.error() << "Invalid content read from the JSON file";
-    return false;
-  }
-
-  QJsonObject obj = json.object();
-  for (QJsonObject::const_iterator i = obj.constBegin(); i != obj.constEnd();
-       ++i) {
-    map.insert(i.key(), i.value().toVariant());
-  }
-
-  return true;
+  return decodeSettings(device.readAll(), map);
 }
 
 bool CryptoSettings::readEncryptedChachaPolyFile(Version fileVersion,
@@ -148,7 +288,7 @@ bool CryptoSettings::readEncryptedChachaPolyFile(Version fileVersion,
   if (fileVersion == EncryptionChachaPolyV2) {
     // Encrypted V2 Header:
     // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    // | Version | Reserved  | Metadata Length | Metadata  |
+    // | Version |   Flags   | Metadata Length | Metadata  |
     // |  8-bit  |   8-bit   |     16-bit      | variable  |
     // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
     header.append(device.read(ENCRYPTED_V2_HEADER_SIZE - 1));
@@ -163,6 +303,14 @@ bool CryptoSettings::readEncryptedChachaPolyFile(Version fileVersion,
       return false;
     }
     metadata = header.mid(ENCRYPTED_V2_HEADER_SIZE);
+
+    if (header.at(1) & ENCRYPTED_V2_FLAG_SECTIONED) {
+      QByteArray key = getKey(fileVersion, metadata);
+      if (!isValidKey(key)) {
+        return false;
+      }
+      return readSectionedFile(header, key, device, map);
+    }
   } else if (fileVersion != EncryptionChachaPolyV1) {
     logger.error() << "Unsupported encrypted file version:" << header[0];
     return false;
@@ -187,12 +335,7 @@ bool CryptoSettings::readEncryptedChachaPolyFile(Version fileVersion,
   }
 
   QByteArray key = getKey(fileVersion, metadata);
-  if (key.isEmpty()) {
-    logger.error() << "Something went wrong reading the key";
-    return false;
-  }
-  if (key.length() != CRYPTO_SETTINGS_KEY_SIZE) {
-    logger.error() << "Invalid key length:" << key.length();
+  if (!isValidKey(key)) {
     return false;
   }
 
@@ -203,21 +346,80 @@ bool CryptoSettings::readEncryptedChachaPolyFile(Version fileVersion,
     return false;
   }
 
-  QJsonDocument json = QJsonDocument::fromJson(content);
-  if (!json.isObject()) {
-    logger.error() << "Invalid content read from the JSON file";
+  if (!decodeSettings(content, map)) {
     return false;
   }
 
-  QJsonObject obj = json.object();
-  for (QJsonObject::const_iterator i = obj.constBegin(); i != obj.constEnd();
-       ++i) {
-    map.insert(i.key(), i.value().toVariant());
+  m_lastNonce = counterFromNonce(nonce);
+  return true;
+}
+
+bool CryptoSettings::readSectionedFile(const QByteArray& header,
+                                       const QByteArray& key,
+                                       QIODevice& device,
+                                       QSettings::SettingsMap& map) {
+  // The main section comes first. It is authenticated together with the MACs
+  // of all the other sections, so that they can't be swapped for older copies
+  // or dropped from the file.
+  SectionRecord main;
+  if (!readSectionRecord(device, main) || !main.m_name.isEmpty()) {
+    logger.error() << "Failed to read the main section";
+    return false;
+  }
+
+  Chacha20Poly1305 cipher(key);
+  QByteArray mainAad = header + main.m_prefix;
+  uint64_t lastNonce = counterFromNonce(main.m_nonce);
+  QSettings::SettingsMap values;
+  QHash<QString, Section> sections;
+
+  while (!device.atEnd()) {
+    SectionRecord record;
+    if (!readSectionRecord(device, record) || record.m_name.isEmpty() ||
+        sections.contains(record.m_name)) {
+      logger.error() << "Failed to read a section";
+      return false;
+    }
+
+    QByteArray content =
+        cipher.decrypt(record.m_nonce, header + record.m_prefix,
+                       record.m_ciphertext, record.m_mac);
+    if (content.isNull()) {
+      logger.error() << "Settings decryption failed for section"
+                     << record.m_name;
+      return false;
+    }
+
+    Section& section = sections[record.m_name];
+    if (!decodeSettings(content, section.m_values)) {
+      return false;
+    }
+    section.m_key = key;
+    section.m_header = header;
+    section.m_mac = record.m_mac;
+    section.m_record = record.toByteArray();
+
+    mainAad.append(record.m_mac);
+    lastNonce = qMax(lastNonce, counterFromNonce(record.m_nonce));
   }
 
-  Q_ASSERT(NONCE_SIZE > sizeof(m_lastNonce));
-  memcpy(&m_lastNonce, nonce.data(), sizeof(m_lastNonce));
+  QByteArray content =
+      cipher.decrypt(main.m_nonce, mainAad, main.m_ciphertext, main.m_mac);
+  if (content.isNull()) {
+    logger.error() << "Settings decryption failed";
+    return false;
+  }
+  if (!decodeSettings(content, values)) {
+    return false;
+  }
 
+  for (auto i = sections.constBegin(); i != sections.constEnd(); ++i) {
+    values.insert(i.value().m_values);
+  }
+  map.insert(values);
+
+  m_sections = sections;
+  m_lastNonce = lastNonce;
   return true;
 }
 
@@ -253,16 +455,7 @@ bool CryptoSettings::writeJsonFile(QIODevice& device,
     return false;
   }
 
-  QJsonObject obj;
-  for (QSettings::SettingsMap::ConstIterator i = map.begin(); i != map.end();
-       ++i) {
-    obj.insert(i.key(), QJsonValue::fromVariant(i.value()));
-  }
-
-  QJsonDocument json;
-  json.setObject(obj);
-  QByteArray content = json.toJson(QJsonDocument::Compact);
-
+  QByteArray content = encodeSettings(map);
   if (device.write(content) != content.length()) {
     logger.error() << "Failed to write the content";
     return false;
@@ -275,15 +468,16 @@ bool CryptoSettings::writeEncryptedChachaPolyFile(
     QIODevice& device, const QSettings::SettingsMap& map) {
   logger.debug() << "Write encrypted file";
 
-  QJsonObject obj;
-  for (QSettings::SettingsMap::ConstIterator i = map.begin(); i != map.end();
-       ++i) {
-    obj.insert(i.key(), QJsonValue::fromVariant(i.value()));
+  Version fileVersion = getPreferredVersion();
+  if (fileVersion == CryptoSettings::EncryptionChachaPolyV2) {
+    return writeSectionedFile(device, map);
+  }
+  if (fileVersion != CryptoSettings::EncryptionChachaPolyV1) {
+    logger.error() << "Unsupported encrypted file version:" << fileVersion;
+    return false;
   }
 
-  QJsonDocument json;
-  json.setObject(obj);
-  QByteArray content = json.toJson(QJsonDocument::Compact);
+  QByteArray content = encodeSettings(map);
 
   logger.debug() << "Incrementing nonce:" << m_lastNonce;
   if (++m_lastNonce == UINT64_MAX) {
@@ -291,48 +485,15 @@ bool CryptoSettings::writeEncryptedChachaPolyFile(
     resetKey();
     m_lastNonce = 0;
   }
+  QByteArray nonce = nonceFromCounter(m_lastNonce);
 
-  Q_ASSERT(NONCE_SIZE > sizeof(m_lastNonce));
-  QByteArray nonce(NONCE_SIZE, 0x00);
-  memcpy(nonce.data(), &m_lastNonce, sizeof(m_lastNonce));
-
-  Version fileVersion = getPreferredVersion();
   QByteArray key = getKey(fileVersion, QByteArray());
-  if (key.isEmpty()) {
-    logger.error() << "Something went wrong reading the key";
-    return false;
-  }
-  if (key.length() != CRYPTO_SETTINGS_KEY_SIZE) {
-    logger.error() << "Invalid key length:" << key.length();
+  if (!isValidKey(key)) {
     return false;
   }
 
-  QByteArray header;
-  if (fileVersion == CryptoSettings::EncryptionChachaPolyV1) {
-    // Encrypted V1 Header: Just the version.
-    header.append(1, fileVersion);
-  } else if (fileVersion == CryptoSettings::EncryptionChachaPolyV2) {
-    QByteArray metadata = getMetaData();
-    if (metadata.length() > UINT16_MAX) {
-      logger.error() << "Failed to write encrypted file header: too long";
-      return false;
-    }
-
-    // Encrypted V2 Header:
-    // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    // | Version | Reserved  | Metadata Length | Metadata  |
-    // |  8-bit  |   8-bit   |     16-bit      | variable  |
-    // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    header.reserve(ENCRYPTED_V2_HEADER_SIZE + metadata.length());
-    header.append(1, fileVersion);
-    header.append(1, 0);
-    header.append(1, metadata.length() & 0xff);
-    header.append(1, (metadata.length() >> 8) & 0xff);
-    header.append(metadata);
-  } else {
-    logger.error() << "Unsupported encrypted file version:" << header[0];
-    return false;
-  }
+  // Encrypted V1 Header: Just the version.
+  QByteArray header(1, fileVersion);
 
   Chacha20Poly1305 cipher(key);
   QByteArray mac;
@@ -361,6 +522,178 @@ bool CryptoSettings::writeEncryptedChachaPolyFile(
   return true;
 }
 
+QByteArray CryptoSettings::encryptedV2Header() {
+  QByteArray metadata = getMetaData();
+  if (metadata.length() > UINT16_MAX) {
+    logger.error() << "Failed to write encrypted file header: too long";
+    return QByteArray();
+  }
+
+  // Encrypted V2 Header:
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // | Version |   Flags   | Metadata Length | Metadata  |
+  // |  8-bit  |   8-bit   |     16-bit      | variable  |
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  QByteArray header;
+  header.reserve(ENCRYPTED_V2_HEADER_SIZE + metadata.length());
+  header.append(1, EncryptionChachaPolyV2);
+  header.append(1, ENCRYPTED_V2_FLAG_SECTIONED);
+  header.append(1, metadata.length() & 0xff);
+  header.append(1, (metadata.length() >> 8) & 0xff);
+  header.append(metadata);
+  return header;
+}
+
+bool CryptoSettings::writeSectionedFile(QIODevice& device,
+                                        const QSettings::SettingsMap& map) {
+  QSettings::SettingsMap mainValues;
+  QMap<QString, QSettings::SettingsMap> sectionValues;
+  for (auto i = map.constBegin(); i != map.constEnd(); ++i) {
+    QString name = sectionName(i.key());
+    if (name.isEmpty()) {
+      mainValues.insert(i.key(), i.value());
+    } else {
+      sectionValues[name].insert(i.key(), i.value());
+    }
+  }
+
+  QByteArray key = getKey(EncryptionChachaPolyV2, QByteArray());
+  if (!isValidKey(key)) {
+    return false;
+  }
+  QByteArray header = encryptedV2Header();
+  if (header.isEmpty()) {
+    return false;
+  }
+
+  // Only the sections whose content has changed since they were last read or
+  // written need to be encrypted again. The others are copied as they are.
+  QStringList changed;
+  for (auto i = sectionValues.constBegin(); i != sectionValues.constEnd();
+       ++i) {
+    auto cached = m_sections.constFind(i.key());
+    if ((cached == m_sections.constEnd()) || (cached->m_key != key) ||
+        (cached->m_header != header) ||
+        !isSameValues(cached->m_values, i.value())) {
+      changed.append(i.key());
+    }
+  }
+
+  // Each encryption takes a nonce, including the one of the main section.
+  if (m_lastNonce >= (UINT64_MAX - changed.length() - 1)) {
+    logger.debug() << "Reset the nonce and the key.";
+    resetKey();
+    m_lastNonce = 0;
+
+    key = getKey(EncryptionChachaPolyV2, QByteArray());
+    if (!isValidKey(key)) {
+      return false;
+    }
+    header = encryptedV2Header();
+    if (header.isEmpty()) {
+      return false;
+    }
+    changed = sectionValues.keys();
+  }
+
+  Chacha20Poly1305 cipher(key);
+  QHash<QString, Section> sections;
+  QByteArray mainAad = header + sectionPrefix(QString());
+  for (auto i = sectionValues.constBegin(); i != sectionValues.constEnd();
+       ++i) {
+    if (!changed.contains(i.key())) {
+      sections.insert(i.key(), m_sections.value(i.key()));
+    } else {
+      logger.debug() << "Encrypting section" << i.key();
+      SectionRecord record;
+      record.m_prefix = sectionPrefix(i.key());
+      record.m_nonce = nonceFromCounter(++m_lastNonce);
+      record.m_ciphertext =
+          cipher.encrypt(record.m_nonce, header + record.m_prefix,
+                         encodeSettings(i.value()), record.m_mac);
+
+      Section& section = sections[i.key()];
+      section.m_values = i.value();
+      section.m_key = key;
+      section.m_header = header;
+      section.m_mac = record.m_mac;
+      section.m_record = record.toByteArray();
+    }
+    mainAad.append(sections.value(i.key()).m_mac);
+  }
+
+  SectionRecord main;
+  main.m_prefix = sectionPrefix(QString());
+  main.m_nonce = nonceFromCounter(++m_lastNonce);
+  main.m_ciphertext = cipher.encrypt(main.m_nonce, mainAad,
+                                     encodeSettings(mainValues), main.m_mac);
+
+  if (device.write(header) != header.length()) {
+    logger.error() << "Failed to write the header";
+    return false;
+  }
+
+  QByteArray mainRecord = main.toByteArray();
+  if (device.write(mainRecord) != mainRecord.length()) {
+    logger.error() << "Failed to write the main section";
+    return false;
+  }
+
+  // The sections follow in the same order as their MACs in the main section.
+  for (auto i = sectionValues.constBegin(); i != sectionValues.constEnd();
+       ++i) {
+    const QByteArray& record = sections[i.key()].m_record;
+    if (device.write(record) != record.length()) {
+      logger.error() << "Failed to write section" << i.key();
+      return false;
+    }
+  }
+
+  m_sections = sections;
+  return true;
+}
+
+// static
+QString CryptoSettings::sectionName(const QString& key) {
+  for (const SectionedKey& entry : SECTIONED_KEYS) {
+    QLatin1String prefix(entry.m_key);
+    if (prefix.endsWith('/') ? key.startsWith(prefix) : (key == prefix)) {
+      return QString(entry.m_section);
+    }
+  }
+  return QString();
+}
+
+// static
+QByteArray CryptoSettings::encodeSettings(const QSettings::SettingsMap& map) {
+  QJsonObject obj;
+  for (QSettings::SettingsMap::ConstIterator i = map.begin(); i != map.end();
+       ++i) {
+    obj.insert(i.key(), QJsonValue::fromVariant(i.value()));
+  }
+
+  QJsonDocument json;
+  json.setObject(obj);
+  return json.toJson(QJsonDocument::Compact);
+}
+
+// static
+bool CryptoSettings::decodeSettings(const QByteArray& content,
+                                    QSettings::SettingsMap& map) {
+  QJsonDocument json = QJsonDocument::fromJson(content);
+  if (!json.isObject()) {
+    logger.error() << "Invalid content read from the JSON file";
+    return false;
+  }
+
+  QJsonObject obj = json.object();
+  for (QJsonObject::const_iterator i = obj.constBegin(); i != obj.constEnd();
+       ++i) {
+    map.insert(i.key(), i.value().toVariant());
+  }
+  return true;
+}
+
 // static
 QByteArray CryptoSettings::generateRandomBytes(qsizetype length) {
   QRandomGenerator* rg = QRandomGenerator::system();
@@ -6,6 +6,7 @@
 #define CRYPTOSETTINGS_H
 
 #include <QByteArray>
+#include <QHash>
 #include <QSettings>
 
 constexpr int CRYPTO_SETTINGS_KEY_SIZE = 32;
@@ -50,8 +51,33 @@ class CryptoSettings {
   bool writeEncryptedChachaPolyFile(QIODevice& device,
                                     const QSettings::SettingsMap& map);
 
+  // Sectioned V2 implementation. Large and rarely changed settings are kept
+  // in their own encrypted sections, which are only re-encrypted when their
+  // content changes.
+  struct Section {
+    QSettings::SettingsMap m_values;
+    QByteArray m_key;
+    QByteArray m_header;
+    QByteArray m_mac;
+    QByteArray m_record;
+  };
+
+  bool readSectionedFile(const QByteArray& header, const QByteArray& key,
+                         QIODevice& device, QSettings::SettingsMap& map);
+  bool writeSectionedFile(QIODevice& device, const QSettings::SettingsMap& map);
+  QByteArray encryptedV2Header();
+
+  static QString sectionName(const QString& key);
+  static QByteArray encodeSettings(const QSettings::SettingsMap& map);
+  static bool decodeSettings(const QByteArray& content,
+                             QSettings::SettingsMap& map);
+
  protected:
   uint64_t m_lastNonce = 0;
+
+ private:
+  // The last section records read or written, by section name.
+  QHash<QString, Section> m_sections;
 };
 
 #endif  // CRYPTOSETTINGS_H
@@ -10,6 +10,7 @@
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QMetaEnum>
+#include <QSet>
 #include <QTimer>
 
 #include "controller.h"
@@ -20,6 +21,10 @@
 constexpr const char* JSON_ALLOWEDIPADDRESSRANGES = "allowedIPAddressRanges";
 constexpr int HANDSHAKE_POLL_MSEC = 250;
 
+// The client polls for the status while connected, so the answer is reused for
+// a short while rather than rebuilt for every request.
+constexpr int STATUS_CACHE_MSEC = 500;
+
 namespace {
 
 Logger logger("Daemon");
@@ -80,22 +85,29 @@ bool Daemon::activate(const InterfaceConfig& config) {
   // If the activation abort's for any reason `the `activationFailure` signal is
   // emitted.
   logger.debug() << "Activating interface.";
+  m_statusExpiry = QDeadlineTimer();
   auto emit_failure_guard = qScopeGuard([this] { emit activationFailure(); });
 
   if (m_connections.contains(config.m_hopType)) {
     if (supportServerSwitching(config)) {
       logger.debug() << "Already connected. Server switching supported.";
+      const QString lastDnsServer =
+          m_connections.value(config.m_hopType).m_config.m_dnsServer;
 
       if (!switchServer(config)) {
         return false;
       }
 
-      if (!dnsutils()->restoreResolvers()) {
-        return false;
-      }
+      // The resolvers only depend on the DNS server when switching, as the
+      // gateways must be unchanged.
+      if (config.m_dnsServer != lastDnsServer) {
+        if (!dnsutils()->restoreResolvers()) {
+          return false;
+        }
 
-      if (!maybeUpdateResolvers(config)) {
-        return false;
+        if (!maybeUpdateResolvers(config)) {
+          return false;
+        }
       }
 
       bool status = run(Switch, config);
@@ -166,6 +178,10 @@ bool Daemon::activate(const InterfaceConfig& config) {
       return false;
     }
   }
+  if (!wgutils()->flushRoutes()) {
+    logger.error() << "Routing configuration failed.";
+    return false;
+  }
 
   bool status = run(Up, config);
   logger.debug() << "Connection status:" << status;
@@ -348,6 +364,7 @@ bool Daemon::parseConfig(const QJsonObject& obj, InterfaceConfig& config) {
 
 bool Daemon::deactivate(bool emitSignals) {
   Q_ASSERT(wgutils() != nullptr);
+  m_statusExpiry = QDeadlineTimer();
 
   // Deactivate the main interface.
   if (!m_connections.isEmpty()) {
@@ -420,12 +437,28 @@ bool Daemon::switchServer(const InterfaceConfig& config) {
   const InterfaceConfig& lastConfig =
       m_connections.value(config.m_hopType).m_config;
 
-  // Activate the new peer and its routes.
-  if (!wgutils()->updatePeer(config)) {
+  // Activate the new peer, unless it is already configured as requested.
+  bool peerChanged =
+      (config.m_serverPublicKey != lastConfig.m_serverPublicKey) ||
+      (config.m_serverIpv4AddrIn != lastConfig.m_serverIpv4AddrIn) ||
+      (config.m_serverIpv6AddrIn != lastConfig.m_serverIpv6AddrIn) ||
+      (config.m_serverPort != lastConfig.m_serverPort) ||
+      (config.m_allowedIPAddressRanges != lastConfig.m_allowedIPAddressRanges);
+  if (peerChanged && !wgutils()->updatePeer(config)) {
     logger.error() << "Server switch failed to update the wireguard interface";
     return false;
   }
+
+  // The routes are bound to the interface rather than the peer, so only the
+  // difference between the old and new routes needs to be programmed.
+  const QSet<IPAddress> lastRanges(lastConfig.m_allowedIPAddressRanges.begin(),
+                                   lastConfig.m_allowedIPAddressRanges.end());
+  const QSet<IPAddress> nextRanges(config.m_allowedIPAddressRanges.begin(),
+                                   config.m_allowedIPAddressRanges.end());
   for (const IPAddress& ip : config.m_allowedIPAddressRanges) {
+    if (lastRanges.contains(ip)) {
+      continue;
+    }
     if (!wgutils()->updateRoutePrefix(ip)) {
       logger.error() << "Server switch failed to update the routing table";
       break;
@@ -434,7 +467,7 @@ bool Daemon::switchServer(const InterfaceConfig& config) {
 
   // Remove routing entries for the old peer.
   for (const IPAddress& ip : lastConfig.m_allowedIPAddressRanges) {
-    if (!config.m_allowedIPAddressRanges.contains(ip)) {
+    if (!nextRanges.contains(ip)) {
       wgutils()->deleteRoutePrefix(ip);
     }
   }
@@ -446,15 +479,30 @@ bool Daemon::switchServer(const InterfaceConfig& config) {
     }
   }
 
+  if (!wgutils()->flushRoutes()) {
+    logger.error() << "Server switch failed to update the routing table";
+    return false;
+  }
+
   m_connections[config.m_hopType] = ConnectionState(config);
+  m_statusExpiry = QDeadlineTimer();
   return true;
 }
 
 QJsonObject Daemon::getStatus() {
   Q_ASSERT(wgutils() != nullptr);
-  QJsonObject json;
-  logger.debug() << "Status request";
+  MZ_LOG(logger, Debug) << "Status request";
 
+  if (!m_statusExpiry.hasExpired()) {
+    return m_status;
+  }
+  m_status = buildStatus();
+  m_statusExpiry.setRemainingTime(STATUS_CACHE_MSEC);
+  return m_status;
+}
+
+QJsonObject Daemon::buildStatus() {
+  QJsonObject json;
   if (!wgutils()->interfaceExists() || m_connections.isEmpty()) {
     json.insert("connected", QJsonValue(false));
     return json;
@@ -502,6 +550,7 @@ void Daemon::checkHandshake() {
       }
       if (status.m_handshake != 0) {
         connection.m_date.setMSecsSinceEpoch(status.m_handshake);
+        m_statusExpiry = QDeadlineTimer();
         emit connected(status.m_pubkey);
       }
     }
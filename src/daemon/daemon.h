@@ -6,6 +6,8 @@
 #define DAEMON_H
 
 #include <QDateTime>
+#include <QDeadlineTimer>
+#include <QJsonObject>
 #include <QTimer>
 
 #include "daemon/daemonerrors.h"
@@ -54,6 +56,7 @@ class Daemon : public QObject {
 
  private:
   bool maybeUpdateResolvers(const InterfaceConfig& config);
+  QJsonObject buildStatus();
 
  protected:
   virtual bool run(Op op, const InterfaceConfig& config) {
@@ -83,6 +86,9 @@ class Daemon : public QObject {
   };
   QMap<InterfaceConfig::HopType, ConnectionState> m_connections;
   QTimer m_handshakeTimer;
+
+  QJsonObject m_status;
+  QDeadlineTimer m_statusExpiry;
 };
 
 #endif  // DAEMON_H
@@ -4,16 +4,19 @@
 
 #include "daemonlocalserverconnection.h"
 
-#include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QLocalSocket>
 
 #include "daemon.h"
 #include "daemonaccesscontrol.h"
+#include "daemonprotocol.h"
 #include "leakdetector.h"
 #include "logger.h"
 
+// Logs are sent in chunks of this size to clients that understand frames.
+constexpr qsizetype LOGS_CHUNK_SIZE = 64 * 1024;
+
 namespace {
 Logger logger("DaemonLocalServerConnection");
 }  // namespace
@@ -50,43 +53,26 @@ DaemonLocalServerConnection::~DaemonLocalServerConnection() {
 }
 
 void DaemonLocalServerConnection::readData() {
-  logger.debug() << "Read Data";
+  MZ_LOG(logger, Debug) << "Read Data";
 
   Q_ASSERT(m_socket);
 
   while (true) {
-    int pos = m_buffer.indexOf("\n");
-    if (pos == -1) {
+    QJsonObject obj;
+    if (!m_reader.next(obj)) {
       QByteArray input = m_socket->readAll();
       if (input.isEmpty()) {
         break;
       }
-      m_buffer.append(input);
-      continue;
-    }
-
-    QByteArray line = m_buffer.left(pos);
-    m_buffer.remove(0, pos + 1);
-
-    QByteArray command(line);
-    command = command.trimmed();
-
-    if (command.isEmpty()) {
+      m_reader.append(input);
       continue;
     }
 
-    parseCommand(command);
+    parseCommand(obj);
   }
 }
 
-void DaemonLocalServerConnection::parseCommand(const QByteArray& data) {
-  QJsonDocument json = QJsonDocument::fromJson(data);
-  if (!json.isObject()) {
-    logger.error() << "Invalid input";
-    return;
-  }
-
-  QJsonObject obj = json.object();
+void DaemonLocalServerConnection::parseCommand(const QJsonObject& obj) {
   QJsonValue typeValue = obj.value("type");
   if (!typeValue.isString()) {
     logger.warning() << "No type command. Ignoring request.";
@@ -94,7 +80,20 @@ void DaemonLocalServerConnection::parseCommand(const QByteArray& data) {
   }
   QString type = typeValue.toString();
 
-  logger.debug() << "Command received:" << type;
+  MZ_LOG(logger, Debug) << "Command received:" << type;
+
+  // Protocol negotiation is not a privileged command. Answer with the version
+  // we have settled on, then start speaking it.
+  if (type == "hello") {
+    int version = obj.value("version").toInt(DaemonProtocol::VERSION_JSON);
+    QJsonObject reply;
+    reply.insert("type", "hello");
+    reply.insert("version", qMin(version, DaemonProtocol::VERSION_CURRENT));
+    write(reply);
+    m_version = qBound(DaemonProtocol::VERSION_JSON, version,
+                       DaemonProtocol::VERSION_CURRENT);
+    return;
+  }
 
   auto accessControl = DaemonAccessControl::instance();
   if (!accessControl->isCommandAuthorizedForPeer(type, m_socket)) {
@@ -143,10 +142,7 @@ void DaemonLocalServerConnection::parseCommand(const QByteArray& data) {
   }
 
   if (type == "logs") {
-    QJsonObject obj;
-    obj.insert("type", "logs");
-    obj.insert("logs", m_daemon->logs().replace("\n", "|"));
-    write(obj);
+    writeLogs(m_daemon->logs());
     return;
   }
 
@@ -178,7 +174,29 @@ void DaemonLocalServerConnection::backendFailure(DaemonError err) {
   write(obj);
 }
 
+void DaemonLocalServerConnection::writeLogs(const QString& logs) {
+  // Older clients expect all the logs in one line.
+  if (m_version < DaemonProtocol::VERSION_CBOR) {
+    QJsonObject obj;
+    obj.insert("type", "logs");
+    obj.insert("logs", QString(logs).replace("\n", "|"));
+    write(obj);
+    return;
+  }
+
+  // Otherwise stream them, the last chunk is flagged as such. The chunks are
+  // cut between UTF-8 characters, so that every chunk is valid text.
+  const QByteArrayList chunks =
+      DaemonProtocol::chunkUtf8(logs.toUtf8(), LOGS_CHUNK_SIZE);
+  for (qsizetype i = 0; i < chunks.length(); i++) {
+    QJsonObject obj;
+    obj.insert("type", "logs");
+    obj.insert("logs", QString::fromUtf8(chunks.at(i)));
+    obj.insert("more", i + 1 < chunks.length());
+    write(obj);
+  }
+}
+
 void DaemonLocalServerConnection::write(const QJsonObject& obj) {
-  m_socket->write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
-  m_socket->write("\n");
+  m_socket->write(DaemonProtocol::encode(obj, m_version));
 }
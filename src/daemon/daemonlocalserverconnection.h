@@ -8,6 +8,7 @@
 #include <QObject>
 
 #include "daemonerrors.h"
+#include "daemonprotocol.h"
 
 class Daemon;
 class QLocalSocket;
@@ -22,18 +23,20 @@ class DaemonLocalServerConnection final : public QObject {
  private:
   void readData();
 
-  void parseCommand(const QByteArray& json);
+  void parseCommand(const QJsonObject& obj);
 
   void connected(const QString& pubkey);
   void disconnected();
   void backendFailure(DaemonError err);
 
   void write(const QJsonObject& obj);
+  void writeLogs(const QString& logs);
 
  private:
   Daemon* m_daemon = nullptr;
   QLocalSocket* m_socket = nullptr;
-  QByteArray m_buffer;
+  DaemonProtocol::Reader m_reader;
+  int m_version = DaemonProtocol::VERSION_JSON;
 };
 
 #endif  // DAEMONLOCALSERVERCONNECTION_H
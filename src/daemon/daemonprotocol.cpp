@@ -0,0 +1,131 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "daemonprotocol.h"
+
+#include <QCborMap>
+#include <QCborValue>
+#include <QJsonDocument>
+#include <QtEndian>
+
+#include "logger.h"
+
+namespace {
+Logger logger("DaemonProtocol");
+}  // namespace
+
+namespace DaemonProtocol {
+
+QByteArray encode(const QJsonObject& message, int version) {
+  if (version < VERSION_CBOR) {
+    QByteArray line = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    return line;
+  }
+
+  QByteArray payload = QCborMap::fromJsonObject(message).toCborValue().toCbor();
+  QByteArray frame(FRAME_HEADER_LENGTH, Qt::Uninitialized);
+  frame[0] = FRAME_MAGIC;
+  frame[1] = static_cast<char>(VERSION_CBOR);
+  qToBigEndian<quint32>(payload.length(), frame.data() + 2);
+  frame.append(payload);
+  return frame;
+}
+
+QByteArrayList chunkUtf8(const QByteArray& utf8, qsizetype size) {
+  Q_ASSERT(size >= 4);
+
+  QByteArrayList chunks;
+  qsizetype offset = 0;
+  do {
+    qsizetype end = qMin(offset + size, utf8.length());
+    // Back off to the start of the character we are cutting through. The
+    // continuation bytes of a character all look like 10xxxxxx.
+    while ((end < utf8.length()) && (end > offset) &&
+           ((utf8.at(end) & 0xc0) == 0x80)) {
+      end--;
+    }
+    chunks.append(utf8.mid(offset, end - offset));
+    offset = end;
+  } while (offset < utf8.length());
+  return chunks;
+}
+
+void Reader::append(const QByteArray& data) {
+  if (m_offset > 0) {
+    m_buffer.remove(0, m_offset);
+    m_offset = 0;
+  }
+  m_buffer.append(data);
+}
+
+bool Reader::next(QJsonObject& message) {
+  while (m_offset < m_buffer.length()) {
+    bool valid = false;
+    bool complete = (m_buffer.at(m_offset) == FRAME_MAGIC)
+                        ? nextFrame(message, valid)
+                        : nextLine(message, valid);
+    if (!complete) {
+      return false;
+    }
+    if (valid) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Reader::nextLine(QJsonObject& message, bool& valid) {
+  qsizetype pos = m_buffer.indexOf('\n', m_offset);
+  if (pos < 0) {
+    return false;
+  }
+
+  QByteArray line = m_buffer.mid(m_offset, pos - m_offset).trimmed();
+  m_offset = pos + 1;
+  if (line.isEmpty()) {
+    return true;
+  }
+
+  QJsonDocument json = QJsonDocument::fromJson(line);
+  if (!json.isObject()) {
+    logger.error() << "Invalid JSON - object expected";
+    return true;
+  }
+  message = json.object();
+  valid = true;
+  return true;
+}
+
+bool Reader::nextFrame(QJsonObject& message, bool& valid) {
+  if ((m_buffer.length() - m_offset) < FRAME_HEADER_LENGTH) {
+    return false;
+  }
+
+  const char* header = m_buffer.constData() + m_offset;
+  quint32 length = qFromBigEndian<quint32>(header + 2);
+  if ((header[1] != VERSION_CBOR) || (length > FRAME_MAX_LENGTH)) {
+    // There is no way to find the next message, drop everything.
+    logger.error() << "Invalid frame - discarding buffered input";
+    m_buffer.clear();
+    m_offset = 0;
+    return false;
+  }
+  if ((m_buffer.length() - m_offset - FRAME_HEADER_LENGTH) < length) {
+    return false;
+  }
+
+  QCborValue cbor =
+      QCborValue::fromCbor(header + FRAME_HEADER_LENGTH, length);
+  m_offset += FRAME_HEADER_LENGTH + length;
+  if (!cbor.isMap()) {
+    logger.error() << "Invalid frame - map expected";
+    return true;
+  }
+  message = cbor.toMap().toJsonObject();
+  valid = true;
+  return true;
+}
+
+}  // namespace DaemonProtocol
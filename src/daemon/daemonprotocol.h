@@ -0,0 +1,75 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef DAEMONPROTOCOL_H
+#define DAEMONPROTOCOL_H
+
+#include <QByteArray>
+#include <QByteArrayList>
+#include <QJsonObject>
+
+// Message framing for the local socket between the client and the daemon.
+//
+// Version 1 sends each message as a line of compact JSON. Version 2 sends
+// each message as a frame: a magic byte, the version, the payload length as
+// a 32-bit big endian integer, and then the message encoded as CBOR. The
+// magic byte can never start a JSON line, so a reader accepts both formats at
+// any time, and a writer switches to frames once the peer has answered a
+// "hello" message announcing the version it supports.
+namespace DaemonProtocol {
+
+constexpr int VERSION_JSON = 1;
+constexpr int VERSION_CBOR = 2;
+constexpr int VERSION_CURRENT = VERSION_CBOR;
+
+constexpr char FRAME_MAGIC = '\xcb';
+constexpr qsizetype FRAME_HEADER_LENGTH = 6;
+constexpr qsizetype FRAME_MAX_LENGTH = 1024 * 1024;
+
+/**
+ * @brief Encode a message in the format of a protocol version.
+ *
+ * @param message - the message to encode
+ * @param version - the protocol version spoken with the peer
+ * @return QByteArray - the bytes to write to the socket.
+ */
+QByteArray encode(const QJsonObject& message, int version);
+
+/**
+ * @brief Split UTF-8 text into chunks, without splitting any character.
+ *
+ * @param utf8 - the text to split
+ * @param size - the maximum size of a chunk in bytes, at least 4
+ * @return QByteArrayList - the chunks, with at least one element.
+ */
+QByteArrayList chunkUtf8(const QByteArray& utf8, qsizetype size);
+
+// Splits the bytes read from the socket into messages.
+class Reader final {
+ public:
+  void append(const QByteArray& data);
+
+  /**
+   * @brief Take the next complete message from the buffer.
+   *
+   * Messages that fail to parse are logged and skipped.
+   *
+   * @param message - set to the next message
+   * @return bool - false if there is no complete message buffered.
+   */
+  bool next(QJsonObject& message);
+
+ private:
+  bool nextLine(QJsonObject& message, bool& valid);
+  bool nextFrame(QJsonObject& message, bool& valid);
+
+  QByteArray m_buffer;
+  // Messages are consumed by advancing this offset, and the buffer is only
+  // compacted when more data arrives.
+  qsizetype m_offset = 0;
+};
+
+}  // namespace DaemonProtocol
+
+#endif  // DAEMONPROTOCOL_H
@@ -45,6 +45,10 @@ class WireguardUtils : public QObject {
   virtual bool deleteRoutePrefix(const IPAddress& prefix) = 0;
   virtual bool excludeLocalNetworks(const QList<IPAddress>& addresses) = 0;
 
+  // Backends may hold on to routing changes and apply them together. This
+  // applies whatever is still pending, and returns false if any of it failed.
+  virtual bool flushRoutes() { return true; }
+
  signals:
   void backendFailure();
 };
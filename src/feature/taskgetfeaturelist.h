@@ -32,6 +32,11 @@ class TaskGetFeatureList final : public Task {
   ~TaskGetFeatureList();
 
   void run() override;
+
+  Priority priority() const override { return Background; }
+  QString conflictGroup() const override {
+    return QStringLiteral("featurelist");
+  }
 };
 
 #endif  // TASKGETFEATURELIST_H
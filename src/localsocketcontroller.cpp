@@ -6,11 +6,11 @@
 
 #include <stdint.h>
 
-#include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QMetaType>
 
+#include "daemon/daemonprotocol.h"
 #include "leakdetector.h"
 #include "logger.h"
 
@@ -105,6 +105,16 @@ void LocalSocketController::initializeInternal() {
 void LocalSocketController::daemonConnected() {
   logger.debug() << "Daemon connected";
   Q_ASSERT(m_daemonState == eInitializing);
+
+  // Offer the framed protocol. Older daemons ignore this, and we keep talking
+  // JSON to them.
+  m_version = DaemonProtocol::VERSION_JSON;
+  m_reader = DaemonProtocol::Reader();
+  QJsonObject json;
+  json.insert("type", "hello");
+  json.insert("version", DaemonProtocol::VERSION_CURRENT);
+  write(json);
+
   checkStatus();
 }
 
@@ -183,41 +193,19 @@ void LocalSocketController::cleanupBackendLogs() {
 }
 
 void LocalSocketController::readData() {
-  logger.debug() << "Reading";
+  MZ_LOG(logger, Debug) << "Reading";
 
   Q_ASSERT(m_socket);
   Q_ASSERT(m_daemonState == eInitializing || m_daemonState == eReady);
-  QByteArray input = m_socket->readAll();
-  m_buffer.append(input);
-
-  while (true) {
-    int pos = m_buffer.indexOf("\n");
-    if (pos == -1) {
-      break;
-    }
-
-    QByteArray line = m_buffer.left(pos);
-    m_buffer.remove(0, pos + 1);
-
-    QByteArray command(line);
-    command = command.trimmed();
-
-    if (command.isEmpty()) {
-      continue;
-    }
+  m_reader.append(m_socket->readAll());
 
-    parseCommand(command);
+  QJsonObject obj;
+  while (m_reader.next(obj)) {
+    parseCommand(obj);
   }
 }
 
-void LocalSocketController::parseCommand(const QByteArray& command) {
-  QJsonDocument json = QJsonDocument::fromJson(command);
-  if (!json.isObject()) {
-    logger.error() << "Invalid JSON - object expected";
-    return;
-  }
-
-  QJsonObject obj = json.object();
+void LocalSocketController::parseCommand(const QJsonObject& obj) {
   QJsonValue typeValue = obj.value("type");
   if (!typeValue.isString()) {
     logger.error() << "Invalid JSON - no type";
@@ -225,9 +213,17 @@ void LocalSocketController::parseCommand(const QByteArray& command) {
   }
   QString type = typeValue.toString();
 
-  logger.debug() << "Parse command:" << type;
+  MZ_LOG(logger, Debug) << "Parse command:" << type;
   clearTimeout(type);
 
+  if (type == "hello") {
+    m_version = qBound(DaemonProtocol::VERSION_JSON,
+                       obj.value("version").toInt(),
+                       DaemonProtocol::VERSION_CURRENT);
+    logger.debug() << "Daemon protocol version:" << m_version;
+    return;
+  }
+
   if (m_daemonState == eInitializing && type == "status") {
     m_daemonState = eReady;
 
@@ -299,23 +295,30 @@ void LocalSocketController::parseCommand(const QByteArray& command) {
     QJsonValue logs = obj.value("logs");
     QString logString;
     if (logs.isString()) {
-      logString = logs.toString().replace("|", "\n");
+      logString = logs.toString();
     }
 
+    // Framed replies keep their newlines, and are streamed in chunks.
+    if (m_version < DaemonProtocol::VERSION_CBOR) {
+      logString.replace("|", "\n");
+    }
     m_logReceiver->write(logString.toUtf8());
+    if (obj.value("more").toBool()) {
+      return;
+    }
+
     m_logReceiver->close();
     m_logReceiver = nullptr;
     return;
   }
 
-  logger.warning() << "Invalid command received:" << command;
+  logger.warning() << "Invalid command received:" << type;
 }
 
 void LocalSocketController::write(const QJsonObject& message,
                                   const QString& expectedResponseType,
                                   int timeout) {
-  QByteArray payload = QJsonDocument(message).toJson(QJsonDocument::Compact);
-  payload.append('\n');
+  QByteArray payload = DaemonProtocol::encode(message, m_version);
 
   // If an immediate response to this message is expected, start a timer to
   // throw an error if that response fails to arrive in a timely manner. This
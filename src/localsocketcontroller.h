@@ -10,6 +10,7 @@
 #include <functional>
 
 #include "controllerimpl.h"
+#include "daemon/daemonprotocol.h"
 
 class QJsonObject;
 
@@ -47,7 +48,7 @@ class LocalSocketController : public ControllerImpl {
   void daemonConnected();
   void errorOccurred(QLocalSocket::LocalSocketError socketError);
   void readData();
-  void parseCommand(const QByteArray& command);
+  void parseCommand(const QJsonObject& obj);
   void clearTimeout(const QString& responseType);
   void clearAllTimeouts();
 
@@ -76,7 +77,8 @@ class LocalSocketController : public ControllerImpl {
   const QString m_path;
   QLocalSocket* m_socket = nullptr;
 
-  QByteArray m_buffer;
+  DaemonProtocol::Reader m_reader;
+  int m_version = DaemonProtocol::VERSION_JSON;
 
   QIODevice* m_logReceiver = nullptr;
 
@@ -99,6 +99,7 @@
 #include <QLocale>
 #include <QQmlApplicationEngine>
 #include <QScreen>
+#include <QStandardPaths>
 #include <QTimer>
 #include <QUrl>
 #include <QUrlQuery>
@@ -262,6 +263,20 @@ void MozillaVPN::initialize() {
 
   m_private->m_ipAddressLookup.initialize();
 
+#ifndef MZ_WASM
+  // The catalogue is a plain file, its digest is kept in the settings with
+  // the server list it was built from.
+  m_private->m_serverCountryModel.setCatalogue(
+      QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation))
+          .filePath("servers.cat"),
+      SettingsHolder::instance()->serversCatalogueDigest());
+  connect(&m_private->m_serverCountryModel,
+          &ServerCountryModel::catalogueWritten, this,
+          [](const QByteArray& fileDigest) {
+            SettingsHolder::instance()->setServersCatalogueDigest(fileDigest);
+          });
+#endif
+
   m_private->m_serverLatency.initialize();
 
   m_private->m_serverData.initialize();
@@ -677,12 +692,12 @@ bool MozillaVPN::setServerList(const QByteArray& serverData) {
   return true;
 }
 
-void MozillaVPN::serversFetched(const QByteArray& serverData) {
+bool MozillaVPN::serversFetched(const QByteArray& serverData) {
   logger.debug() << "Server fetched!";
 
   if (!setServerList(serverData)) {
     // This is OK. The check is done elsewhere.
-    return;
+    return false;
   }
 
   // The serverData could be unset or invalid with the new server list.
@@ -696,6 +711,8 @@ void MozillaVPN::serversFetched(const QByteArray& serverData) {
     m_private->m_serverData.update(city->country(), city->name());
     Q_ASSERT(m_private->m_serverData.hasServerData());
   }
+
+  return true;
 }
 
 void MozillaVPN::deviceRemovalCompleted(const QString& publicKey) {
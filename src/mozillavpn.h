@@ -152,7 +152,7 @@ class MozillaVPN final : public App {
   void removeDevice(const QString& publicKey, const QString& source);
   void deviceRemovalCompleted(const QString& publicKey);
 
-  void serversFetched(const QByteArray& serverData);
+  bool serversFetched(const QByteArray& serverData);
 
   void accountChecked(const QByteArray& json);
 
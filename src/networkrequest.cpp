@@ -138,6 +138,23 @@ void NetworkRequest::auth(const QByteArray& authorizationHeader) {
   m_request.setRawHeader("Authorization", finalAuthorizationHeader);
 }
 
+void NetworkRequest::setValidators(const QByteArray& etag,
+                                   const QByteArray& lastModified) {
+  if (etag.isEmpty() && lastModified.isEmpty()) {
+    return;
+  }
+
+  // If-None-Match takes precedence on the server side, but sending both is
+  // harmless and helps the servers that only know about dates.
+  if (!etag.isEmpty()) {
+    m_request.setRawHeader("If-None-Match", etag);
+  }
+  if (!lastModified.isEmpty()) {
+    m_request.setRawHeader("If-Modified-Since", lastModified);
+  }
+  addExpectedStatus(304);
+}
+
 void NetworkRequest::get(const QUrl& url) {
   m_request.setUrl(url);
   getResource();
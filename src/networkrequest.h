@@ -56,6 +56,11 @@ class NetworkRequest final : public QObject {
 
   void auth(const QByteArray& authorizationHeader = "");
 
+  // Make the request conditional on the resource having changed since a
+  // response carrying these validators. An unchanged resource completes with
+  // the status 304 and no data.
+  void setValidators(const QByteArray& etag, const QByteArray& lastModified);
+
   void disableTimeout();
 
   int statusCode() const;
@@ -138,6 +143,7 @@ class NetworkRequest final : public QObject {
 #ifdef UNIT_TEST
   friend class TestTaskGetFeatureList;
   friend class TestNetworkRequest;
+  friend class TestHelper;
 #endif
 };
 
@@ -27,6 +27,7 @@
 #include "models/server.h"
 #include "mozillavpn.h"
 #include "notificationhandler.h"
+#include "prefixset.h"
 #include "settingsholder.h"
 
 namespace {
@@ -151,18 +152,19 @@ void AndroidController::activate(const InterfaceConfig& config,
   logger.info() << "Server" << logger.sensitive(config.m_serverPublicKey);
   // This could be done better with VpnService.Builder.excludeRoute()
   // but that requires API level 33 (Android 13).
-  const auto lanRoutes = IPAddress::lanAddressRanges();
+  PrefixSet catchAll;
   QJsonArray jAllowedIPs;
   foreach (auto item, config.m_allowedIPAddressRanges) {
     if (item.prefixLength() > 0) {
       jAllowedIPs.append(QJsonValue(item.toString()));
     } else {
-      QList<IPAddress> list = {item};
-      foreach (auto prefix, IPAddress::excludeAddresses(list, lanRoutes)) {
-        jAllowedIPs.append(QJsonValue(prefix.toString()));
-      }
+      catchAll.add(item);
     }
   }
+  catchAll.remove(PrefixSet(IPAddress::lanAddressRanges()));
+  foreach (auto prefix, catchAll.toList()) {
+    jAllowedIPs.append(QJsonValue(prefix.toString()));
+  }
 
   QJsonArray excludedApps;
   foreach (auto appID, config.m_vpnDisabledApps) {
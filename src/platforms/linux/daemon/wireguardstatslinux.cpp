@@ -0,0 +1,390 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "wireguardstatslinux.h"
+
+#include <errno.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/time_types.h>
+#include <linux/wireguard.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QSocketNotifier>
+
+#include "leakdetector.h"
+#include "logger.h"
+
+// How long the statistics read from the kernel are served from the cache.
+// This is shorter than the daemon's handshake polling interval, so that every
+// poll sees fresh data, while bursts of status requests share a single read.
+constexpr int STATS_REFRESH_MSEC = 200;
+
+// How long to wait for the kernel to answer a request before sending another.
+constexpr int STATS_TIMEOUT_MSEC = 1000;
+
+// The most public keys to remember the base64 encoding of.
+constexpr qsizetype MAX_CACHED_KEYS = 64;
+
+namespace {
+Logger logger("WireguardStatsLinux");
+}  // namespace
+
+// Call a function for each netlink attribute in a buffer.
+template <typename F>
+static void nla_for_each(const char* data, size_t len, F&& func) {
+  while (len >= NLA_HDRLEN) {
+    const struct nlattr* attr = reinterpret_cast<const struct nlattr*>(data);
+    if ((attr->nla_len < NLA_HDRLEN) || (attr->nla_len > len)) {
+      return;
+    }
+    func(attr->nla_type & NLA_TYPE_MASK, data + NLA_HDRLEN,
+         attr->nla_len - NLA_HDRLEN);
+
+    size_t step = NLA_ALIGN(attr->nla_len);
+    if (step >= len) {
+      return;
+    }
+    data += step;
+    len -= step;
+  }
+}
+
+static void nlmsg_append_attr(struct nlmsghdr* nlmsg, size_t maxlen,
+                              int attrtype, const void* attrdata,
+                              size_t attrlen) {
+  size_t newlen = NLMSG_ALIGN(nlmsg->nlmsg_len) + NLA_HDRLEN + attrlen;
+  if (newlen <= maxlen) {
+    char* buf = reinterpret_cast<char*>(nlmsg) + NLMSG_ALIGN(nlmsg->nlmsg_len);
+    struct nlattr* attr = reinterpret_cast<struct nlattr*>(buf);
+    attr->nla_type = attrtype;
+    attr->nla_len = NLA_HDRLEN + attrlen;
+    memcpy(buf + NLA_HDRLEN, attrdata, attrlen);
+    nlmsg->nlmsg_len = newlen;
+  }
+}
+
+WireguardStatsLinux::WireguardStatsLinux() {
+  MZ_COUNT_CTOR(WireguardStatsLinux);
+}
+
+WireguardStatsLinux::~WireguardStatsLinux() {
+  MZ_COUNT_DTOR(WireguardStatsLinux);
+  delete m_notifier;
+  if (m_nlsock >= 0) {
+    close(m_nlsock);
+  }
+}
+
+QList<WireguardUtils::PeerStatus> WireguardStatsLinux::peers(
+    const QString& ifname) {
+  if (ifname != m_ifname) {
+    m_peers.clear();
+    m_ifname = ifname;
+    invalidate();
+  }
+
+  if (m_expiry.hasExpired()) {
+    m_deviceWanted = true;
+    update();
+  }
+
+  // This is an implicitly shared copy.
+  return m_peers;
+}
+
+void WireguardStatsLinux::invalidate() {
+  m_expiry = QDeadlineTimer();
+
+  // A dump still in flight may have been taken before the change.
+  if (m_handler == &WireguardStatsLinux::handleDevice) {
+    m_handler = nullptr;
+  }
+}
+
+bool WireguardStatsLinux::open() {
+  if (m_nlsock >= 0) {
+    return true;
+  }
+
+  m_nlsock = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    NETLINK_GENERIC);
+  if (m_nlsock < 0) {
+    logger.warning() << "Failed to create netlink socket:" << strerror(errno);
+    return false;
+  }
+
+  struct sockaddr_nl nladdr;
+  memset(&nladdr, 0, sizeof(nladdr));
+  nladdr.nl_family = AF_NETLINK;
+  if (bind(m_nlsock, (struct sockaddr*)&nladdr, sizeof(nladdr)) != 0) {
+    logger.warning() << "Failed to bind netlink socket:" << strerror(errno);
+    close(m_nlsock);
+    m_nlsock = -1;
+    return false;
+  }
+
+  m_notifier = new QSocketNotifier(m_nlsock, QSocketNotifier::Read);
+  QObject::connect(m_notifier, &QSocketNotifier::activated, m_notifier,
+                   [this]() { update(); });
+  return true;
+}
+
+void WireguardStatsLinux::update() {
+  // Collect whatever has arrived for the request in flight.
+  receive();
+  if (m_handler != nullptr) {
+    if (!m_requestExpiry.hasExpired()) {
+      return;
+    }
+    logger.warning() << "Netlink request timed out";
+    m_handler = nullptr;
+  }
+
+  if (!m_deviceWanted || !open()) {
+    return;
+  }
+
+  // The kernel answers the requests as they are sent, so the replies are
+  // usually queued by the time we look for them.
+  if (m_family == 0) {
+    if (!requestFamily()) {
+      m_deviceWanted = false;
+      return;
+    }
+    receive();
+    if ((m_handler != nullptr) || (m_family == 0)) {
+      return;
+    }
+  }
+
+  m_deviceWanted = false;
+  if (requestDevice()) {
+    receive();
+  }
+}
+
+bool WireguardStatsLinux::requestFamily() {
+  // Look up the generic netlink family of the WireGuard module.
+  char buf[NLMSG_SPACE(GENL_HDRLEN + NLA_HDRLEN + GENL_NAMSIZ)];
+  memset(buf, 0, sizeof(buf));
+  struct nlmsghdr* nlmsg = reinterpret_cast<struct nlmsghdr*>(buf);
+  struct genlmsghdr* genl = static_cast<struct genlmsghdr*>(NLMSG_DATA(nlmsg));
+  nlmsg->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  nlmsg->nlmsg_type = GENL_ID_CTRL;
+  nlmsg->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  genl->cmd = CTRL_CMD_GETFAMILY;
+  genl->version = 1;
+  nlmsg_append_attr(nlmsg, sizeof(buf), CTRL_ATTR_FAMILY_NAME, WG_GENL_NAME,
+                    sizeof(WG_GENL_NAME));
+
+  return send(nlmsg, &WireguardStatsLinux::handleFamily);
+}
+
+bool WireguardStatsLinux::requestDevice() {
+  QByteArray name = m_ifname.toLocal8Bit();
+  if (name.length() >= IFNAMSIZ) {
+    m_peers.clear();
+    return false;
+  }
+
+  char buf[NLMSG_SPACE(GENL_HDRLEN + NLA_HDRLEN + IFNAMSIZ)];
+  memset(buf, 0, sizeof(buf));
+  struct nlmsghdr* nlmsg = reinterpret_cast<struct nlmsghdr*>(buf);
+  struct genlmsghdr* genl = static_cast<struct genlmsghdr*>(NLMSG_DATA(nlmsg));
+  nlmsg->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  nlmsg->nlmsg_type = m_family;
+  nlmsg->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  genl->cmd = WG_CMD_GET_DEVICE;
+  genl->version = WG_GENL_VERSION;
+  nlmsg_append_attr(nlmsg, sizeof(buf), WGDEVICE_A_IFNAME, name.constData(),
+                    name.length() + 1);
+
+  return send(nlmsg, &WireguardStatsLinux::handleDevice);
+}
+
+bool WireguardStatsLinux::send(struct nlmsghdr* nlmsg, Handler handler) {
+  nlmsg->nlmsg_seq = ++m_nlseq;
+
+  struct sockaddr_nl nladdr;
+  memset(&nladdr, 0, sizeof(nladdr));
+  nladdr.nl_family = AF_NETLINK;
+  ssize_t result = sendto(m_nlsock, nlmsg, nlmsg->nlmsg_len, 0,
+                          (struct sockaddr*)&nladdr, sizeof(nladdr));
+  if (result != static_cast<ssize_t>(nlmsg->nlmsg_len)) {
+    logger.warning() << "Netlink send failed:" << strerror(errno);
+    return false;
+  }
+
+  m_handler = handler;
+  m_handlerOkay = true;
+  m_received.clear();
+  m_requestExpiry.setRemainingTime(STATS_TIMEOUT_MSEC);
+  return true;
+}
+
+void WireguardStatsLinux::receive() {
+  if (m_nlsock < 0) {
+    return;
+  }
+
+  // Read replies until the socket is empty. Handling them never sends a new
+  // request, so the buffer is not reused while it is being walked.
+  while (true) {
+    ssize_t len = recv(m_nlsock, m_nlrecvbuf, sizeof(m_nlrecvbuf), 0);
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len < 0 && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      return;
+    }
+    if (len <= 0) {
+      logger.warning() << "Netlink recv failed:" << strerror(errno);
+      if (m_handler != nullptr) {
+        finish(false);
+      }
+      return;
+    }
+
+    struct nlmsghdr* reply = reinterpret_cast<struct nlmsghdr*>(m_nlrecvbuf);
+    for (; NLMSG_OK(reply, len); reply = NLMSG_NEXT(reply, len)) {
+      // Skip the leftovers of a request that timed out or was dropped.
+      if ((m_handler == nullptr) || (reply->nlmsg_seq != m_nlseq)) {
+        continue;
+      }
+      if (reply->nlmsg_type == NLMSG_DONE) {
+        finish(m_handlerOkay);
+        continue;
+      }
+      if (reply->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr* err =
+            static_cast<struct nlmsgerr*>(NLMSG_DATA(reply));
+        if (err->error != 0) {
+          logger.debug() << "Netlink request failed:" << strerror(-err->error);
+        }
+        finish((err->error == 0) && m_handlerOkay);
+        continue;
+      }
+      m_handlerOkay = (this->*m_handler)(reply) && m_handlerOkay;
+    }
+  }
+}
+
+void WireguardStatsLinux::finish(bool okay) {
+  Handler handler = m_handler;
+  m_handler = nullptr;
+
+  if (handler == &WireguardStatsLinux::handleFamily) {
+    if (!okay || (m_family == 0)) {
+      logger.warning() << "Failed to find the wireguard netlink family";
+      m_family = 0;
+      m_deviceWanted = false;
+    }
+    return;
+  }
+
+  if (!okay) {
+    logger.warning() << "Unable to get stats for" << m_ifname;
+    m_peers.clear();
+  } else {
+    m_peers = m_received;
+    m_expiry.setRemainingTime(STATS_REFRESH_MSEC);
+  }
+  m_received.clear();
+}
+
+bool WireguardStatsLinux::handleFamily(const struct nlmsghdr* nlmsg) {
+  if (nlmsg->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
+    return false;
+  }
+  const char* data = static_cast<const char*>(NLMSG_DATA(nlmsg)) + GENL_HDRLEN;
+  size_t len = nlmsg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+  nla_for_each(data, len, [&](int type, const char* value, size_t vlen) {
+    if ((type == CTRL_ATTR_FAMILY_ID) && (vlen >= sizeof(quint16))) {
+      memcpy(&m_family, value, sizeof(quint16));
+    }
+  });
+  return true;
+}
+
+bool WireguardStatsLinux::handleDevice(const struct nlmsghdr* nlmsg) {
+  if (nlmsg->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
+    return false;
+  }
+  // A device with many peers is split over several messages.
+  const char* data = static_cast<const char*>(NLMSG_DATA(nlmsg)) + GENL_HDRLEN;
+  size_t len = nlmsg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+  nla_for_each(data, len, [&](int type, const char* value, size_t vlen) {
+    if (type != WGDEVICE_A_PEERS) {
+      return;
+    }
+    nla_for_each(value, vlen, [&](int, const char* peer, size_t plen) {
+      parsePeer(peer, plen);
+    });
+  });
+  return true;
+}
+
+void WireguardStatsLinux::parsePeer(const char* data, size_t len) {
+  WireguardUtils::PeerStatus status;
+  QByteArray pubkey;
+  bool hasStats = false;
+
+  nla_for_each(data, len, [&](int type, const char* value, size_t vlen) {
+    switch (type) {
+      case WGPEER_A_PUBLIC_KEY:
+        if (vlen == WG_KEY_LEN) {
+          pubkey = QByteArray(value, WG_KEY_LEN);
+        }
+        break;
+
+      case WGPEER_A_LAST_HANDSHAKE_TIME:
+        if (vlen == sizeof(struct __kernel_timespec)) {
+          struct __kernel_timespec ts;
+          memcpy(&ts, value, sizeof(ts));
+          status.m_handshake = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        }
+        break;
+
+      case WGPEER_A_RX_BYTES:
+        if (vlen == sizeof(quint64)) {
+          memcpy(&status.m_rxBytes, value, sizeof(quint64));
+          hasStats = true;
+        }
+        break;
+
+      case WGPEER_A_TX_BYTES:
+        if (vlen == sizeof(quint64)) {
+          memcpy(&status.m_txBytes, value, sizeof(quint64));
+          hasStats = true;
+        }
+        break;
+
+      default:
+        break;
+    }
+  });
+
+  // A peer that continues from the previous message only carries the rest of
+  // its allowed IPs, and no statistics.
+  if (pubkey.isEmpty() || !hasStats) {
+    return;
+  }
+
+  auto it = m_keys.find(pubkey);
+  if (it == m_keys.end()) {
+    if (m_keys.count() >= MAX_CACHED_KEYS) {
+      m_keys.clear();
+    }
+    it = m_keys.insert(pubkey, QString::fromLatin1(pubkey.toBase64()));
+  }
+  status.m_pubkey = it.value();
+
+  MZ_LOG(logger, Debug) << "found" << logger.keys(status.m_pubkey)
+                        << "handshake" << status.m_handshake / 1000;
+  m_received.append(status);
+}
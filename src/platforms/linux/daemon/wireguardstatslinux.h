@@ -0,0 +1,85 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef WIREGUARDSTATSLINUX_H
+#define WIREGUARDSTATSLINUX_H
+
+#include <QByteArray>
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QList>
+
+#include "daemon/wireguardutils.h"
+
+class QSocketNotifier;
+struct nlmsghdr;
+
+// Reads the peer statistics of a WireGuard interface over a generic netlink
+// socket that is kept open between reads. The statistics are cached, and are
+// re-read from the kernel at most once per refresh interval no matter how many
+// callers ask for them. The socket never blocks: the replies the kernel has
+// already queued are collected right away, and the rest are collected by a
+// socket notifier as they arrive.
+class WireguardStatsLinux final {
+  Q_DISABLE_COPY_MOVE(WireguardStatsLinux)
+
+ public:
+  WireguardStatsLinux();
+  ~WireguardStatsLinux();
+
+  /**
+   * @brief Get the statistics of the peers of an interface.
+   *
+   * @param ifname - the name of the WireGuard interface
+   * @return QList<PeerStatus> - the cached statistics. If they are out of
+   * date, they are re-read from the kernel first, unless the kernel doesn't
+   * answer right away, in which case they are updated when it does.
+   */
+  QList<WireguardUtils::PeerStatus> peers(const QString& ifname);
+
+  // Drop the cached statistics, so that the next read goes to the kernel.
+  // This should be called whenever the peers are changed.
+  void invalidate();
+
+ private:
+  using Handler = bool (WireguardStatsLinux::*)(const struct nlmsghdr*);
+
+  bool open();
+  void update();
+  bool requestFamily();
+  bool requestDevice();
+  bool send(struct nlmsghdr* nlmsg, Handler handler);
+  void receive();
+  void finish(bool okay);
+  bool handleFamily(const struct nlmsghdr* nlmsg);
+  bool handleDevice(const struct nlmsghdr* nlmsg);
+  void parsePeer(const char* data, size_t len);
+
+  int m_nlsock = -1;
+  QSocketNotifier* m_notifier = nullptr;
+  quint16 m_family = 0;
+  quint32 m_nlseq = 0;
+
+  // The request awaiting its replies, if any, and whether the replies so far
+  // were handled successfully.
+  Handler m_handler = nullptr;
+  bool m_handlerOkay = true;
+  QDeadlineTimer m_requestExpiry;
+
+  QString m_ifname;
+  QList<WireguardUtils::PeerStatus> m_peers;
+  QDeadlineTimer m_expiry;
+
+  // Whether the statistics must be re-read once the family is known, and the
+  // statistics of the dump in progress.
+  bool m_deviceWanted = false;
+  QList<WireguardUtils::PeerStatus> m_received;
+
+  // Base64 encoding of the public keys seen so far, indexed by raw key.
+  QHash<QByteArray, QString> m_keys;
+
+  char m_nlrecvbuf[32768];
+};
+
+#endif  // WIREGUARDSTATSLINUX_H
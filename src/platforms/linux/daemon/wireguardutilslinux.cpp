@@ -44,6 +44,13 @@ extern "C" {
 constexpr uint32_t WG_FIREWALL_MARK = 0xca6c;
 constexpr uint32_t WG_ROUTE_TABLE = 0xca6c;
 
+/* Netlink requests are sent in batches of up to this many bytes. The kernel
+ * handles a batch within a single sendmsg() call, and queues up the ACKs for
+ * every request in it, so the receive buffer must have room for them.
+ */
+constexpr int NETLINK_BATCH_SIZE = 16384;
+constexpr int NETLINK_RCVBUF_SIZE = 262144;
+
 /* Traffic classifiers can be used to mark packets which should be either
  * excluded from the VPN tunnel, or blocked entirely. The values of these
  * classifiers aren't important so long as they are unique.
@@ -77,9 +84,16 @@ WireguardUtilsLinux::WireguardUtilsLinux(QObject* parent)
   if (setsockopt(m_nlsock, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) < 0) {
     logger.warning() << "Failed to set SO_SNDBUF:" << strerror(errno);
   }
+  val = NETLINK_RCVBUF_SIZE;
   if (setsockopt(m_nlsock, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) < 0) {
     logger.warning() << "Failed to set SO_RCVBUF:" << strerror(errno);
   }
+  // Don't echo the whole request back in every ACK.
+  val = 1;
+  if (setsockopt(m_nlsock, SOL_NETLINK, NETLINK_CAP_ACK, &val, sizeof(val)) <
+      0) {
+    logger.warning() << "Failed to set NETLINK_CAP_ACK:" << strerror(errno);
+  }
 
   struct sockaddr_nl nladdr;
   memset(&nladdr, 0, sizeof(nladdr));
@@ -123,6 +137,7 @@ WireguardUtilsLinux::WireguardUtilsLinux(QObject* parent)
 
 WireguardUtilsLinux::~WireguardUtilsLinux() {
   MZ_COUNT_DTOR(WireguardUtilsLinux);
+  nlsockFlush();
   if (m_nlsock >= 0) {
     close(m_nlsock);
   }
@@ -195,6 +210,7 @@ bool WireguardUtilsLinux::addInterface(const InterfaceConfig& config) {
 }
 
 bool WireguardUtilsLinux::updatePeer(const InterfaceConfig& config) {
+  m_stats.invalidate();
   wg_device* device = static_cast<wg_device*>(calloc(1, sizeof(*device)));
   if (!device) {
     logger.error() << "Allocation failure";
@@ -264,6 +280,7 @@ bool WireguardUtilsLinux::updatePeer(const InterfaceConfig& config) {
 }
 
 bool WireguardUtilsLinux::deletePeer(const InterfaceConfig& config) {
+  m_stats.invalidate();
   wg_device* device = static_cast<wg_device*>(calloc(1, sizeof(*device)));
   if (!device) {
     logger.error() << "Allocation failure";
@@ -308,6 +325,7 @@ bool WireguardUtilsLinux::deletePeer(const InterfaceConfig& config) {
 }
 
 bool WireguardUtilsLinux::deleteInterface() {
+  m_stats.invalidate();
   if (!m_firewall.down()) {
     return false;
   }
@@ -320,6 +338,9 @@ bool WireguardUtilsLinux::deleteInterface() {
     return false;
   }
 
+  // Send any pending route changes before the interface goes away.
+  nlsockFlush();
+
   // Delete the interface
   int returnCode = wg_del_device(WG_INTERFACE);
   if (returnCode != 0) {
@@ -331,30 +352,7 @@ bool WireguardUtilsLinux::deleteInterface() {
 }
 
 QList<WireguardUtils::PeerStatus> WireguardUtilsLinux::getPeerStatus() {
-  wg_device* device = nullptr;
-  wg_peer* peer = nullptr;
-  QList<WireguardUtils::PeerStatus> peerList;
-
-  if (wg_get_device(&device, WG_INTERFACE) != 0) {
-    logger.warning() << "Unable to get stats for" << WG_INTERFACE;
-    return peerList;
-  }
-
-  wg_for_each_peer(device, peer) {
-    PeerStatus status;
-    wg_key_b64_string keystring;
-    wg_key_to_base64(keystring, peer->public_key);
-    status.m_pubkey = QString(keystring);
-    status.m_handshake = peer->last_handshake_time.tv_sec * 1000;
-    status.m_handshake += peer->last_handshake_time.tv_nsec / 1000000;
-    status.m_txBytes = peer->tx_bytes;
-    status.m_rxBytes = peer->rx_bytes;
-    logger.debug() << "found" << logger.keys(status.m_pubkey) << "handshake"
-                   << peer->last_handshake_time.tv_sec;
-    peerList.append(status);
-  }
-  wg_free_device(device);
-  return peerList;
+  return m_stats.peers(WG_INTERFACE);
 }
 
 bool WireguardUtilsLinux::updateRoutePrefix(const IPAddress& prefix) {
@@ -500,9 +498,6 @@ bool WireguardUtilsLinux::rtmSendRule(int action, int flags, int addrfamily) {
   struct nlmsghdr* nlmsg = reinterpret_cast<struct nlmsghdr*>(buf);
   struct fib_rule_hdr* rule =
       static_cast<struct fib_rule_hdr*>(NLMSG_DATA(nlmsg));
-  struct sockaddr_nl nladdr;
-  memset(&nladdr, 0, sizeof(nladdr));
-  nladdr.nl_family = AF_NETLINK;
 
   /* Create a routing policy rule to select the wireguard routing table for
    * unmarked packets. This is equivalent to:
@@ -520,9 +515,10 @@ bool WireguardUtilsLinux::rtmSendRule(int action, int flags, int addrfamily) {
   rule->flags = FIB_RULE_INVERT;
   nlmsg_append_attr32(nlmsg, sizeof(buf), FRA_FWMARK, WG_FIREWALL_MARK);
   nlmsg_append_attr32(nlmsg, sizeof(buf), FRA_TABLE, WG_ROUTE_TABLE);
-  ssize_t result = sendto(m_nlsock, buf, nlmsg->nlmsg_len, 0,
-                          (struct sockaddr*)&nladdr, sizeof(nladdr));
-  return (result == static_cast<ssize_t>(nlmsg->nlmsg_len));
+
+  QString request = (action == RTM_NEWRULE) ? "add rule" : "delete rule";
+  request += (addrfamily == AF_INET6) ? " IPv6" : " IPv4";
+  return nlsockQueue(nlmsg, request);
 }
 
 bool WireguardUtilsLinux::rtmSendRoute(int action, const IPAddress& dest,
@@ -563,12 +559,8 @@ bool WireguardUtilsLinux::rtmSendRoute(int action, const IPAddress& dest,
     nlmsg_append_attr32(nlmsg, sizeof(buf), RTA_OIF, m_ifindex);
   }
 
-  struct sockaddr_nl nladdr;
-  memset(&nladdr, 0, sizeof(nladdr));
-  nladdr.nl_family = AF_NETLINK;
-  ssize_t result = sendto(m_nlsock, buf, nlmsg->nlmsg_len, 0,
-                          (struct sockaddr*)&nladdr, sizeof(nladdr));
-  return (result == static_cast<ssize_t>(nlmsg->nlmsg_len));
+  QString request = (action == RTM_NEWROUTE) ? "add route" : "delete route";
+  return nlsockQueue(nlmsg, request + " " + dest.toString());
 }
 
 bool WireguardUtilsLinux::rtmIncludePeer(int action, const IPAddress& prefix,
@@ -581,9 +573,6 @@ bool WireguardUtilsLinux::rtmIncludePeer(int action, const IPAddress& prefix,
   struct nlmsghdr* nlmsg = reinterpret_cast<struct nlmsghdr*>(buf);
   struct fib_rule_hdr* rule =
       static_cast<struct fib_rule_hdr*>(NLMSG_DATA(nlmsg));
-  struct sockaddr_nl nladdr;
-  memset(&nladdr, 0, sizeof(nladdr));
-  nladdr.nl_family = AF_NETLINK;
 
   // Create a routing policy rule to select the wireguard routing table for
   // marked packets matching the destination address. This is equivalent to:
@@ -613,19 +602,108 @@ bool WireguardUtilsLinux::rtmIncludePeer(int action, const IPAddress& prefix,
     return false;
   }
 
-  ssize_t result =
-      sendto(m_nlsock, buf, nlmsg->nlmsg_len, 0,
-             reinterpret_cast<struct sockaddr*>(&nladdr), sizeof(nladdr));
-  return (result == static_cast<ssize_t>(nlmsg->nlmsg_len));
+  QString request = (action == RTM_NEWRULE) ? "add rule" : "delete rule";
+  return nlsockQueue(nlmsg, request + " " + prefix.toString());
+}
+
+bool WireguardUtilsLinux::nlsockQueue(struct nlmsghdr* nlmsg,
+                                      const QString& request) {
+  const int len = NLMSG_ALIGN(nlmsg->nlmsg_len);
+  if (m_nlbatches.isEmpty() ||
+      ((m_nlbatches.last().size() + len) > NETLINK_BATCH_SIZE)) {
+    m_nlbatches.append(QByteArray());
+  }
+
+  // The message buffers are zeroed, so the alignment padding is too.
+  m_nlbatches.last().append(reinterpret_cast<const char*>(nlmsg), len);
+  if (nlmsg->nlmsg_flags & NLM_F_ACK) {
+    m_nlpending.insert(nlmsg->nlmsg_seq, request);
+  }
+  return true;
+}
+
+bool WireguardUtilsLinux::flushRoutes() { return nlsockFlush(); }
+
+bool WireguardUtilsLinux::nlsockFlush() {
+  int failures = m_nlfailures;
+
+  // Send one batch at a time and collect its replies before the next, so
+  // that the ACKs never overflow the receive buffer. The replies may queue up
+  // more requests, which are picked up by the next iteration.
+  while (!m_nlbatches.isEmpty()) {
+    QByteArray batch = m_nlbatches.takeFirst();
+    if (!nlsockSend(batch)) {
+      m_nlbatches.clear();
+      m_nlpending.clear();
+      return false;
+    }
+
+    // The kernel has already handled the batch by the time sendmsg()
+    // returns, so the ACKs are all there to collect.
+    nlsockDrain();
+  }
+
+  return m_nlfailures == failures;
+}
+
+bool WireguardUtilsLinux::nlsockSend(QByteArray& batch) {
+  struct sockaddr_nl nladdr;
+  memset(&nladdr, 0, sizeof(nladdr));
+  nladdr.nl_family = AF_NETLINK;
+
+  struct iovec iov;
+  iov.iov_base = batch.data();
+  iov.iov_len = batch.size();
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &nladdr;
+  msg.msg_namelen = sizeof(nladdr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  ssize_t result = sendmsg(m_nlsock, &msg, 0);
+  if (result != static_cast<ssize_t>(iov.iov_len)) {
+    logger.warning() << "Netlink send failed:" << strerror(errno);
+    return false;
+  }
+  return true;
 }
 
 void WireguardUtilsLinux::nlsockReady() {
-  ssize_t len = recv(m_nlsock, m_nlrecvbuf, sizeof(m_nlrecvbuf), MSG_DONTWAIT);
-  if (len <= 0) {
+  nlsockDrain();
+
+  // Send the requests made in response to the replies, such as the removal
+  // of the LAN exclusions when the interface goes away.
+  nlsockFlush();
+}
+
+void WireguardUtilsLinux::nlsockDrain() {
+  // Drain the socket, a batch of requests produces many replies. The replies
+  // are handled before the next recv() reuses the buffer, and handling them
+  // only queues up new requests.
+  while (true) {
+    ssize_t len =
+        recv(m_nlsock, m_nlrecvbuf, sizeof(m_nlrecvbuf), MSG_DONTWAIT);
+    if (len > 0) {
+      nlsockHandleBuffer(len);
+      continue;
+    }
+    if ((len < 0) && (errno == ENOBUFS)) {
+      logger.warning() << "Netlink replies lost:" << m_nlpending.count()
+                       << "requests unacknowledged";
+      m_nlpending.clear();
+      continue;
+    }
+    if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      return;
+    }
     logger.warning() << "Netlink recv failed:" << strerror(errno);
     return;
   }
+}
 
+void WireguardUtilsLinux::nlsockHandleBuffer(qint64 len) {
   struct nlmsghdr* nlmsg;
   for (nlmsg = (struct nlmsghdr*)m_nlrecvbuf; NLMSG_OK(nlmsg, len);
        nlmsg = NLMSG_NEXT(nlmsg, len)) {
@@ -639,8 +717,11 @@ void WireguardUtilsLinux::nlsockReady() {
 
       case NLMSG_ERROR: {
         struct nlmsgerr* err = static_cast<struct nlmsgerr*>(NLMSG_DATA(nlmsg));
+        QString request = m_nlpending.take(nlmsg->nlmsg_seq);
         if (err->error != 0) {
-          logger.debug() << "Netlink request failed:" << strerror(-err->error);
+          logger.warning() << "Netlink request failed:" << request
+                           << strerror(-err->error);
+          m_nlfailures++;
         }
         break;
       }
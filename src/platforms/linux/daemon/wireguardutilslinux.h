@@ -5,6 +5,8 @@
 #ifndef WIREGUARDUTILSLINUX_H
 #define WIREGUARDUTILSLINUX_H
 
+#include <QByteArray>
+#include <QHash>
 #include <QHostAddress>
 #include <QObject>
 #include <QSocketNotifier>
@@ -12,6 +14,7 @@
 
 #include "daemon/wireguardutils.h"
 #include "linuxfirewall.h"
+#include "wireguardstatslinux.h"
 
 struct nlmsghdr;
 
@@ -32,6 +35,7 @@ class WireguardUtilsLinux final : public WireguardUtils {
   bool updateRoutePrefix(const IPAddress& prefix) override;
   bool deleteRoutePrefix(const IPAddress& prefix) override;
   bool excludeLocalNetworks(const QList<IPAddress>& lanAddressRanges) override;
+  bool flushRoutes() override;
 
   void excludeCgroup(const QString& cgroup);
   void resetCgroup(const QString& cgroup);
@@ -47,6 +51,12 @@ class WireguardUtilsLinux final : public WireguardUtils {
   bool rtmSendRoute(int action, const IPAddress& prefix, int type,
                     int flags = 0);
 
+  bool nlsockQueue(struct nlmsghdr* nlmsg, const QString& request);
+  bool nlsockFlush();
+  bool nlsockSend(QByteArray& batch);
+  void nlsockDrain();
+  void nlsockHandleBuffer(qint64 len);
+
   void nlsockHandleNewlink(struct nlmsghdr* nlmsg);
   void nlsockHandleDellink(struct nlmsghdr* nlmsg);
   static bool setupCgroupClass(const QString& path, unsigned long classid);
@@ -57,6 +67,16 @@ class WireguardUtilsLinux final : public WireguardUtils {
   int m_nlseq = 0;
   char m_nlrecvbuf[32768];
   QSocketNotifier* m_notifier = nullptr;
+  WireguardStatsLinux m_stats;
+
+  // Netlink requests are queued up in batches and sent by flushRoutes().
+  // Queueing never sends anything, so that requests made while handling the
+  // replies are only sent once the receive buffer has been fully handled.
+  // Requests awaiting an ACK are tracked by sequence number so that errors can
+  // be traced back to them.
+  QList<QByteArray> m_nlbatches;
+  QHash<quint32, QString> m_nlpending;
+  int m_nlfailures = 0;
 
   int m_cgroupVersion = 0;
   QString m_cgroupNetClass;
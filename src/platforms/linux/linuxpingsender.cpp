@@ -11,6 +11,7 @@
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <QSocketNotifier>
@@ -21,7 +22,14 @@
 
 namespace {
 Logger logger("LinuxPingSender");
-}
+
+// The most packets submitted or drained by a single system call.
+constexpr const int PING_BATCH_SIZE = 32;
+
+// Replies to our echo requests carry no payload, this leaves plenty of room
+// for the IP header when reading from a raw socket.
+constexpr const int PING_RECV_BUFFER_SIZE = 2048;
+}  // namespace
 
 int LinuxPingSender::createSocket() {
   // Try creating an ICMP socket. This would be the ideal choice, but it can
@@ -76,6 +84,14 @@ LinuxPingSender::LinuxPingSender(const QHostAddress& source, QObject* parent)
     return;
   }
 
+  // Have the kernel timestamp the replies as they arrive, so that the latency
+  // doesn't include the time spent waiting for the event loop.
+  int enable = 1;
+  if (setsockopt(m_socket, SOL_SOCKET, SO_TIMESTAMPNS, &enable,
+                 sizeof(enable)) != 0) {
+    logger.warning() << "Failed to enable timestamps:" << strerror(errno);
+  }
+
   quint32 ipv4addr = INADDR_ANY;
   if (!source.isNull()) {
     ipv4addr = source.toIPv4Address();
@@ -93,13 +109,8 @@ LinuxPingSender::LinuxPingSender(const QHostAddress& source, QObject* parent)
   }
 
   m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
-  if (m_ident) {
-    connect(m_notifier, &QSocketNotifier::activated, this,
-            &LinuxPingSender::rawSocketReady);
-  } else {
-    connect(m_notifier, &QSocketNotifier::activated, this,
-            &LinuxPingSender::icmpSocketReady);
-  }
+  connect(m_notifier, &QSocketNotifier::activated, this,
+          &LinuxPingSender::socketReady);
 }
 
 LinuxPingSender::~LinuxPingSender() {
@@ -110,72 +121,148 @@ LinuxPingSender::~LinuxPingSender() {
 }
 
 void LinuxPingSender::sendPing(const QHostAddress& dest, quint16 sequence) {
-  quint32 ipv4dest = dest.toIPv4Address();
-  struct sockaddr_in addr;
-  memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = qToBigEndian<quint32>(ipv4dest);
+  sendPings(QList<QHostAddress>{dest}, sequence);
+}
 
-  struct icmphdr packet;
-  memset(&packet, 0, sizeof(packet));
-  packet.type = ICMP_ECHO;
-  packet.un.echo.id = htons(m_ident);
-  packet.un.echo.sequence = htons(sequence);
-  packet.checksum = inetChecksum(&packet, sizeof(packet));
-
-  int rc = sendto(m_socket, &packet, sizeof(packet), 0, (struct sockaddr*)&addr,
-                  sizeof(addr));
-  if (rc < 0) {
-    logger.error() << "failed to send:" << strerror(errno);
+void LinuxPingSender::sendPings(const QList<QHostAddress>& destinations,
+                                quint16 sequence) {
+  struct sockaddr_in addrs[PING_BATCH_SIZE];
+  struct icmphdr packets[PING_BATCH_SIZE];
+  struct iovec iovecs[PING_BATCH_SIZE];
+  struct mmsghdr msgs[PING_BATCH_SIZE];
+
+  qsizetype offset = 0;
+  while (offset < destinations.count()) {
+    int count = qMin<qsizetype>(destinations.count() - offset, PING_BATCH_SIZE);
+    for (int i = 0; i < count; i++) {
+      quint32 ipv4dest = destinations.at(offset + i).toIPv4Address();
+      memset(&addrs[i], 0, sizeof(addrs[i]));
+      addrs[i].sin_family = AF_INET;
+      addrs[i].sin_addr.s_addr = qToBigEndian<quint32>(ipv4dest);
+
+      memset(&packets[i], 0, sizeof(packets[i]));
+      packets[i].type = ICMP_ECHO;
+      packets[i].un.echo.id = htons(m_ident);
+      packets[i].un.echo.sequence = htons(sequence++);
+      packets[i].checksum = inetChecksum(&packets[i], sizeof(packets[i]));
+
+      iovecs[i].iov_base = &packets[i];
+      iovecs[i].iov_len = sizeof(packets[i]);
+
+      memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_name = &addrs[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // sendmmsg() stops at the first packet that fails, and only reports the
+    // error if it was the first one of the batch. Skip over it and carry on
+    // with the rest.
+    int sent = 0;
+    while (sent < count) {
+      int rc = sendmmsg(m_socket, msgs + sent, count - sent, 0);
+      if (rc < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        logger.error() << "failed to send:" << strerror(errno);
+        rc = 1;
+      }
+      sent += rc;
+    }
+    offset += count;
   }
 }
 
-void LinuxPingSender::icmpSocketReady() {
-  socklen_t slen = 0;
-  unsigned char data[2048];
-  int rc = recvfrom(m_socket, data, sizeof(data), MSG_DONTWAIT, NULL, &slen);
-  if (rc <= 0) {
-    logger.error() << "recvfrom failed:" << strerror(errno);
-    return;
+void LinuxPingSender::socketReady() {
+  unsigned char buffers[PING_BATCH_SIZE][PING_RECV_BUFFER_SIZE];
+  alignas(struct cmsghdr) unsigned char
+      controls[PING_BATCH_SIZE][CMSG_SPACE(sizeof(struct timespec))];
+  struct iovec iovecs[PING_BATCH_SIZE];
+  struct mmsghdr msgs[PING_BATCH_SIZE];
+
+  // Drain everything that is queued on the socket, a batch at a time.
+  while (true) {
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < PING_BATCH_SIZE; i++) {
+      iovecs[i].iov_base = buffers[i];
+      iovecs[i].iov_len = sizeof(buffers[i]);
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_control = controls[i];
+      msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+    }
+
+    int rc = recvmmsg(m_socket, msgs, PING_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        logger.error() << "recvmmsg failed:" << strerror(errno);
+      }
+      return;
+    }
+
+    for (int i = 0; i < rc; i++) {
+      struct msghdr* hdr = &msgs[i].msg_hdr;
+      qint64 timestamp = 0;
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) &&
+            (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+          struct timespec ts;
+          memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+          timestamp = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+        }
+      }
+
+      if (m_ident) {
+        rawReply(buffers[i], msgs[i].msg_len, timestamp);
+      } else {
+        icmpReply(buffers[i], msgs[i].msg_len, timestamp);
+      }
+    }
+
+    if (rc < PING_BATCH_SIZE) {
+      return;
+    }
   }
+}
 
+void LinuxPingSender::icmpReply(const unsigned char* data, int length,
+                                qint64 timestamp) {
   struct icmphdr packet;
-  if (rc >= (int)sizeof(packet)) {
+  if (length >= (int)sizeof(packet)) {
     memcpy(&packet, data, sizeof(packet));
     if (packet.type == ICMP_ECHOREPLY) {
-      emit recvPing(htons(packet.un.echo.sequence));
+      emit recvPing(htons(packet.un.echo.sequence), timestamp);
     }
   }
 }
 
-void LinuxPingSender::rawSocketReady() {
-  socklen_t slen = 0;
-  unsigned char data[2048];
-  int rc = recvfrom(m_socket, data, sizeof(data), MSG_DONTWAIT, NULL, &slen);
-  if (rc <= 0) {
-    logger.error() << "recvfrom failed:" << strerror(errno);
-    return;
-  }
-
+void LinuxPingSender::rawReply(const unsigned char* data, int length,
+                               qint64 timestamp) {
   // Check the IP header
   const struct iphdr* ip = (struct iphdr*)data;
   int iphdrlen = ip->ihl * 4;
-  if (rc < iphdrlen || iphdrlen < (int)sizeof(struct iphdr)) {
-    logger.error() << "malformed IP packet:" << strerror(errno);
+  if (length < iphdrlen || iphdrlen < (int)sizeof(struct iphdr)) {
+    logger.error() << "malformed IP packet";
     return;
   }
 
   // Check the ICMP packet
   struct icmphdr packet;
-  if (inetChecksum(data + iphdrlen, rc - iphdrlen) != 0) {
+  if (inetChecksum(data + iphdrlen, length - iphdrlen) != 0) {
     logger.warning() << "invalid checksum";
     return;
   }
-  if (rc >= (iphdrlen + (int)sizeof(packet))) {
+  if (length >= (iphdrlen + (int)sizeof(packet))) {
     memcpy(&packet, data + iphdrlen, sizeof(packet));
     quint16 id = htons(m_ident);
     if ((packet.type == ICMP_ECHOREPLY) && (packet.un.echo.id == id)) {
-      emit recvPing(htons(packet.un.echo.sequence));
+      emit recvPing(htons(packet.un.echo.sequence), timestamp);
     }
   }
 }
@@ -22,13 +22,16 @@ class LinuxPingSender final : public PingSender {
   bool isValid() override { return (m_socket >= 0); };
 
   void sendPing(const QHostAddress& dest, quint16 sequence) override;
+  void sendPings(const QList<QHostAddress>& destinations,
+                 quint16 sequence) override;
 
  private:
   int createSocket();
+  void rawReply(const unsigned char* data, int length, qint64 timestamp);
+  void icmpReply(const unsigned char* data, int length, qint64 timestamp);
 
  private slots:
-  void rawSocketReady();
-  void icmpSocketReady();
+  void socketReady();
 
  private:
   QSocketNotifier* m_notifier = nullptr;
@@ -4,23 +4,41 @@
 
 #include "serverlatency.h"
 
+#include <QCryptographicHash>
 #include <QDateTime>
+#include <QDir>
+#include <QMessageAuthenticationCode>
+#include <QRandomGenerator>
+#include <QStandardPaths>
+#include <QtEndian>
+#include <algorithm>
+#include <chrono>
 
 #include "controller.h"
 #include "feature/feature.h"
 #include "leakdetector.h"
 #include "logger.h"
-#include "mfbt/checkedint.h"
 #include "models/location.h"
 #include "models/servercountrymodel.h"
 #include "mozillavpn.h"
 #include "pingsenderfactory.h"
+#include "settingsholder.h"
 #include "tcppingsender.h"
 
-constexpr const int SERVER_LATENCY_MAX_PARALLEL = 8;
+// Probes are paced by a token bucket: up to SERVER_LATENCY_BURST of them are
+// sent in one go, then SERVER_LATENCY_RATE per second, in batches of
+// SERVER_LATENCY_BATCH to keep the number of wakeups and system calls down.
+constexpr const int SERVER_LATENCY_BURST = 32;
+constexpr const int SERVER_LATENCY_BATCH = 16;
+constexpr const int SERVER_LATENCY_RATE = 200;
 
 constexpr const int SERVER_LATENCY_MAX_RETRIES = 2;
 
+// The number of slots tracking the pings awaiting a reply. This must exceed
+// the number of pings that can be sent within a timeout, or the sweep stalls
+// until a slot frees up.
+constexpr const int SERVER_LATENCY_SLOTS = 4096;
+
 // Minimum number of redundant servers we expect at a location.
 constexpr int SCORE_SERVER_REDUNDANCY_THRESHOLD = 3;
 
@@ -32,10 +50,89 @@ Logger logger("ServerLatency");
 
 using namespace std::chrono_literals;
 constexpr const std::chrono::milliseconds SERVER_LATENCY_TIMEOUT = 5s;
+// The granularity of the timeout wheel, a ping may time out this much late.
+constexpr const std::chrono::milliseconds SERVER_LATENCY_TICK = 100ms;
 constexpr const auto SERVER_LATENCY_INITIAL = 1s;
 constexpr const auto SERVER_LATENCY_REFRESH = 30min;
 // Delay the progressChanged() signal to rate-limit how often score changes.
 constexpr const auto SERVER_LATENCY_PROGRESS_DELAY = 500ms;
+
+constexpr const int NETWORK_KEY_SIZE = 32;
+
+// Pacing and timeouts use a monotonic clock, so that they are not thrown off
+// when the system clock is adjusted.
+qint64 currentUsecs() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+// The same clock as the kernel uses to timestamp packets.
+qint64 currentUsecsSinceEpoch() {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+constexpr const qint64 TIMEOUT_USEC =
+    std::chrono::microseconds(SERVER_LATENCY_TIMEOUT).count();
+constexpr const qint64 TICK_USEC =
+    std::chrono::microseconds(SERVER_LATENCY_TICK).count();
+
+QString storeFileName() {
+#ifdef MZ_WASM
+  return QString();
+#else
+  QDir dir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+  return dir.filePath("latency.dat");
+#endif
+}
+
+// The network identity is written to the latency store in the clear, so it is
+// keyed with a random secret kept in the settings. Otherwise, the location and
+// the network prefix could be recovered by trying them all.
+QByteArray networkKey() {
+  SettingsHolder* settingsHolder = SettingsHolder::instance();
+  QByteArray key = settingsHolder->serverLatencyNetworkKey();
+  if (key.length() == NETWORK_KEY_SIZE) {
+    return key;
+  }
+
+  QRandomGenerator* generator = QRandomGenerator::system();
+  Q_ASSERT(generator);
+
+  key.resize(NETWORK_KEY_SIZE);
+  generator->fillRange(reinterpret_cast<quint32*>(key.data()),
+                       NETWORK_KEY_SIZE / sizeof(quint32));
+  settingsHolder->setServerLatencyNetworkKey(key);
+  return key;
+}
+
+// Identify the network we measure from by where we appear to be, and by the
+// public address truncated to the size of a typical provider allocation.
+quint64 networkIdentity(const Location* location) {
+  if (!location->initialized()) {
+    return 0;
+  }
+
+  QMessageAuthenticationCode hash(QCryptographicHash::Sha256, networkKey());
+  hash.addData(location->countryCode().toUtf8());
+  hash.addData(location->subdivision().toUtf8());
+  hash.addData(location->cityName().toUtf8());
+
+  QHostAddress address = location->ipAddress();
+  if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+    quint32 prefix = qToBigEndian<quint32>(address.toIPv4Address() & ~0xffu);
+    hash.addData(QByteArray(reinterpret_cast<const char*>(&prefix), 4));
+  } else if (address.protocol() == QAbstractSocket::IPv6Protocol) {
+    Q_IPV6ADDR raw = address.toIPv6Address();
+    hash.addData(QByteArray(reinterpret_cast<const char*>(&raw), 6));
+  }
+  return qFromLittleEndian<quint64>(hash.result().constData());
+}
+
+template <typename T>
+bool fartherThan(const T& a, const T& b) {
+  return a.distance > b.distance;
+}
 }  // namespace
 
 ServerLatency::ServerLatency() { MZ_COUNT_CTOR(ServerLatency); }
@@ -45,9 +142,22 @@ ServerLatency::~ServerLatency() { MZ_COUNT_DTOR(ServerLatency); }
 void ServerLatency::initialize() {
   MozillaVPN* vpn = MozillaVPN::instance();
 
+  // Seed the scores with what we measured last time, until a sweep completes.
+  QString fileName = storeFileName();
+  if (!fileName.isEmpty()) {
+    m_store.open(fileName);
+  }
+  m_network = m_store.lastNetwork();
+  warmStart();
+
+  connect(vpn->serverCountryModel(), &ServerCountryModel::changed, this,
+          &ServerLatency::warmStart);
   connect(vpn->serverCountryModel(), &ServerCountryModel::changed, this,
           &ServerLatency::start);
 
+  connect(vpn->location(), &Location::changed, this,
+          &ServerLatency::locationChanged);
+
   connect(vpn->controller(), &Controller::stateChanged, this,
           &ServerLatency::stateChanged);
 
@@ -104,12 +214,12 @@ void ServerLatency::start() {
     m_pingSender = new TcpPingSender(QHostAddress(), 80, this);
   }
 
-  connect(m_pingSender, SIGNAL(recvPing(quint16)), this,
-          SLOT(recvPing(quint16)), Qt::QueuedConnection);
+  connect(m_pingSender, &PingSender::recvPing, this, &ServerLatency::recvPing,
+          Qt::QueuedConnection);
   connect(m_pingSender, SIGNAL(criticalPingError()), this,
           SLOT(criticalPingError()));
 
-  // Generate a list of servers to ping. If possible, sort them by geographic
+  // Generate a list of servers to ping. If possible, order them by geographic
   // distance to try and get data for the quickest servers first.
   for (const ServerCountry& country : vpn->serverCountryModel()->countries()) {
     for (const QString& cityName : country.cities()) {
@@ -119,25 +229,14 @@ void ServerLatency::start() {
           vpn->location()->distance(city.latitude(), city.longitude());
       Q_ASSERT(city.initialized());
 
-      // Search for where in the list to insert this city's servers.
-      auto i = m_pingSendQueue.begin();
-      while (i != m_pingSendQueue.end()) {
-        if (i->distance >= distance) {
-          break;
-        }
-        i++;
-      }
-
-      // Insert the servers into the list.
       for (const QString& pubkey : city.servers()) {
         ServerPingRecord rec = {
-            pubkey, city.country(), city.name(), 0, 0, distance, 0};
-        i = m_pingSendQueue.insert(i, rec);
+            pubkey, city.country(), city.name(), 0, 0, 0, distance, 0};
+        m_pingSendQueue.append(rec);
       }
     }
   }
-
-  m_pingSendTotal = m_pingSendQueue.count();
+  resetSweep();
 
   m_progressDelayTimer.stop();
   emit progressChanged();
@@ -146,52 +245,71 @@ void ServerLatency::start() {
   maybeSendPings();
 }
 
+void ServerLatency::resetSweep() {
+  std::make_heap(m_pingSendQueue.begin(), m_pingSendQueue.end(),
+                 fartherThan<ServerPingRecord>);
+
+  m_pingSendTotal = m_pingSendQueue.count();
+  m_pingSlots.resize(SERVER_LATENCY_SLOTS);
+  m_pingPending = 0;
+  m_pingWheel.resize(TIMEOUT_USEC / TICK_USEC + 2);
+  m_pingTokens = SERVER_LATENCY_BURST;
+  m_pingTokensUpdated = currentUsecs();
+  m_pingWheelTick = m_pingTokensUpdated / TICK_USEC;
+}
+
 void ServerLatency::maybeSendPings() {
-  quint64 now = QDateTime::currentMSecsSinceEpoch();
+  qint64 now = currentUsecs();
+  qint64 sentAt = currentUsecsSinceEpoch();
   ServerCountryModel* scm = MozillaVPN::instance()->serverCountryModel();
   if (m_pingSender == nullptr) {
     return;
   }
 
-  // Scan through the reply list, looking for timeouts.
-  while (!m_pingReplyList.isEmpty()) {
-    const ServerPingRecord& record = m_pingReplyList.first();
-    if ((record.timestamp + SERVER_LATENCY_TIMEOUT.count()) > now) {
-      break;
-    }
-    logger.debug() << "Server" << logger.keys(record.publicKey) << "timeout"
-                   << record.retries;
-
-    // Send a retry.
-    if (record.retries < SERVER_LATENCY_MAX_RETRIES) {
-      ServerPingRecord retry = record;
-      retry.retries++;
-      retry.sequence = m_sequence++;
-      retry.timestamp = now;
-      m_pingReplyList.append(retry);
-
-      const Server& server = scm->server(retry.publicKey);
-      m_pingSender->sendPing(QHostAddress(server.ipv4AddrIn()), retry.sequence);
-    }
-
-    // TODO: Mark the server unavailable?
-    m_pingReplyList.removeFirst();
-  }
+  // Timed out pings go back into the queue for a retry.
+  expirePings(now);
+
+  // Refill the token bucket.
+  m_pingTokens += (now - m_pingTokensUpdated) * SERVER_LATENCY_RATE / 1e6;
+  m_pingTokens = qMin<double>(m_pingTokens, SERVER_LATENCY_BURST);
+  m_pingTokensUpdated = now;
+
+  // Generate new pings once the bucket holds enough tokens for a batch, and
+  // then for as long as there are tokens left. They all go out in a single
+  // batch, with consecutive sequence numbers.
+  QList<QHostAddress> destinations;
+  quint16 firstSequence = m_sequence;
+  QList<quint16>& bucket =
+      m_pingWheel[(now / TICK_USEC) % m_pingWheel.count()];
+  bool stalled = false;
+  qsizetype batch =
+      qMin<qsizetype>(SERVER_LATENCY_BATCH, m_pingSendQueue.count());
+  if ((batch > 0) && (m_pingTokens >= batch)) {
+    while ((m_pingTokens >= 1) && !m_pingSendQueue.isEmpty()) {
+      ServerPingRecord& slot = m_pingSlots[m_sequence % m_pingSlots.count()];
+      if (!slot.publicKey.isEmpty()) {
+        // Wait for the slot to be freed by a reply or a timeout.
+        stalled = true;
+        break;
+      }
 
-  // Generate new pings until we reach our max number of parallel pings.
-  while (m_pingReplyList.count() < SERVER_LATENCY_MAX_PARALLEL) {
-    if (m_pingSendQueue.isEmpty()) {
-      break;
+      std::pop_heap(m_pingSendQueue.begin(), m_pingSendQueue.end(),
+                    fartherThan<ServerPingRecord>);
+      slot = m_pingSendQueue.takeLast();
+      slot.sequence = m_sequence++;
+      slot.timestamp = now;
+      slot.sentAt = sentAt;
+      m_pingPending++;
+      m_pingTokens -= 1;
+      bucket.append(slot.sequence);
+
+      const Server& server = scm->server(slot.publicKey);
+      destinations.append(QHostAddress(server.ipv4AddrIn()));
     }
+  }
 
-    ServerPingRecord record = m_pingSendQueue.takeFirst();
-    record.sequence = m_sequence++;
-    record.timestamp = now;
-    record.retries = 0;
-    m_pingReplyList.append(record);
-
-    const Server& server = scm->server(record.publicKey);
-    m_pingSender->sendPing(QHostAddress(server.ipv4AddrIn()), record.sequence);
+  if (!destinations.isEmpty()) {
+    m_pingSender->sendPings(destinations, firstSequence);
   }
 
   m_lastUpdateTime = QDateTime::currentDateTime();
@@ -199,26 +317,78 @@ void ServerLatency::maybeSendPings() {
     m_progressDelayTimer.start(SERVER_LATENCY_PROGRESS_DELAY);
   }
 
-  if (m_pingReplyList.isEmpty()) {
-    // If the ping reply list is empty, then we have nothing left to do.
+  if ((m_pingPending == 0) && m_pingSendQueue.isEmpty()) {
+    // If there is nothing awaiting a reply or waiting to be sent, then we have
+    // nothing left to do.
     stop();
-  } else {
-    // Otherwise, the list should be sorted by transmit time. Schedule a timer
-    // to cleanup anything that experiences a timeout.
-    const ServerPingRecord& record = m_pingReplyList.first();
+    return;
+  }
 
-    CheckedInt<int> value(SERVER_LATENCY_TIMEOUT.count());
-    value -= static_cast<int>(now - record.timestamp);
+  // Otherwise, schedule a timer to cleanup the oldest bucket of the wheel
+  // that still holds pings, or to send more pings once the bucket holds
+  // enough tokens for a batch, whichever comes first.
+  qint64 wakeup = std::numeric_limits<qint64>::max();
+  for (qint64 tick = m_pingWheelTick;
+       tick < m_pingWheelTick + m_pingWheel.count(); tick++) {
+    if (!m_pingWheel.at(tick % m_pingWheel.count()).isEmpty()) {
+      wakeup = (tick + 1) * TICK_USEC + TIMEOUT_USEC - now;
+      break;
+    }
+  }
+  if (!m_pingSendQueue.isEmpty() && !stalled) {
+    batch = qMin<qsizetype>(SERVER_LATENCY_BATCH, m_pingSendQueue.count());
+    qint64 refill = (batch - m_pingTokens) * 1e6 / SERVER_LATENCY_RATE;
+    wakeup = qMin(wakeup, refill);
+  }
+
+  m_pingTimeout.start(qMax<int>((wakeup + 999) / 1000, 1));
+}
 
-    m_pingTimeout.start(value.value());
+void ServerLatency::expirePings(qint64 now) {
+  // Every ping in the bucket of a tick has waited at least a full timeout
+  // once the end of that tick is a timeout in the past.
+  qint64 expireTick = (now - TIMEOUT_USEC) / TICK_USEC;
+  for (qsizetype n = 0;
+       (m_pingWheelTick < expireTick) && (n < m_pingWheel.count()); n++) {
+    QList<quint16>& bucket =
+        m_pingWheel[m_pingWheelTick % m_pingWheel.count()];
+    for (quint16 sequence : bucket) {
+      ServerPingRecord& slot = m_pingSlots[sequence % m_pingSlots.count()];
+      if (slot.publicKey.isEmpty() || (slot.sequence != sequence)) {
+        // Already answered.
+        continue;
+      }
+      logger.debug() << "Server" << logger.keys(slot.publicKey) << "timeout"
+                     << slot.retries;
+
+      // Queue a retry.
+      if (slot.retries < SERVER_LATENCY_MAX_RETRIES) {
+        slot.retries++;
+        m_pingSendQueue.append(slot);
+        std::push_heap(m_pingSendQueue.begin(), m_pingSendQueue.end(),
+                       fartherThan<ServerPingRecord>);
+      }
+
+      // TODO: Mark the server unavailable?
+      slot = ServerPingRecord();
+      m_pingPending--;
+    }
+    bucket.clear();
+    m_pingWheelTick++;
   }
+
+  // If the clock jumped ahead, every bucket is empty by now.
+  m_pingWheelTick = qMax(m_pingWheelTick, expireTick);
 }
 
 void ServerLatency::stop() {
   m_pingTimeout.stop();
   m_pingSendQueue.clear();
-  m_pingReplyList.clear();
+  m_pingSlots.clear();
+  m_pingWheel.clear();
+  m_pingPending = 0;
   m_pingSendTotal = 0;
+  m_store.flush();
 
   if (m_pingSender) {
     m_pingSender->deleteLater();
@@ -241,6 +411,61 @@ void ServerLatency::refresh() {
   start();
 }
 
+void ServerLatency::warmStart() {
+  if (m_pingSender != nullptr) {
+    // A sweep is in progress, and has fresher data.
+    return;
+  }
+
+  ServerCountryModel* scm = MozillaVPN::instance()->serverCountryModel();
+  QStringList seeded;
+  for (const ServerCity& city : scm->cities()) {
+    bool found = false;
+    for (const QString& pubkey : city.servers()) {
+      ServerLatencyStore::Entry entry;
+      if (m_latency.contains(pubkey) ||
+          !m_store.lookup(m_network, pubkey, &entry)) {
+        continue;
+      }
+      qint64 msec = qMax<qint64>(qRound64(entry.mean), 1);
+      m_sumLatencyMsec += msec;
+      m_latency[pubkey] = msec;
+      found = true;
+    }
+    if (found) {
+      seeded.append(city.servers().first());
+    }
+  }
+
+  // Score the cities once all the latencies are in, since they are compared
+  // to the average.
+  for (const QString& pubkey : seeded) {
+    updateConnectionScore(pubkey);
+  }
+  if (!seeded.isEmpty()) {
+    logger.debug() << "Seeded the latency of" << seeded.count() << "cities";
+    emit progressChanged();
+  }
+}
+
+void ServerLatency::locationChanged() {
+  quint64 network = networkIdentity(MozillaVPN::instance()->location());
+  if ((network == 0) || (network == m_network)) {
+    return;
+  }
+
+  // Until the location is known, assume we are still on the same network as
+  // last time. Otherwise, the latency measured elsewhere is meaningless here.
+  quint64 previous = m_network;
+  m_store.flush();
+  m_network = network;
+  if ((previous != 0) && (m_pingSender == nullptr)) {
+    logger.debug() << "Network changed";
+    clear();
+    warmStart();
+  }
+}
+
 void ServerLatency::clear() {
   m_latency.clear();
   m_sumLatencyMsec = 0;
@@ -279,24 +504,37 @@ void ServerLatency::applicationStateChanged() {
 #endif
 }
 
-void ServerLatency::recvPing(quint16 sequence) {
-  qint64 now(QDateTime::currentMSecsSinceEpoch());
-
-  for (auto i = m_pingReplyList.begin(); i != m_pingReplyList.end(); i++) {
-    const ServerPingRecord& record = *i;
-    if (record.sequence != sequence) {
-      continue;
-    }
+void ServerLatency::recvPing(quint16 sequence, qint64 timestamp) {
+  if (m_pingSlots.isEmpty()) {
+    return;
+  }
+  ServerPingRecord& slot = m_pingSlots[sequence % m_pingSlots.count()];
+  if (slot.publicKey.isEmpty() || (slot.sequence != sequence)) {
+    return;
+  }
 
-    qint64 latency(now - record.timestamp);
-    if (latency <= std::numeric_limits<uint>::max()) {
-      setLatency(record.publicKey, latency);
-    }
+  // Prefer the time at which the reply reached the network stack, if the
+  // platform knows it, over the time at which we got to process it. The
+  // kernel timestamps packets with the system clock.
+  qint64 elapsed;
+  if (timestamp > 0) {
+    elapsed = timestamp - slot.sentAt;
+  } else {
+    elapsed = currentUsecs() - slot.timestamp;
+  }
 
-    m_pingReplyList.erase(i);
-    maybeSendPings();
-    return;
+  // Round up, so that a sub-millisecond reply still counts as a sample.
+  qint64 latency((elapsed + 999) / 1000);
+  if ((latency >= 0) && (latency <= std::numeric_limits<uint>::max())) {
+    latency = qMax<qint64>(latency, 1);
+    setLatency(slot.publicKey, latency);
+    m_store.addSample(m_network, slot.publicKey, latency);
   }
+
+  // The sequence number stays on the wheel, and is skipped when it expires.
+  slot = ServerPingRecord();
+  m_pingPending--;
+  maybeSendPings();
 }
 
 void ServerLatency::criticalPingError() {
@@ -367,7 +605,7 @@ double ServerLatency::progress() const {
     return 1.0;  // Operation is complete.
   }
 
-  double remaining = m_pingReplyList.count() + m_pingSendQueue.count();
+  double remaining = m_pingPending + m_pingSendQueue.count();
   return 1.0 - (remaining / m_pingSendTotal);
 }
 
@@ -10,6 +10,7 @@
 #include <QTimer>
 
 #include "pingsender.h"
+#include "serverlatencystore.h"
 #include "task.h"
 
 class ServerCity;
@@ -73,7 +74,10 @@ class ServerLatency final : public QObject {
  private:
   void updateConnectionScore(const QString& pubkey);
   void clearCooldowns();
+  void resetSweep();
   void maybeSendPings();
+  void expirePings(qint64 now);
+  void warmStart();
   void clear();
 
  private:
@@ -81,17 +85,40 @@ class ServerLatency final : public QObject {
     QString publicKey;
     QString countryCode;
     QString cityName;
-    quint64 timestamp;
-    quint16 sequence;
-    double distance;
-    int retries;
+    qint64 timestamp = 0;  // microseconds, on the monotonic clock.
+    qint64 sentAt = 0;     // microseconds since the epoch.
+    quint16 sequence = 0;
+    double distance = 0;
+    int retries = 0;
   };
   quint16 m_sequence = 0;
   PingSender* m_pingSender = nullptr;
-  QList<ServerPingRecord> m_pingSendQueue;
-  QList<ServerPingRecord> m_pingReplyList;
   qsizetype m_pingSendTotal = 0;
 
+  // Servers waiting to be pinged, as a binary heap with the nearest on top.
+  QList<ServerPingRecord> m_pingSendQueue;
+
+  // Pings awaiting a reply, indexed by their sequence number modulo the size
+  // of the table. A free slot has an empty public key.
+  QList<ServerPingRecord> m_pingSlots;
+  qsizetype m_pingPending = 0;
+
+  // The sequence numbers of the pings sent during each tick, in a ring of
+  // buckets spanning the timeout. m_pingWheelTick is the oldest tick whose
+  // bucket has not expired yet.
+  QList<QList<quint16>> m_pingWheel;
+  qint64 m_pingWheelTick = 0;
+
+  // Token bucket pacing the probes, refilled at SERVER_LATENCY_RATE.
+  double m_pingTokens = 0;
+  qint64 m_pingTokensUpdated = 0;
+
+  friend class TestServerLatency;
+
+  // The latency measured by previous sweeps, and the network they are for.
+  ServerLatencyStore m_store;
+  quint64 m_network = 0;
+
   QHash<QString, qint64> m_latency;
   QHash<QString, qint64> m_cooldown;
   qint64 m_sumLatencyMsec = 0;
@@ -106,7 +133,8 @@ class ServerLatency final : public QObject {
  private slots:
   void stateChanged();
   void applicationStateChanged();
-  void recvPing(quint16 sequence);
+  void locationChanged();
+  void recvPing(quint16 sequence, qint64 timestamp);
   void criticalPingError();
 };
 
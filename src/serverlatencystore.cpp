@@ -0,0 +1,247 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "serverlatencystore.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cmath>
+
+#include "leakdetector.h"
+#include "logger.h"
+
+using Entry = ServerLatencyStore::Entry;
+
+namespace {
+Logger logger("ServerLatencyStore");
+
+constexpr const char STORE_MAGIC[4] = {'M', 'Z', 'L', 'T'};
+constexpr const quint32 STORE_VERSION = 1;
+constexpr const qsizetype STORE_HEADER_SIZE = 8;
+
+// Key hash, network, last seen time, mean and variance.
+constexpr const qsizetype STORE_RECORD_SIZE = 32;
+
+// The weight of a new sample in the moving averages.
+constexpr const double STORE_SAMPLE_WEIGHT = 0.25;
+
+// Servers that haven't been measured for this long are forgotten.
+constexpr const qint64 STORE_MAX_AGE_SECS = 14 * 24 * 60 * 60;
+
+// Rewrite the file once fewer than one in this many records is still live.
+constexpr const qsizetype STORE_COMPACT_RATIO = 4;
+
+void appendRecord(QByteArray& out, quint64 key, quint64 network,
+                  const Entry& entry) {
+  uchar record[STORE_RECORD_SIZE];
+  quint32 mean;
+  quint32 variance;
+  memcpy(&mean, &entry.mean, sizeof(mean));
+  memcpy(&variance, &entry.variance, sizeof(variance));
+
+  qToLittleEndian<quint64>(key, record);
+  qToLittleEndian<quint64>(network, record + 8);
+  qToLittleEndian<qint64>(entry.lastSeen, record + 16);
+  qToLittleEndian<quint32>(mean, record + 24);
+  qToLittleEndian<quint32>(variance, record + 28);
+  out.append(reinterpret_cast<const char*>(record), sizeof(record));
+}
+}  // namespace
+
+ServerLatencyStore::ServerLatencyStore() {
+  MZ_COUNT_CTOR(ServerLatencyStore);
+}
+
+ServerLatencyStore::~ServerLatencyStore() {
+  MZ_COUNT_DTOR(ServerLatencyStore);
+}
+
+// static
+quint64 ServerLatencyStore::keyHash(const QString& publicKey) {
+  QByteArray hash = QCryptographicHash::hash(publicKey.toLatin1(),
+                                             QCryptographicHash::Sha256);
+  return qFromLittleEndian<quint64>(hash.constData());
+}
+
+bool ServerLatencyStore::open(const QString& fileName) {
+  m_fileName = fileName;
+  m_networks.clear();
+  m_lastNetwork = 0;
+  m_fileRecords = 0;
+  m_pending.clear();
+
+  QFile file(fileName);
+  if (!file.exists()) {
+    return true;
+  }
+  if (!file.open(QIODevice::ReadOnly)) {
+    logger.warning() << "Unable to open the latency history:"
+                     << file.errorString();
+    return false;
+  }
+
+  qint64 size = file.size();
+  const uchar* data = (size > 0) ? file.map(0, size) : nullptr;
+  if ((size < STORE_HEADER_SIZE) || (data == nullptr) ||
+      (memcmp(data, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0) ||
+      (qFromLittleEndian<quint32>(data + 4) != STORE_VERSION)) {
+    logger.warning() << "Discarding an unreadable latency history";
+    file.close();
+    compact();
+    return true;
+  }
+
+  qint64 now = QDateTime::currentSecsSinceEpoch();
+  qint64 lastSeen = 0;
+  qsizetype count = (size - STORE_HEADER_SIZE) / STORE_RECORD_SIZE;
+  for (qsizetype i = 0; i < count; i++) {
+    const uchar* record = data + STORE_HEADER_SIZE + i * STORE_RECORD_SIZE;
+    quint64 key = qFromLittleEndian<quint64>(record);
+    quint64 network = qFromLittleEndian<quint64>(record + 8);
+    quint32 mean = qFromLittleEndian<quint32>(record + 24);
+    quint32 variance = qFromLittleEndian<quint32>(record + 28);
+
+    Entry entry;
+    entry.lastSeen = qFromLittleEndian<qint64>(record + 16);
+    memcpy(&entry.mean, &mean, sizeof(mean));
+    memcpy(&entry.variance, &variance, sizeof(variance));
+    if (!std::isfinite(entry.mean) || !std::isfinite(entry.variance)) {
+      continue;
+    }
+
+    m_networks[network][key] = entry;
+    if (entry.lastSeen >= lastSeen) {
+      lastSeen = entry.lastSeen;
+      m_lastNetwork = network;
+    }
+  }
+  file.unmap(const_cast<uchar*>(data));
+  file.close();
+  m_fileRecords = count;
+
+  // Age out the servers we haven't heard from in a while.
+  qsizetype live = 0;
+  for (auto n = m_networks.begin(); n != m_networks.end();) {
+    for (auto e = n->begin(); e != n->end();) {
+      if ((now - e->lastSeen) > STORE_MAX_AGE_SECS) {
+        e = n->erase(e);
+      } else {
+        ++e;
+        live++;
+      }
+    }
+    if (n->isEmpty()) {
+      n = m_networks.erase(n);
+    } else {
+      ++n;
+    }
+  }
+  if (!m_networks.contains(m_lastNetwork)) {
+    m_lastNetwork = 0;
+  }
+  logger.debug() << "Loaded" << live << "latency records";
+
+  // A torn record at the end would misalign everything appended after it.
+  bool torn = ((size - STORE_HEADER_SIZE) % STORE_RECORD_SIZE) != 0;
+  if (torn || ((live * STORE_COMPACT_RATIO) < m_fileRecords)) {
+    compact();
+  }
+  return true;
+}
+
+bool ServerLatencyStore::lookup(quint64 network, const QString& publicKey,
+                                Entry* entry) const {
+  auto n = m_networks.constFind(network);
+  if (n == m_networks.constEnd()) {
+    return false;
+  }
+  auto e = n->constFind(keyHash(publicKey));
+  if (e == n->constEnd()) {
+    return false;
+  }
+  *entry = e.value();
+  return true;
+}
+
+void ServerLatencyStore::addSample(quint64 network, const QString& publicKey,
+                                   qint64 msec) {
+  quint64 key = keyHash(publicKey);
+  Entry& entry = m_networks[network][key];
+  if (entry.lastSeen == 0) {
+    entry.mean = msec;
+    entry.variance = 0;
+  } else {
+    double delta = msec - entry.mean;
+    entry.mean += STORE_SAMPLE_WEIGHT * delta;
+    entry.variance = (1 - STORE_SAMPLE_WEIGHT) *
+                     (entry.variance + STORE_SAMPLE_WEIGHT * delta * delta);
+  }
+  entry.lastSeen = QDateTime::currentSecsSinceEpoch();
+  m_lastNetwork = network;
+
+  appendRecord(m_pending, key, network, entry);
+}
+
+void ServerLatencyStore::flush() {
+  if (m_pending.isEmpty() || m_fileName.isEmpty()) {
+    return;
+  }
+
+  QFile file(m_fileName);
+  if (!file.exists()) {
+    compact();
+    return;
+  }
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+    logger.warning() << "Unable to open the latency history:"
+                     << file.errorString();
+    return;
+  }
+  if (file.write(m_pending) != m_pending.length()) {
+    logger.warning() << "Unable to write the latency history:"
+                     << file.errorString();
+  }
+  file.close();
+  m_fileRecords += m_pending.length() / STORE_RECORD_SIZE;
+  m_pending.clear();
+
+  qsizetype live = 0;
+  for (const QHash<quint64, Entry>& entries : m_networks) {
+    live += entries.count();
+  }
+  if ((live * STORE_COMPACT_RATIO) < m_fileRecords) {
+    compact();
+  }
+}
+
+void ServerLatencyStore::compact() {
+  if (m_fileName.isEmpty()) {
+    return;
+  }
+
+  QByteArray data(STORE_MAGIC, sizeof(STORE_MAGIC));
+  data.resize(STORE_HEADER_SIZE);
+  qToLittleEndian<quint32>(STORE_VERSION, data.data() + 4);
+  for (auto n = m_networks.constBegin(); n != m_networks.constEnd(); ++n) {
+    for (auto e = n->constBegin(); e != n->constEnd(); ++e) {
+      appendRecord(data, e.key(), n.key(), e.value());
+    }
+  }
+
+  QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+  QSaveFile file(m_fileName);
+  if (!file.open(QIODevice::WriteOnly) || (file.write(data) != data.length()) ||
+      !file.commit()) {
+    logger.warning() << "Unable to write the latency history:"
+                     << file.errorString();
+    return;
+  }
+  m_fileRecords = (data.length() - STORE_HEADER_SIZE) / STORE_RECORD_SIZE;
+  m_pending.clear();
+}
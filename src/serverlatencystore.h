@@ -0,0 +1,64 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef SERVERLATENCYSTORE_H
+#define SERVERLATENCYSTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+// A history of the latency measured to each server, kept on disk so that the
+// connection scores are available as soon as the app starts. The file is a
+// short header followed by fixed size records, and is only ever appended to:
+// when loading, the last record for a server wins. It is rewritten without
+// the superseded and stale records when they take up too much of it.
+//
+// Servers are identified by a hash of their public key, and samples are kept
+// apart for each network the client measured them from.
+class ServerLatencyStore final {
+  Q_DISABLE_COPY_MOVE(ServerLatencyStore)
+
+ public:
+  ServerLatencyStore();
+  ~ServerLatencyStore();
+
+  struct Entry {
+    float mean = 0;      // exponentially weighted mean, in milliseconds.
+    float variance = 0;  // exponentially weighted variance.
+    qint64 lastSeen = 0;  // seconds since the epoch.
+  };
+
+  /**
+   * @brief Load the history from a file. Records not updated for longer than
+   * the maximum age are dropped. A missing file is not an error, it is
+   * created by the first flush().
+   *
+   * @param fileName - the file to read and append to
+   * @return bool - false if the file exists but can't be read.
+   */
+  bool open(const QString& fileName);
+
+  // The network of the most recent sample, or zero if there are none.
+  quint64 lastNetwork() const { return m_lastNetwork; }
+
+  bool lookup(quint64 network, const QString& publicKey, Entry* entry) const;
+
+  // Fold a new sample into the history, it is written out by flush().
+  void addSample(quint64 network, const QString& publicKey, qint64 msec);
+  void flush();
+
+ private:
+  static quint64 keyHash(const QString& publicKey);
+  void compact();
+
+ private:
+  QString m_fileName;
+  QHash<quint64, QHash<quint64, Entry>> m_networks;
+  quint64 m_lastNetwork = 0;
+  qsizetype m_fileRecords = 0;
+  QByteArray m_pending;
+};
+
+#endif  // SERVERLATENCYSTORE_H
@@ -61,6 +61,16 @@ SETTING_BOOL(addonProdKeyInStaging,        // getter
              true                          // sensitive (do not log)
 )
 
+SETTING_BYTEARRAY(addonVerifiedHashes,        // getter
+                  setAddonVerifiedHashes,     // setter
+                  removeAddonVerifiedHashes,  // remover
+                  hasAddonVerifiedHashes,     // has
+                  "addons/verifiedHashes",    // key
+                  "",                         // default value
+                  false,                      // remove when reset
+                  false                       // sensitive (do not log)
+)
+
 #if defined(MZ_ADJUST)
 SETTING_BOOL(adjustActivatable,        // getter
              setAdjustActivatable,     // setter
@@ -428,6 +438,16 @@ SETTING_STRINGLIST(recentConnectionsDeprecated,        // getter
                    true                                // sensitive (do not log)
 )
 
+SETTING_BYTEARRAY(serverLatencyNetworkKey,        // getter
+                  setServerLatencyNetworkKey,     // setter
+                  removeServerLatencyNetworkKey,  // remover
+                  hasServerLatencyNetworkKey,     // has
+                  "serverLatencyNetworkKey",      // key
+                  "",                             // default value
+                  true,                           // remove when reset
+                  true                            // sensitive (do not log)
+)
+
 SETTING_BYTEARRAY(servers,        // getter
                   setServers,     // setter
                   removeServers,  // remover
@@ -438,6 +458,16 @@ SETTING_BYTEARRAY(servers,        // getter
                   true  // sensitive (do not log) - noisy and limited value
 )
 
+SETTING_BYTEARRAY(serversCatalogueDigest,        // getter
+                  setServersCatalogueDigest,     // setter
+                  removeServersCatalogueDigest,  // remover
+                  hasServersCatalogueDigest,     // has
+                  "serversCatalogueDigest",      // key
+                  "",                            // default value
+                  true,                          // remove when reset
+                  true                           // sensitive (do not log)
+)
+
 SETTING_BYTEARRAY(serverData,        // getter
                   setServerData,     // setter
                   removeServerData,  // remover
@@ -448,6 +478,26 @@ SETTING_BYTEARRAY(serverData,        // getter
                   true               // sensitive (do not log)
 )
 
+SETTING_BYTEARRAY(serversETag,        // getter
+                  setServersETag,     // setter
+                  removeServersETag,  // remover
+                  hasServersETag,     // has
+                  "serversETag",      // key
+                  "",                 // default value
+                  true,               // remove when reset
+                  false               // sensitive (do not log)
+)
+
+SETTING_BYTEARRAY(serversLastModified,        // getter
+                  setServersLastModified,     // setter
+                  removeServersLastModified,  // remover
+                  hasServersLastModified,     // has
+                  "serversLastModified",      // key
+                  "",                         // default value
+                  true,                       // remove when reset
+                  false                       // sensitive (do not log)
+)
+
 SETTING_BOOL(serverSwitchNotification,        // getter
              setServerSwitchNotification,     // setter
              removeServerSwitchNotification,  // remover
@@ -22,6 +22,12 @@ class TaskAddon final : public Task {
   // downloaded and when they are ready to be loaded.
   DeletePolicy deletePolicy() const override { return Reschedulable; }
 
+  Priority priority() const override { return Background; }
+  QString conflictGroup() const override { return CONFLICT_GROUP; }
+
+  // The add-on tasks run one after the other, but next to the other tasks.
+  static constexpr const char* CONFLICT_GROUP = "addons";
+
  private:
   const QString m_addonId;
   const QByteArray m_sha256;
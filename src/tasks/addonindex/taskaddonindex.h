@@ -8,6 +8,7 @@
 #include <QObject>
 
 #include "task.h"
+#include "tasks/addon/taskaddon.h"
 
 class TaskAddonIndex final : public Task {
   Q_DISABLE_COPY_MOVE(TaskAddonIndex)
@@ -21,6 +22,9 @@ class TaskAddonIndex final : public Task {
   // If we cancel this task, we have to wait 1 hour before the next fetch.
   DeletePolicy deletePolicy() const override { return Reschedulable; }
 
+  Priority priority() const override { return Background; }
+  QString conflictGroup() const override { return TaskAddon::CONFLICT_GROUP; }
+
  private:
   void maybeComplete();
 
@@ -19,6 +19,13 @@ class TaskGetLocation final : public Task {
 
   void run() override;
 
+  // The location is only read by the UI and the server recommendations, so
+  // the lookup doesn't have to wait for the other tasks.
+  Priority priority() const override { return Interactive; }
+  QString conflictGroup() const override {
+    return QStringLiteral("location");
+  }
+
  private:
   ErrorHandler::ErrorPropagationPolicy m_errorPropagationPolicy =
       ErrorHandler::DoNotPropagateError;
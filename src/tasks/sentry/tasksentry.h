@@ -28,6 +28,9 @@ class TaskSentry final : public Task {
     return DeletePolicy::Reschedulable;
   }
 
+  Priority priority() const override { return Background; }
+  QString conflictGroup() const override { return QStringLiteral("sentry"); }
+
   enum ContentType { Unknown, Ping, CrashReport };
   Q_ENUM(ContentType);
 
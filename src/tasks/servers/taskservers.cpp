@@ -10,6 +10,7 @@
 #include "logger.h"
 #include "mozillavpn.h"
 #include "networkrequest.h"
+#include "settingsholder.h"
 
 namespace {
 Logger logger("TaskServers");
@@ -24,8 +25,18 @@ TaskServers::TaskServers(
 TaskServers::~TaskServers() { MZ_COUNT_DTOR(TaskServers); }
 
 void TaskServers::run() {
+  SettingsHolder* settingsHolder = SettingsHolder::instance();
+
   NetworkRequest* request = new NetworkRequest(this, 200);
   request->auth();
+
+  // Only ask for the list if it changed since the copy we have. Compressed
+  // transfer encodings are negotiated and decoded by QNetworkAccessManager.
+  if (settingsHolder->hasServers()) {
+    request->setValidators(settingsHolder->serversETag(),
+                           settingsHolder->serversLastModified());
+  }
+
   request->get(Constants::apiUrl(Constants::Servers));
 
   connect(request, &NetworkRequest::requestFailed, this,
@@ -36,9 +47,23 @@ void TaskServers::run() {
           });
 
   connect(request, &NetworkRequest::requestCompleted, this,
-          [this](const QByteArray& data) {
+          [this, request](const QByteArray& data) {
+            if (request->statusCode() == 304) {
+              logger.debug() << "Servers not modified";
+              emit completed();
+              return;
+            }
+
             logger.debug() << "Servers obtained";
-            MozillaVPN::instance()->serversFetched(data);
+            SettingsHolder* settingsHolder = SettingsHolder::instance();
+            if (MozillaVPN::instance()->serversFetched(data)) {
+              settingsHolder->setServersETag(request->rawHeader("ETag"));
+              settingsHolder->setServersLastModified(
+                  request->rawHeader("Last-Modified"));
+            } else {
+              settingsHolder->removeServersETag();
+              settingsHolder->removeServersLastModified();
+            }
             emit completed();
           });
 }
@@ -7,6 +7,7 @@
 #include <QtMath>
 
 #include "leakdetector.h"
+#include "prefixset.h"
 #include "rfc/rfc1112.h"
 #include "rfc/rfc1918.h"
 #include "rfc/rfc4193.h"
@@ -241,24 +242,9 @@ QList<IPAddress> IPAddress::subnets() const {
 // static
 QList<IPAddress> IPAddress::excludeAddresses(
     const QList<IPAddress>& sourceList, const QList<IPAddress>& excludeList) {
-  QList<IPAddress> results = sourceList;
-
-  for (const IPAddress& exclude : excludeList) {
-    QList<IPAddress> newResults;
-
-    for (const IPAddress& ip : results) {
-      if (!ip.overlaps(exclude)) {
-        newResults.append(ip);
-      } else if (exclude.subnetOf(ip) && exclude != ip) {
-        QList<IPAddress> range = ip.excludeAddresses(exclude);
-        newResults.append(range);
-      }
-    }
-
-    results = newResults;
-  }
-
-  return results;
+  PrefixSet results(sourceList);
+  results.remove(PrefixSet(excludeList));
+  return results.toList();
 }
 
 QList<IPAddress> IPAddress::excludeAddresses(const IPAddress& ip) const {
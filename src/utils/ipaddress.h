@@ -9,6 +9,8 @@
 
 class IPAddress final {
  public:
+  // Returns the smallest list of prefixes covering the addresses in the
+  // source list but not in the exclude list. See PrefixSet.
   static QList<IPAddress> excludeAddresses(const QList<IPAddress>& sourceList,
                                            const QList<IPAddress>& excludeList);
 
@@ -9,17 +9,26 @@
 
 #include "loghandler.h"
 
+// static
+std::atomic<int> Logger::s_logLevel(LogLevel::Debug);
+
 Logger::Logger(const QString& className) : m_className(className) {}
 
 Logger::Log Logger::error() { return Log(this, LogLevel::Error); }
 Logger::Log Logger::warning() { return Log(this, LogLevel::Warning); }
 Logger::Log Logger::info() { return Log(this, LogLevel::Info); }
 Logger::Log Logger::debug() { return Log(this, LogLevel::Debug); }
+Logger::Log Logger::trace() { return Log(this, LogLevel::Trace); }
 
 Logger::Log::Log(Logger* logger, LogLevel logLevel)
-    : m_logger(logger), m_logLevel(logLevel), m_data(new Data()) {}
+    : m_logger(logger),
+      m_logLevel(logLevel),
+      m_data(isEnabled(logLevel) ? new Data() : nullptr) {}
 
 Logger::Log::~Log() {
+  if (!m_data) {
+    return;
+  }
   LogHandler::messageHandler(m_logLevel, m_logger->className(),
                              m_data->m_buffer.trimmed());
   delete m_data;
@@ -27,7 +36,9 @@ Logger::Log::~Log() {
 
 #define CREATE_LOG_OP_REF(x)                  \
   Logger::Log& Logger::Log::operator<<(x t) { \
-    m_data->m_ts << t << ' ';                 \
+    if (m_data) {                             \
+      m_data->m_ts << t << ' ';               \
+    }                                         \
     return *this;                             \
   }
 
@@ -40,30 +51,48 @@ CREATE_LOG_OP_REF(const void*);
 #undef CREATE_LOG_OP_REF
 
 Logger::Log& Logger::Log::operator<<(const QStringList& t) {
+  if (!m_data) {
+    return *this;
+  }
   m_data->m_ts << '[' << t.join(",") << ']' << ' ';
   return *this;
 }
 
 Logger::Log& Logger::Log::operator<<(const QJsonObject& t) {
+  if (!m_data) {
+    return *this;
+  }
   m_data->m_ts << QJsonDocument(t).toJson(QJsonDocument::Indented) << ' ';
   return *this;
 }
 
 Logger::Log& Logger::Log::operator<<(QTextStreamFunction t) {
+  if (!m_data) {
+    return *this;
+  }
   m_data->m_ts << t;
   return *this;
 }
 
 #ifdef Q_OS_APPLE
 Logger::Log& Logger::Log::operator<<(const NSString* t) {
+  if (!m_data) {
+    return *this;
+  }
   m_data->m_ts << QString::fromNSString(t);
   return *this;
 }
 Logger::Log& Logger::Log::operator<<(CFStringRef t) {
+  if (!m_data) {
+    return *this;
+  }
   m_data->m_ts << QString::fromCFString(t);
   return *this;
 }
 Logger::Log& Logger::Log::operator<<(CFErrorRef t) {
+  if (!m_data) {
+    return *this;
+  }
   CFStringRef ref = CFErrorCopyDescription(t);
   m_data->m_ts << QString::fromCFString(ref);
   CFRelease(ref);
@@ -95,6 +124,9 @@ QString Logger::keys(const QString& input) {
 
 void Logger::Log::addMetaEnum(quint64 value, const QMetaObject* meta,
                               const char* name) {
+  if (!m_data) {
+    return;
+  }
   QMetaEnum me = meta->enumerator(meta->indexOfEnumerator(name));
 
   QString out;
@@ -11,12 +11,16 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QMessageLogContext>
+#include <QMetaMethod>
 #include <QProcessEnvironment>
 #include <QRegularExpression>
 #include <QScopeGuard>
 #include <QStandardPaths>
 #include <QString>
 #include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <cstdio>
 
 #if defined(MZ_ANDROID)
 #  include <android/log.h>
@@ -30,6 +34,10 @@
 constexpr qint64 LOG_MAX_FILE_SIZE = 204800;
 constexpr const char* LOG_FILE_SUFFIX = ".log";
 
+// How long the writer thread lets log lines pile up before writing them out,
+// unless a ring fills up.
+constexpr unsigned long LOG_WRITER_INTERVAL_MSEC = 100;
+
 namespace {
 LogLevel qtTypeToLogLevel(QtMsgType type) {
   switch (type) {
@@ -50,8 +58,56 @@ LogLevel qtTypeToLogLevel(QtMsgType type) {
 
 // Please! Use this `logger` carefully in this file to avoid log loops!
 Logger logger("LogHandler");
+
+LogLevel logLevelFromString(const QByteArray& name, LogLevel fallback) {
+  if (name == "trace") {
+    return Trace;
+  }
+  if (name == "debug") {
+    return Debug;
+  }
+  if (name == "info") {
+    return Info;
+  }
+  if (name == "warning") {
+    return Warning;
+  }
+  if (name == "error") {
+    return Error;
+  }
+  return fallback;
+}
 }  // namespace
 
+// A single producer, single consumer queue of formatted log lines. The
+// producer is the thread that owns it, and the consumer whoever holds the
+// LogHandler mutex. Once its thread exits, the ring can be taken over by
+// another one.
+struct LogHandler::Ring {
+  static constexpr quint32 SIZE = 512;
+
+  struct Record {
+    quint64 m_sequence = 0;
+    LogLevel m_logLevel = Debug;
+    QByteArray m_line;
+  };
+
+  Record m_records[SIZE];
+  std::atomic<quint32> m_head{0};  // Only written by the producer.
+  std::atomic<quint32> m_tail{0};  // Only written by the consumer.
+  std::atomic<bool> m_owned{true};
+};
+
+// Releases the ring of a thread when it exits.
+struct LogHandler::RingOwner {
+  ~RingOwner() {
+    if (m_ring) {
+      m_ring->m_owned.store(false, std::memory_order_release);
+    }
+  }
+  Ring* m_ring = nullptr;
+};
+
 Q_GLOBAL_STATIC(LogHandler, logHandler);
 LogHandler* LogHandler::instance() { return logHandler; }
 
@@ -61,8 +117,12 @@ QString LogHandler::s_filename;
 void LogHandler::messageQTHandler(QtMsgType type,
                                   const QMessageLogContext& context,
                                   const QString& message) {
-  logHandler->addLog(Log(qtTypeToLogLevel(type), context.file, context.function,
-                         context.line, message));
+  LogLevel logLevel = qtTypeToLogLevel(type);
+  if (!Logger::isEnabled(logLevel)) {
+    return;
+  }
+  logHandler->addLog(
+      Log(logLevel, context.file, context.function, context.line, message));
 }
 
 // static
@@ -73,6 +133,9 @@ void LogHandler::messageHandler(LogLevel logLevel, const QString& className,
 
 // static
 void LogHandler::rustMessageHandler(int32_t logLevel, char* message) {
+  if (!Logger::isEnabled(static_cast<LogLevel>(logLevel))) {
+    return;
+  }
   logHandler->addLog(
       Log(static_cast<LogLevel>(logLevel), "Rust", QString::fromUtf8(message)));
 }
@@ -153,6 +216,11 @@ LogHandler::LogHandler() : QObject(nullptr) {
   m_stderrEnabled = true;
 #endif
 
+  QByteArray logLevel = qgetenv("MVPN_LOG_LEVEL").toLower();
+  if (!logLevel.isEmpty()) {
+    Logger::setLogLevel(logLevelFromString(logLevel, Debug));
+  }
+
 #if defined(MZ_IOS)
   CFBundleRef bundle = CFBundleGetMainBundle();
   QString bundleId;
@@ -171,34 +239,171 @@ LogHandler::LogHandler() : QObject(nullptr) {
     s_filename = QDir(where).filePath(m_shortname + LOG_FILE_SUFFIX);
   }
   openLogFile(lock);
+
+#ifndef MZ_WASM
+  m_writer = QThread::create([this]() { writerMain(); });
+  m_writer->setObjectName("LogWriter");
+  m_writer->start(QThread::LowPriority);
+#endif
 }
 
-void LogHandler::addLog(const Log& log) {
+LogHandler::~LogHandler() {
+  if (m_writer) {
+    {
+      QMutexLocker<QMutex> lock(&m_mutex);
+      m_writerStopping = true;
+      m_writerWakeup.wakeOne();
+    }
+    m_writer->wait();
+    delete m_writer;
+    m_writer = nullptr;
+  }
+
+  // The rings are left behind, on purpose: threads that are still running
+  // may hold on to them.
   QMutexLocker<QMutex> lock(&m_mutex);
-  return addLog(log, lock);
+  drain(lock);
+  closeLogFile(lock);
+}
+
+void LogHandler::addLog(const Log& log) {
+  // Format the line on the calling thread, and hand it over to the writer.
+  QByteArray line;
+  {
+    QTextStream out(&line);
+    prettyOutput(out, log);
+  }
+
+  // Warnings and errors are written out straight away, so that they are not
+  // lost if the process is about to go down. So are all the lines without a
+  // writer thread, or when it is falling behind.
+  if ((log.m_logLevel >= Warning) || !m_writer ||
+      !enqueue(log.m_logLevel, line)) {
+    QMutexLocker<QMutex> lock(&m_mutex);
+    drain(lock);
+    writeLine(log.m_logLevel, line, lock);
+    if (m_logFile) {
+      m_logFile->flush();
+    }
+  }
+
+  // The listeners, such as the Sentry breadcrumbs, expect to be called on the
+  // thread that logs.
+  notifyLogEntryAdded(line);
 }
 
 void LogHandler::addLog(const Log& log,
                         const QMutexLocker<QMutex>& proofOfLock) {
-  if (m_output) {
-    prettyOutput(*m_output, log);
+  QByteArray line;
+  {
+    QTextStream out(&line);
+    prettyOutput(out, log);
+  }
+  writeLine(log.m_logLevel, line, proofOfLock);
+  notifyLogEntryAdded(line);
+}
+
+void LogHandler::notifyLogEntryAdded(const QByteArray& line) {
+  // Formatting the signal arguments isn't free, skip it if nobody listens.
+  if (isSignalConnected(QMetaMethod::fromSignal(&LogHandler::logEntryAdded))) {
+    emit logEntryAdded(line);
+  }
+}
+
+LogHandler::Ring* LogHandler::threadRing() {
+  static thread_local RingOwner owner;
+  if (owner.m_ring) {
+    return owner.m_ring;
+  }
+
+  // Take over a ring left behind by a thread that has exited, or make one.
+  QMutexLocker<QMutex> lock(&m_ringsMutex);
+  for (Ring* ring : m_rings) {
+    if (!ring->m_owned.load(std::memory_order_acquire)) {
+      ring->m_owned.store(true, std::memory_order_relaxed);
+      owner.m_ring = ring;
+      return ring;
+    }
+  }
+  owner.m_ring = new Ring();
+  m_rings.append(owner.m_ring);
+  return owner.m_ring;
+}
+
+bool LogHandler::enqueue(LogLevel logLevel, const QByteArray& line) {
+  Ring* ring = threadRing();
+  quint32 head = ring->m_head.load(std::memory_order_relaxed);
+  quint32 used = head - ring->m_tail.load(std::memory_order_acquire);
+  if (used >= Ring::SIZE) {
+    return false;
+  }
+
+  Ring::Record& record = ring->m_records[head % Ring::SIZE];
+  record.m_sequence = m_sequence.fetch_add(1, std::memory_order_relaxed);
+  record.m_logLevel = logLevel;
+  record.m_line = line;
+  ring->m_head.store(head + 1, std::memory_order_release);
+
+  if (used == (Ring::SIZE / 2)) {
+    m_writerWakeup.wakeOne();
+  }
+  return true;
+}
+
+void LogHandler::writerMain() {
+  QMutexLocker<QMutex> lock(&m_mutex);
+  while (!m_writerStopping) {
+    m_writerWakeup.wait(&m_mutex, LOG_WRITER_INTERVAL_MSEC);
+    drain(lock);
   }
+}
 
-  QByteArray buffer;
+void LogHandler::drain(const QMutexLocker<QMutex>& proofOfLock) {
+  QList<Ring::Record> batch;
   {
-    QTextStream out(&buffer);
-    prettyOutput(out, log);
+    QMutexLocker<QMutex> lock(&m_ringsMutex);
+    for (Ring* ring : m_rings) {
+      quint32 tail = ring->m_tail.load(std::memory_order_relaxed);
+      quint32 head = ring->m_head.load(std::memory_order_acquire);
+      for (; tail != head; tail++) {
+        batch.append(std::move(ring->m_records[tail % Ring::SIZE]));
+      }
+      ring->m_tail.store(tail, std::memory_order_release);
+    }
+  }
+  if (batch.isEmpty()) {
+    return;
+  }
+
+  std::sort(batch.begin(), batch.end(),
+            [](const Ring::Record& a, const Ring::Record& b) {
+              return a.m_sequence < b.m_sequence;
+            });
+  for (const Ring::Record& record : batch) {
+    writeLine(record.m_logLevel, record.m_line, proofOfLock);
+  }
+  if (m_logFile) {
+    m_logFile->flush();
+  }
+}
+
+void LogHandler::writeLine(LogLevel logLevel, const QByteArray& line,
+                           const QMutexLocker<QMutex>& proofOfLock) {
+  Q_UNUSED(proofOfLock);
+  Q_UNUSED(logLevel);
+  if (m_logFile) {
+    m_logFile->write(line);
   }
 
   if (m_stderrEnabled) {
 #if defined(MZ_ANDROID)
-    const char* str = buffer.constData();
+    const char* str = line.constData();
     if (str) {
       __android_log_write(ANDROID_LOG_DEBUG, qPrintable(m_shortname), str);
     }
 #elif defined(MZ_IOS)
-    QString logstr = QString::fromUtf8(buffer);
-    switch (log.m_logLevel) {
+    QString logstr = QString::fromUtf8(line);
+    switch (logLevel) {
       case Error:
       case Warning:
         os_log_error(m_ioslog, "%s", qPrintable(logstr));
@@ -211,19 +416,18 @@ void LogHandler::addLog(const Log& log,
         break;
     }
 #else
-    QTextStream out(stderr);
-    prettyOutput(out, log);
+    fwrite(line.constData(), 1, line.length(), stderr);
 #endif
   }
-
-  emit logEntryAdded(buffer);
 }
 
 void LogHandler::writeLogs(QTextStream& out) {
   QMutexLocker<QMutex> lock(&m_mutex);
+  drain(lock);
   if (!m_logFile) {
     return;
   }
+  m_logFile->flush();
 
   if (m_logFile->seek(0)) {
     out << m_logFile->readAll();
@@ -240,6 +444,7 @@ void LogHandler::cleanupLogs() {
 }
 
 void LogHandler::cleanupLogFile(const QMutexLocker<QMutex>& proofOfLock) {
+  drain(proofOfLock);
   if (!m_logFile) {
     return;
   }
@@ -324,7 +529,6 @@ bool LogHandler::makeLogDir(const QDir& dir) {
 void LogHandler::openLogFile(const QMutexLocker<QMutex>& proofOfLock) {
   Q_UNUSED(proofOfLock);
   Q_ASSERT(!m_logFile);
-  Q_ASSERT(!m_output);
 
   QDir appDataLocation = QFileInfo(s_filename).dir();
   if (!makeLogDir(appDataLocation)) {
@@ -341,8 +545,6 @@ void LogHandler::openLogFile(const QMutexLocker<QMutex>& proofOfLock) {
     return;
   }
 
-  m_output = new QTextStream(m_logFile);
-
 #ifdef MZ_DEBUG
   addLog(Log(Debug, "LogHandler", QString("Log file: %1").arg(s_filename)),
          proofOfLock);
@@ -353,9 +555,6 @@ void LogHandler::closeLogFile(const QMutexLocker<QMutex>& proofOfLock) {
   Q_UNUSED(proofOfLock);
 
   if (m_logFile) {
-    delete m_output;
-    m_output = nullptr;
-
     delete m_logFile;
     m_logFile = nullptr;
   }
@@ -10,6 +10,8 @@
 #include <QMutexLocker>
 #include <QObject>
 #include <QStandardPaths>
+#include <QWaitCondition>
+#include <atomic>
 
 #ifdef MZ_IOS
 #  include <os/log.h>
@@ -21,6 +23,7 @@ class QBuffer;
 class QDir;
 class QFile;
 class QTextStream;
+class QThread;
 
 class LogSerializer {
  public:
@@ -39,6 +42,7 @@ class LogHandler final : public QObject, public LogSerializer {
 
  public:
   LogHandler();
+  ~LogHandler();
   static LogHandler* instance();
 
   struct Log {
@@ -112,9 +116,20 @@ class LogHandler final : public QObject, public LogSerializer {
   void cleanupLogsNeeded();
 
  private:
+  struct Ring;
+  struct RingOwner;
+
   void addLog(const Log& log);
   void addLog(const Log& log, const QMutexLocker<QMutex>& proofOfLock);
 
+  bool enqueue(LogLevel logLevel, const QByteArray& line);
+  Ring* threadRing();
+  void drain(const QMutexLocker<QMutex>& proofOfLock);
+  void writeLine(LogLevel logLevel, const QByteArray& line,
+                 const QMutexLocker<QMutex>& proofOfLock);
+  void notifyLogEntryAdded(const QByteArray& line);
+  void writerMain();
+
   static bool makeLogDir(const QDir& dir);
 
   void openLogFile(const QMutexLocker<QMutex>& proofOfLock);
@@ -137,7 +152,18 @@ class LogHandler final : public QObject, public LogSerializer {
 #endif
 
   QFile* m_logFile = nullptr;
-  QTextStream* m_output = nullptr;
+
+  // Each thread formats its log lines into a ring buffer of its own, without
+  // taking any lock. The writer thread collects them in batches and writes
+  // them out under m_mutex. The lines of a thread keep their order, but those
+  // of different threads are only sorted within a batch: a line that is still
+  // being queued when a batch is collected ends up in the next one.
+  QMutex m_ringsMutex;
+  QList<Ring*> m_rings;
+  std::atomic<quint64> m_sequence{0};
+  QThread* m_writer = nullptr;
+  QWaitCondition m_writerWakeup;
+  bool m_writerStopping = false;
 
   QList<LogSerializer*> m_logSerializers;
 };
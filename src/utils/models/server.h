@@ -74,6 +74,8 @@ class Server final {
   uint32_t m_multihopPort = 0;
   QString m_countryCode;
   QString m_cityName;
+
+  friend class ServerCatalogue;
 };
 
 #endif  // SERVER_H
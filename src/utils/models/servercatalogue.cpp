@@ -0,0 +1,507 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "servercatalogue.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHostAddress>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include "logger.h"
+
+using Content = ServerCatalogue::Content;
+
+namespace {
+Logger logger("ServerCatalogue");
+
+constexpr const char CATALOGUE_MAGIC[4] = {'M', 'Z', 'S', 'C'};
+constexpr const quint32 CATALOGUE_VERSION = 1;
+constexpr const qsizetype CATALOGUE_DIGEST_SIZE = 32;
+
+// Magic, version, digest, then the number of strings, countries, cities,
+// servers and port ranges, and a reserved word.
+constexpr const qsizetype CATALOGUE_HEADER_SIZE = 64;
+
+// Name, code, first city and number of cities.
+constexpr const qsizetype COUNTRY_RECORD_SIZE = 16;
+
+// Name, code, latitude, longitude, first server and number of servers.
+constexpr const qsizetype CITY_RECORD_SIZE = 32;
+
+// Hostname, public key, socks name, country code, city name, weight, multihop
+// port, first port range, number of port ranges, the kinds of the four
+// addresses, then the IPv4 address and gateway and the IPv6 address and
+// gateway.
+constexpr const qsizetype SERVER_RECORD_SIZE = 80;
+
+// First and last port.
+constexpr const qsizetype PORT_RANGE_RECORD_SIZE = 8;
+
+enum AddressKind : quint8 {
+  AddressEmpty = 0,
+  AddressString,
+  AddressIPv4,
+  AddressIPv6,
+};
+
+class StringTable final {
+ public:
+  quint32 intern(const QString& string) {
+    auto it = m_index.constFind(string);
+    if (it != m_index.constEnd()) {
+      return it.value();
+    }
+
+    quint32 index = static_cast<quint32>(m_offsets.length());
+    m_offsets.append(static_cast<quint32>(m_data.length()));
+    m_data.append(string.toUtf8());
+    m_index.insert(string, index);
+    return index;
+  }
+
+  quint32 count() const { return static_cast<quint32>(m_offsets.length()); }
+
+  void appendTo(QByteArray& out) const {
+    for (quint32 offset : m_offsets) {
+      appendU32(out, offset);
+    }
+    appendU32(out, static_cast<quint32>(m_data.length()));
+    out.append(m_data);
+  }
+
+  qsizetype dataSize() const { return m_data.length(); }
+
+  static void appendU32(QByteArray& out, quint32 value) {
+    char buffer[sizeof(value)];
+    qToLittleEndian<quint32>(value, buffer);
+    out.append(buffer, sizeof(buffer));
+  }
+
+ private:
+  QHash<QString, quint32> m_index;
+  QList<quint32> m_offsets;
+  QByteArray m_data;
+};
+
+void packAddress(StringTable& strings, const QString& address, uchar* kind,
+                 uchar* slot, qsizetype width) {
+  memset(slot, 0, width);
+  if (address.isEmpty()) {
+    *kind = AddressEmpty;
+    return;
+  }
+
+  // Only pack the addresses that read back exactly as they were written.
+  QHostAddress host;
+  if (host.setAddress(address) && (host.toString() == address)) {
+    if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+      *kind = AddressIPv4;
+      qToBigEndian<quint32>(host.toIPv4Address(), slot);
+      return;
+    }
+    if ((host.protocol() == QAbstractSocket::IPv6Protocol) &&
+        host.scopeId().isEmpty() && (width >= 16)) {
+      *kind = AddressIPv6;
+      Q_IPV6ADDR raw = host.toIPv6Address();
+      memcpy(slot, raw.c, 16);
+      return;
+    }
+  }
+
+  *kind = AddressString;
+  qToLittleEndian<quint32>(strings.intern(address), slot);
+}
+
+bool unpackAddress(const QList<QString>& strings, uchar kind,
+                   const uchar* slot, qsizetype width, QString& address) {
+  switch (kind) {
+    case AddressEmpty:
+      address = QString();
+      return true;
+
+    case AddressString: {
+      quint32 index = qFromLittleEndian<quint32>(slot);
+      if (index >= strings.length()) {
+        return false;
+      }
+      address = strings.at(index);
+      return true;
+    }
+
+    case AddressIPv4:
+      address = QHostAddress(qFromBigEndian<quint32>(slot)).toString();
+      return true;
+
+    case AddressIPv6:
+      if (width < 16) {
+        return false;
+      }
+      address = QHostAddress(slot).toString();
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Bounds-checked access to the sections of a catalogue.
+class Reader final {
+ public:
+  Reader(const uchar* data, qsizetype size) : m_data(data), m_size(size) {}
+
+  const uchar* take(qsizetype length) {
+    if ((length < 0) || (length > (m_size - m_offset))) {
+      return nullptr;
+    }
+    const uchar* data = m_data + m_offset;
+    m_offset += length;
+    return data;
+  }
+
+  bool atEnd() const { return m_offset == m_size; }
+
+ private:
+  const uchar* m_data;
+  qsizetype m_size;
+  qsizetype m_offset = 0;
+};
+
+void putDouble(double value, uchar* dest) {
+  quint64 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  qToLittleEndian<quint64>(bits, dest);
+}
+
+double getDouble(const uchar* src) {
+  quint64 bits = qFromLittleEndian<quint64>(src);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+bool isValidRange(quint32 first, quint32 count, qsizetype total) {
+  return (static_cast<quint64>(first) + count) <=
+         static_cast<quint64>(total);
+}
+
+}  // namespace
+
+// static
+QByteArray ServerCatalogue::digest(const QByteArray& json) {
+  return QCryptographicHash::hash(json, QCryptographicHash::Sha256);
+}
+
+// static
+QByteArray ServerCatalogue::encode(const QByteArray& digest,
+                                   const Content& content) {
+  Q_ASSERT(digest.length() == CATALOGUE_DIGEST_SIZE);
+
+  StringTable strings;
+  QByteArray countries;
+  QByteArray cities;
+  QByteArray servers;
+  QByteArray portRanges;
+  quint32 cityCount = 0;
+  quint32 serverCount = 0;
+  quint32 portRangeCount = 0;
+
+  for (const ServerCountry& country : content.countries) {
+    quint32 firstCity = cityCount;
+    for (const QString& cityName : country.cities()) {
+      auto city = content.cities.constFind(
+          ServerCity::hashKey(country.code(), cityName));
+      if (city == content.cities.constEnd()) {
+        continue;
+      }
+
+      quint32 firstServer = serverCount;
+      for (const QString& publicKey : city->servers()) {
+        const Server& server = content.servers.value(publicKey);
+
+        quint32 firstPortRange = portRangeCount;
+        for (const QPair<uint32_t, uint32_t>& range : server.m_portRanges) {
+          uchar record[PORT_RANGE_RECORD_SIZE];
+          qToLittleEndian<quint32>(range.first, record);
+          qToLittleEndian<quint32>(range.second, record + 4);
+          portRanges.append(reinterpret_cast<const char*>(record),
+                            sizeof(record));
+          portRangeCount++;
+        }
+
+        uchar record[SERVER_RECORD_SIZE];
+        qToLittleEndian<quint32>(strings.intern(server.m_hostname), record);
+        qToLittleEndian<quint32>(strings.intern(server.m_publicKey),
+                                 record + 4);
+        qToLittleEndian<quint32>(strings.intern(server.m_socksName),
+                                 record + 8);
+        qToLittleEndian<quint32>(strings.intern(server.m_countryCode),
+                                 record + 12);
+        qToLittleEndian<quint32>(strings.intern(server.m_cityName),
+                                 record + 16);
+        qToLittleEndian<quint32>(server.m_weight, record + 20);
+        qToLittleEndian<quint32>(server.m_multihopPort, record + 24);
+        qToLittleEndian<quint32>(firstPortRange, record + 28);
+        qToLittleEndian<quint32>(portRangeCount - firstPortRange,
+                                 record + 32);
+        packAddress(strings, server.m_ipv4AddrIn, record + 36, record + 40, 4);
+        packAddress(strings, server.m_ipv4Gateway, record + 37, record + 44, 4);
+        packAddress(strings, server.m_ipv6AddrIn, record + 38, record + 48, 16);
+        packAddress(strings, server.m_ipv6Gateway, record + 39, record + 64,
+                    16);
+        servers.append(reinterpret_cast<const char*>(record), sizeof(record));
+        serverCount++;
+      }
+
+      uchar record[CITY_RECORD_SIZE];
+      qToLittleEndian<quint32>(strings.intern(city->m_name), record);
+      qToLittleEndian<quint32>(strings.intern(city->m_code), record + 4);
+      putDouble(city->m_latitude, record + 8);
+      putDouble(city->m_longitude, record + 16);
+      qToLittleEndian<quint32>(firstServer, record + 24);
+      qToLittleEndian<quint32>(serverCount - firstServer, record + 28);
+      cities.append(reinterpret_cast<const char*>(record), sizeof(record));
+      cityCount++;
+    }
+
+    uchar record[COUNTRY_RECORD_SIZE];
+    qToLittleEndian<quint32>(strings.intern(country.m_name), record);
+    qToLittleEndian<quint32>(strings.intern(country.m_code), record + 4);
+    qToLittleEndian<quint32>(firstCity, record + 8);
+    qToLittleEndian<quint32>(cityCount - firstCity, record + 12);
+    countries.append(reinterpret_cast<const char*>(record), sizeof(record));
+  }
+
+  QByteArray out;
+  out.reserve(CATALOGUE_HEADER_SIZE + (strings.count() + 1) * 4 +
+              strings.dataSize() + countries.length() + cities.length() +
+              servers.length() + portRanges.length());
+  out.append(CATALOGUE_MAGIC, sizeof(CATALOGUE_MAGIC));
+  StringTable::appendU32(out, CATALOGUE_VERSION);
+  out.append(digest);
+  StringTable::appendU32(out, strings.count());
+  StringTable::appendU32(out, content.countries.length());
+  StringTable::appendU32(out, cityCount);
+  StringTable::appendU32(out, serverCount);
+  StringTable::appendU32(out, portRangeCount);
+  StringTable::appendU32(out, 0);  // Reserved.
+  Q_ASSERT(out.length() == CATALOGUE_HEADER_SIZE);
+
+  strings.appendTo(out);
+  out.append(countries);
+  out.append(cities);
+  out.append(servers);
+  out.append(portRanges);
+  return out;
+}
+
+// static
+bool ServerCatalogue::decode(const uchar* data, qsizetype size,
+                             const QByteArray& digest, Content& content) {
+  Reader reader(data, size);
+  const uchar* header = reader.take(CATALOGUE_HEADER_SIZE);
+  if (!header ||
+      (memcmp(header, CATALOGUE_MAGIC, sizeof(CATALOGUE_MAGIC)) != 0) ||
+      (qFromLittleEndian<quint32>(header + 4) != CATALOGUE_VERSION)) {
+    logger.debug() << "Unsupported catalogue";
+    return false;
+  }
+  if (QByteArray::fromRawData(reinterpret_cast<const char*>(header + 8),
+                              CATALOGUE_DIGEST_SIZE) != digest) {
+    logger.debug() << "The catalogue is out of date";
+    return false;
+  }
+
+  quint32 stringCount = qFromLittleEndian<quint32>(header + 40);
+  quint32 countryCount = qFromLittleEndian<quint32>(header + 44);
+  quint32 cityCount = qFromLittleEndian<quint32>(header + 48);
+  quint32 serverCount = qFromLittleEndian<quint32>(header + 52);
+  quint32 portRangeCount = qFromLittleEndian<quint32>(header + 56);
+
+  // The string table: one offset per string, the size of the data, then the
+  // data itself.
+  const uchar* offsets = reader.take((static_cast<qsizetype>(stringCount) + 1) *
+                                     sizeof(quint32));
+  if (!offsets) {
+    return false;
+  }
+  quint32 dataSize = qFromLittleEndian<quint32>(offsets + stringCount * 4);
+  const uchar* stringData = reader.take(dataSize);
+  if (!stringData) {
+    return false;
+  }
+
+  QList<QString> strings;
+  strings.reserve(stringCount);
+  for (quint32 i = 0; i < stringCount; i++) {
+    quint32 begin = qFromLittleEndian<quint32>(offsets + i * 4);
+    quint32 end = (i + 1 < stringCount)
+                      ? qFromLittleEndian<quint32>(offsets + (i + 1) * 4)
+                      : dataSize;
+    if ((begin > end) || (end > dataSize)) {
+      return false;
+    }
+    strings.append(QString::fromUtf8(
+        reinterpret_cast<const char*>(stringData + begin), end - begin));
+  }
+
+  const uchar* countries = reader.take(countryCount * COUNTRY_RECORD_SIZE);
+  const uchar* cities = reader.take(cityCount * CITY_RECORD_SIZE);
+  const uchar* servers = reader.take(serverCount * SERVER_RECORD_SIZE);
+  const uchar* portRanges =
+      reader.take(portRangeCount * PORT_RANGE_RECORD_SIZE);
+  if (!countries || !cities || !servers || !portRanges || !reader.atEnd()) {
+    return false;
+  }
+
+  auto lookupString = [&strings](const uchar* field, QString& value) {
+    quint32 index = qFromLittleEndian<quint32>(field);
+    if (index >= strings.length()) {
+      return false;
+    }
+    value = strings.at(index);
+    return true;
+  };
+
+  Content result;
+  result.countries.reserve(countryCount);
+  result.cities.reserve(cityCount);
+  result.servers.reserve(serverCount);
+
+  for (quint32 i = 0; i < countryCount; i++) {
+    const uchar* countryRecord = countries + i * COUNTRY_RECORD_SIZE;
+    quint32 firstCity = qFromLittleEndian<quint32>(countryRecord + 8);
+    quint32 countryCities = qFromLittleEndian<quint32>(countryRecord + 12);
+
+    ServerCountry country;
+    if (!lookupString(countryRecord, country.m_name) ||
+        !lookupString(countryRecord + 4, country.m_code) ||
+        !isValidRange(firstCity, countryCities, cityCount)) {
+      return false;
+    }
+
+    for (quint32 j = firstCity; j < firstCity + countryCities; j++) {
+      const uchar* cityRecord = cities + j * CITY_RECORD_SIZE;
+      quint32 firstServer = qFromLittleEndian<quint32>(cityRecord + 24);
+      quint32 cityServers = qFromLittleEndian<quint32>(cityRecord + 28);
+
+      ServerCity city;
+      if (!lookupString(cityRecord, city.m_name) ||
+          !lookupString(cityRecord + 4, city.m_code) ||
+          !isValidRange(firstServer, cityServers, serverCount)) {
+        return false;
+      }
+      city.m_country = country.m_code;
+      city.m_hashKey = ServerCity::hashKey(city.m_country, city.m_name);
+      city.m_latitude = getDouble(cityRecord + 8);
+      city.m_longitude = getDouble(cityRecord + 16);
+
+      for (quint32 k = firstServer; k < firstServer + cityServers; k++) {
+        const uchar* serverRecord = servers + k * SERVER_RECORD_SIZE;
+        quint32 firstPortRange = qFromLittleEndian<quint32>(serverRecord + 28);
+        quint32 serverPortRanges =
+            qFromLittleEndian<quint32>(serverRecord + 32);
+
+        Server server;
+        if (!lookupString(serverRecord, server.m_hostname) ||
+            !lookupString(serverRecord + 4, server.m_publicKey) ||
+            !lookupString(serverRecord + 8, server.m_socksName) ||
+            !lookupString(serverRecord + 12, server.m_countryCode) ||
+            !lookupString(serverRecord + 16, server.m_cityName) ||
+            !unpackAddress(strings, serverRecord[36], serverRecord + 40, 4,
+                           server.m_ipv4AddrIn) ||
+            !unpackAddress(strings, serverRecord[37], serverRecord + 44, 4,
+                           server.m_ipv4Gateway) ||
+            !unpackAddress(strings, serverRecord[38], serverRecord + 48, 16,
+                           server.m_ipv6AddrIn) ||
+            !unpackAddress(strings, serverRecord[39], serverRecord + 64, 16,
+                           server.m_ipv6Gateway) ||
+            !isValidRange(firstPortRange, serverPortRanges, portRangeCount)) {
+          return false;
+        }
+        server.m_weight = qFromLittleEndian<quint32>(serverRecord + 20);
+        server.m_multihopPort = qFromLittleEndian<quint32>(serverRecord + 24);
+
+        server.m_portRanges.reserve(serverPortRanges);
+        for (quint32 l = firstPortRange; l < firstPortRange + serverPortRanges;
+             l++) {
+          const uchar* range = portRanges + l * PORT_RANGE_RECORD_SIZE;
+          server.m_portRanges.append(
+              QPair<uint32_t, uint32_t>(qFromLittleEndian<quint32>(range),
+                                        qFromLittleEndian<quint32>(range + 4)));
+        }
+
+        city.m_servers.append(server.m_publicKey);
+        result.servers.insert(server.m_publicKey, server);
+      }
+
+      country.m_cities.append(city.m_name);
+      result.cities.insert(city.m_hashKey, city);
+    }
+
+    result.countries.append(country);
+  }
+
+  content = result;
+  return true;
+}
+
+// static
+QByteArray ServerCatalogue::write(const QString& fileName,
+                                  const QByteArray& digest,
+                                  const Content& content) {
+  QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly)) {
+    logger.warning() << "Unable to write the server catalogue:"
+                     << file.errorString();
+    return QByteArray();
+  }
+
+  QByteArray data = encode(digest, content);
+  if ((file.write(data) != data.length()) || !file.commit()) {
+    logger.warning() << "Unable to write the server catalogue:"
+                     << file.errorString();
+    return QByteArray();
+  }
+
+  logger.debug() << "Server catalogue written:" << data.length() << "bytes";
+  return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+}
+
+// static
+bool ServerCatalogue::read(const QString& fileName,
+                           const QByteArray& fileDigest,
+                           const QByteArray& digest, Content& content) {
+  if (fileDigest.isEmpty()) {
+    return false;
+  }
+
+  QFile file(fileName);
+  if (!file.exists() || !file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+
+  qint64 size = file.size();
+  const uchar* data = (size > 0) ? file.map(0, size) : nullptr;
+  if (data == nullptr) {
+    return false;
+  }
+
+  // Anyone who can write to the app data could have changed the servers, so
+  // the whole file must be the one that was written.
+  QCryptographicHash hash(QCryptographicHash::Sha256);
+  hash.addData(QByteArrayView(data, size));
+  bool result = (hash.result() == fileDigest) &&
+                decode(data, size, digest, content);
+  file.unmap(const_cast<uchar*>(data));
+  if (!result) {
+    logger.debug() << "Unable to use the server catalogue";
+  }
+  return result;
+}
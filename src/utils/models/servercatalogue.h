@@ -0,0 +1,66 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef SERVERCATALOGUE_H
+#define SERVERCATALOGUE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include "models/servercountry.h"
+
+// A binary copy of the server list, so that the models can be rebuilt at
+// startup without parsing the JSON again. The file holds a table of interned
+// UTF-8 strings, followed by fixed size records for countries, cities, servers
+// and port ranges which refer to each other by index. Addresses are packed in
+// binary when they round-trip through QHostAddress, and are interned strings
+// otherwise. All integers are little endian.
+//
+// The catalogue records a digest of the JSON it was built from, and is only
+// used while that JSON is still the current server list. The file itself is
+// not trusted: it is only read if its SHA-256 matches the one recorded when it
+// was written, which the caller keeps next to the server list.
+class ServerCatalogue final {
+ public:
+  struct Content {
+    QList<ServerCountry> countries;
+    QHash<QString, ServerCity> cities;
+    QHash<QString, Server> servers;
+  };
+
+  static QByteArray digest(const QByteArray& json);
+
+  static QByteArray encode(const QByteArray& digest, const Content& content);
+  static bool decode(const uchar* data, qsizetype size,
+                     const QByteArray& digest, Content& content);
+
+  /**
+   * @brief Write the catalogue of a server list to a file, atomically.
+   *
+   * @param fileName - the file to replace
+   * @param digest - the digest of the server list JSON
+   * @param content - the models parsed from it
+   * @return QByteArray - the SHA-256 of the file, or an empty QByteArray if
+   * the file can't be written.
+   */
+  static QByteArray write(const QString& fileName, const QByteArray& digest,
+                          const Content& content);
+
+  /**
+   * @brief Memory-map a catalogue file and rebuild the models from it.
+   *
+   * @param fileName - the file to read
+   * @param fileDigest - the SHA-256 returned by write()
+   * @param digest - the digest of the current server list JSON
+   * @param content - filled with the models on success
+   * @return bool - false if the file is missing, unreadable, modified or out
+   * of date.
+   */
+  static bool read(const QString& fileName, const QByteArray& fileDigest,
+                   const QByteArray& digest, Content& content);
+};
+
+#endif  // SERVERCATALOGUE_H
@@ -76,6 +76,8 @@ class ServerCity final : public QObject {
   // Settable field for connection scoring.
   qint64 m_latency = 0;
   int m_connectionScore = 0;
+
+  friend class ServerCatalogue;
 };
 
 #endif  // SERVERCITY_H
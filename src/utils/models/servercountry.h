@@ -37,6 +37,8 @@ class ServerCountry final {
   QString m_code;
 
   QList<QString> m_cities;
+
+  friend class ServerCatalogue;
 };
 
 #endif  // SERVERCOUNTRY_H
@@ -11,6 +11,7 @@
 #include "collator.h"
 #include "leakdetector.h"
 #include "logger.h"
+#include "models/servercatalogue.h"
 #include "models/servercountry.h"
 
 namespace {
@@ -29,15 +30,59 @@ bool ServerCountryModel::fromJson(const QByteArray& json) {
     return true;
   }
 
+  QByteArray digest;
+  if (!m_catalogueFileName.isEmpty() && !json.isEmpty()) {
+    digest = ServerCatalogue::digest(json);
+    if (fromCatalogue(digest)) {
+      m_rawJson = json;
+      emit changed();
+      return true;
+    }
+  }
+
   if (!fromJsonInternal(json)) {
     return false;
   }
 
   m_rawJson = json;
+  if (!digest.isEmpty()) {
+    writeCatalogue(digest);
+  }
   emit changed();
   return true;
 }
 
+bool ServerCountryModel::fromCatalogue(const QByteArray& digest) {
+  ServerCatalogue::Content content;
+  if (!ServerCatalogue::read(m_catalogueFileName, m_catalogueFileDigest,
+                             digest, content)) {
+    return false;
+  }
+  logger.debug() << "Reading from the server catalogue";
+
+  beginResetModel();
+
+  m_countries = content.countries;
+  m_cities = content.cities;
+  m_servers = content.servers;
+
+  sortCountries();
+
+  endResetModel();
+
+  return true;
+}
+
+void ServerCountryModel::writeCatalogue(const QByteArray& digest) {
+  ServerCatalogue::Content content;
+  content.countries = m_countries;
+  content.cities = m_cities;
+  content.servers = m_servers;
+  m_catalogueFileDigest =
+      ServerCatalogue::write(m_catalogueFileName, digest, content);
+  emit catalogueWritten(m_catalogueFileDigest);
+}
+
 bool ServerCountryModel::fromJsonInternal(const QByteArray& s) {
   beginResetModel();
 
@@ -30,6 +30,15 @@ class ServerCountryModel final : public QAbstractListModel {
 
   [[nodiscard]] bool fromJson(const QByteArray& data);
 
+  // Keep a binary catalogue of the server list in this file, and load from it
+  // instead of parsing the JSON when it is still up to date. The file is only
+  // trusted if its SHA-256 matches the digest, which must be kept somewhere
+  // safe. It is reported by catalogueWritten() whenever the file is replaced.
+  void setCatalogue(const QString& fileName, const QByteArray& fileDigest) {
+    m_catalogueFileName = fileName;
+    m_catalogueFileDigest = fileDigest;
+  }
+
   bool initialized() const { return !m_rawJson.isEmpty(); }
 
   bool exists(const QString& countryCode, const QString& cityName) const;
@@ -59,14 +68,19 @@ class ServerCountryModel final : public QAbstractListModel {
 
  signals:
   void changed();
+  void catalogueWritten(const QByteArray& fileDigest);
 
  private:
   [[nodiscard]] bool fromJsonInternal(const QByteArray& data);
+  bool fromCatalogue(const QByteArray& digest);
+  void writeCatalogue(const QByteArray& digest);
 
   void sortCountries();
 
  private:
   QByteArray m_rawJson;
+  QString m_catalogueFileName;
+  QByteArray m_catalogueFileDigest;
 
   QList<ServerCountry> m_countries;
   QHash<QString, ServerCity> m_cities;
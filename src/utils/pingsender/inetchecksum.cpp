@@ -0,0 +1,155 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "inetchecksum.h"
+
+#include <string.h>
+
+#if (defined(Q_PROCESSOR_X86_64) || defined(__SSE2__)) && !defined(Q_CC_MSVC)
+#  define INETCHECKSUM_AVX2
+#  include <immintrin.h>
+#endif
+
+namespace {
+
+// Add with the end around carry of ones' complement arithmetic.
+inline quint64 addCarry(quint64 sum, quint64 value) {
+  sum += value;
+  return sum + (sum < value);
+}
+
+inline quint16 fold(quint64 sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return static_cast<quint16>(~sum);
+}
+
+// Sum the bytes that don't fill a whole 64-bit word. They keep their position
+// in memory, so that they line up with the 16-bit words of the other paths.
+inline quint64 sumTail(const quint8* data, size_t length) {
+  quint64 word = 0;
+  memcpy(&word, data, length);
+  return word;
+}
+
+quint16 computeScalar(const void* data, size_t length) {
+  const quint8* bytes = static_cast<const quint8*>(data);
+  quint64 sum = 0;
+
+  while (length > 1) {
+    quint16 word;
+    memcpy(&word, bytes, sizeof(word));
+    sum += word;
+    bytes += 2;
+    length -= 2;
+  }
+
+  // Mop up an odd byte, if necessary.
+  if (length == 1) {
+    quint8 last[2] = {*bytes, 0};
+    quint16 word;
+    memcpy(&word, last, sizeof(word));
+    sum += word;
+  }
+
+  return fold(sum);
+}
+
+quint16 computeWide(const void* data, size_t length) {
+  const quint8* bytes = static_cast<const quint8*>(data);
+  quint64 sum = 0;
+
+  // Four independent accumulators hide the latency of the carries.
+  quint64 a = 0, b = 0, c = 0, d = 0;
+  while (length >= 32) {
+    quint64 words[4];
+    memcpy(words, bytes, sizeof(words));
+    a = addCarry(a, words[0]);
+    b = addCarry(b, words[1]);
+    c = addCarry(c, words[2]);
+    d = addCarry(d, words[3]);
+    bytes += 32;
+    length -= 32;
+  }
+  sum = addCarry(addCarry(a, b), addCarry(c, d));
+
+  while (length >= 8) {
+    quint64 word;
+    memcpy(&word, bytes, sizeof(word));
+    sum = addCarry(sum, word);
+    bytes += 8;
+    length -= 8;
+  }
+
+  return fold(addCarry(sum, sumTail(bytes, length)));
+}
+
+#ifdef INETCHECKSUM_AVX2
+__attribute__((target("avx2"))) quint16 computeAvx2(const void* data,
+                                                    size_t length) {
+  const quint8* bytes = static_cast<const quint8*>(data);
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  while (length >= 64) {
+    __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+    __m256i v1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+    bytes += 64;
+    length -= 64;
+  }
+
+  quint64 lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc0);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 4), acc1);
+  quint64 sum = 0;
+  for (quint64 lane : lanes) {
+    sum = addCarry(sum, lane);
+  }
+
+  while (length >= 8) {
+    quint64 word;
+    memcpy(&word, bytes, sizeof(word));
+    sum = addCarry(sum, word);
+    bytes += 8;
+    length -= 8;
+  }
+
+  return fold(addCarry(sum, sumTail(bytes, length)));
+}
+#endif
+
+InetChecksum::Function select() {
+  QList<InetChecksum::Implementation> list = InetChecksum::implementations();
+  return list.last().function;
+}
+
+}  // namespace
+
+namespace InetChecksum {
+
+quint16 compute(const void* data, size_t length) {
+  static const Function s_function = select();
+  return s_function(data, length);
+}
+
+QList<Implementation> implementations() {
+  QList<Implementation> list;
+  list.append(Implementation{"scalar", computeScalar});
+  list.append(Implementation{"wide", computeWide});
+#ifdef INETCHECKSUM_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    list.append(Implementation{"avx2", computeAvx2});
+  }
+#endif
+  return list;
+}
+
+}  // namespace InetChecksum
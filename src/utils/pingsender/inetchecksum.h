@@ -0,0 +1,41 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef INETCHECKSUM_H
+#define INETCHECKSUM_H
+
+#include <QList>
+#include <QtGlobal>
+
+// The Internet checksum of RFC 1071, as used by ICMP. The ones' complement
+// sum does not depend on how the data is grouped into words, so it can be
+// computed 64 bits at a time, or a vector register at a time, and folded down
+// to 16 bits at the end. The fastest implementation supported by the CPU is
+// picked the first time a checksum is computed.
+namespace InetChecksum {
+
+using Function = quint16 (*)(const void* data, size_t length);
+
+struct Implementation {
+  const char* name;
+  Function function;
+};
+
+/**
+ * @brief Compute the Internet checksum of a buffer.
+ *
+ * @param data - the buffer, with no alignment requirements
+ * @param length - the length of the buffer in bytes
+ * @return quint16 - the checksum, in the same byte order as the data.
+ */
+quint16 compute(const void* data, size_t length);
+
+// The implementations that can run on this CPU, from slowest to fastest on
+// typical hardware. The last one is used by compute(). The first one sums
+// 16-bit words one at a time, and serves as the reference.
+QList<Implementation> implementations();
+
+}  // namespace InetChecksum
+
+#endif  // INETCHECKSUM_H
@@ -4,45 +4,20 @@
 
 #include "pingsender.h"
 
+#include "inetchecksum.h"
 #include "logger.h"
 
 namespace {
 Logger logger("PingSender");
 }
 
-quint16 PingSender::inetChecksum(const void* data, size_t len) {
-  int nleft, sum;
-  quint16* w;
-  union {
-    quint16 us;
-    quint8 uc[2];
-  } last;
-  quint16 answer;
-
-  nleft = static_cast<int>(len);
-  sum = 0;
-  w = (quint16*)data;
-
-  /*
-   * Our algorithm is simple, using a 32 bit accumulator (sum), we add
-   * sequential 16 bit words to it, and at the end, fold back all the
-   * carry bits from the top 16 bits into the lower 16 bits.
-   */
-  while (nleft > 1) {
-    sum += *w++;
-    nleft -= 2;
-  }
-
-  /* mop up an odd byte, if necessary */
-  if (nleft == 1) {
-    last.uc[0] = *(quint8*)w;
-    last.uc[1] = 0;
-    sum += last.us;
+void PingSender::sendPings(const QList<QHostAddress>& destinations,
+                           quint16 sequence) {
+  for (const QHostAddress& destination : destinations) {
+    sendPing(destination, sequence++);
   }
+}
 
-  /* add back carry outs from top 16 bits to low 16 bits */
-  sum = (sum >> 16) + (sum & 0xffff); /* add hi 16 to low 16 */
-  sum += (sum >> 16);                 /* add carry */
-  answer = ~sum;                      /* truncate to 16 bits */
-  return (answer);
+quint16 PingSender::inetChecksum(const void* data, size_t len) {
+  return InetChecksum::compute(data, len);
 }
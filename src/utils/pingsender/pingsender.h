@@ -7,6 +7,7 @@
 
 #include <QElapsedTimer>
 #include <QHostAddress>
+#include <QList>
 #include <QObject>
 
 class PingSender : public QObject {
@@ -21,10 +22,18 @@ class PingSender : public QObject {
 
   virtual void sendPing(const QHostAddress& destination, quint16 sequence) = 0;
 
+  // Send a ping to each destination, numbered consecutively from the given
+  // sequence. Platforms that can submit many packets with a single system
+  // call override this, by default the pings are sent one at a time.
+  virtual void sendPings(const QList<QHostAddress>& destinations,
+                         quint16 sequence);
+
   static quint16 inetChecksum(const void* data, size_t length);
 
  signals:
-  void recvPing(quint16 sequence);
+  // The timestamp is when the reply reached the network stack, in
+  // microseconds since the epoch, or zero if the platform doesn't know.
+  void recvPing(quint16 sequence, qint64 timestamp = 0);
   void criticalPingError();
 };
 
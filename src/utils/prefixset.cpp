@@ -0,0 +1,271 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "prefixset.h"
+
+#include <QtEndian>
+#include <algorithm>
+
+using Uint128 = PrefixSet::Uint128;
+
+namespace {
+
+// The arithmetic needed by the range algorithms, for both address widths.
+bool before(quint32 a, quint32 b) { return a < b; }
+bool before(const Uint128& a, const Uint128& b) {
+  return (a.hi < b.hi) || ((a.hi == b.hi) && (a.lo < b.lo));
+}
+
+bool same(quint32 a, quint32 b) { return a == b; }
+bool same(const Uint128& a, const Uint128& b) {
+  return (a.hi == b.hi) && (a.lo == b.lo);
+}
+
+quint32 next(quint32 a) { return a + 1; }
+Uint128 next(const Uint128& a) {
+  return Uint128{(a.lo == UINT64_MAX) ? a.hi + 1 : a.hi, a.lo + 1};
+}
+
+quint32 prev(quint32 a) { return a - 1; }
+Uint128 prev(const Uint128& a) {
+  return Uint128{(a.lo == 0) ? a.hi - 1 : a.hi, a.lo - 1};
+}
+
+bool isMax(quint32 a) { return a == UINT32_MAX; }
+bool isMax(const Uint128& a) {
+  return (a.hi == UINT64_MAX) && (a.lo == UINT64_MAX);
+}
+
+int width(quint32) { return 32; }
+int width(const Uint128&) { return 128; }
+
+// The host bits of a prefix of the given length.
+quint32 hostmask(quint32, int prefixLength) {
+  return (prefixLength >= 32) ? 0 : (UINT32_MAX >> prefixLength);
+}
+Uint128 hostmask(const Uint128&, int prefixLength) {
+  if (prefixLength >= 128) {
+    return Uint128{0, 0};
+  }
+  if (prefixLength >= 64) {
+    return Uint128{0, UINT64_MAX >> (prefixLength - 64)};
+  }
+  return Uint128{UINT64_MAX >> prefixLength, UINT64_MAX};
+}
+
+bool isAligned(quint32 a, int prefixLength) {
+  return (a & hostmask(a, prefixLength)) == 0;
+}
+bool isAligned(const Uint128& a, int prefixLength) {
+  Uint128 mask = hostmask(a, prefixLength);
+  return ((a.hi & mask.hi) == 0) && ((a.lo & mask.lo) == 0);
+}
+
+quint32 blockLast(quint32 a, int prefixLength) {
+  return a | hostmask(a, prefixLength);
+}
+Uint128 blockLast(const Uint128& a, int prefixLength) {
+  Uint128 mask = hostmask(a, prefixLength);
+  return Uint128{a.hi | mask.hi, a.lo | mask.lo};
+}
+
+template <typename T>
+using Range = PrefixSet::Range<T>;
+
+// Sort the ranges and merge the ones that overlap or touch.
+template <typename T>
+void normalize(QList<Range<T>>& ranges) {
+  if (ranges.count() < 2) {
+    return;
+  }
+  std::sort(ranges.begin(), ranges.end(),
+            [](const Range<T>& a, const Range<T>& b) {
+              return before(a.first, b.first);
+            });
+
+  qsizetype out = 0;
+  for (qsizetype i = 1; i < ranges.count(); i++) {
+    Range<T>& last = ranges[out];
+    const Range<T>& range = ranges.at(i);
+    if (isMax(last.last) || !before(next(last.last), range.first)) {
+      if (before(last.last, range.last)) {
+        last.last = range.last;
+      }
+    } else {
+      ranges[++out] = range;
+    }
+  }
+  ranges.resize(out + 1);
+}
+
+// Remove the addresses of one sorted list of ranges from another.
+template <typename T>
+QList<Range<T>> subtract(const QList<Range<T>>& ranges,
+                         const QList<Range<T>>& excluded) {
+  QList<Range<T>> result;
+  result.reserve(ranges.count());
+
+  qsizetype j = 0;
+  for (const Range<T>& range : ranges) {
+    while ((j < excluded.count()) &&
+           before(excluded.at(j).last, range.first)) {
+      j++;
+    }
+
+    T first = range.first;
+    bool remaining = true;
+    for (qsizetype k = j; k < excluded.count(); k++) {
+      const Range<T>& hole = excluded.at(k);
+      if (before(range.last, hole.first)) {
+        break;
+      }
+      if (before(first, hole.first)) {
+        result.append(Range<T>{first, prev(hole.first)});
+      }
+      if (!before(hole.last, range.last)) {
+        remaining = false;
+        break;
+      }
+      first = next(hole.last);
+    }
+    if (remaining) {
+      result.append(Range<T>{first, range.last});
+    }
+  }
+  return result;
+}
+
+template <typename T>
+bool lookup(const QList<Range<T>>& ranges, const T& value) {
+  // Find the first range starting after the value, and check the one before.
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), value,
+      [](const T& v, const Range<T>& r) { return before(v, r.first); });
+  if (it == ranges.begin()) {
+    return false;
+  }
+  --it;
+  return !before(it->last, value);
+}
+
+// Split a range into the fewest possible CIDR prefixes.
+template <typename T, typename F>
+void cover(const Range<T>& range, F&& func) {
+  T first = range.first;
+  while (true) {
+    // Find the largest aligned block that starts here and fits in the range.
+    int prefixLength = 0;
+    T last = blockLast(first, 0);
+    while (prefixLength < width(first)) {
+      if (isAligned(first, prefixLength)) {
+        last = blockLast(first, prefixLength);
+        if (!before(range.last, last)) {
+          break;
+        }
+      }
+      prefixLength++;
+    }
+    if (prefixLength == width(first)) {
+      last = first;
+    }
+
+    func(first, prefixLength);
+    if (same(last, range.last)) {
+      return;
+    }
+    first = next(last);
+  }
+}
+
+Range<quint32> ipv4Range(const IPAddress& prefix) {
+  quint32 address = prefix.address().toIPv4Address();
+  int length = prefix.prefixLength();
+  quint32 first = address & ~hostmask(address, length);
+  return Range<quint32>{first, blockLast(first, length)};
+}
+
+Range<Uint128> ipv6Range(const IPAddress& prefix) {
+  Q_IPV6ADDR raw = prefix.address().toIPv6Address();
+  Uint128 address{qFromBigEndian<quint64>(&raw[0]),
+                  qFromBigEndian<quint64>(&raw[8])};
+  Uint128 mask = hostmask(address, prefix.prefixLength());
+  Uint128 first{address.hi & ~mask.hi, address.lo & ~mask.lo};
+  return Range<Uint128>{first, blockLast(first, prefix.prefixLength())};
+}
+
+Uint128 ipv6Value(const QHostAddress& address) {
+  Q_IPV6ADDR raw = address.toIPv6Address();
+  return Uint128{qFromBigEndian<quint64>(&raw[0]),
+                 qFromBigEndian<quint64>(&raw[8])};
+}
+
+}  // namespace
+
+PrefixSet::PrefixSet(const QList<IPAddress>& prefixes) {
+  for (const IPAddress& prefix : prefixes) {
+    if (prefix.type() == QAbstractSocket::IPv4Protocol) {
+      m_ipv4.append(ipv4Range(prefix));
+    } else if (prefix.type() == QAbstractSocket::IPv6Protocol) {
+      m_ipv6.append(ipv6Range(prefix));
+    }
+  }
+  normalize(m_ipv4);
+  normalize(m_ipv6);
+}
+
+void PrefixSet::add(const IPAddress& prefix) {
+  add(PrefixSet(QList<IPAddress>{prefix}));
+}
+
+void PrefixSet::add(const PrefixSet& other) {
+  if (!other.m_ipv4.isEmpty()) {
+    m_ipv4.append(other.m_ipv4);
+    normalize(m_ipv4);
+  }
+  if (!other.m_ipv6.isEmpty()) {
+    m_ipv6.append(other.m_ipv6);
+    normalize(m_ipv6);
+  }
+}
+
+void PrefixSet::remove(const IPAddress& prefix) {
+  remove(PrefixSet(QList<IPAddress>{prefix}));
+}
+
+void PrefixSet::remove(const PrefixSet& other) {
+  if (!other.m_ipv4.isEmpty()) {
+    m_ipv4 = subtract(m_ipv4, other.m_ipv4);
+  }
+  if (!other.m_ipv6.isEmpty()) {
+    m_ipv6 = subtract(m_ipv6, other.m_ipv6);
+  }
+}
+
+bool PrefixSet::contains(const QHostAddress& address) const {
+  if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+    return lookup(m_ipv4, address.toIPv4Address());
+  }
+  if (address.protocol() == QAbstractSocket::IPv6Protocol) {
+    return lookup(m_ipv6, ipv6Value(address));
+  }
+  return false;
+}
+
+QList<IPAddress> PrefixSet::toList() const {
+  QList<IPAddress> list;
+  for (const Range<quint32>& range : m_ipv4) {
+    cover(range, [&](quint32 first, int prefixLength) {
+      list.append(IPAddress(QHostAddress(first), prefixLength));
+    });
+  }
+  for (const Range<Uint128>& range : m_ipv6) {
+    cover(range, [&](const Uint128& first, int prefixLength) {
+      Q_IPV6ADDR raw;
+      qToBigEndian<quint64>(first.hi, &raw[0]);
+      qToBigEndian<quint64>(first.lo, &raw[8]);
+      list.append(IPAddress(QHostAddress(raw), prefixLength));
+    });
+  }
+  return list;
+}
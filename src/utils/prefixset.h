@@ -0,0 +1,54 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef PREFIXSET_H
+#define PREFIXSET_H
+
+#include <QList>
+
+#include "ipaddress.h"
+
+// A set of IPv4 and IPv6 addresses, built from and converted back to CIDR
+// prefixes. Addresses are held as sorted, non-overlapping ranges of plain
+// integers, so that union, difference and lookups are linear or logarithmic
+// in the number of ranges, whatever the prefix lengths involved.
+class PrefixSet final {
+ public:
+  PrefixSet() = default;
+  explicit PrefixSet(const QList<IPAddress>& prefixes);
+
+  bool isEmpty() const { return m_ipv4.isEmpty() && m_ipv6.isEmpty(); }
+
+  void add(const IPAddress& prefix);
+  void add(const PrefixSet& other);
+  void remove(const IPAddress& prefix);
+  void remove(const PrefixSet& other);
+
+  bool contains(const QHostAddress& address) const;
+
+  /**
+   * @brief Get the smallest list of CIDR prefixes covering the set.
+   *
+   * @return QList<IPAddress> - the prefixes, IPv4 first, in address order.
+   */
+  QList<IPAddress> toList() const;
+
+  // An unsigned 128-bit integer, for IPv6 addresses.
+  struct Uint128 {
+    quint64 hi = 0;
+    quint64 lo = 0;
+  };
+
+  template <typename T>
+  struct Range {
+    T first;
+    T last;
+  };
+
+ private:
+  QList<Range<quint32>> m_ipv4;
+  QList<Range<Uint128>> m_ipv6;
+};
+
+#endif  // PREFIXSET_H
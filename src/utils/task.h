@@ -24,6 +24,20 @@ class Task : public QObject {
     Reschedulable,
   };
 
+  // The scheduler runs the tasks of a higher priority first, and limits how
+  // many tasks of each priority can run at the same time. See
+  // TaskScheduler::setConcurrency().
+  enum Priority {
+    // Something the user is waiting for.
+    Interactive,
+
+    // The default priority.
+    Normal,
+
+    // Work nobody is waiting for, such as downloads and telemetry.
+    Background,
+  };
+
   explicit Task(const QString& name) : m_name(name) {}
   virtual ~Task() = default;
 
@@ -36,6 +50,17 @@ class Task : public QObject {
   // executed.
   virtual DeletePolicy deletePolicy() const { return Deletable; }
 
+  virtual Priority priority() const { return Normal; }
+
+  // Tasks with the same conflict group never run at the same time, and start
+  // in the order they were scheduled. By default, all the tasks share one
+  // group, and run one after the other. Overwrite this method if the task
+  // does not depend on, and does not change, the state used by the others. An
+  // empty group means that the task can run next to any other task.
+  virtual QString conflictGroup() const { return defaultConflictGroup(); }
+
+  static QString defaultConflictGroup() { return QStringLiteral("default"); }
+
  signals:
   void completed();
 
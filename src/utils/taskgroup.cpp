@@ -52,6 +52,16 @@ void TaskGroup::cancel() {
   }
 }
 
+Task::Priority TaskGroup::priority() const {
+  // The group runs as soon as its most urgent task would, but it is never a
+  // background task: it holds the default conflict group while it runs.
+  Priority priority = Normal;
+  for (Task* task : m_tasks) {
+    priority = qMin(priority, task->priority());
+  }
+  return priority;
+}
+
 Task::DeletePolicy TaskGroup::deletePolicy() const {
   // The policy for task group is:
   // - if there is at least 1 non-deletable task, the group is non-deletable
@@ -21,6 +21,7 @@ class TaskGroup final : public Task {
 
   void cancel() override;
   DeletePolicy deletePolicy() const override;
+  Priority priority() const override;
 
  private:
   void maybeComplete();
@@ -5,7 +5,9 @@
 #include "taskscheduler.h"
 
 #include <QCoreApplication>
+#include <QSet>
 #include <QTimer>
+#include <QtAlgorithms>
 
 #include "leakdetector.h"
 #include "logger.h"
@@ -21,19 +23,45 @@ Q_GLOBAL_STATIC(TaskScheduler, taskScheduler);
 // static
 void TaskScheduler::scheduleTask(Task* task) {
   Q_ASSERT(task);
-  logger.debug() << "Scheduling task:" << task->name();
+  MZ_LOG(logger, Debug) << "Scheduling task:" << task->name();
   taskScheduler->scheduleTaskInternal(task);
 }
 
 // static
 void TaskScheduler::scheduleTaskNow(Task* task) {
   Q_ASSERT(task);
-  logger.debug() << "Scheduling task NOW!:" << task->name();
+  MZ_LOG(logger, Debug) << "Scheduling task NOW!:" << task->name();
 
   task->run();
   connect(task, &Task::completed, task, &QObject::deleteLater);
 }
 
+// static
+void TaskScheduler::setConcurrency(Task::Priority priority, int limit) {
+  Q_ASSERT(limit > 0);
+  taskScheduler->m_concurrency[priority] = limit;
+  taskScheduler->maybeRunTask();
+}
+
+// static
+TaskScheduler::Histogram TaskScheduler::queueTimes(const QString& name) {
+  return taskScheduler->m_queueTimes.value(name);
+}
+
+// static
+TaskScheduler::Histogram TaskScheduler::runTimes(const QString& name) {
+  return taskScheduler->m_runTimes.value(name);
+}
+
+void TaskScheduler::Histogram::record(qint64 msec) {
+  msec = qMax<qint64>(msec, 0);
+  int bucket = 64 - qCountLeadingZeroBits(static_cast<quint64>(msec));
+  ++m_buckets[qMin(bucket, BUCKETS - 1)];
+  ++m_count;
+  m_totalMsec += msec;
+  m_maxMsec = qMax(m_maxMsec, msec);
+}
+
 // static
 void TaskScheduler::deleteTasks() {
   taskScheduler->deleteTasksInternal(/* forced */ false);
@@ -67,36 +95,109 @@ TaskScheduler::~TaskScheduler() {
 
 void TaskScheduler::scheduleTaskInternal(Task* task) {
   m_tasks.append(task);
+
+  // A rescheduled task keeps the time it was first queued.
+  if (!m_queuedTimers.contains(task)) {
+    m_queuedTimers[task].start();
+  }
+
   maybeRunTask();
 }
 
 void TaskScheduler::maybeRunTask() {
-  logger.debug() << "Tasks: " << m_tasks.size();
+  MZ_LOG(logger, Debug) << "Tasks: " << m_tasks.size()
+                        << "running:" << m_running.size();
 
-  if (m_running_task || m_tasks.empty()) {
-    return;
+  while (m_paused == 0) {
+    Task* task = takeNextTask();
+    if (!task) {
+      return;
+    }
+
+    QElapsedTimer queued = m_queuedTimers.take(task);
+
+    Running running;
+    running.m_task = task;
+    running.m_priority = task->priority();
+    running.m_conflictGroup = task->conflictGroup();
+    running.m_queueMsec = queued.isValid() ? queued.elapsed() : 0;
+    running.m_timer.start();
+    m_queueTimes[task->name()].record(running.m_queueMsec);
+    m_running.append(running);
+
+    connect(task, &Task::completed, this,
+            [this, task]() { taskCompleted(task); });
+
+    // This can complete the task, and start the next ones, synchronously.
+    task->run();
   }
+}
 
-  if (m_paused > 0) {
-    return;
+Task* TaskScheduler::takeNextTask() {
+  int running[Task::Background + 1] = {};
+  QSet<QString> busyGroups;
+  for (const Running& r : m_running) {
+    ++running[r.m_priority];
+    if (!r.m_conflictGroup.isEmpty()) {
+      busyGroups.insert(r.m_conflictGroup);
+    }
   }
 
-  m_running_task = m_tasks.takeFirst();
-  Q_ASSERT(m_running_task);
+  // Only the first queued task of each conflict group can start, so that the
+  // tasks of a group keep their order. Among those, the highest priority wins,
+  // and the oldest task breaks the ties.
+  qsizetype next = -1;
+  Task::Priority nextPriority = Task::Background;
+  for (qsizetype i = 0; i < m_tasks.size(); ++i) {
+    Task* task = m_tasks.at(i);
+
+    QString group = task->conflictGroup();
+    if (!group.isEmpty()) {
+      if (busyGroups.contains(group)) {
+        continue;
+      }
+      busyGroups.insert(group);
+    }
+
+    Task::Priority priority = task->priority();
+    if (running[priority] >= m_concurrency[priority]) {
+      continue;
+    }
 
-  QObject::connect(m_running_task, &Task::completed, this,
-                   &TaskScheduler::taskCompleted);
+    if (next < 0 || priority < nextPriority) {
+      next = i;
+      nextPriority = priority;
+    }
+  }
 
-  m_running_task->run();
+  if (next < 0) {
+    return nullptr;
+  }
+  return m_tasks.takeAt(next);
 }
 
-void TaskScheduler::taskCompleted() {
-  Q_ASSERT(m_running_task);
+void TaskScheduler::taskCompleted(Task* task) {
+  qsizetype index = -1;
+  for (qsizetype i = 0; i < m_running.size(); ++i) {
+    if (m_running.at(i).m_task == task) {
+      index = i;
+      break;
+    }
+  }
+  Q_ASSERT(index >= 0);
+  if (index < 0) {
+    return;
+  }
 
-  logger.debug() << "Task completed:" << m_running_task->name();
-  m_running_task->deleteLater();
-  m_running_task->disconnect();
-  m_running_task = nullptr;
+  qint64 runMsec = m_running.at(index).m_timer.elapsed();
+  m_runTimes[task->name()].record(runMsec);
+
+  MZ_LOG(logger, Debug) << "Task completed:" << task->name()
+                        << "queued (ms):" << m_running.at(index).m_queueMsec
+                        << "ran (ms):" << runMsec;
+  m_running.removeAt(index);
+  task->deleteLater();
+  task->disconnect();
 
   maybeRunTask();
 }
@@ -107,6 +208,7 @@ void TaskScheduler::deleteTasksInternal(bool forced) {
     Task* task = i.next();
 
     if (forced) {
+      m_queuedTimers.remove(task);
       task->deleteLater();
       i.remove();
       continue;
@@ -114,6 +216,7 @@ void TaskScheduler::deleteTasksInternal(bool forced) {
 
     switch (task->deletePolicy()) {
       case Task::Deletable:
+        m_queuedTimers.remove(task);
         task->deleteLater();
         i.remove();
         break;
@@ -130,12 +233,16 @@ void TaskScheduler::deleteTasksInternal(bool forced) {
     }
   }
 
-  if (m_running_task) {
-    if (forced || m_running_task->deletePolicy() == Task::Deletable) {
-      m_running_task->cancel();
-      m_running_task->deleteLater();
-      m_running_task->disconnect();
-      m_running_task = nullptr;
+  for (qsizetype index = m_running.size() - 1; index >= 0; --index) {
+    Task* task = m_running.at(index).m_task;
+    if (forced || task->deletePolicy() == Task::Deletable) {
+      m_running.removeAt(index);
+      // Drop our completion handler first, in case the task completes while
+      // it's being cancelled.
+      task->disconnect(this);
+      task->cancel();
+      task->deleteLater();
+      task->disconnect();
     }
   }
 
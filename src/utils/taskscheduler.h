@@ -5,14 +5,17 @@
 #ifndef TASKSCHEDULER_H
 #define TASKSCHEDULER_H
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QObject>
 
-class Task;
+#include "task.h"
 
 class TaskScheduler final : public QObject {
   Q_OBJECT
 
   friend class TestTaskGetFeatureListWorker;
+  friend class TestTasks;
 
  public:
   explicit TaskScheduler(QObject* parent = nullptr);
@@ -26,6 +29,29 @@ class TaskScheduler final : public QObject {
   // that the current tasks do not conflict with this one.
   static void scheduleTaskNow(Task* task);
 
+  // How many tasks of a priority can run at the same time. Tasks of the same
+  // conflict group are serialized regardless.
+  static void setConcurrency(Task::Priority priority, int limit);
+
+  // A log2 histogram of durations, in milliseconds. Bucket 0 counts the
+  // durations below 1 msec, and bucket N those in [2^(N-1), 2^N) msecs. The
+  // last bucket also counts everything longer.
+  struct Histogram {
+    static constexpr int BUCKETS = 20;
+
+    void record(qint64 msec);
+
+    quint32 m_buckets[BUCKETS] = {};
+    quint32 m_count = 0;
+    qint64 m_totalMsec = 0;
+    qint64 m_maxMsec = 0;
+  };
+
+  // How long the tasks with the given name waited in the queue, and how long
+  // they took to complete once started.
+  static Histogram queueTimes(const QString& name);
+  static Histogram runTimes(const QString& name);
+
  protected:
   static void pause();
   static void resume();
@@ -36,12 +62,27 @@ class TaskScheduler final : public QObject {
   void deleteTasksInternal(bool forced);
 
   void maybeRunTask();
+  Task* takeNextTask();
 
-  void taskCompleted();
+  void taskCompleted(Task* task);
 
  private:
-  Task* m_running_task = nullptr;
+  struct Running {
+    Task* m_task = nullptr;
+    Task::Priority m_priority = Task::Normal;
+    QString m_conflictGroup;
+    qint64 m_queueMsec = 0;
+    QElapsedTimer m_timer;
+  };
+
+  QList<Running> m_running;
   QList<Task*> m_tasks;
+  QHash<Task*, QElapsedTimer> m_queuedTimers;
+
+  int m_concurrency[Task::Background + 1] = {4, 2, 2};
+
+  QHash<QString, Histogram> m_queueTimes;
+  QHash<QString, Histogram> m_runTimes;
 
   int m_paused = false;
 };
@@ -0,0 +1,89 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "testinetchecksum.h"
+
+#include <QByteArray>
+#include <QRandomGenerator>
+#include <QtEndian>
+#include <QtTest/QtTest>
+#include <cstring>
+
+#include "inetchecksum.h"
+
+Q_DECLARE_METATYPE(InetChecksum::Function)
+
+void TestInetChecksum::rfc1071() {
+  // The worked example of RFC 1071, section 3: the sum is 0xddf2 when the
+  // words are read in network byte order.
+  const QByteArray data = QByteArray::fromHex("0001f203f4f5f6f7");
+  quint16 checksum = InetChecksum::compute(data.constData(), data.length());
+  QCOMPARE(qFromBigEndian(checksum), quint16(~0xddf2));
+
+  // A buffer that includes its own checksum sums to zero.
+  QByteArray packet = data;
+  packet.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+  QCOMPARE(InetChecksum::compute(packet.constData(), packet.length()),
+           quint16(0));
+}
+
+void TestInetChecksum::equivalence_data() {
+  QTest::addColumn<InetChecksum::Function>("function");
+  for (const InetChecksum::Implementation& impl :
+       InetChecksum::implementations()) {
+    QTest::addRow("%s", impl.name) << impl.function;
+  }
+}
+
+void TestInetChecksum::equivalence() {
+  QFETCH(InetChecksum::Function, function);
+  InetChecksum::Function reference =
+      InetChecksum::implementations().first().function;
+
+  // Random lengths, contents and alignments, with runs of 0xff to exercise
+  // the carries, must all agree with the 16-bit scalar sum.
+  QRandomGenerator rng(1071);
+  QByteArray buffer(4096 + 64, Qt::Uninitialized);
+  for (int i = 0; i < 10000; i++) {
+    qsizetype offset = rng.bounded(64);
+    qsizetype length = rng.bounded((i < 100) ? 4096 : 256);
+    char* data = buffer.data() + offset;
+    if (i % 5 == 0) {
+      memset(data, 0xff, length);
+    } else {
+      for (qsizetype j = 0; j < length; j++) {
+        data[j] = static_cast<char>(rng.generate());
+      }
+    }
+
+    quint16 expected = reference(data, length);
+    quint16 actual = function(data, length);
+    QVERIFY2(actual == expected,
+             qPrintable(QString("length %1 offset %2: got %3, expected %4")
+                            .arg(length)
+                            .arg(offset)
+                            .arg(actual, 0, 16)
+                            .arg(expected, 0, 16)));
+  }
+}
+
+void TestInetChecksum::benchmark_data() {
+  QTest::addColumn<InetChecksum::Function>("function");
+  QTest::addColumn<int>("length");
+  for (const InetChecksum::Implementation& impl :
+       InetChecksum::implementations()) {
+    QTest::addRow("%s/64", impl.name) << impl.function << 64;
+    QTest::addRow("%s/1500", impl.name) << impl.function << 1500;
+  }
+}
+
+void TestInetChecksum::benchmark() {
+  QFETCH(InetChecksum::Function, function);
+  QFETCH(int, length);
+
+  QByteArray data(length, 'x');
+  quint16 checksum = 0;
+  QBENCHMARK { checksum ^= function(data.constData(), data.length()); }
+  Q_UNUSED(checksum);
+}
@@ -0,0 +1,18 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <QObject>
+
+#include "testhelper.h"
+
+class TestInetChecksum final : public QObject, TestHelper<TestInetChecksum> {
+  Q_OBJECT
+
+ private slots:
+  void rfc1071();
+  void equivalence_data();
+  void equivalence();
+  void benchmark_data();
+  void benchmark();
+};
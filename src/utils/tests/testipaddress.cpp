@@ -7,6 +7,7 @@
 #include <QtTest/QtTest>
 
 #include "ipaddress.h"
+#include "prefixset.h"
 
 void TestIpAddress::ctor() {
   IPAddress ip;
@@ -289,3 +290,79 @@ void TestIpAddress::excludeAddresses() {
   qDebug() << list.join(",");
   QVERIFY(list.join(",") == result);
 }
+
+void TestIpAddress::prefixSet_data() {
+  QTest::addColumn<QString>("add");
+  QTest::addColumn<QString>("remove");
+  QTest::addColumn<QString>("result");
+  QTest::addColumn<QString>("inside");
+  QTest::addColumn<QString>("outside");
+
+  QTest::addRow("adjacent halves merge")
+      << "10.0.0.0/9,10.128.0.0/9"
+      << ""
+      << "10.0.0.0/8"
+      << "10.200.1.1"
+      << "11.0.0.0";
+
+  QTest::addRow("overlapping prefixes merge")
+      << "192.168.0.0/16,192.168.1.0/24,fe80::/10,fe80::1/128"
+      << ""
+      << "192.168.0.0/16,fe80::/10"
+      << "192.168.1.1"
+      << "fec0::1";
+
+  QTest::addRow("hole in the middle")
+      << "10.0.0.0/8"
+      << "10.1.0.0/16"
+      << "10.0.0.0/16,10.128.0.0/9,10.16.0.0/12,10.2.0.0/15,10.4.0.0/14,10.64."
+         "0.0/10,10.8.0.0/13,10.32.0.0/11"
+      << "10.0.255.255"
+      << "10.1.2.3";
+
+  QTest::addRow("remove everything")
+      << "172.16.0.0/12"
+      << "0.0.0.0/0"
+      << ""
+      << ""
+      << "172.16.0.1";
+
+  QTest::addRow("families are separate")
+      << "0.0.0.0/0,::/0"
+      << "::/1"
+      << "0.0.0.0/0,8000::/1"
+      << "8000::1"
+      << "::1";
+}
+
+void TestIpAddress::prefixSet() {
+  QFETCH(QString, add);
+  QFETCH(QString, remove);
+
+  PrefixSet set;
+  for (const QString& prefix : add.split(",", Qt::SkipEmptyParts)) {
+    set.add(IPAddress(prefix));
+  }
+  for (const QString& prefix : remove.split(",", Qt::SkipEmptyParts)) {
+    set.remove(IPAddress(prefix));
+  }
+
+  QStringList list;
+  for (const IPAddress& r : set.toList()) {
+    list.append(r.toString());
+  }
+  std::sort(list.begin(), list.end());
+
+  QFETCH(QString, result);
+  QStringList expected = result.split(",", Qt::SkipEmptyParts);
+  std::sort(expected.begin(), expected.end());
+  QCOMPARE(list, expected);
+  QCOMPARE(set.isEmpty(), expected.isEmpty());
+
+  QFETCH(QString, inside);
+  if (!inside.isEmpty()) {
+    QVERIFY(set.contains(QHostAddress(inside)));
+  }
+  QFETCH(QString, outside);
+  QVERIFY(!set.contains(QHostAddress(outside)));
+}
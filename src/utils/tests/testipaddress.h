@@ -26,4 +26,7 @@ class TestIpAddress final : public QObject, TestHelper<TestIpAddress> {
 
   void excludeAddresses_data();
   void excludeAddresses();
+
+  void prefixSet_data();
+  void prefixSet();
 };
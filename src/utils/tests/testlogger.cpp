@@ -5,6 +5,7 @@
 #include "testlogger.h"
 
 #include <QScopeGuard>
+#include <QThread>
 #include <QtTest/QtTest>
 
 #include "logger.h"
@@ -76,3 +77,71 @@ void TestLogger::logTruncation() {
   QVERIFY(truncatedBuffer.size() > 64 * 1024);
   QVERIFY(truncatedBuffer.size() < 128 * 1024);
 }
+
+void TestLogger::logLevel() {
+  Logger l("test");
+  int evaluated = 0;
+  auto sideEffect = [&]() {
+    evaluated++;
+    return QString("side effect");
+  };
+
+  Logger::setLogLevel(LogLevel::Info);
+  auto guard = qScopeGuard([&] { Logger::setLogLevel(LogLevel::Debug); });
+  QVERIFY(!Logger::isEnabled(LogLevel::Debug));
+  QVERIFY(Logger::isEnabled(LogLevel::Info));
+
+  // Disabled levels don't evaluate their arguments.
+  MZ_LOG(l, Debug) << sideEffect();
+  QCOMPARE(evaluated, 0);
+  MZ_LOG(l, Info) << sideEffect();
+  QCOMPARE(evaluated, 1);
+
+  // Nor do they reach the log file.
+  LogHandler* lh = LogHandler::instance();
+  lh->cleanupLogs();
+  l.debug() << "This is hidden";
+  l.info() << "This is shown";
+
+  QString buffer;
+  QTextStream out(&buffer);
+  lh->writeLogs(out);
+  QVERIFY(!buffer.contains("This is hidden"));
+  QVERIFY(buffer.contains("This is shown"));
+}
+
+void TestLogger::logThreads() {
+  LogHandler* lh = LogHandler::instance();
+  lh->cleanupLogs();
+
+  // Log from a few threads at once, each line must be written whole.
+  constexpr int THREADS = 4;
+  constexpr int LINES = 1000;
+  QList<QThread*> threads;
+  for (int i = 0; i < THREADS; i++) {
+    threads.append(QThread::create([i]() {
+      Logger l("thread");
+      for (int j = 0; j < LINES; j++) {
+        l.info() << "Thread" << i << "line" << j;
+      }
+    }));
+    threads.last()->start();
+  }
+  for (QThread* thread : threads) {
+    QVERIFY(thread->wait());
+    delete thread;
+  }
+
+  // And the lines of each thread keep their order.
+  QString buffer;
+  QTextStream out(&buffer);
+  lh->writeLogs(out);
+  for (int i = 0; i < THREADS; i++) {
+    qsizetype pos = 0;
+    for (int j = 0; j < LINES; j++) {
+      QString line = QString("Thread %1 line %2\n").arg(i).arg(j);
+      pos = buffer.indexOf(line, pos);
+      QVERIFY(pos >= 0);
+    }
+  }
+}
@@ -15,4 +15,8 @@ class TestLogger final : public QObject, TestHelper<TestLogger> {
   void logHandler();
 
   void logTruncation();
+
+  void logLevel();
+
+  void logThreads();
 };
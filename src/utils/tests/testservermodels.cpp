@@ -6,6 +6,7 @@
 
 #include <QtTest/QtTest>
 
+#include "models/servercatalogue.h"
 #include "models/servercity.h"
 #include "models/servercountry.h"
 #include "models/servercountrymodel.h"
@@ -543,3 +544,146 @@ void TestServerModels::serverCountryModelFromJson() {
     }
   }
 }
+
+// ServerCatalogue
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void TestServerModels::serverCatalogue() {
+  QJsonObject packed;
+  packed.insert("hostname", "packed-host");
+  packed.insert("ipv4_addr_in", "185.213.154.131");
+  packed.insert("ipv4_gateway", "10.64.0.1");
+  packed.insert("ipv6_addr_in", "2a03:1b20:3:f011::a01f");
+  packed.insert("ipv6_gateway", "fc00:bbbb:bbbb:bb01::1");
+  packed.insert("public_key", "packedKey");
+  packed.insert("weight", 100);
+  packed.insert("port_ranges", QJsonArray{QJsonArray{53, 53}});
+  packed.insert("multihop_port", 3155);
+  packed.insert("socks5_name", "packed.socks");
+
+  // Addresses that are not valid, or missing, are kept as they are.
+  QJsonObject unpacked;
+  unpacked.insert("hostname", "unpacked-host");
+  unpacked.insert("ipv4_addr_in", "ipv4AddrIn");
+  unpacked.insert("ipv4_gateway", "ipv4Gateway");
+  unpacked.insert("ipv6_addr_in", "ipv6AddrIn");
+  unpacked.insert("public_key", "unpackedKey");
+  unpacked.insert("weight", 5);
+  unpacked.insert("port_ranges", QJsonArray{QJsonArray{53, 53},
+                                            QJsonArray{4000, 33433}});
+
+  QJsonObject city;
+  city.insert("code", "serverCityCode");
+  city.insert("name", "serverCityName");
+  city.insert("latitude", 12.34);
+  city.insert("longitude", 34.56);
+  city.insert("servers", QJsonArray{packed, unpacked});
+
+  QJsonObject country;
+  country.insert("name", "serverCountryName");
+  country.insert("code", "serverCountryCode");
+  country.insert("cities", QJsonArray{city});
+
+  QJsonObject obj;
+  obj.insert("countries", QJsonArray{country});
+  QByteArray json = QJsonDocument(obj).toJson();
+  QByteArray digest = ServerCatalogue::digest(json);
+
+  QTemporaryDir dir;
+  QString fileName = dir.filePath("servers.cat");
+
+  // Parsing the JSON writes the catalogue.
+  ServerCountryModel parsed;
+  parsed.setCatalogue(fileName, QByteArray());
+  QSignalSpy catalogueWritten(&parsed, &ServerCountryModel::catalogueWritten);
+  QVERIFY(parsed.fromJson(json));
+  QVERIFY(QFile::exists(fileName));
+  QCOMPARE(catalogueWritten.count(), 1);
+  QByteArray fileDigest = catalogueWritten.at(0).at(0).toByteArray();
+  QCOMPARE(fileDigest.length(), 32);
+
+  ServerCatalogue::Content content;
+  QVERIFY(!ServerCatalogue::read(fileName, QByteArray(), digest, content));
+  QVERIFY(ServerCatalogue::read(fileName, fileDigest, digest, content));
+  QCOMPARE(content.countries.length(), 1);
+  QCOMPARE(content.countries.at(0).name(), "serverCountryName");
+  QCOMPARE(content.countries.at(0).cities(),
+           QList<QString>{"serverCityName"});
+  QCOMPARE(content.cities.count(), 1);
+  QCOMPARE(content.servers.count(), 2);
+
+  const ServerCity& loadedCity =
+      content.cities.value(ServerCity::hashKey("serverCountryCode",
+                                               "serverCityName"));
+  QCOMPARE(loadedCity.code(), "serverCityCode");
+  QCOMPARE(loadedCity.country(), "serverCountryCode");
+  QCOMPARE(loadedCity.latitude(), 12.34);
+  QCOMPARE(loadedCity.longitude(), 34.56);
+  QCOMPARE(loadedCity.servers(),
+           (QList<QString>{"packedKey", "unpackedKey"}));
+
+  for (const QString& publicKey : {"packedKey", "unpackedKey"}) {
+    const Server& expected = parsed.server(publicKey);
+    const Server& loaded = content.servers.value(publicKey);
+    QCOMPARE(loaded.hostname(), expected.hostname());
+    QCOMPARE(loaded.ipv4AddrIn(), expected.ipv4AddrIn());
+    QCOMPARE(loaded.ipv4Gateway(), expected.ipv4Gateway());
+    QCOMPARE(loaded.ipv6AddrIn(), expected.ipv6AddrIn());
+    QCOMPARE(loaded.ipv6Gateway(), expected.ipv6Gateway());
+    QCOMPARE(loaded.publicKey(), expected.publicKey());
+    QCOMPARE(loaded.socksName(), expected.socksName());
+    QCOMPARE(loaded.weight(), expected.weight());
+    QCOMPARE(loaded.multihopPort(), expected.multihopPort());
+    QCOMPARE(loaded.countryCode(), expected.countryCode());
+    QCOMPARE(loaded.cityName(), expected.cityName());
+  }
+  QCOMPARE(content.servers.value("packedKey").choosePort(), (uint32_t)53);
+
+  // Another model picks up the catalogue for the same JSON.
+  ServerCountryModel loaded;
+  loaded.setCatalogue(fileName, fileDigest);
+  QSignalSpy loadedWritten(&loaded, &ServerCountryModel::catalogueWritten);
+  QVERIFY(loaded.fromJson(json));
+  QCOMPARE(loadedWritten.count(), 0);
+  QCOMPARE(loaded.rowCount(QModelIndex()), 1);
+  QCOMPARE(loaded.server("packedKey").ipv6AddrIn(), "2a03:1b20:3:f011::a01f");
+  QVERIFY(loaded.exists("serverCountryCode", "serverCityName"));
+
+  // The catalogue doesn't match any other server list.
+  QVERIFY(!ServerCatalogue::read(fileName, fileDigest,
+                                 ServerCatalogue::digest("{}"), content));
+
+  // A catalogue edited behind our back still decodes, but is not read.
+  QFile file(fileName);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QByteArray tampered = file.readAll();
+  file.close();
+  QVERIFY(tampered.contains("packedKey"));
+  tampered.replace("packedKey", "forgedKey");
+  QVERIFY(ServerCatalogue::decode(
+      reinterpret_cast<const uchar*>(tampered.constData()), tampered.length(),
+      digest, content));
+  QVERIFY(content.servers.contains("forgedKey"));
+  QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+  QCOMPARE(file.write(tampered), tampered.length());
+  file.close();
+  QVERIFY(!ServerCatalogue::read(fileName, fileDigest, digest, content));
+
+  // The model falls back to the JSON, and replaces the catalogue.
+  ServerCountryModel reparsed;
+  reparsed.setCatalogue(fileName, fileDigest);
+  QSignalSpy reparsedWritten(&reparsed, &ServerCountryModel::catalogueWritten);
+  QVERIFY(reparsed.fromJson(json));
+  QCOMPARE(reparsedWritten.count(), 1);
+  QCOMPARE(reparsedWritten.at(0).at(0).toByteArray(), fileDigest);
+  QCOMPARE(reparsed.server("packedKey").publicKey(), "packedKey");
+  QVERIFY(ServerCatalogue::read(fileName, fileDigest, digest, content));
+
+  // Truncated catalogues are rejected.
+  QByteArray data = ServerCatalogue::encode(digest, content);
+  for (qsizetype length = 0; length < data.length(); length++) {
+    QVERIFY(!ServerCatalogue::decode(
+        reinterpret_cast<const uchar*>(data.constData()), length, digest,
+        content));
+  }
+}
@@ -26,4 +26,6 @@ class TestServerModels final : public QObject, TestHelper<TestServerModels> {
   void serverCountryModelBasic();
   void serverCountryModelFromJson_data();
   void serverCountryModelFromJson();
+
+  void serverCatalogue();
 };
@@ -10,6 +10,49 @@
 #include "taskgroup.h"
 #include "taskscheduler.h"
 
+namespace {
+
+// Records when it starts and completes, and completes after a delay.
+class TaskTimed final : public Task {
+ public:
+  TaskTimed(const QString& name, int msec, Priority priority,
+            const QString& conflictGroup, QStringList* sequence,
+            QEventLoop* loop, int* pending)
+      : Task("TaskTimed"),
+        m_name(name),
+        m_msec(msec),
+        m_priority(priority),
+        m_conflictGroup(conflictGroup),
+        m_sequence(sequence),
+        m_loop(loop),
+        m_pending(pending) {}
+
+  void run() override {
+    m_sequence->append("start:" + m_name);
+    QTimer::singleShot(m_msec, this, [this]() {
+      m_sequence->append("end:" + m_name);
+      if (--(*m_pending) == 0) {
+        m_loop->exit();
+      }
+      emit completed();
+    });
+  }
+
+  Priority priority() const override { return m_priority; }
+  QString conflictGroup() const override { return m_conflictGroup; }
+
+ private:
+  QString m_name;
+  int m_msec;
+  Priority m_priority;
+  QString m_conflictGroup;
+  QStringList* m_sequence;
+  QEventLoop* m_loop;
+  int* m_pending;
+};
+
+}  // namespace
+
 void TestTasks::function() {
   bool completed = false;
   TaskFunction* task = new TaskFunction([&]() { completed = true; });
@@ -231,3 +274,98 @@ void TestTasks::forceDeleteTasks() {
   QCOMPARE(sequence.length(), 1);
   QCOMPARE(sequence.at(0), "t3");
 }
+
+void TestTasks::priority() {
+  QStringList sequence;
+  QEventLoop loop;
+  int pending = 6;
+
+  TaskScheduler::setConcurrency(Task::Background, 2);
+
+  auto schedule = [&](const QString& name, int msec, Task::Priority priority,
+                      const QString& conflictGroup) {
+    TaskScheduler::scheduleTask(new TaskTimed(
+        name, msec, priority, conflictGroup, &sequence, &loop, &pending));
+  };
+
+  // A default task keeps the default group busy for a while.
+  schedule("blocker", 50, Task::Normal, Task::defaultConflictGroup());
+
+  // Only two background tasks can run at the same time.
+  schedule("bg1", 200, Task::Background, QString());
+  schedule("bg2", 200, Task::Background, QString());
+  schedule("bg3", 10, Task::Background, QString());
+
+  // The background tasks don't delay an interactive one, nor the next
+  // default task.
+  schedule("interactive", 10, Task::Interactive, QString());
+  schedule("normal", 10, Task::Normal, Task::defaultConflictGroup());
+
+  loop.exec();
+
+  QCOMPARE(sequence.mid(0, 4),
+           QStringList({"start:blocker", "start:bg1", "start:bg2",
+                        "start:interactive"}));
+  QVERIFY(sequence.indexOf("start:normal") < sequence.indexOf("end:bg1"));
+  QVERIFY(sequence.indexOf("start:bg3") >
+          qMin(sequence.indexOf("end:bg1"), sequence.indexOf("end:bg2")));
+
+  TaskScheduler::Histogram queueTimes = TaskScheduler::queueTimes("TaskTimed");
+  QVERIFY(queueTimes.m_count >= 6);
+  QVERIFY(queueTimes.m_maxMsec >= 50);
+
+  TaskScheduler::Histogram runTimes = TaskScheduler::runTimes("TaskTimed");
+  QVERIFY(runTimes.m_count >= 6);
+  QVERIFY(runTimes.m_buckets[0] < runTimes.m_count);
+}
+
+void TestTasks::priority_limit() {
+  QStringList sequence;
+  QEventLoop loop;
+  int pending = 4;
+
+  TaskScheduler::setConcurrency(Task::Normal, 1);
+
+  auto schedule = [&](const QString& name, int msec, Task::Priority priority) {
+    TaskScheduler::scheduleTask(new TaskTimed(name, msec, priority, name,
+                                              &sequence, &loop, &pending));
+  };
+
+  // Queue the tasks in the reverse order of their priority, and let them all
+  // start at once.
+  TaskScheduler::pause();
+  schedule("background", 10, Task::Background);
+  schedule("normal1", 50, Task::Normal);
+  schedule("normal2", 10, Task::Normal);
+  schedule("interactive", 10, Task::Interactive);
+  TaskScheduler::resume();
+
+  loop.exec();
+  TaskScheduler::setConcurrency(Task::Normal, 2);
+
+  // The highest priority starts first, then the oldest task of each priority
+  // that has a free slot. The other normal task waits for the first one.
+  QCOMPARE(sequence.mid(0, 3),
+           QStringList({"start:interactive", "start:normal1",
+                        "start:background"}));
+  QVERIFY(sequence.indexOf("start:normal2") > sequence.indexOf("end:normal1"));
+}
+
+void TestTasks::conflictGroup() {
+  QStringList sequence;
+  QEventLoop loop;
+  int pending = 3;
+
+  TaskScheduler::scheduleTask(new TaskTimed("a1", 50, Task::Background, "a",
+                                            &sequence, &loop, &pending));
+  TaskScheduler::scheduleTask(new TaskTimed("a2", 10, Task::Interactive, "a",
+                                            &sequence, &loop, &pending));
+  TaskScheduler::scheduleTask(new TaskTimed("b", 10, Task::Normal, "b",
+                                            &sequence, &loop, &pending));
+  loop.exec();
+
+  // The tasks of a group keep their order, whatever their priority, while
+  // other groups go ahead.
+  QCOMPARE(sequence, QStringList({"start:a1", "start:b", "end:b", "end:a1",
+                                  "start:a2", "end:a2"}));
+}
@@ -18,4 +18,8 @@ class TestTasks final : public QObject, TestHelper<TestTasks> {
 
   void deleteTasks();
   void forceDeleteTasks();
+
+  void priority();
+  void priority_limit();
+  void conflictGroup();
 };
@@ -57,7 +57,7 @@ void MozillaVPN::removeDevice(const QString&, const QString&) {}
 
 void MozillaVPN::deviceRemovalCompleted(const QString&) {}
 
-void MozillaVPN::serversFetched(const QByteArray&) {}
+bool MozillaVPN::serversFetched(const QByteArray&) { return true; }
 
 void MozillaVPN::removeDeviceFromPublicKey(const QString&) {}
 
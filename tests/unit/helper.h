@@ -30,8 +30,19 @@ class TestHelper : public QObject {
     NetworkStatus m_status;
     QByteArray m_body;
 
+    // If set, the request gets a reply with this HTTP status and headers.
+    int m_statusCode = 0;
+    QList<QPair<QByteArray, QByteArray>> m_headers;
+
     NetworkConfig(NetworkStatus status, const QByteArray& body)
         : m_status(status), m_body(body) {}
+
+    NetworkConfig(int statusCode, const QByteArray& body,
+                  const QList<QPair<QByteArray, QByteArray>>& headers = {})
+        : m_status(Success),
+          m_body(body),
+          m_statusCode(statusCode),
+          m_headers(headers) {}
   };
 
   static bool networkRequestDelete(NetworkRequest* request) {
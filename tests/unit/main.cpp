@@ -3,6 +3,7 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include <QCoreApplication>
+#include <QNetworkReply>
 
 #include "constants.h"
 #include "glean/mzglean.h"
@@ -94,6 +95,44 @@ void maybeWaitForDebugger(int argc, char* argv[]) {
 
 TestHelper::TestHelper() { testList.append(this); }
 
+namespace {
+// A finished reply carrying the status, headers and body of a NetworkConfig.
+class MockNetworkReply final : public QNetworkReply {
+ public:
+  explicit MockNetworkReply(const TestHelper::NetworkConfig& nc)
+      : m_body(nc.m_body) {
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, nc.m_statusCode);
+    for (const auto& header : nc.m_headers) {
+      setRawHeader(header.first, header.second);
+    }
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+  }
+
+  void finish() {
+    setFinished(true);
+    emit finished();
+  }
+
+  void abort() override {}
+
+  qint64 bytesAvailable() const override {
+    return m_body.size() - m_offset + QNetworkReply::bytesAvailable();
+  }
+
+ protected:
+  qint64 readData(char* data, qint64 maxSize) override {
+    qint64 length = qMin(maxSize, m_body.size() - m_offset);
+    memcpy(data, m_body.constData() + m_offset, length);
+    m_offset += length;
+    return length;
+  }
+
+ private:
+  QByteArray m_body;
+  qint64 m_offset = 0;
+};
+}  // namespace
+
 // static
 App* App::instance() {
   static App* app = nullptr;
@@ -110,6 +149,15 @@ bool TestHelper::networkRequestGeneric(NetworkRequest* request) {
   Q_ASSERT(!TestHelper::networkConfig.isEmpty());
   TestHelper::NetworkConfig nc = TestHelper::networkConfig.takeFirst();
 
+  // Go through the reply handling of the request, so that it sees the status
+  // code and the headers.
+  if (nc.m_statusCode != 0) {
+    MockNetworkReply* reply = new MockNetworkReply(nc);
+    request->handleReply(reply);
+    QTimer::singleShot(0, reply, [reply]() { reply->finish(); });
+    return true;
+  }
+
   QTimer::singleShot(0, request, [request, nc]() {
     request->deleteLater();
 
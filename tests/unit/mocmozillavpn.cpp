@@ -9,6 +9,7 @@
 #include "models/subscriptiondata.h"
 #include "mozillavpn.h"
 #include "serverlatency.h"
+#include "settingsholder.h"
 
 // The singleton.
 static MozillaVPN* s_instance = nullptr;
@@ -84,7 +85,14 @@ void MozillaVPN::removeDevice(const QString&, const QString&) {}
 
 void MozillaVPN::deviceRemovalCompleted(const QString&) {}
 
-void MozillaVPN::serversFetched(const QByteArray&) {}
+bool MozillaVPN::serversFetched(const QByteArray& serverData) {
+  if (!serverCountryModel()->fromJson(serverData)) {
+    return false;
+  }
+
+  SettingsHolder::instance()->setServers(serverData);
+  return true;
+}
 
 void MozillaVPN::removeDeviceFromPublicKey(const QString&) {}
 
@@ -4,8 +4,13 @@
 
 #include "testaddon.h"
 
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QQmlApplicationEngine>
+#include <QTemporaryDir>
 #include <QTemporaryFile>
+#include <functional>
 
 #include "addons/addon.h"
 #include "addons/addonmessage.h"
@@ -18,6 +23,7 @@
 #include "addons/conditionwatchers/addonconditionwatchertimeend.h"
 #include "addons/conditionwatchers/addonconditionwatchertimestart.h"
 #include "addons/conditionwatchers/addonconditionwatchertriggertimesecs.h"
+#include "addons/manager/addonhashcache.h"
 #include "addons/manager/addonmanager.h"
 #include "feature/feature.h"
 #include "feature/featuremodel.h"
@@ -169,3 +175,89 @@ void TestAddon::message_notification() {
 }
 
 static TestAddon s_testAddon;
+
+void TestAddon::hashCache() {
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  QString filePath = dir.filePath("test.rcc");
+
+  auto write = [&](const QByteArray& data) {
+    QFile file(filePath);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QCOMPARE(file.write(data), data.length());
+  };
+  auto sha256 = [](const QByteArray& data) {
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+  };
+
+  write("hello");
+  {
+    // The prefetch completes in the background.
+    AddonHashCache cache;
+    bool done = false;
+    cache.prefetch(QStringList{filePath}, this, [&]() { done = true; });
+    QTRY_VERIFY(done);
+    QCOMPARE(cache.hash(filePath), sha256("hello"));
+
+    // With nothing to hash, it completes right away.
+    done = false;
+    cache.prefetch(QStringList(), this, [&]() { done = true; });
+    QVERIFY(done);
+  }
+
+#ifdef Q_OS_UNIX
+  // Move the verification well past the racy window, so that only the file
+  // metadata decides whether the record is trusted.
+  auto editRecord = [&](const std::function<void(QJsonObject&)>& edit) {
+    QJsonObject obj =
+        QJsonDocument::fromJson(m_settingsHolder->addonVerifiedHashes())
+            .object();
+    QJsonObject record = obj[filePath].toObject();
+    edit(record);
+    obj[filePath] = record;
+    m_settingsHolder->setAddonVerifiedHashes(
+        QJsonDocument(obj).toJson(QJsonDocument::Compact));
+  };
+  editRecord([&](QJsonObject& record) {
+    QVERIFY(!record.isEmpty());
+    record["verified"] = qMax(record["modified"].toInteger(),
+                              record["changed"].toInteger()) +
+                         60000;
+    record["sha256"] = QString::fromLatin1(sha256("cached").toHex());
+  });
+
+  // An unchanged file is not hashed again.
+  {
+    AddonHashCache cache;
+    QCOMPARE(cache.hash(filePath), sha256("cached"));
+  }
+
+  // A change that keeps the size and the modification time is detected by
+  // the status change time.
+  QDateTime modified = QFileInfo(filePath).lastModified();
+  write("world");
+  {
+    QFile file(filePath);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.setFileTime(modified, QFileDevice::FileModificationTime));
+  }
+  {
+    AddonHashCache cache;
+    QCOMPARE(cache.hash(filePath), sha256("world"));
+  }
+#else
+  // The records don't outlive the run.
+  QVERIFY(m_settingsHolder->addonVerifiedHashes().isEmpty());
+  write("world");
+  {
+    AddonHashCache cache;
+    QCOMPARE(cache.hash(filePath), sha256("world"));
+  }
+#endif
+
+  AddonHashCache cache;
+  QVERIFY(cache.hash(dir.filePath("missing.rcc")).isEmpty());
+
+  cache.reset();
+  QVERIFY(!m_settingsHolder->hasAddonVerifiedHashes());
+}
@@ -16,6 +16,8 @@ class TestAddon final : public TestHelper {
   void message_notification_data();
   void message_notification();
 
+  void hashCache();
+
  private:
   SettingsHolder* m_settingsHolder = nullptr;
 };
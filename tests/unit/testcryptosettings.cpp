@@ -4,6 +4,8 @@
 
 #include "testcryptosettings.h"
 
+#include <QBuffer>
+
 #include "platforms/dummy/dummycryptosettings.h"
 
 void TestCryptoSettings::init() {
@@ -228,4 +230,72 @@ void TestCryptoSettings::readFailsWithMetaDataError() {
   QCOMPARE(CryptoSettings::readFile(file, map), false);
 }
 
+void TestCryptoSettings::writeV2SectionsIncrementally() {
+  DummyCryptoSettings crypto;
+  crypto.m_keyVersion = CryptoSettings::EncryptionChachaPolyV2;
+  QByteArray servers(4096, 'x');
+
+  QSettings settings(testFileName(), crypto.format());
+  settings.setValue("servers", servers);
+  settings.setValue("someBool", true);
+  settings.sync();
+  QCOMPARE(parseVersion(), CryptoSettings::EncryptionChachaPolyV2);
+
+  QFile file(testFileName());
+  QVERIFY(file.open(QIODeviceBase::ReadOnly));
+  QByteArray before = file.readAll();
+  file.close();
+  QVERIFY(!before.contains(servers.left(16)));
+
+  settings.setValue("someBool", false);
+  settings.sync();
+
+  QVERIFY(file.open(QIODeviceBase::ReadOnly));
+  QByteArray after = file.readAll();
+  QVERIFY(before != after);
+
+  // The servers section comes last and must not have been encrypted again.
+  QCOMPARE(after.right(servers.length()), before.right(servers.length()));
+
+  QSettings::SettingsMap map;
+  QVERIFY(file.reset());
+  QVERIFY(CryptoSettings::readFile(file, map));
+  QCOMPARE(map.value("servers").toByteArray(), servers);
+  QCOMPARE(map.value("someBool").toBool(), false);
+}
+
+void TestCryptoSettings::readFailsWithSectionSwap() {
+  DummyCryptoSettings crypto;
+  crypto.m_keyVersion = CryptoSettings::EncryptionChachaPolyV2;
+
+  QSettings settings(testFileName(), crypto.format());
+  settings.setValue("servers", QByteArray(4096, 'a'));
+  settings.setValue("someBool", true);
+  settings.sync();
+
+  QFile file(testFileName());
+  QVERIFY(file.open(QIODeviceBase::ReadOnly));
+  QByteArray before = file.readAll();
+  file.close();
+
+  settings.setValue("servers", QByteArray(4096, 'b'));
+  settings.sync();
+
+  QVERIFY(file.open(QIODeviceBase::ReadOnly));
+  QByteArray after = file.readAll();
+  QCOMPARE(after.length(), before.length());
+
+  // Replace the servers section with its older copy, which is validly
+  // encrypted on its own.
+  qsizetype pos = after.indexOf(QByteArray("\x07servers"));
+  QVERIFY(pos > 0);
+  QCOMPARE(before.indexOf(QByteArray("\x07servers")), pos);
+  QByteArray spliced = after.left(pos) + before.mid(pos);
+
+  QBuffer buffer(&spliced);
+  QVERIFY(buffer.open(QIODeviceBase::ReadOnly));
+  QSettings::SettingsMap map;
+  QCOMPARE(CryptoSettings::readFile(buffer, map), false);
+}
+
 static TestCryptoSettings s_testCryptoSettings;
@@ -41,4 +41,8 @@ class TestCryptoSettings final : public TestHelper {
   void writeV1readV2upgrade();
   void writeV2WithMetaData();
   void readFailsWithMetaDataError();
+
+  // Tests for the sectioned v2 format.
+  void writeV2SectionsIncrementally();
+  void readFailsWithSectionSwap();
 };
@@ -5,15 +5,58 @@
 #include "testserverlatency.h"
 
 #include <QDateTime>
+#include <QFile>
 #include <QJsonObject>
+#include <QTemporaryDir>
+#include <chrono>
 
 #include "constants.h"
 #include "feature/feature.h"
 #include "models/location.h"
 #include "models/servercity.h"
+#include "pingsender.h"
 #include "serverlatency.h"
+#include "serverlatencystore.h"
 #include "settingsholder.h"
 
+namespace {
+// Records the pings, and which batch they were sent in, without sending
+// anything.
+class RecordingPingSender final : public PingSender {
+ public:
+  RecordingPingSender(QObject* parent) : PingSender(parent) {}
+
+  void sendPing(const QHostAddress& destination, quint16 sequence) override {
+    Q_UNUSED(destination);
+    m_sequences.append(sequence);
+  }
+
+  void sendPings(const QList<QHostAddress>& destinations,
+                 quint16 sequence) override {
+    m_batches.append(destinations.count());
+    PingSender::sendPings(destinations, sequence);
+  }
+
+  QList<quint16> m_sequences;
+  QList<qsizetype> m_batches;
+};
+
+qint64 steadyUsecs() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+// Mirrors SERVER_LATENCY_TIMEOUT and SERVER_LATENCY_TICK.
+constexpr const qint64 TIMEOUT_USEC = 5000000;
+constexpr const qint64 TICK_USEC = 100000;
+
+// The time at which the pings sent during the same tick as the given one
+// time out.
+qint64 expiryUsecs(qint64 sent) {
+  return (sent / TICK_USEC + 1) * TICK_USEC + TIMEOUT_USEC;
+}
+}  // namespace
+
 void TestServerLatency::init() {
   SettingsHolder settingsHolder;
   settingsHolder.setFeaturesFlippedOn(QStringList{"serverConnectionScore"});
@@ -55,6 +98,276 @@ void TestServerLatency::cooldown() {
   QCOMPARE(serverLatency.getCooldown("Some Server"), 0);
 }
 
+void TestServerLatency::store() {
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  QString fileName = dir.filePath("latency.dat");
+  ServerLatencyStore::Entry entry;
+
+  {
+    ServerLatencyStore store;
+    QVERIFY(store.open(fileName));
+    QCOMPARE(store.lastNetwork(), quint64(0));
+    QVERIFY(!store.lookup(1, "Server A", &entry));
+
+    // The first sample sets the mean, the next ones move it part of the way.
+    store.addSample(1, "Server A", 100);
+    store.addSample(1, "Server A", 200);
+    store.addSample(2, "Server B", 50);
+    QVERIFY(store.lookup(1, "Server A", &entry));
+    QCOMPARE(entry.mean, 125.0f);
+    QVERIFY(entry.variance > 0);
+    QVERIFY(!store.lookup(2, "Server A", &entry));
+    QCOMPARE(store.lastNetwork(), quint64(2));
+    store.flush();
+  }
+
+  // The samples survive a restart.
+  {
+    ServerLatencyStore store;
+    QVERIFY(store.open(fileName));
+    QCOMPARE(store.lastNetwork(), quint64(2));
+    QVERIFY(store.lookup(1, "Server A", &entry));
+    QCOMPARE(entry.mean, 125.0f);
+    QVERIFY(store.lookup(2, "Server B", &entry));
+    QCOMPARE(entry.mean, 50.0f);
+  }
+
+  // A torn record at the end of the file is dropped.
+  {
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+    file.write("torn");
+  }
+  {
+    ServerLatencyStore store;
+    QVERIFY(store.open(fileName));
+    QVERIFY(store.lookup(1, "Server A", &entry));
+    store.addSample(1, "Server A", 125);
+    store.flush();
+  }
+  {
+    ServerLatencyStore store;
+    QVERIFY(store.open(fileName));
+    QVERIFY(store.lookup(1, "Server A", &entry));
+    QCOMPARE(entry.mean, 125.0f);
+  }
+}
+
+void TestServerLatency::queuePings(ServerLatency* serverLatency,
+                                   PingSender* sender, int count) {
+  serverLatency->m_pingSender = sender;
+
+  // Queue the farthest first, so that the heap has to reorder all of them.
+  for (int i = count - 1; i >= 0; i--) {
+    ServerLatency::ServerPingRecord rec;
+    rec.publicKey = "DummyServer" + QString::number(i);
+    rec.distance = i;
+    serverLatency->m_pingSendQueue.append(rec);
+  }
+  serverLatency->resetSweep();
+}
+
+void TestServerLatency::pacing() {
+  ServerLatency serverLatency;
+  RecordingPingSender* sender = new RecordingPingSender(&serverLatency);
+  queuePings(&serverLatency, sender, 100);
+
+  // The first pass sends a full burst, in a single batch.
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches, QList<qsizetype>{32});
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(32));
+  QCOMPARE(serverLatency.m_pingSendQueue.count(), qsizetype(100 - 32));
+
+  // The nearest servers go first, with consecutive sequence numbers.
+  for (int i = 0; i < 32; i++) {
+    QCOMPARE(sender->m_sequences.at(i), quint16(i));
+    QCOMPARE(serverLatency.m_pingSlots.at(i).publicKey,
+             "DummyServer" + QString::number(i));
+  }
+
+  // The bucket is empty, so nothing more goes out until it holds enough
+  // tokens for another batch, which takes 80ms.
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches.count(), qsizetype(1));
+  QVERIFY(serverLatency.m_pingTimeout.isActive());
+  QVERIFY(serverLatency.m_pingTimeout.interval() > 0);
+  QVERIFY(serverLatency.m_pingTimeout.interval() <= 80);
+
+  // Once the time has passed, the next batch goes out.
+  serverLatency.m_pingTokensUpdated -= 80000;
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches, (QList<qsizetype>{32, 16}));
+  QCOMPARE(sender->m_sequences.count(), qsizetype(48));
+  QCOMPARE(sender->m_sequences.last(), quint16(47));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(48));
+
+  // The bucket never holds more than a burst, however long it sat idle.
+  serverLatency.m_pingTokensUpdated -= 3600000000LL;
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches, (QList<qsizetype>{32, 16, 32}));
+}
+
+void TestServerLatency::batchedReplies() {
+  ServerLatency serverLatency;
+  RecordingPingSender* sender = new RecordingPingSender(&serverLatency);
+  queuePings(&serverLatency, sender, 40);
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches, QList<qsizetype>{32});
+
+  // A reply timestamped by the kernel is measured on the system clock.
+  const auto& pings = serverLatency.m_pingSlots;
+  serverLatency.recvPing(0, pings.at(0).sentAt + 4200);
+  QCOMPARE(serverLatency.getLatency("DummyServer0"), qint64(5));
+
+  // Otherwise it is measured on the monotonic clock, and a sub-millisecond
+  // reply still counts.
+  serverLatency.m_pingSlots[1].timestamp = steadyUsecs() - 12000;
+  serverLatency.recvPing(1, 0);
+  QVERIFY(serverLatency.getLatency("DummyServer1") >= 12);
+  serverLatency.recvPing(2, 0);
+  QVERIFY(serverLatency.getLatency("DummyServer2") >= 1);
+
+  // The rest of the batch is answered in one go.
+  for (quint16 sequence = 3; sequence < 32; sequence++) {
+    serverLatency.recvPing(sequence, pings.at(sequence).sentAt + 1000);
+  }
+  for (int i = 3; i < 32; i++) {
+    QCOMPARE(serverLatency.getLatency("DummyServer" + QString::number(i)),
+             qint64(1));
+  }
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(0));
+
+  // Duplicate replies, and replies for a sequence number that shares a slot
+  // with one in flight, are ignored.
+  serverLatency.m_pingTokensUpdated -= 1000000;
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches, (QList<qsizetype>{32, 8}));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(8));
+  serverLatency.recvPing(0, pings.at(32).sentAt + 1000);
+  serverLatency.recvPing(quint16(32 + 4096), pings.at(32).sentAt + 1000);
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(8));
+  QCOMPARE(serverLatency.getLatency("DummyServer32"), qint64(0));
+
+  // The sweep stops once the last reply is in.
+  for (quint16 sequence = 32; sequence < 40; sequence++) {
+    serverLatency.recvPing(sequence, pings.at(sequence).sentAt + 2000);
+  }
+  QCOMPARE(serverLatency.getLatency("DummyServer39"), qint64(2));
+  QVERIFY(!serverLatency.isActive());
+}
+
+void TestServerLatency::expiryOrder() {
+  ServerLatency serverLatency;
+  RecordingPingSender* sender = new RecordingPingSender(&serverLatency);
+  queuePings(&serverLatency, sender, 100);
+  const auto& pings = serverLatency.m_pingSlots;
+
+  // Send a burst, then another batch during a later tick.
+  serverLatency.maybeSendPings();
+  qint64 firstSent = pings.at(0).timestamp;
+  QTest::qSleep(TICK_USEC / 1000);
+  serverLatency.m_pingTokens = 16;
+  serverLatency.m_pingTokensUpdated = steadyUsecs();
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches, (QList<qsizetype>{32, 16}));
+  qint64 secondSent = pings.at(32).timestamp;
+  QVERIFY(secondSent / TICK_USEC > firstSent / TICK_USEC);
+
+  // A ping doesn't expire before the end of its tick is a timeout away.
+  serverLatency.expirePings(expiryUsecs(firstSent) - 1);
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(48));
+
+  // The oldest bucket expires first, and its pings are queued for a retry.
+  serverLatency.expirePings(expiryUsecs(firstSent));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(16));
+  QCOMPARE(serverLatency.m_pingSendQueue.count(), qsizetype(52 + 32));
+  for (int i = 0; i < 32; i++) {
+    QVERIFY(pings.at(i).publicKey.isEmpty());
+  }
+  for (int i = 32; i < 48; i++) {
+    QCOMPARE(pings.at(i).publicKey, "DummyServer" + QString::number(i));
+  }
+
+  // Then the next one.
+  serverLatency.expirePings(expiryUsecs(secondSent));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(0));
+  QCOMPARE(serverLatency.m_pingSendQueue.count(), qsizetype(100));
+
+  // The retries are still sent nearest first.
+  const auto& top = serverLatency.m_pingSendQueue.first();
+  QCOMPARE(top.publicKey, QString("DummyServer0"));
+  QCOMPARE(top.retries, 1);
+}
+
+void TestServerLatency::slotReuse() {
+  ServerLatency serverLatency;
+  RecordingPingSender* sender = new RecordingPingSender(&serverLatency);
+  queuePings(&serverLatency, sender, 100);
+  serverLatency.m_pingSlots.resize(48);
+  const auto& pings = serverLatency.m_pingSlots;
+
+  // Fill every slot.
+  serverLatency.maybeSendPings();
+  serverLatency.m_pingTokensUpdated -= 80000;
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches, (QList<qsizetype>{32, 16}));
+
+  // The next ping would overwrite the first one, so the sweep stalls until a
+  // reply or a timeout frees its slot.
+  serverLatency.m_pingTokensUpdated -= 80000;
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_batches.count(), qsizetype(2));
+  QVERIFY(serverLatency.m_pingTimeout.interval() > 1000);
+
+  // A reply frees the slot for the next ping, but not the one after.
+  serverLatency.recvPing(0, pings.at(0).sentAt + 1000);
+  QCOMPARE(sender->m_batches, (QList<qsizetype>{32, 16, 1}));
+  QCOMPARE(pings.at(0).sequence, quint16(48));
+  QCOMPARE(pings.at(0).publicKey, QString("DummyServer48"));
+  QCOMPARE(serverLatency.getLatency("DummyServer0"), qint64(1));
+
+  // A late duplicate of the old reply doesn't match the new ping.
+  serverLatency.recvPing(0, pings.at(0).sentAt + 1000);
+  QCOMPARE(pings.at(0).publicKey, QString("DummyServer48"));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(48));
+
+  // The old sequence number is still on the wheel, and is skipped when it
+  // expires rather than expiring the new ping twice.
+  serverLatency.expirePings(expiryUsecs(pings.at(0).timestamp));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(0));
+  QCOMPARE(serverLatency.m_pingSendQueue.count(), qsizetype(51 + 48));
+}
+
+void TestServerLatency::sequenceWraparound() {
+  ServerLatency serverLatency;
+  RecordingPingSender* sender = new RecordingPingSender(&serverLatency);
+  queuePings(&serverLatency, sender, 40);
+  serverLatency.m_sequence = 65530;
+  const auto& pings = serverLatency.m_pingSlots;
+
+  // The sequence numbers wrap around within a batch, and so do the slots.
+  serverLatency.maybeSendPings();
+  QCOMPARE(sender->m_sequences.count(), qsizetype(32));
+  QCOMPARE(sender->m_sequences.at(5), quint16(65535));
+  QCOMPARE(sender->m_sequences.at(6), quint16(0));
+  QCOMPARE(pings.last().publicKey, QString("DummyServer5"));
+  QCOMPARE(pings.first().publicKey, QString("DummyServer6"));
+  QCOMPARE(serverLatency.m_sequence, quint16(26));
+
+  // Replies on either side of the wrap find their ping.
+  serverLatency.recvPing(65535, pings.last().sentAt + 3000);
+  serverLatency.recvPing(0, pings.first().sentAt + 4000);
+  QCOMPARE(serverLatency.getLatency("DummyServer5"), qint64(3));
+  QCOMPARE(serverLatency.getLatency("DummyServer6"), qint64(4));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(30));
+
+  // And so does the timeout of the others.
+  serverLatency.expirePings(expiryUsecs(pings.at(1).timestamp));
+  QCOMPARE(serverLatency.m_pingPending, qsizetype(0));
+  QCOMPARE(serverLatency.m_pingSendQueue.count(), qsizetype(8 + 30));
+}
+
 constexpr const char* testServerCountryCode = "Middle Earth";
 
 void TestServerLatency::baseCityScore_data() {
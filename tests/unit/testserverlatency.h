@@ -4,6 +4,9 @@
 
 #include "helper.h"
 
+class PingSender;
+class ServerLatency;
+
 class TestServerLatency : public TestHelper {
   Q_OBJECT
 
@@ -12,7 +15,17 @@ class TestServerLatency : public TestHelper {
 
   void latency();
   void cooldown();
+  void store();
+  void pacing();
+  void batchedReplies();
+  void expiryOrder();
+  void slotReuse();
+  void sequenceWraparound();
 
   void baseCityScore_data();
   void baseCityScore();
+
+ private:
+  void queuePings(ServerLatency* serverLatency, PingSender* sender,
+                  int count);
 };
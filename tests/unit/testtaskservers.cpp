@@ -0,0 +1,129 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "testtaskservers.h"
+
+#include <QEventLoop>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "models/servercountrymodel.h"
+#include "settingsholder.h"
+#include "tasks/servers/taskservers.h"
+
+namespace {
+constexpr const char* LAST_MODIFIED = "Tue, 01 Sep 2026 10:00:00 GMT";
+constexpr const char* NEXT_MODIFIED = "Wed, 02 Sep 2026 10:00:00 GMT";
+
+QByteArray serverList(const QString& countryCode) {
+  QJsonObject server;
+  server.insert("hostname", "hostname");
+  server.insert("ipv4_addr_in", "1.2.3.4");
+  server.insert("ipv4_gateway", "10.0.0.1");
+  server.insert("ipv6_addr_in", "::1");
+  server.insert("ipv6_gateway", "::2");
+  server.insert("public_key", "publicKey" + countryCode);
+  server.insert("weight", 1234);
+  server.insert("port_ranges", QJsonArray());
+  server.insert("multihop_port", 1234);
+  server.insert("socks5_name", "socks5_name");
+
+  QJsonObject city;
+  city.insert("code", "serverCityCode");
+  city.insert("name", "serverCityName");
+  city.insert("latitude", 12.34);
+  city.insert("longitude", 34.56);
+  city.insert("servers", QJsonArray{server});
+
+  QJsonObject country;
+  country.insert("name", "serverCountryName");
+  country.insert("code", countryCode);
+  country.insert("cities", QJsonArray{city});
+
+  QJsonObject obj;
+  obj.insert("countries", QJsonArray{country});
+  return QJsonDocument(obj).toJson();
+}
+
+void runTask() {
+  TaskServers task(ErrorHandler::DoNotPropagateError);
+  QEventLoop loop;
+  QObject::connect(&task, &Task::completed, &loop, &QEventLoop::quit);
+  task.run();
+  loop.exec();
+}
+
+QString firstCountry() {
+  ServerCountryModel* scm = MozillaVPN::instance()->serverCountryModel();
+  if (scm->countries().isEmpty()) {
+    return QString();
+  }
+  return scm->countries().first().code();
+}
+}  // namespace
+
+void TestTaskServers::init() { TestHelper::networkConfig.clear(); }
+
+void TestTaskServers::accepted() {
+  SettingsHolder settingsHolder;
+  settingsHolder.setToken("aToken");
+
+  QByteArray list = serverList("aa");
+  TestHelper::networkConfig.append(TestHelper::NetworkConfig(
+      200, list,
+      {{"ETag", "\"v1\""}, {"Last-Modified", LAST_MODIFIED}}));
+  runTask();
+
+  // The list is used and its validators are kept for the next fetch.
+  QCOMPARE(firstCountry(), "aa");
+  QCOMPARE(settingsHolder.servers(), list);
+  QCOMPARE(settingsHolder.serversETag(), "\"v1\"");
+  QCOMPARE(settingsHolder.serversLastModified(), QByteArray(LAST_MODIFIED));
+}
+
+void TestTaskServers::notModified() {
+  SettingsHolder settingsHolder;
+  settingsHolder.setToken("aToken");
+
+  QByteArray list = serverList("bb");
+  QVERIFY(MozillaVPN::instance()->serverCountryModel()->fromJson(list));
+  settingsHolder.setServers(list);
+  settingsHolder.setServersETag("\"v1\"");
+  settingsHolder.setServersLastModified(LAST_MODIFIED);
+
+  // A 304 has no body, and leaves everything as it was.
+  TestHelper::networkConfig.append(
+      TestHelper::NetworkConfig(304, QByteArray()));
+  runTask();
+  QVERIFY(TestHelper::networkConfig.isEmpty());
+
+  QCOMPARE(firstCountry(), "bb");
+  QCOMPARE(settingsHolder.servers(), list);
+  QCOMPARE(settingsHolder.serversETag(), "\"v1\"");
+  QCOMPARE(settingsHolder.serversLastModified(), QByteArray(LAST_MODIFIED));
+}
+
+void TestTaskServers::rejected() {
+  SettingsHolder settingsHolder;
+  settingsHolder.setToken("aToken");
+
+  QByteArray list = serverList("cc");
+  settingsHolder.setServers(list);
+  settingsHolder.setServersETag("\"v1\"");
+  settingsHolder.setServersLastModified(LAST_MODIFIED);
+
+  // A list that can't be used must not be trusted as the cached copy, so the
+  // next fetch asks for the full list again.
+  TestHelper::networkConfig.append(TestHelper::NetworkConfig(
+      200, "not a server list",
+      {{"ETag", "\"v2\""}, {"Last-Modified", NEXT_MODIFIED}}));
+  runTask();
+
+  QVERIFY(!settingsHolder.hasServersETag());
+  QVERIFY(!settingsHolder.hasServersLastModified());
+  QCOMPARE(settingsHolder.servers(), list);
+}
+
+static TestTaskServers s_testTaskServers;
@@ -0,0 +1,180 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "testdaemonprotocol.h"
+
+#include <QJsonArray>
+#include <QtEndian>
+
+#include "daemon/daemonprotocol.h"
+
+using namespace DaemonProtocol;
+
+namespace {
+
+QJsonObject message(const QString& type) {
+  QJsonObject obj;
+  obj.insert("type", type);
+  obj.insert("count", 42);
+  obj.insert("enabled", true);
+  obj.insert("list", QJsonArray{"a", "b"});
+  return obj;
+}
+
+QByteArray header(char magic, char version, quint32 length) {
+  QByteArray data(FRAME_HEADER_LENGTH, Qt::Uninitialized);
+  data[0] = magic;
+  data[1] = version;
+  qToBigEndian<quint32>(length, data.data() + 2);
+  return data;
+}
+
+}  // namespace
+
+void TestDaemonProtocol::roundTrip_data() {
+  QTest::addColumn<int>("version");
+  QTest::addRow("json") << VERSION_JSON;
+  QTest::addRow("cbor") << VERSION_CBOR;
+}
+
+void TestDaemonProtocol::roundTrip() {
+  QFETCH(int, version);
+
+  QJsonObject obj = message("status");
+  obj.insert("nested", message("inner"));
+  obj.insert("text", QString::fromUtf8("caf\xc3\xa9 \xf0\x9f\x98\x80"));
+
+  QByteArray data = encode(obj, version);
+  if (version == VERSION_CBOR) {
+    QCOMPARE(data.at(0), FRAME_MAGIC);
+    QCOMPARE(data.at(1), char(VERSION_CBOR));
+    QCOMPARE(qFromBigEndian<quint32>(data.constData() + 2),
+             quint32(data.length() - FRAME_HEADER_LENGTH));
+  } else {
+    QVERIFY(data.endsWith('\n'));
+  }
+
+  Reader reader;
+  reader.append(data);
+  QJsonObject decoded;
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, obj);
+  QVERIFY(!reader.next(decoded));
+}
+
+void TestDaemonProtocol::partialFrame() {
+  QByteArray data = encode(message("partial"), VERSION_CBOR);
+  Reader reader;
+  QJsonObject decoded;
+
+  // Not even a whole header.
+  reader.append(data.left(3));
+  QVERIFY(!reader.next(decoded));
+
+  // The header, but not the whole payload.
+  reader.append(data.mid(3, data.length() - 4));
+  QVERIFY(!reader.next(decoded));
+
+  reader.append(data.right(1));
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("partial"));
+  QVERIFY(!reader.next(decoded));
+}
+
+void TestDaemonProtocol::severalFrames() {
+  Reader reader;
+  reader.append(encode(message("first"), VERSION_CBOR) +
+                encode(message("second"), VERSION_CBOR) +
+                encode(message("third"), VERSION_CBOR).left(4));
+
+  QJsonObject decoded;
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("first"));
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("second"));
+  QVERIFY(!reader.next(decoded));
+
+  // The rest of the third frame arrives with the next read.
+  reader.append(encode(message("third"), VERSION_CBOR).mid(4));
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("third"));
+  QVERIFY(!reader.next(decoded));
+}
+
+void TestDaemonProtocol::mixedFormats() {
+  Reader reader;
+  reader.append(encode(message("json"), VERSION_JSON) +
+                encode(message("cbor"), VERSION_CBOR) +
+                encode(message("json again"), VERSION_JSON));
+
+  QJsonObject decoded;
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("json"));
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("cbor"));
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("json again"));
+  QVERIFY(!reader.next(decoded));
+}
+
+void TestDaemonProtocol::badMagic() {
+  // Without the magic byte, the data is read as a line of JSON, which is
+  // skipped when it doesn't parse.
+  QByteArray bad = header('\x01', VERSION_CBOR, 4) + "junk\n";
+  Reader reader;
+  reader.append(bad + encode(message("after"), VERSION_CBOR));
+
+  QJsonObject decoded;
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("after"));
+  QVERIFY(!reader.next(decoded));
+}
+
+void TestDaemonProtocol::badVersion() {
+  QByteArray payload = encode(message("future"), VERSION_CBOR);
+  payload[1] = char(VERSION_CBOR + 1);
+
+  // There is no telling where an unknown frame ends, so everything buffered
+  // is dropped.
+  Reader reader;
+  reader.append(payload + encode(message("dropped"), VERSION_CBOR));
+  QJsonObject decoded;
+  QVERIFY(!reader.next(decoded));
+
+  // The reader recovers with the next read.
+  reader.append(encode(message("next"), VERSION_CBOR));
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("next"));
+}
+
+void TestDaemonProtocol::frameTooLong() {
+  Reader reader;
+  reader.append(header(FRAME_MAGIC, VERSION_CBOR, FRAME_MAX_LENGTH + 1));
+  QJsonObject decoded;
+  QVERIFY(!reader.next(decoded));
+
+  reader.append(encode(message("next"), VERSION_CBOR));
+  QVERIFY(reader.next(decoded));
+  QCOMPARE(decoded, message("next"));
+}
+
+void TestDaemonProtocol::chunkUtf8() {
+  // A 2 byte, a 3 byte and a 4 byte character, with ASCII around them.
+  const QByteArray text("a\xc3\xa9" "b\xe2\x82\xac" "c\xf0\x9f\x98\x80" "d");
+
+  for (qsizetype size = 4; size <= text.length() + 1; size++) {
+    const QByteArrayList chunks = DaemonProtocol::chunkUtf8(text, size);
+    QCOMPARE(chunks.join(), text);
+
+    for (const QByteArray& chunk : chunks) {
+      QVERIFY2(chunk.length() <= size, qPrintable(QString::number(size)));
+      QVERIFY2(QString::fromUtf8(chunk).toUtf8() == chunk,
+               qPrintable(QString::number(size)));
+    }
+  }
+
+  QCOMPARE(DaemonProtocol::chunkUtf8(QByteArray(), 4).length(), 1);
+}
+
+static TestDaemonProtocol s_testDaemonProtocol;
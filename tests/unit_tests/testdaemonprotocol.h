@@ -0,0 +1,23 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "helper.h"
+
+class TestDaemonProtocol final : public TestHelper {
+  Q_OBJECT
+
+ private slots:
+  void roundTrip_data();
+  void roundTrip();
+
+  void partialFrame();
+  void severalFrames();
+  void mixedFormats();
+
+  void badMagic();
+  void badVersion();
+  void frameTooLong();
+
+  void chunkUtf8();
+};